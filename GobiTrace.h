@@ -0,0 +1,252 @@
+/*===========================================================================
+FILE:
+   GobiTrace.h
+
+DESCRIPTION:
+   Tracepoints of the Qualcomm Linux USB Network driver
+      Events carry binary payloads, formatting only happens when the
+      trace buffer is read.  Tracepoints are created in QMIDevice.c
+   
+FUNCTIONS:
+   none
+
+Copyright (c) 2011, Code Aurora Forum. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Code Aurora Forum nor
+      the names of its contributors may be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+===========================================================================*/
+
+// No #pragma once, define_trace.h reads this file several times
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gobinet
+
+#if !defined( GOBI_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define GOBI_TRACE_H
+
+//---------------------------------------------------------------------------
+// Include Files
+//---------------------------------------------------------------------------
+#include <linux/tracepoint.h>
+#include "Structs.h"
+
+// Bytes of a QMI message kept by gobi_qmi_tx and gobi_qmi_rx
+#define GOBI_TRACE_QMI_MAX  256
+
+// Bytes of a data packet kept by gobi_tx_fixup and gobi_rx_fixup
+#define GOBI_TRACE_DATA_MAX 40
+
+/*=========================================================================*/
+// QMI control messages, as written to or read from the control endpoint
+/*=========================================================================*/
+DECLARE_EVENT_CLASS( gobi_qmi_msg,
+
+   TP_PROTO( sGobiUSBNet * pDev, const void * pData, u16 dataSize ),
+
+   TP_ARGS( pDev, pData, dataSize ),
+
+   TP_STRUCT__entry(
+      __array(         char, ifname, IFNAMSIZ )
+      __field(         u16,  size )
+      __field(         u16,  len )
+      __dynamic_array( u8,   data, min_t( u16, dataSize, GOBI_TRACE_QMI_MAX ) )
+   ),
+
+   TP_fast_assign(
+      memcpy( __entry->ifname, pDev->mpNetDev->net->name, IFNAMSIZ );
+      __entry->size = dataSize;
+      __entry->len = min_t( u16, dataSize, GOBI_TRACE_QMI_MAX );
+      memcpy( __get_dynamic_array( data ), pData, __entry->len );
+   ),
+
+   TP_printk( "%s size=%u %s",
+              __entry->ifname,
+              __entry->size,
+              __print_hex( __get_dynamic_array( data ), __entry->len ) )
+);
+
+DEFINE_EVENT( gobi_qmi_msg, gobi_qmi_tx,
+
+   TP_PROTO( sGobiUSBNet * pDev, const void * pData, u16 dataSize ),
+
+   TP_ARGS( pDev, pData, dataSize )
+);
+
+DEFINE_EVENT( gobi_qmi_msg, gobi_qmi_rx,
+
+   TP_PROTO( sGobiUSBNet * pDev, const void * pData, u16 dataSize ),
+
+   TP_ARGS( pDev, pData, dataSize )
+);
+
+/*=========================================================================*/
+// A read message handed to one client
+/*=========================================================================*/
+TRACE_EVENT( gobi_qmi_dispatch,
+
+   TP_PROTO( sGobiUSBNet * pDev, 
+             u16 clientID, 
+             u16 transactionID, 
+             u16 msgID, 
+             u16 dataSize ),
+
+   TP_ARGS( pDev, clientID, transactionID, msgID, dataSize ),
+
+   TP_STRUCT__entry(
+      __array( char, ifname, IFNAMSIZ )
+      __field( u16,  clientID )
+      __field( u16,  transactionID )
+      __field( u16,  msgID )
+      __field( u16,  size )
+   ),
+
+   TP_fast_assign(
+      memcpy( __entry->ifname, pDev->mpNetDev->net->name, IFNAMSIZ );
+      __entry->clientID = clientID;
+      __entry->transactionID = transactionID;
+      __entry->msgID = msgID;
+      __entry->size = dataSize;
+   ),
+
+   TP_printk( "%s client=0x%04x tid=0x%x msg=0x%04x size=%u",
+              __entry->ifname,
+              __entry->clientID,
+              __entry->transactionID,
+              __entry->msgID,
+              __entry->size )
+);
+
+/*=========================================================================*/
+// A client's notify callback about to run
+/*=========================================================================*/
+TRACE_EVENT( gobi_qmi_notify,
+
+   TP_PROTO( sGobiUSBNet * pDev, u16 clientID, u16 transactionID ),
+
+   TP_ARGS( pDev, clientID, transactionID ),
+
+   TP_STRUCT__entry(
+      __array( char, ifname, IFNAMSIZ )
+      __field( u16,  clientID )
+      __field( u16,  transactionID )
+   ),
+
+   TP_fast_assign(
+      memcpy( __entry->ifname, pDev->mpNetDev->net->name, IFNAMSIZ );
+      __entry->clientID = clientID;
+      __entry->transactionID = transactionID;
+   ),
+
+   TP_printk( "%s client=0x%04x tid=0x%x",
+              __entry->ifname,
+              __entry->clientID,
+              __entry->transactionID )
+);
+
+/*=========================================================================*/
+// Data packets entering rx_fixup and tx_fixup
+/*=========================================================================*/
+DECLARE_EVENT_CLASS( gobi_data,
+
+   TP_PROTO( sGobiUSBNet * pDev, struct sk_buff * pSKB ),
+
+   TP_ARGS( pDev, pSKB ),
+
+   TP_STRUCT__entry(
+      __array(         char, ifname, IFNAMSIZ )
+      __field(         u32,  size )
+      __field(         bool, bRawIP )
+      __field(         u16,  len )
+      __dynamic_array( u8,   data, min_t( u32, 
+                                          skb_headlen( pSKB ), 
+                                          GOBI_TRACE_DATA_MAX ) )
+   ),
+
+   TP_fast_assign(
+      memcpy( __entry->ifname, pDev->mpNetDev->net->name, IFNAMSIZ );
+      __entry->size = pSKB->len;
+      __entry->bRawIP = pDev->mbRawIPMode;
+      __entry->len = min_t( u32, skb_headlen( pSKB ), GOBI_TRACE_DATA_MAX );
+      memcpy( __get_dynamic_array( data ), pSKB->data, __entry->len );
+   ),
+
+   TP_printk( "%s size=%u rawip=%d %s",
+              __entry->ifname,
+              __entry->size,
+              __entry->bRawIP,
+              __print_hex( __get_dynamic_array( data ), __entry->len ) )
+);
+
+DEFINE_EVENT( gobi_data, gobi_rx_fixup,
+
+   TP_PROTO( sGobiUSBNet * pDev, struct sk_buff * pSKB ),
+
+   TP_ARGS( pDev, pSKB )
+);
+
+DEFINE_EVENT( gobi_data, gobi_tx_fixup,
+
+   TP_PROTO( sGobiUSBNet * pDev, struct sk_buff * pSKB ),
+
+   TP_ARGS( pDev, pSKB )
+);
+
+/*=========================================================================*/
+// mDownReason set or cleared
+/*=========================================================================*/
+TRACE_EVENT( gobi_down_reason,
+
+   TP_PROTO( sGobiUSBNet * pDev, u8 reason, bool bSet ),
+
+   TP_ARGS( pDev, reason, bSet ),
+
+   TP_STRUCT__entry(
+      __array( char,          ifname, IFNAMSIZ )
+      __field( u8,            reason )
+      __field( bool,          bSet )
+      __field( unsigned long, downReason )
+   ),
+
+   TP_fast_assign(
+      memcpy( __entry->ifname, pDev->mpNetDev->net->name, IFNAMSIZ );
+      __entry->reason = reason;
+      __entry->bSet = bSet;
+      __entry->downReason = pDev->mDownReason;
+   ),
+
+   TP_printk( "%s %s reason=%u mDownReason=0x%lx",
+              __entry->ifname,
+              __entry->bSet ? "set" : "clear",
+              __entry->reason,
+              __entry->downReason )
+);
+
+#endif
+
+// Outside the guard, define_trace.h needs to find this file again
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE GobiTrace
+#include <trace/define_trace.h>
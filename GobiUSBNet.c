@@ -10,6 +10,23 @@ FUNCTIONS:
    GobiNetResume
    GobiNetDriverBind
    GobiNetDriverUnbind
+   GobiDataUpdateBegin
+   GobiDataUpdateEnd
+   GobiDataRx
+   GobiDataTx
+   GobiDataSnapshot
+   GobiDataShow
+   GobiDataOpen
+   GobiDataResetOpen
+   GobiDataResetWrite
+   GobiDataDebugfsInit
+   GobiStatsCount
+   GobiStatsStrings
+   GobiStatsValues
+   GobiEthtoolGetSsetCount
+   GobiEthtoolGetStrings
+   GobiEthtoolGetStats
+   GobiEthtoolGetLinkKsettings
    GobiUSBNetURBCallback
    GobiUSBNetTXTimeout
    GobiUSBNetAutoPMThread
@@ -55,9 +72,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "Structs.h"
 #include "QMIDevice.h"
 #include "QMI.h"
+#include "GobiTrace.h"
 #include <linux/etherdevice.h>
 #include <linux/ethtool.h>
 #include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 //-----------------------------------------------------------------------------
 // Definitions
@@ -71,15 +91,89 @@ POSSIBILITY OF SUCH DAMAGE.
 // Debug flag
 int debug = 0;
 
+#ifdef QMI_DEBUG_KEY
+// Follows debug, tested by DBG
+DEFINE_STATIC_KEY_FALSE( gDebugKey );
+#endif
+
 // Allow user interrupts
 int interruptible = 1;
 
 // Number of IP packets which may be queued up for transmit
 int txQueueLength = 100;
 
+// Idle QMI clients pre-allocated per service, 0 to disable
+int clientPoolSize = 0;
+
+// O_NONBLOCK writes each QMI file handle may have in flight
+int writeQueueLength = 8;
+
+// Unread QMI messages kept per client, 0 for no limit
+int readQueueDepth = 128;
+
+// Bytes of unread QMI messages kept per client, 0 for no limit
+int readQueueBytes = 256 * 1024;
+
+// Full read queues drop their oldest message when set, else the newest
+int readQueueDropOldest = 1;
+
+// Milliseconds an unclaimed message waits for an in-driver reader
+int orphanResponseTTL = 30000;
+
+// Answer allowlisted QMI queries from the response cache
+int responseCache = 1;
+
+// QMI writes in flight on the control endpoint, 0 for no limit
+int ctrlUrbsInFlight = 4;
+
 // Class should be created during module init, so needs to be global
 static struct class * gpClass;
 
+// debugfs directory shared by all devices
+static struct dentry * gpDebugRoot;
+
+#define GOBI_DATA_COUNTER( name, field ) \
+   { name, offsetof( sGobiDataStats, field ), 0 }
+#define GOBI_DATA_HIST( name, field ) \
+   { name, offsetof( sGobiDataStats, field ), \
+     sizeof( ((sGobiDataStats *)0)->field ) / sizeof( u32 ) }
+
+// Data path statistics published through ethtool and debugfs
+static const sGobiDataStat gDataStats[] =
+{
+   GOBI_DATA_COUNTER( "rx_urbs",          mRxURBs ),
+   GOBI_DATA_COUNTER( "rx_urb_packets",   mRxPackets ),
+   GOBI_DATA_COUNTER( "rx_zlps",          mRxZLPs ),
+   GOBI_DATA_COUNTER( "tx_urbs",          mTxURBs ),
+   GOBI_DATA_COUNTER( "tx_urb_packets",   mTxPackets ),
+   GOBI_DATA_COUNTER( "tx_zlps",          mTxZLPs ),
+   GOBI_DATA_HIST(    "rx_urb_bytes",     mRxBytes ),
+   GOBI_DATA_HIST(    "tx_urb_bytes",     mTxBytes ),
+   GOBI_DATA_HIST(    "rx_pkts_per_urb",  mRxPacketsPerURB ),
+   GOBI_DATA_HIST(    "tx_pkts_per_urb",  mTxPacketsPerURB ),
+   GOBI_DATA_HIST(    "rx_idle_us",       mRxIdleUs ),
+   GOBI_DATA_HIST(    "tx_latency_us",    mTxLatencyUs ),
+   GOBI_DATA_HIST(    "tx_in_flight",     mTxInFlight ),
+};
+
+#define GOBI_MODEM_COUNTER( name, field ) \
+   { name, offsetof( sGobiModemStats, field ), 0 }
+
+// Modem reported statistics published through ethtool
+static const sGobiDataStat gModemStats[] =
+{
+   GOBI_MODEM_COUNTER( "modem_tx_packets",   mTXOk ),
+   GOBI_MODEM_COUNTER( "modem_rx_packets",   mRXOk ),
+   GOBI_MODEM_COUNTER( "modem_tx_bytes",     mTXBytesOk ),
+   GOBI_MODEM_COUNTER( "modem_rx_bytes",     mRXBytesOk ),
+   GOBI_MODEM_COUNTER( "modem_tx_errors",    mTXErr ),
+   GOBI_MODEM_COUNTER( "modem_rx_errors",    mRXErr ),
+   GOBI_MODEM_COUNTER( "modem_tx_overflows", mTXOfl ),
+   GOBI_MODEM_COUNTER( "modem_rx_overflows", mRXOfl ),
+   GOBI_MODEM_COUNTER( "modem_downlink_bps", mDownlinkBps ),
+   GOBI_MODEM_COUNTER( "modem_uplink_bps",   mUplinkBps ),
+};
+
 #ifdef CONFIG_PM
 /*===========================================================================
 METHOD:
@@ -387,6 +481,13 @@ static void GobiNetDriverUnbind(
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,29 ))
    kfree( pDev->net->netdev_ops );
    pDev->net->netdev_ops = NULL;
+
+   if (pGobiDev->mpEthtoolOps != NULL)
+   {
+      pDev->net->ethtool_ops = NULL;
+      kfree( pGobiDev->mpEthtoolOps );
+      pGobiDev->mpEthtoolOps = NULL;
+   }
 #endif
 
 #if (LINUX_VERSION_CODE <= KERNEL_VERSION( 2,6,23 ))
@@ -403,6 +504,661 @@ static void GobiNetDriverUnbind(
       DBG("memory leak!\n");
 }
 
+/*===========================================================================
+METHOD:
+   GobiDataUpdateBegin (Public Method)
+
+DESCRIPTION:
+   Start a write to the data path statistics
+      The fixups run in softirq context and the old URB callback in
+      interrupt context, so the lock is taken with interrupts off
+
+PARAMETERS
+   pGobiDev       [ I ] - Device specific memory
+
+RETURN VALUE:
+   unsigned long - Flags for GobiDataUpdateEnd
+===========================================================================*/
+static unsigned long GobiDataUpdateBegin( sGobiUSBNet * pGobiDev )
+{
+   unsigned long flags;
+
+   spin_lock_irqsave( &pGobiDev->mDataStatsLock, flags );
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,36 ))
+   u64_stats_update_begin( &pGobiDev->mDataStatsSync );
+#endif
+
+   return flags;
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataUpdateEnd (Public Method)
+
+DESCRIPTION:
+   Finish a write to the data path statistics
+
+PARAMETERS
+   pGobiDev       [ I ] - Device specific memory
+   flags          [ I ] - Return value of GobiDataUpdateBegin
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiDataUpdateEnd( 
+   sGobiUSBNet *     pGobiDev, 
+   unsigned long     flags )
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,36 ))
+   u64_stats_update_end( &pGobiDev->mDataStatsSync );
+#endif
+   spin_unlock_irqrestore( &pGobiDev->mDataStatsLock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataRx (Public Method)
+
+DESCRIPTION:
+   Account one bulk-in URB in the data path statistics
+      Called from rx_fixup
+
+PARAMETERS
+   pDev           [ I ] - Pointer to usbnet device
+   pSKB           [ I ] - Received URB data, before any fixup
+   packets        [ I ] - Packets carried by the URB
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiDataRx( 
+   struct usbnet *   pDev, 
+   struct sk_buff *  pSKB, 
+   u32               packets )
+{
+   sGobiUSBNet * pGobiDev = (sGobiUSBNet *)pDev->data[0];
+   sGobiDataStats * pStats = &pGobiDev->mDataStats;
+   ktime_t now = ktime_get();
+   unsigned long flags;
+   u64 idleUs;
+
+   flags = GobiDataUpdateBegin( pGobiDev );
+
+   pStats->mRxURBs++;
+   pStats->mRxPackets += packets;
+   pStats->mRxBytes[GobiLog2Bucket( pSKB->len, 
+                                    GOBI_DATA_SIZE_BUCKETS )]++;
+   pStats->mRxPacketsPerURB[GobiLog2Bucket( packets, 
+                                            GOBI_DATA_COUNT_BUCKETS )]++;
+
+   if (ktime_to_ns( pStats->mLastRx ) != 0)
+   {
+      idleUs = ktime_to_us( ktime_sub( now, pStats->mLastRx ) );
+      pStats->mRxIdleUs[GobiLog2Bucket( idleUs, GOBI_DATA_TIME_BUCKETS )]++;
+   }
+   pStats->mLastRx = now;
+
+   // Short of the buffer size yet a whole number of packets, 
+   //    only a zero length packet could have ended the transfer
+   if (pDev->maxpacket != 0
+   &&  pSKB->len % pDev->maxpacket == 0
+   &&  pSKB->len < pDev->rx_urb_size)
+   {
+      pStats->mRxZLPs++;
+   }
+
+   GobiDataUpdateEnd( pGobiDev, flags );
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataTx (Public Method)
+
+DESCRIPTION:
+   Account one bulk-out URB in the data path statistics
+      Called from tx_fixup
+
+PARAMETERS
+   pDev           [ I ] - Pointer to usbnet device
+   pSKB           [ I ] - URB data, after the fixup
+   packets        [ I ] - Packets carried by the URB
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiDataTx( 
+   struct usbnet *   pDev, 
+   struct sk_buff *  pSKB, 
+   u32               packets )
+{
+   sGobiUSBNet * pGobiDev = (sGobiUSBNet *)pDev->data[0];
+   sGobiDataStats * pStats = &pGobiDev->mDataStats;
+   unsigned long flags;
+
+   flags = GobiDataUpdateBegin( pGobiDev );
+
+   pStats->mTxURBs++;
+   pStats->mTxPackets += packets;
+   pStats->mTxBytes[GobiLog2Bucket( pSKB->len, 
+                                    GOBI_DATA_SIZE_BUCKETS )]++;
+   pStats->mTxPacketsPerURB[GobiLog2Bucket( packets, 
+                                            GOBI_DATA_COUNT_BUCKETS )]++;
+   pStats->mTxInFlight[GobiLog2Bucket( pDev->txq.qlen, 
+                                       GOBI_DATA_COUNT_BUCKETS )]++;
+
+   // usbnet terminates these with a zero length packet
+   if (pDev->maxpacket != 0
+   &&  pSKB->len % pDev->maxpacket == 0)
+   {
+      pStats->mTxZLPs++;
+   }
+
+   GobiDataUpdateEnd( pGobiDev, flags );
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataSnapshot (Public Method)
+
+DESCRIPTION:
+   Copy the data path statistics without tearing the u64 counters
+      Kernels without u64_stats_sync take the writers' lock instead
+
+PARAMETERS:
+   pGobiDev       [ I ] - Device specific memory
+   pStats         [ O ] - Copy of the statistics
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiDataSnapshot(
+   sGobiUSBNet *     pGobiDev,
+   sGobiDataStats *  pStats )
+{
+   unsigned long flags;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,36 ))
+   unsigned int start;
+
+   // Without SMP the sequence count is compiled out and only 
+   //    keeping the writers from interrupting us protects the copy
+   local_irq_save( flags );
+   do
+   {
+      start = u64_stats_fetch_begin( &pGobiDev->mDataStatsSync );
+      memcpy( pStats, &pGobiDev->mDataStats, sizeof( sGobiDataStats ) );
+   } while (u64_stats_fetch_retry( &pGobiDev->mDataStatsSync, start ));
+   local_irq_restore( flags );
+#else
+   spin_lock_irqsave( &pGobiDev->mDataStatsLock, flags );
+   memcpy( pStats, &pGobiDev->mDataStats, sizeof( sGobiDataStats ) );
+   spin_unlock_irqrestore( &pGobiDev->mDataStatsLock, flags );
+#endif
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataShow (Public Method)
+
+DESCRIPTION:
+   Print the data path statistics, one counter or histogram per line
+
+PARAMETERS:
+   pSeq           [ I ] - Output
+   pUnused        [ I ] - Unused
+
+RETURN VALUE:
+   int - 0 for success
+         -ENOMEM if the snapshot could not be allocated
+===========================================================================*/
+static int GobiDataShow(
+   struct seq_file * pSeq,
+   void *            pUnused )
+{
+   sGobiUSBNet * pGobiDev = pSeq->private;
+   sGobiDataStats * pSnapshot;
+   const u8 * pStats;
+   const u32 * pBuckets;
+   int index;
+   int bucket;
+
+   pSnapshot = kmalloc( sizeof( sGobiDataStats ), GFP_KERNEL );
+   if (pSnapshot == NULL)
+   {
+      return -ENOMEM;
+   }
+   GobiDataSnapshot( pGobiDev, pSnapshot );
+   pStats = (const u8 *)pSnapshot;
+
+   seq_printf( pSeq, "# bucket n counts [2^n, 2^(n+1))\n" );
+
+   for (index = 0; index < ARRAY_SIZE( gDataStats ); index++)
+   {
+      seq_printf( pSeq, "%s", gDataStats[index].mpName );
+
+      if (gDataStats[index].mBuckets == 0)
+      {
+         seq_printf( pSeq, 
+                     " %llu\n", 
+                     *(const u64 *)(pStats + gDataStats[index].mOffset) );
+         continue;
+      }
+
+      pBuckets = (const u32 *)(pStats + gDataStats[index].mOffset);
+      for (bucket = 0; bucket < gDataStats[index].mBuckets; bucket++)
+      {
+         seq_printf( pSeq, " %u", pBuckets[bucket] );
+      }
+      seq_putc( pSeq, '\n' );
+   }
+
+   kfree( pSnapshot );
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataOpen (Public Method)
+
+DESCRIPTION:
+   Open the "datapath" debugfs file
+
+PARAMETERS:
+   pInode         [ I ] - Debugfs inode, i_private is the device
+   pFilp          [ I ] - File being opened
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+static int GobiDataOpen(
+   struct inode *    pInode,
+   struct file *     pFilp )
+{
+   return single_open( pFilp, GobiDataShow, pInode->i_private );
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataResetOpen (Public Method)
+
+DESCRIPTION:
+   Open the "datapath_reset" debugfs file
+
+PARAMETERS:
+   pInode         [ I ] - Debugfs inode, i_private is the device
+   pFilp          [ I ] - File being opened
+
+RETURN VALUE:
+   int - 0
+===========================================================================*/
+static int GobiDataResetOpen(
+   struct inode *    pInode,
+   struct file *     pFilp )
+{
+   pFilp->private_data = pInode->i_private;
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   GobiDataResetWrite (Public Method)
+
+DESCRIPTION:
+   Clear the data path statistics, any write will do
+
+PARAMETERS:
+   pFilp          [ I ] - File being written
+   pBuf           [ I ] - Written data, ignored
+   size           [ I ] - Size of pBuf
+   pPos           [I/O] - File position
+
+RETURN VALUE:
+   ssize_t - size
+===========================================================================*/
+static ssize_t GobiDataResetWrite(
+   struct file *        pFilp,
+   const char __user *  pBuf,
+   size_t               size,
+   loff_t *             pPos )
+{
+   sGobiUSBNet * pGobiDev = pFilp->private_data;
+   unsigned long flags;
+
+   flags = GobiDataUpdateBegin( pGobiDev );
+   memset( &pGobiDev->mDataStats, 0, sizeof( sGobiDataStats ) );
+   GobiDataUpdateEnd( pGobiDev, flags );
+
+   return size;
+}
+
+static const struct file_operations GobiDataFops =
+{
+   .owner   = THIS_MODULE,
+   .open    = GobiDataOpen,
+   .read    = seq_read,
+   .llseek  = seq_lseek,
+   .release = single_release,
+};
+
+static const struct file_operations GobiDataResetFops =
+{
+   .owner   = THIS_MODULE,
+   .open    = GobiDataResetOpen,
+   .write   = GobiDataResetWrite,
+};
+
+/*===========================================================================
+METHOD:
+   GobiDataDebugfsInit (Public Method)
+
+DESCRIPTION:
+   Publish the data path statistics as <debugfs>/GobiNet/qcqmiN/datapath, 
+   cleared by writing to datapath_reset next to it
+      DeregisterQMIDevice removes them with the directory
+
+PARAMETERS:
+   pGobiDev       [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiDataDebugfsInit( sGobiUSBNet * pGobiDev )
+{
+   if (pGobiDev->mQMIDev.mpDebugDir == NULL)
+   {
+      return;
+   }
+
+   debugfs_create_file( "datapath", 
+                        S_IRUGO, 
+                        pGobiDev->mQMIDev.mpDebugDir, 
+                        pGobiDev, 
+                        &GobiDataFops );
+   debugfs_create_file( "datapath_reset", 
+                        S_IWUSR, 
+                        pGobiDev->mQMIDev.mpDebugDir, 
+                        pGobiDev, 
+                        &GobiDataResetFops );
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,29 ))
+/*===========================================================================
+METHOD:
+   GobiStatsCount (Public Method)
+
+DESCRIPTION:
+   Number of ethtool statistics in a table, one per counter and 
+   histogram bucket
+
+PARAMETERS:
+   pTable         [ I ] - Statistics table
+   count          [ I ] - Entries in pTable
+
+RETURN VALUE:
+   int - Number of statistics
+===========================================================================*/
+static int GobiStatsCount(
+   const sGobiDataStat *   pTable,
+   int                     count )
+{
+   int index;
+   int stats = 0;
+
+   for (index = 0; index < count; index++)
+   {
+      stats += max( pTable[index].mBuckets, 1 );
+   }
+
+   return stats;
+}
+
+/*===========================================================================
+METHOD:
+   GobiStatsStrings (Public Method)
+
+DESCRIPTION:
+   Names of the ethtool statistics in a table
+
+PARAMETERS:
+   pTable         [ I ] - Statistics table
+   count          [ I ] - Entries in pTable
+   pData          [ O ] - ETH_GSTRING_LEN bytes per statistic
+
+RETURN VALUE:
+   u8 * - pData past the names written
+===========================================================================*/
+static u8 * GobiStatsStrings(
+   const sGobiDataStat *   pTable,
+   int                     count,
+   u8 *                    pData )
+{
+   int index;
+   int bucket;
+
+   for (index = 0; index < count; index++)
+   {
+      if (pTable[index].mBuckets == 0)
+      {
+         snprintf( (char *)pData, 
+                   ETH_GSTRING_LEN, 
+                   "%s", 
+                   pTable[index].mpName );
+         pData += ETH_GSTRING_LEN;
+         continue;
+      }
+
+      for (bucket = 0; bucket < pTable[index].mBuckets; bucket++)
+      {
+         snprintf( (char *)pData, 
+                   ETH_GSTRING_LEN, 
+                   "%s_%d", 
+                   pTable[index].mpName, 
+                   bucket );
+         pData += ETH_GSTRING_LEN;
+      }
+   }
+
+   return pData;
+}
+
+/*===========================================================================
+METHOD:
+   GobiStatsValues (Public Method)
+
+DESCRIPTION:
+   Values of the ethtool statistics in a table
+
+PARAMETERS:
+   pStats         [ I ] - Structure the table describes
+   pTable         [ I ] - Statistics table
+   count          [ I ] - Entries in pTable
+   pData          [ O ] - One value per statistic
+
+RETURN VALUE:
+   u64 * - pData past the values written
+===========================================================================*/
+static u64 * GobiStatsValues(
+   const void *            pStats,
+   const sGobiDataStat *   pTable,
+   int                     count,
+   u64 *                   pData )
+{
+   const u8 * pBase = pStats;
+   const u32 * pBuckets;
+   int index;
+   int bucket;
+
+   for (index = 0; index < count; index++)
+   {
+      if (pTable[index].mBuckets == 0)
+      {
+         *pData++ = *(const u64 *)(pBase + pTable[index].mOffset);
+         continue;
+      }
+
+      pBuckets = (const u32 *)(pBase + pTable[index].mOffset);
+      for (bucket = 0; bucket < pTable[index].mBuckets; bucket++)
+      {
+         *pData++ = pBuckets[bucket];
+      }
+   }
+
+   return pData;
+}
+
+/*===========================================================================
+METHOD:
+   GobiEthtoolGetSsetCount (Public Method)
+
+DESCRIPTION:
+   Number of ethtool statistics, data path then modem
+
+PARAMETERS:
+   pNet           [ I ] - Pointer to net device
+   sset           [ I ] - String set
+
+RETURN VALUE:
+   int - Number of strings in the set
+         -EOPNOTSUPP for sets other than ETH_SS_STATS
+===========================================================================*/
+static int GobiEthtoolGetSsetCount(
+   struct net_device *  pNet,
+   int                  sset )
+{
+   if (sset != ETH_SS_STATS)
+   {
+      return -EOPNOTSUPP;
+   }
+
+   return GobiStatsCount( gDataStats, ARRAY_SIZE( gDataStats ) )
+        + GobiStatsCount( gModemStats, ARRAY_SIZE( gModemStats ) );
+}
+
+/*===========================================================================
+METHOD:
+   GobiEthtoolGetStrings (Public Method)
+
+DESCRIPTION:
+   Names of the ethtool statistics
+
+PARAMETERS:
+   pNet           [ I ] - Pointer to net device
+   sset           [ I ] - String set
+   pData          [ O ] - ETH_GSTRING_LEN bytes per statistic
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiEthtoolGetStrings(
+   struct net_device *  pNet,
+   u32                  sset,
+   u8 *                 pData )
+{
+   if (sset != ETH_SS_STATS)
+   {
+      return;
+   }
+
+   pData = GobiStatsStrings( gDataStats, ARRAY_SIZE( gDataStats ), pData );
+   GobiStatsStrings( gModemStats, ARRAY_SIZE( gModemStats ), pData );
+}
+
+/*===========================================================================
+METHOD:
+   GobiEthtoolGetStats (Public Method)
+
+DESCRIPTION:
+   Values of the ethtool statistics, in GobiEthtoolGetStrings order
+
+PARAMETERS:
+   pNet           [ I ] - Pointer to net device
+   pEthStats      [ I ] - Unused
+   pData          [ O ] - One value per statistic
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiEthtoolGetStats(
+   struct net_device *     pNet,
+   struct ethtool_stats *  pEthStats,
+   u64 *                   pData )
+{
+   struct usbnet * pDev = netdev_priv( pNet );
+   sGobiUSBNet * pGobiDev = (sGobiUSBNet *)pDev->data[0];
+   sGobiDataStats * pSnapshot;
+
+   pSnapshot = kmalloc( sizeof( sGobiDataStats ), GFP_KERNEL );
+   if (pSnapshot == NULL)
+   {
+      memset( pData, 
+              0, 
+              GobiEthtoolGetSsetCount( pNet, ETH_SS_STATS ) * sizeof( u64 ) );
+      return;
+   }
+   GobiDataSnapshot( pGobiDev, pSnapshot );
+
+   pData = GobiStatsValues( pSnapshot, 
+                            gDataStats, 
+                            ARRAY_SIZE( gDataStats ), 
+                            pData );
+   kfree( pSnapshot );
+
+   GobiStatsValues( &pGobiDev->mModemStats, 
+                    gModemStats, 
+                    ARRAY_SIZE( gModemStats ), 
+                    pData );
+}
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,6,0 ))
+/*===========================================================================
+METHOD:
+   GobiEthtoolGetLinkKsettings (Public Method)
+
+DESCRIPTION:
+   Report the channel rate of the last CDC CONNECTION_SPEED_CHANGE as the
+   link speed.  ethtool has a single speed, the downlink rate is used
+   unless only the uplink rate is known
+
+PARAMETERS:
+   pNet           [ I ] - Pointer to net device
+   pCmd           [ O ] - Link settings
+
+RETURN VALUE:
+   int - 0
+===========================================================================*/
+static int GobiEthtoolGetLinkKsettings(
+   struct net_device *              pNet,
+   struct ethtool_link_ksettings *  pCmd )
+{
+   struct usbnet * pDev = netdev_priv( pNet );
+   sGobiUSBNet * pGobiDev = (sGobiUSBNet *)pDev->data[0];
+   u64 bitRate;
+
+   bitRate = pGobiDev->mModemStats.mDownlinkBps;
+   if (bitRate == 0)
+   {
+      bitRate = pGobiDev->mModemStats.mUplinkBps;
+   }
+
+   pCmd->base.port = PORT_OTHER;
+   pCmd->base.autoneg = AUTONEG_DISABLE;
+   if (bitRate == 0)
+   {
+      pCmd->base.speed = SPEED_UNKNOWN;
+      pCmd->base.duplex = DUPLEX_UNKNOWN;
+   }
+   else
+   {
+      // Round up, a working link under 1 Mb/s must not read as 0
+      pCmd->base.speed = (u32)DIV_ROUND_UP_ULL( bitRate, 1000000 );
+      pCmd->base.duplex = DUPLEX_FULL;
+   }
+
+   return 0;
+}
+#endif
+
 #if 1 //def DATA_MODE_RP
 /*===========================================================================
 METHOD:
@@ -423,11 +1179,16 @@ struct sk_buff *GobiNetDriverTxFixup(struct usbnet *dev, struct sk_buff *skb, gf
 {
     sGobiUSBNet * pGobiDev = (sGobiUSBNet *)dev->data[0];
 
-    if (!pGobiDev->mbRawIPMode)
+    trace_gobi_tx_fixup( pGobiDev, skb );
+
+    if (!pGobiDev->mbRawIPMode) {
+        GobiDataTx( dev, skb, 1 );
         return skb;
+    }
         
     // Skip Ethernet header from message
     if (skb_pull(skb, ETH_HLEN)) {
+        GobiDataTx( dev, skb, 1 );
         return skb;
     } else {
 #if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,22 ))
@@ -463,6 +1224,9 @@ static int GobiNetDriverRxFixup(struct usbnet *dev, struct sk_buff *skb)
     __be16 proto;
     sGobiUSBNet * pGobiDev = (sGobiUSBNet *)dev->data[0];
 
+    trace_gobi_rx_fixup( pGobiDev, skb );
+    GobiDataRx( dev, skb, 1 );
+
     if (!pGobiDev->mbRawIPMode)
         return 1;
 
@@ -523,6 +1287,9 @@ void GobiUSBNetURBCallback(struct urb *pURB, struct pt_regs *regs)
 #endif
 {
    unsigned long activeURBflags;
+   unsigned long statsFlags;
+   sGobiUSBNet * pGobiDev;
+   u64 latencyUs;
    sAutoPM * pAutoPM = (sAutoPM *)pURB->context;
    if (pAutoPM == NULL)
    {
@@ -531,6 +1298,15 @@ void GobiUSBNetURBCallback(struct urb *pURB, struct pt_regs *regs)
       return;
    }
 
+   pGobiDev = container_of( pAutoPM, sGobiUSBNet, mAutoPM );
+   latencyUs = ktime_to_us( ktime_sub( ktime_get(), 
+                                       pAutoPM->mActiveURBSubmitted ) );
+   statsFlags = GobiDataUpdateBegin( pGobiDev );
+   pGobiDev->mDataStats.mTxLatencyUs[GobiLog2Bucket( 
+                                       latencyUs, 
+                                       GOBI_DATA_TIME_BUCKETS )]++;
+   GobiDataUpdateEnd( pGobiDev, statsFlags );
+
    if (pURB->status != 0)
    {
       // Note that in case of an error, the behaviour is no different
@@ -777,6 +1553,7 @@ static int GobiUSBNetAutoPMThread( void * pData )
       }
 
       // Submit URB
+      pAutoPM->mActiveURBSubmitted = ktime_get();
       status = usb_submit_urb( pAutoPM->mpActiveURB, GFP_KERNEL );
       if (status < 0)
       {
@@ -1267,6 +2044,11 @@ int GobiUSBNetProbe(
    
    atomic_set(&pGobiDev->refcount, 1);
 
+   spin_lock_init( &pGobiDev->mDataStatsLock );
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 3,13,0 ))
+   u64_stats_init( &pGobiDev->mDataStatsSync );
+#endif
+
    pDev->data[0] = (unsigned long)pGobiDev;
    
    pGobiDev->mpNetDev = pDev;
@@ -1310,6 +2092,27 @@ int GobiUSBNetProbe(
    pNetDevOps->ndo_tx_timeout = usbnet_tx_timeout;
 
    pDev->net->netdev_ops = pNetDevOps;
+
+   // Not fatal, ethtool just shows no statistics without the copy
+   pGobiDev->mpEthtoolOps = kmalloc( sizeof( struct ethtool_ops ), GFP_KERNEL );
+   if (pGobiDev->mpEthtoolOps == NULL)
+   {
+      DBG( "failed to allocate ethtool ops\n" );
+   }
+   else
+   {
+      memcpy( pGobiDev->mpEthtoolOps, 
+              pDev->net->ethtool_ops, 
+              sizeof( struct ethtool_ops ) );
+      pGobiDev->mpEthtoolOps->get_sset_count = GobiEthtoolGetSsetCount;
+      pGobiDev->mpEthtoolOps->get_strings = GobiEthtoolGetStrings;
+      pGobiDev->mpEthtoolOps->get_ethtool_stats = GobiEthtoolGetStats;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,6,0 ))
+      pGobiDev->mpEthtoolOps->get_link_ksettings = 
+         GobiEthtoolGetLinkKsettings;
+#endif
+      pDev->net->ethtool_ops = pGobiDev->mpEthtoolOps;
+   }
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION( 2,6,31 ))
@@ -1329,6 +2132,7 @@ int GobiUSBNetProbe(
    pGobiDev->mQMIDev.mbCdevIsInitialized = false;
 
    pGobiDev->mQMIDev.mpDevClass = gpClass;
+   pGobiDev->mQMIDev.mpDebugRoot = gpDebugRoot;
    
 #ifdef CONFIG_PM
    #if (LINUX_VERSION_CODE < KERNEL_VERSION( 2,6,29 ))
@@ -1336,6 +2140,11 @@ int GobiUSBNetProbe(
    #endif
 #endif /* CONFIG_PM */
    spin_lock_init( &pGobiDev->mQMIDev.mClientMemLock );
+   spin_lock_init( &pGobiDev->mQMIDev.mCacheLock );
+   pGobiDev->mQMIDev.mpCacheList = NULL;
+   pGobiDev->mQMIDev.mCacheCount = 0;
+   pGobiDev->mQMIDev.mpDedupList = NULL;
+   pGobiDev->mQMIDev.mDedupCount = 0;
 
    // Default to device down
    pGobiDev->mDownReason = 0;
@@ -1354,6 +2163,8 @@ int GobiUSBNetProbe(
       usbnet_disconnect( pIntf );
       return status;
    }
+
+   GobiDataDebugfsInit( pGobiDev );
    
    // Success
    return 0;
@@ -1389,6 +2200,8 @@ RETURN VALUE:
 ===========================================================================*/
 static int __init GobiUSBNetModInit( void )
 {
+   int result;
+
    gpClass = class_create( THIS_MODULE, "GobiQMI" );
    if (IS_ERR( gpClass ) == true)
    {
@@ -1397,10 +2210,28 @@ static int __init GobiUSBNetModInit( void )
       return -ENOMEM;
    }
 
+   // Not fatal, debugfs only carries statistics
+   gpDebugRoot = debugfs_create_dir( "GobiNet", NULL );
+
    // This will be shown whenever driver is loaded
    printk( KERN_INFO "%s: %s\n", DRIVER_DESC, DRIVER_VERSION );
 
-   return usb_register( &GobiNet );
+   result = usb_register( &GobiNet );
+   if (result != 0)
+   {
+      debugfs_remove_recursive( gpDebugRoot );
+      class_destroy( gpClass );
+   }
+
+#if defined( GOBI_KUNIT ) && (LINUX_VERSION_CODE < KERNEL_VERSION( 6,0,0 ))
+   // Later kernels run the suite through kunit_test_suite()
+   if (result == 0)
+   {
+      GobiKUnitRun();
+   }
+#endif
+
+   return result;
 }
 module_init( GobiUSBNetModInit );
 
@@ -1419,6 +2250,8 @@ static void __exit GobiUSBNetModExit( void )
 {
    usb_deregister( &GobiNet );
 
+   debugfs_remove_recursive( gpDebugRoot );
+
    class_destroy( gpClass );
 }
 module_exit( GobiUSBNetModExit );
@@ -1432,7 +2265,56 @@ MODULE_LICENSE("Dual BSD/GPL");
 #undef bool
 #endif
 
+#ifdef QMI_DEBUG_KEY
+/*===========================================================================
+METHOD:
+   GobiDebugSet (Public Method)
+
+DESCRIPTION:
+   Set the debug module parameter and flip gDebugKey to follow it
+
+PARAMETERS
+   pVal     [ I ] - New value, as written
+   pKP      [ I ] - Parameter being set
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+static int GobiDebugSet(
+   const char *                  pVal,
+   const struct kernel_param *   pKP )
+{
+   int result;
+
+   result = param_set_int( pVal, pKP );
+   if (result != 0)
+   {
+      return result;
+   }
+
+   if (debug == 1)
+   {
+      static_branch_enable( &gDebugKey );
+   }
+   else
+   {
+      static_branch_disable( &gDebugKey );
+   }
+
+   return 0;
+}
+
+static const struct kernel_param_ops GobiDebugOps =
+{
+   .set = GobiDebugSet,
+   .get = param_get_int,
+};
+
+module_param_cb( debug, &GobiDebugOps, &debug, S_IRUGO | S_IWUSR );
+#else
 module_param( debug, int, S_IRUGO | S_IWUSR );
+#endif
 MODULE_PARM_DESC( debug, "Debuging enabled or not" );
 
 module_param( interruptible, int, S_IRUGO | S_IWUSR );
@@ -1440,4 +2322,28 @@ MODULE_PARM_DESC( interruptible, "Listen for and return on user interrupt" );
 module_param( txQueueLength, int, S_IRUGO | S_IWUSR );
 MODULE_PARM_DESC( txQueueLength, 
                   "Number of IP packets which may be queued up for transmit" );
+module_param( clientPoolSize, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( clientPoolSize,
+                  "Idle QMI clients kept per service (WDS, DMS, NAS, UIM)" );
+module_param( writeQueueLength, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( writeQueueLength,
+                  "O_NONBLOCK writes each QMI file handle may have in flight" );
+module_param( readQueueDepth, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( readQueueDepth,
+                  "Unread QMI messages kept per client, 0 for no limit" );
+module_param( readQueueBytes, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( readQueueBytes,
+                  "Bytes of unread QMI messages kept per client, 0 for no limit" );
+module_param( readQueueDropOldest, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( readQueueDropOldest,
+                  "Full read queues drop the oldest (1) or newest (0) message" );
+module_param( orphanResponseTTL, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( orphanResponseTTL,
+                  "Milliseconds unclaimed messages to in-driver clients are kept" );
+module_param( responseCache, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( responseCache,
+                  "Answer static QMI queries from a response cache" );
+module_param( ctrlUrbsInFlight, int, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC( ctrlUrbsInFlight,
+                  "QMI writes in flight on the control endpoint, 0 for no limit" );
 
@@ -11,11 +11,15 @@ FUNCTIONS:
       FillQMUX
    
    Generic QMI functions
+      IndexTLVs
+      GetIndexedTLV
+      ValidIndexedQMIMessage
       GetTLV
       ValidQMIMessage
       GetQMIMessageID
 
    Fill Buffers with QMI requests
+      QMIEncodeReq
       QMICTLGetClientIDReq
       QMICTLReleaseClientIDReq
       QMICTLReadyReq
@@ -25,6 +29,7 @@ FUNCTIONS:
       QMIWDASetDataFormatReq
       QMICTLSetDataFormatReq
       QMICTLSyncReq
+      QMIServiceResetReq
       
    Parse data from QMI responses
       QMICTLGetClientIDResp
@@ -33,6 +38,7 @@ FUNCTIONS:
       QMIDMSGetMEIDResp
       QMIWDASetDataFormatResp
       QMICTLSyncResp
+      QMIServiceResetResp
 
 Copyright (c) 2011, Code Aurora Forum. All rights reserved.
 
@@ -65,11 +71,114 @@ POSSIBILITY OF SUCH DAMAGE.
 //---------------------------------------------------------------------------
 // Include Files
 //---------------------------------------------------------------------------
+
+// QMI.c only encodes and decodes buffers, it does not need the device
+//    structures in Structs.h.  The only kernel services used here are
+//    get/put_unaligned, cpu_to_le*/le*_to_cpu, memcpy, ARRAY_SIZE and
+//    printk (through DBG), so this file is also built in userspace against
+//    the shim headers in test/shim (make -C test run).  linux/version.h
+//    and linux/jump_label.h are only needed for the DBG static key, without
+//    __KERNEL__ DBG tests debug instead and the shim leaves them empty.
+//    Keep test/shim in step when adding includes here
 #include <asm/unaligned.h>
 #include <linux/kernel.h>
-#include "Structs.h"
+#include <linux/string.h>
+#include <linux/version.h>
+#include <linux/jump_label.h>
 #include "QMI.h"
 
+/*=========================================================================*/
+// QMI request tables
+/*=========================================================================*/
+
+// DataFormat: 0-default; 1-QoS hdr present
+#ifdef QOS_MODE
+#define QMI_QOS_HEADER 1
+#else
+#define QMI_QOS_HEADER 0
+#endif
+
+// LinkProt: 0x1 - ETH; 0x2 - rawIP
+#ifdef DATA_MODE_RP
+#define QMI_LINK_PROTOCOL 2
+#else
+#define QMI_LINK_PROTOCOL 1
+#endif
+
+// No TLV's
+#define QMI_NO_FIELDS( E )
+
+// QMI CTL Get Client ID: service type
+#define QMI_CTL_GET_CLIENT_ID_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x01, QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  0,    0 )
+
+// QMI CTL Release Client ID: service type / client ID
+#define QMI_CTL_RELEASE_CLIENT_ID_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x01, QMI_ARG_NONE ) \
+   E( QMI_FIELD_U16, 0,    0 )
+
+// QMI WDS Set Event Report: report channel rate, stats period and mask
+#define QMI_WDS_SET_EVENT_REPORT_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x11,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  0x01,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x000000ff, QMI_ARG_NONE )
+
+// QMI WDA Set Data Format: QoS header, link protocol, uplink aggregation
+#define QMI_WDA_SET_DATA_FORMAT_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x10,              QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  QMI_QOS_HEADER,    QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, 0x11,              QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, QMI_LINK_PROTOCOL, QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, 0x13,              QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000000,        QMI_ARG_NONE )
+
+// QMI CTL Set Data Format: QoS header, link protocol
+#define QMI_CTL_SET_DATA_FORMAT_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x01,                QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  QMI_QOS_HEADER,      QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, TLV_TYPE_LINK_PROTO, QMI_ARG_NONE ) \
+   E( QMI_FIELD_U16, QMI_LINK_PROTOCOL,   QMI_ARG_NONE )
+
+// QMI WDS Bind Mux Data Port: end point type and interface, mux ID 0,
+//    client type
+#define QMI_WDS_BIND_MUX_DATA_PORT_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x10,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000005, QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000008, QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, 0x11,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  0x00,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, 0x13,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000001, QMI_ARG_NONE )
+
+// QMI WDS Bind Mux Data Port: end point type and interface 0, mux ID
+#define QMI_WDS_BIND_MUX_DATA_PORT_PRE_FIELDS( E ) \
+   E( QMI_FIELD_TLV, 0x10,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000005, QMI_ARG_NONE ) \
+   E( QMI_FIELD_U32, 0x00000000, QMI_ARG_NONE ) \
+   E( QMI_FIELD_TLV, 0x11,       QMI_ARG_NONE ) \
+   E( QMI_FIELD_U8,  0,          0 )
+
+QMI_DEFINE_REQ( gQMICTLGetClientIDReq, 0x0022, true, 
+                QMI_CTL_GET_CLIENT_ID_FIELDS );
+QMI_DEFINE_REQ( gQMICTLReleaseClientIDReq, 0x0023, true, 
+                QMI_CTL_RELEASE_CLIENT_ID_FIELDS );
+QMI_DEFINE_REQ( gQMICTLReadyReq, 0x0021, true, QMI_NO_FIELDS );
+QMI_DEFINE_REQ( gQMICTLSetDataFormatReq, 0x0026, true, 
+                QMI_CTL_SET_DATA_FORMAT_FIELDS );
+QMI_DEFINE_REQ( gQMICTLSyncReq, 0x0027, true, QMI_NO_FIELDS );
+QMI_DEFINE_REQ( gQMIWDSSetEventReportReq, 0x0001, false, 
+                QMI_WDS_SET_EVENT_REPORT_FIELDS );
+QMI_DEFINE_REQ( gQMIWDSGetPKGSRVCStatusReq, 0x0022, false, QMI_NO_FIELDS );
+QMI_DEFINE_REQ( gQMIDMSGetMEIDReq, 0x0025, false, QMI_NO_FIELDS );
+QMI_DEFINE_REQ( gQMIWDASetDataFormatReq, 0x0020, false, 
+                QMI_WDA_SET_DATA_FORMAT_FIELDS );
+QMI_DEFINE_REQ( gQMIWDSBindMuxDataPortReq, 0x00A2, false, 
+                QMI_WDS_BIND_MUX_DATA_PORT_FIELDS );
+QMI_DEFINE_REQ( gQMIWDSBindMuxDataPortPreReq, 0x00A2, false, 
+                QMI_WDS_BIND_MUX_DATA_PORT_PRE_FIELDS );
+QMI_DEFINE_REQ( gQMIServiceResetReq, 0x0000, false, QMI_NO_FIELDS );
+
 /*=========================================================================*/
 // Get sizes of buffers needed by QMI requests
 /*=========================================================================*/
@@ -101,7 +210,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMICTLGetClientIDReqSize( void )
 {
-   return sizeof( sQMUX ) + 10;
+   return gQMICTLGetClientIDReq.mSize;
 }
 
 /*===========================================================================
@@ -116,7 +225,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMICTLReleaseClientIDReqSize( void )
 {
-   return sizeof( sQMUX ) + 11;
+   return gQMICTLReleaseClientIDReq.mSize;
 }
 
 /*===========================================================================
@@ -131,7 +240,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMICTLReadyReqSize( void )
 {
-   return sizeof( sQMUX ) + 6;
+   return gQMICTLReadyReq.mSize;
 }
 
 /*===========================================================================
@@ -146,7 +255,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIWDSSetEventReportReqSize( void )
 {
-   return sizeof( sQMUX ) + 15;
+   return gQMIWDSSetEventReportReq.mSize;
 }
 
 /*===========================================================================
@@ -161,7 +270,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIWDSGetPKGSRVCStatusReqSize( void )
 {
-   return sizeof( sQMUX ) + 7;
+   return gQMIWDSGetPKGSRVCStatusReq.mSize;
 }
 
 /*===========================================================================
@@ -176,7 +285,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIDMSGetMEIDReqSize( void )
 {
-   return sizeof( sQMUX ) + 7;
+   return gQMIDMSGetMEIDReq.mSize;
 }
 
 /*===========================================================================
@@ -191,7 +300,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIWDASetDataFormatReqSize( void )
 {
-   return sizeof( sQMUX ) + 25;
+   return gQMIWDASetDataFormatReq.mSize;
 }
 
 /*===========================================================================
@@ -206,7 +315,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16  QMICTLSetDataFormatReqSize( void )
 {
-   return sizeof( sQMUX ) + 15; 
+   return gQMICTLSetDataFormatReq.mSize;
 }
 
 /*===========================================================================
@@ -221,7 +330,22 @@ RETURN VALUE:
 ===========================================================================*/
 u16  QMICTLSyncReqSize( void )
 {
-   return sizeof( sQMUX ) + 6; 
+   return gQMICTLSyncReq.mSize;
+}
+
+/*===========================================================================
+METHOD:
+   QMIServiceResetReqSize (Public Method)
+
+DESCRIPTION:
+   Get size of buffer needed for QMUX + QMIServiceResetReq
+
+RETURN VALUE:
+   u16 - size of buffer
+===========================================================================*/
+u16 QMIServiceResetReqSize( void )
+{
+   return gQMIServiceResetReq.mSize;
 }
 
 /*=========================================================================*/
@@ -321,94 +445,173 @@ int FillQMUX(
 
 /*===========================================================================
 METHOD:
-   GetTLV (Public Method)
+   IndexTLVs (Public Method)
 
 DESCRIPTION:
-   Get data buffer of a specified TLV from a QMI message
+   Walk a QMI message once and record type, offset and length of each TLV
+      Every TLV is checked to lie inside the message in the same pass
 
    QMI Message shall NOT include SDU
    
 PARAMETERS
    pQMIMessage    [ I ] - QMI Message buffer
    messageLen     [ I ] - Size of QMI Message buffer
-   type           [ I ] - Desired Type
-   pOutDataBuf    [ O ] - Buffer to be filled with TLV
-   messageLen     [ I ] - Size of QMI Message buffer
+   pIndex         [ O ] - Index to fill
 
 RETURN VALUE:
-   u16 - Size of TLV for success
+   int - Number of TLVs indexed
          Negative errno for error
 ===========================================================================*/
-int GetTLV(
-   void *   pQMIMessage,
-   u16      messageLen,
-   u8       type,
-   void *   pOutDataBuf,
-   u16      bufferLen )
+int IndexTLVs(
+   void *            pQMIMessage,
+   u16               messageLen,
+   sQMITLVIndex *    pIndex )
 {
-   u16 pos;
-   u16 tlvSize = 0;
-   u16 cpyCount;
+   u32 pos;
+   u16 tlvSize;
    
-   if (pQMIMessage == 0 || pOutDataBuf == 0)
+   if (pQMIMessage == 0 || pIndex == 0)
    {
       return -ENOMEM;
    }   
+
+   pIndex->mpQMIMessage = pQMIMessage;
+   pIndex->mCount = 0;
+   pIndex->mMessageLen = messageLen;
+   pIndex->mScanFrom = 0;
    
-   for (pos = 4; 
-        pos + 3 < messageLen; 
-        pos += tlvSize + 3)
+   for (pos = 4; pos + 3 <= messageLen; pos += tlvSize + 3)
    {
-      tlvSize = le16_to_cpu( get_unaligned(((u16 *)(pQMIMessage + pos + 1) )) );
-      if (*(u8 *)(pQMIMessage + pos) == type)
+      tlvSize = le16_to_cpu( get_unaligned( (u16 *)(pQMIMessage + pos + 1) ) );
+      if (pos + 3 + tlvSize > messageLen)
       {
-         if (bufferLen < tlvSize)
-         {
-            return -ENOMEM;
-         }
-                
-         for (cpyCount = 0; cpyCount < tlvSize; cpyCount++)
-         {
-            *((char*)(pOutDataBuf + cpyCount)) = *((char*)(pQMIMessage + pos + 3 + cpyCount));
-         }
-         
-         return tlvSize;
+         // Truncated TLV, keep what was complete
+         break;
+      }
+
+      if (pIndex->mCount == QMI_TLV_INDEX_MAX)
+      {
+         // GetIndexedTLV scans the rest of the message
+         pIndex->mScanFrom = pos;
+         break;
       }
+
+      pIndex->mType[pIndex->mCount] = *(u8 *)(pQMIMessage + pos);
+      pIndex->mOffset[pIndex->mCount] = pos + 3;
+      pIndex->mLength[pIndex->mCount] = tlvSize;
+      pIndex->mCount++;
    }
    
-   return -ENOMSG;
+   return pIndex->mCount;
 }
 
 /*===========================================================================
 METHOD:
-   ValidQMIMessage (Public Method)
+   GetIndexedTLV (Public Method)
 
 DESCRIPTION:
-   Check mandatory TLV in a QMI message
+   Get data buffer of a specified TLV from an indexed QMI message
+      TLVs past QMI_TLV_INDEX_MAX are found by scanning the message
 
-   QMI Message shall NOT include SDU
+PARAMETERS
+   pIndex         [ I ] - Index built by IndexTLVs
+   type           [ I ] - Desired Type
+   pOutDataBuf    [ O ] - Buffer to be filled with TLV
+   bufferLen      [ I ] - Size of pOutDataBuf
+
+RETURN VALUE:
+   int - Size of TLV for success
+         Negative errno for error
+===========================================================================*/
+int GetIndexedTLV(
+   const sQMITLVIndex * pIndex,
+   u8                   type,
+   void *               pOutDataBuf,
+   u16                  bufferLen )
+{
+   u8 i;
+   u32 pos;
+   u16 tlvSize;
+   u16 offset = 0;
+   u16 length = 0;
+   bool bFound = false;
+
+   if (pIndex == 0 || pOutDataBuf == 0)
+   {
+      return -ENOMEM;
+   }
+
+   for (i = 0; i < pIndex->mCount; i++)
+   {
+      if (pIndex->mType[i] == type)
+      {
+         offset = pIndex->mOffset[i];
+         length = pIndex->mLength[i];
+         bFound = true;
+         break;
+      }
+   }
+
+   // Same walk as IndexTLVs, over the TLVs the index had no room for
+   for (pos = pIndex->mScanFrom; 
+        bFound == false && pos != 0 && pos + 3 <= pIndex->mMessageLen;
+        pos += tlvSize + 3)
+   {
+      tlvSize = le16_to_cpu( 
+                   get_unaligned( (u16 *)(pIndex->mpQMIMessage + pos + 1) ) );
+      if (pos + 3 + tlvSize > pIndex->mMessageLen)
+      {
+         break;
+      }
+
+      if (*(u8 *)(pIndex->mpQMIMessage + pos) == type)
+      {
+         offset = pos + 3;
+         length = tlvSize;
+         bFound = true;
+      }
+   }
+
+   if (bFound == false)
+   {
+      return -ENOMSG;
+   }
+
+   if (bufferLen < length)
+   {
+      return -ENOMEM;
+   }
+
+   memcpy( pOutDataBuf, pIndex->mpQMIMessage + offset, length );
+   
+   return length;
+}
+
+/*===========================================================================
+METHOD:
+   ValidIndexedQMIMessage (Public Method)
+
+DESCRIPTION:
+   Check mandatory TLV in an indexed QMI message
 
 PARAMETERS
-   pQMIMessage    [ I ] - QMI Message buffer
-   messageLen     [ I ] - Size of QMI Message buffer
+   pIndex         [ I ] - Index built by IndexTLVs
 
 RETURN VALUE:
    int - 0 for success (no error)
          Negative errno for error
          Positive for QMI error code
 ===========================================================================*/
-int ValidQMIMessage(
-   void *   pQMIMessage,
-   u16      messageLen )
+int ValidIndexedQMIMessage( const sQMITLVIndex * pIndex )
 {
-   char mandTLV[4];
+   u8 mandTLV[4];
 
-   if (GetTLV( pQMIMessage, messageLen, 2, &mandTLV[0], 4 ) == 4)
+   if (GetIndexedTLV( pIndex, 2, &mandTLV[0], 4 ) == 4)
    {
       // Found TLV
-      if (*(u16 *)&mandTLV[0] != 0)
+      if (get_unaligned( (u16 *)&mandTLV[0] ) != 0)
       {
-         return le16_to_cpu( get_unaligned(&mandTLV[2]) );
+         return le16_to_cpu( get_unaligned( (u16 *)&mandTLV[2] ) );
       }
       else
       {
@@ -419,6 +622,80 @@ int ValidQMIMessage(
    {
       return -ENOMSG;
    }
+}
+
+/*===========================================================================
+METHOD:
+   GetTLV (Public Method)
+
+DESCRIPTION:
+   Get data buffer of a specified TLV from a QMI message
+      Parsers needing more than one TLV should index the message once
+
+   QMI Message shall NOT include SDU
+   
+PARAMETERS
+   pQMIMessage    [ I ] - QMI Message buffer
+   messageLen     [ I ] - Size of QMI Message buffer
+   type           [ I ] - Desired Type
+   pOutDataBuf    [ O ] - Buffer to be filled with TLV
+   bufferLen      [ I ] - Size of pOutDataBuf
+
+RETURN VALUE:
+   int - Size of TLV for success
+         Negative errno for error
+===========================================================================*/
+int GetTLV(
+   void *   pQMIMessage,
+   u16      messageLen,
+   u8       type,
+   void *   pOutDataBuf,
+   u16      bufferLen )
+{
+   sQMITLVIndex index;
+   int result;
+
+   result = IndexTLVs( pQMIMessage, messageLen, &index );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   return GetIndexedTLV( &index, type, pOutDataBuf, bufferLen );
+}
+
+/*===========================================================================
+METHOD:
+   ValidQMIMessage (Public Method)
+
+DESCRIPTION:
+   Check mandatory TLV in a QMI message
+
+   QMI Message shall NOT include SDU
+
+PARAMETERS
+   pQMIMessage    [ I ] - QMI Message buffer
+   messageLen     [ I ] - Size of QMI Message buffer
+
+RETURN VALUE:
+   int - 0 for success (no error)
+         Negative errno for error
+         Positive for QMI error code
+===========================================================================*/
+int ValidQMIMessage(
+   void *   pQMIMessage,
+   u16      messageLen )
+{
+   sQMITLVIndex index;
+   int result;
+
+   result = IndexTLVs( pQMIMessage, messageLen, &index );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   return ValidIndexedQMIMessage( &index );
 }      
 
 /*===========================================================================
@@ -458,50 +735,170 @@ int GetQMIMessageID(
 
 /*===========================================================================
 METHOD:
-   QMICTLGetClientIDReq (Public Method)
+   QMIEncodeReq (Public Method)
 
 DESCRIPTION:
-   Fill buffer with QMI CTL Get Client ID Request
+   Fill buffer with a QMI request described by a field table
+
+   The SDU header, every field and every TLV length are written straight
+   into pBuffer in one pass, no intermediate buffer is used
 
 PARAMETERS
+   pDesc           [ I ] - Request description
    pBuffer         [ 0 ] - Buffer to be filled
    buffSize        [ I ] - Size of pBuffer
    transactionID   [ I ] - Transaction ID
-   serviceType     [ I ] - Service type requested
+   pArgs           [ I ] - Values for fields that take a caller argument
+   argCount        [ I ] - Number of entries in pArgs
 
 RETURN VALUE:
    int - Positive for resulting size of pBuffer
          Negative errno for error
 ===========================================================================*/
-int QMICTLGetClientIDReq(
-   void *   pBuffer,
-   u16      buffSize,
-   u8       transactionID,
-   u8       serviceType )
+int QMIEncodeReq(
+   const sQMIReqDesc *  pDesc,
+   void *               pBuffer,
+   u16                  buffSize,
+   u16                  transactionID,
+   const u32 *          pArgs,
+   u8                   argCount )
 {
-   if (pBuffer == 0 || buffSize < QMICTLGetClientIDReqSize() )
+   const sQMIFieldDesc * pField;
+   u8 * pSDU;
+   u8 * pTLVLength = NULL;
+   u16 offset;
+   u16 tlvStart = 0;
+   u32 value;
+   u8 fieldIndex;
+
+   if (pDesc == NULL || pBuffer == NULL || buffSize < pDesc->mSize)
    {
       return -ENOMEM;
    }
 
-   // QMI CTL GET CLIENT ID
+   pSDU = (u8 *)pBuffer + sizeof( sQMUX );
+
    // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))= 0x00;
-   // Transaction ID
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 1) = transactionID;
+   pSDU[0] = 0x00;
+   if (pDesc->mbCTL == true)
+   {
+      // Transaction ID
+      pSDU[1] = (u8)transactionID;
+      offset = 2;
+   }
+   else
+   {
+      // Transaction ID
+      put_unaligned( cpu_to_le16(transactionID), (u16 *)(pSDU + 1) );
+      offset = 3;
+   }
+
    // Message ID
-   put_unaligned(cpu_to_le16(0x0022), (u16 *)(pBuffer + sizeof( sQMUX ) + 2));
+   put_unaligned( cpu_to_le16(pDesc->mMessageID), (u16 *)(pSDU + offset) );
+   offset += 2;
+
    // Size of TLV's
-   put_unaligned(cpu_to_le16(0x0004), (u16 *)(pBuffer + sizeof( sQMUX ) + 4));
-      // QMI Service Type
-      *(u8 *)(pBuffer + sizeof( sQMUX ) + 6)  = 0x01;
-      // Size
-   put_unaligned(cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 7));
-      // QMI svc type
-      *(u8 *)(pBuffer + sizeof( sQMUX ) + 9)  = serviceType;
+   put_unaligned( cpu_to_le16(pDesc->mSize - sizeof( sQMUX ) - offset - 2),
+                  (u16 *)(pSDU + offset) );
+   offset += 2;
+
+   for (fieldIndex = 0; fieldIndex < pDesc->mFieldCount; fieldIndex++)
+   {
+      pField = &pDesc->mpFields[fieldIndex];
+
+      value = pField->mValue;
+      if (pField->mArg != QMI_ARG_NONE)
+      {
+         if (pArgs == NULL || pField->mArg >= argCount)
+         {
+            DBG( "missing argument %d for message 0x%04X\n",
+                 pField->mArg, pDesc->mMessageID );
+            return -EINVAL;
+         }
+         value = pArgs[pField->mArg];
+      }
+
+      switch (pField->mKind)
+      {
+         case QMI_FIELD_TLV:
+            // Close the previous TLV
+            if (pTLVLength != NULL)
+            {
+               put_unaligned( cpu_to_le16(offset - tlvStart), 
+                              (u16 *)pTLVLength );
+            }
+
+            // Type
+            pSDU[offset] = (u8)value;
+            // Size, filled in once the TLV is closed
+            pTLVLength = pSDU + offset + 1;
+            offset += 3;
+            tlvStart = offset;
+            break;
+
+         case QMI_FIELD_U8:
+            pSDU[offset] = (u8)value;
+            offset += 1;
+            break;
+
+         case QMI_FIELD_U16:
+            put_unaligned( cpu_to_le16((u16)value), (u16 *)(pSDU + offset) );
+            offset += 2;
+            break;
+
+         case QMI_FIELD_U32:
+            put_unaligned( cpu_to_le32(value), (u32 *)(pSDU + offset) );
+            offset += 4;
+            break;
+
+         default:
+            DBG( "invalid field kind %d for message 0x%04X\n",
+                 pField->mKind, pDesc->mMessageID );
+            return -EINVAL;
+      }
+   }
+
+   // Close the last TLV
+   if (pTLVLength != NULL)
+   {
+      put_unaligned( cpu_to_le16(offset - tlvStart), (u16 *)pTLVLength );
+   }
 
    // success
-   return sizeof( sQMUX ) + 10;
+   return sizeof( sQMUX ) + offset;
+}
+
+/*===========================================================================
+METHOD:
+   QMICTLGetClientIDReq (Public Method)
+
+DESCRIPTION:
+   Fill buffer with QMI CTL Get Client ID Request
+
+PARAMETERS
+   pBuffer         [ 0 ] - Buffer to be filled
+   buffSize        [ I ] - Size of pBuffer
+   transactionID   [ I ] - Transaction ID
+   serviceType     [ I ] - Service type requested
+
+RETURN VALUE:
+   int - Positive for resulting size of pBuffer
+         Negative errno for error
+===========================================================================*/
+int QMICTLGetClientIDReq(
+   void *   pBuffer,
+   u16      buffSize,
+   u8       transactionID,
+   u8       serviceType )
+{
+   u32 args[] = { serviceType };
+
+   return QMIEncodeReq( &gQMICTLGetClientIDReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        args,
+                        ARRAY_SIZE( args ) );
 }
 
 /*===========================================================================
@@ -527,32 +924,17 @@ int QMICTLReleaseClientIDReq(
    u8       transactionID,
    u16      clientID )
 {
-   if (pBuffer == 0 || buffSize < QMICTLReleaseClientIDReqSize() )
-   {
-      return -ENOMEM;
-   }
+   u32 args[] = { clientID };
 
    DBG(  "buffSize: 0x%x, transactionID: 0x%x, clientID: 0x%x,\n",
          buffSize, transactionID, clientID );
 
-   // QMI CTL RELEASE CLIENT ID REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 1 ) = transactionID;
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0023), (u16 *)(pBuffer + sizeof( sQMUX ) + 2) );
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0005), (u16 *)(pBuffer + sizeof( sQMUX ) + 4) );
-      // Release client ID
-      *(u8 *)(pBuffer + sizeof( sQMUX ) + 6)  = 0x01;
-      // Size
-   put_unaligned( cpu_to_le16(0x0002), (u16 *)(pBuffer + sizeof( sQMUX ) + 7));
-      // QMI svs type / Client ID
-   put_unaligned(cpu_to_le16(clientID), (u16 *)(pBuffer + sizeof( sQMUX ) + 9));
-      
-   // success
-   return sizeof( sQMUX ) + 11;
+   return QMIEncodeReq( &gQMICTLReleaseClientIDReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        args,
+                        ARRAY_SIZE( args ) );
 }
 
 /*===========================================================================
@@ -576,25 +958,14 @@ int QMICTLReadyReq(
    u16      buffSize,
    u8       transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMICTLReadyReqSize() )
-   {
-      return -ENOMEM;
-   }
-
    DBG("buffSize: 0x%x, transactionID: 0x%x\n", buffSize, transactionID);
 
-   // QMI CTL GET VERSION INFO REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 1) = transactionID;
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0021), (u16 *)(pBuffer + sizeof( sQMUX ) + 2) );
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0000), (u16 *)(pBuffer + sizeof( sQMUX ) + 4) );
-
-   // success
-   return sizeof( sQMUX ) + 6;
+   return QMIEncodeReq( &gQMICTLReadyReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 /*===========================================================================
@@ -618,31 +989,12 @@ int QMIWDSSetEventReportReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMIWDSSetEventReportReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI WDS SET EVENT REPORT REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   put_unaligned( cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1));
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 3));
-   // Size of TLV's
-   put_unaligned(cpu_to_le16(0x0008), (u16 *)(pBuffer + sizeof( sQMUX ) + 5));
-      // Report channel rate TLV
-      *(u8 *)(pBuffer + sizeof( sQMUX ) + 7)  = 0x11;
-      // Size
-   put_unaligned( cpu_to_le16(0x0005), (u16 *)(pBuffer + sizeof( sQMUX ) + 8));
-      // Stats period
-      *(u8 *)(pBuffer + sizeof( sQMUX ) + 10)  = 0x01;
-      // Stats mask
-   put_unaligned( cpu_to_le32(0x000000ff), (u32 *)(pBuffer + sizeof( sQMUX ) + 11) );
-
-   // success
-   return sizeof( sQMUX ) + 15;
+   return QMIEncodeReq( &gQMIWDSSetEventReportReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 /*===========================================================================
@@ -666,23 +1018,12 @@ int QMIWDSGetPKGSRVCStatusReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMIWDSGetPKGSRVCStatusReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI WDS Get PKG SRVC Status REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   put_unaligned(cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1));
-   // Message ID
-   put_unaligned(cpu_to_le16(0x0022), (u16 *)(pBuffer + sizeof( sQMUX ) + 3));
-   // Size of TLV's
-   put_unaligned(cpu_to_le16(0x0000), (u16 *)(pBuffer + sizeof( sQMUX ) + 5));
-
-   // success
-   return sizeof( sQMUX ) + 7;
+   return QMIEncodeReq( &gQMIWDSGetPKGSRVCStatusReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 /*===========================================================================
@@ -706,23 +1047,12 @@ int QMIDMSGetMEIDReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMIDMSGetMEIDReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI DMS GET SERIAL NUMBERS REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   put_unaligned( cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1) );
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0025), (u16 *)(pBuffer + sizeof( sQMUX ) + 3) );
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0000), (u16 *)(pBuffer + sizeof( sQMUX ) + 5));
-
-   // success
-   return sizeof( sQMUX ) + 7;
+   return QMIEncodeReq( &gQMIDMSGetMEIDReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 /*===========================================================================
@@ -746,65 +1076,18 @@ int QMIWDASetDataFormatReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMIWDASetDataFormatReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI WDA SET DATA FORMAT REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-
-   // Transaction ID
-   put_unaligned( cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1) );
-
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0020), (u16 *)(pBuffer + sizeof( sQMUX ) + 3) );
-
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0012), (u16 *)(pBuffer + sizeof( sQMUX ) + 5));
-
-   /* TLVType QOS Data Format 1 byte  */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) +  7) = 0x10; // type data format
-
-   /* TLVLength  2 bytes - see spec */
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 8)); 
-
-   /* DataFormat: 0-default; 1-QoS hdr present 2 bytes */
-#ifdef QOS_MODE
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 10) = 1; /* QOS header */
-#else
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 10) = 0; /* no-QOS header */
-#endif
-
-   /* TLVType Link-Layer Protocol  (Optional) 1 byte */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 11) = 0x11;
-
-   /* TLVLength 2 bytes */
-   put_unaligned( cpu_to_le16(0x0004), (u16 *)(pBuffer + sizeof( sQMUX ) + 12));
-
-   /* LinkProt: 0x1 - ETH; 0x2 - rawIP  4 bytes */
 #ifdef DATA_MODE_RP
-   /* Set RawIP mode */
-   put_unaligned( cpu_to_le32(0x00000002), (u32 *)(pBuffer + sizeof( sQMUX ) + 14));
    DBG("Request RawIP Data Format\n");
 #else
-   /* Set Ethernet  mode */
-   put_unaligned( cpu_to_le32(0x00000001), (u32 *)(pBuffer + sizeof( sQMUX ) + 14));
    DBG("Request Ethernet Data Format\n");
 #endif
 
-   /* TLVType Uplink Data Aggression Protocol - 1 byte */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 18) = 0x13;
-
-   /* TLVLength 2 bytes */
-   put_unaligned( cpu_to_le16(0x0004), (u16 *)(pBuffer + sizeof( sQMUX ) + 19));
-
-   /* TLV Data */
-   put_unaligned( cpu_to_le32(0x00000000), (u32 *)(pBuffer + sizeof( sQMUX ) + 21));
-
-   // success
-   return QMIWDASetDataFormatReqSize();
+   return QMIEncodeReq( &gQMIWDASetDataFormatReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 
@@ -830,57 +1113,18 @@ int QMICTLSetDataFormatReq(
    u16      buffSize,
    u8       transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMICTLSetDataFormatReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   /* QMI CTL Set Data Format Request */
-   /* Request */
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00; // QMICTL_FLAG_REQUEST
-   
-   /* Transaction ID 1 byte */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 1) = transactionID; /* 1 byte as in spec */
-
-   /* QMICTLType  2 bytes */
-   put_unaligned( cpu_to_le16(0x0026), (u16 *)(pBuffer + sizeof( sQMUX ) + 2));
-
-   /* Length  2 bytes  of 2 TLVs  each - see spec */
-   put_unaligned( cpu_to_le16(0x0009), (u16 *)(pBuffer + sizeof( sQMUX ) + 4));
-
-   /* TLVType Data Format (Mandatory)  1 byte  */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) +  6) = 0x01; // type data format
-
-   /* TLVLength  2 bytes - see spec */
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 7)); 
-
-   /* DataFormat: 0-default; 1-QoS hdr present 2 bytes */
-#ifdef QOS_MODE
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 9) = 1; /* QOS header */
-#else
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 9) = 0; /* no-QOS header */
-#endif
-
-    /* TLVType Link-Layer Protocol  (Optional) 1 byte */
-    *(u8 *)(pBuffer + sizeof( sQMUX ) + 10) = TLV_TYPE_LINK_PROTO;
-
-    /* TLVLength 2 bytes */
-    put_unaligned( cpu_to_le16(0x0002), (u16 *)(pBuffer + sizeof( sQMUX ) + 11));
-
-   /* LinkProt: 0x1 - ETH; 0x2 - rawIP  2 bytes */
 #ifdef DATA_MODE_RP
-   /* Set RawIP mode */
-   put_unaligned( cpu_to_le16(0x0002), (u16 *)(pBuffer + sizeof( sQMUX ) + 13));
    DBG("Request RawIP Data Format\n");
 #else
-   /* Set Ethernet  mode */
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 13));
    DBG("Request Ethernet Data Format\n");
 #endif
 
-   /* success */
-   return sizeof( sQMUX ) + 15;
-
+   return QMIEncodeReq( &gQMICTLSetDataFormatReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 
@@ -897,7 +1141,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIWDSBindMuxDataPortReqSize( void )
 {
-   return sizeof( sQMUX ) + 29;
+   return gQMIWDSBindMuxDataPortReq.mSize;
 }
 
 
@@ -923,48 +1167,12 @@ int QMIWDSBindMuxDataPortReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMIWDSBindMuxDataPortReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI WDA SET DATA FORMAT REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00; //1
-
-   // Transaction ID
-   put_unaligned( cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1) ); //2
-
-   // Message ID
-   put_unaligned( cpu_to_le16(0x00A2), (u16 *)(pBuffer + sizeof( sQMUX ) + 3) ); //2
-
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0016), (u16 *)(pBuffer + sizeof( sQMUX ) + 5)); //2
-
-   /* TLVType Peripheral End Point ID Format 1 byte  */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) +  7) = 0x10; //Peripheral End Point ID
-   /* TLVLength  2 bytes - see spec */
-   put_unaligned( cpu_to_le16(0x0008), (u16 *)(pBuffer + sizeof( sQMUX ) + 8));
-   //ep_type 4 bit
-   put_unaligned( cpu_to_le32(0x00000005), (u32 *)(pBuffer + sizeof( sQMUX ) + 10));
-   //iface_id 4 bit
-   put_unaligned( cpu_to_le32(0x00000008), (u32 *)(pBuffer + sizeof( sQMUX ) + 14));
-   
-   //TLVType Mux ID 1 bit
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 18) = 0x11;
-   /* TLVLength 2 bytes */
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 19));
-   /* Mux ID of the logical data channel to which the client binds. The default value is 0. 1 byte */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 21) = 0x0;
-
-
-   //TLVType Mux ID 1 bit
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 22) = 0x13;
-   put_unaligned( cpu_to_le16(0x0004), (u16 *)(pBuffer + sizeof( sQMUX ) + 23));
-   put_unaligned( cpu_to_le32(0x00000001), (u32 *)(pBuffer + sizeof( sQMUX ) + 25));
-
-   // success
-   return QMIWDSBindMuxDataPortReqSize();
+   return QMIEncodeReq( &gQMIWDSBindMuxDataPortReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 
@@ -982,7 +1190,7 @@ RETURN VALUE:
 ===========================================================================*/
 u16 QMIWDSBindMuxDataPortPreReqSize( void )
 {
-   return sizeof( sQMUX ) + 22;
+   return gQMIWDSBindMuxDataPortPreReq.mSize;
 }
 
 
@@ -1014,42 +1222,14 @@ int QMIWDSBindMuxDataPortPreReq(
    u16      transactionID,
    unsigned int index )
 {
-   if (pBuffer == 0 || buffSize < QMIWDSBindMuxDataPortPreReqSize() )
-   {
-      return -ENOMEM;
-   }
-
-   // QMI WDA SET DATA FORMAT REQ
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00; //1
-
-   // Transaction ID
-   put_unaligned( cpu_to_le16(transactionID), (u16 *)(pBuffer + sizeof( sQMUX ) + 1) ); //2
-
-   // Message ID
-   put_unaligned( cpu_to_le16(0x00A2), (u16 *)(pBuffer + sizeof( sQMUX ) + 3) ); //2
-
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x000F), (u16 *)(pBuffer + sizeof( sQMUX ) + 5)); //2
-
-   /* TLVType Peripheral End Point ID Format 1 byte  */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) +  7) = 0x10; //Peripheral End Point ID
-   /* TLVLength  2 bytes - see spec */
-   put_unaligned( cpu_to_le16(0x0008), (u16 *)(pBuffer + sizeof( sQMUX ) + 8));
-   //ep_type 4 bit
-   put_unaligned( cpu_to_le32(0x00000005), (u32 *)(pBuffer + sizeof( sQMUX ) + 10));
-   //iface_id 4 bit
-   put_unaligned( cpu_to_le32(0x00000000), (u32 *)(pBuffer + sizeof( sQMUX ) + 14));
-   
-   //TLVType Mux ID 1 bit
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 18) = 0x11;
-   /* TLVLength 2 bytes */
-   put_unaligned( cpu_to_le16(0x0001), (u16 *)(pBuffer + sizeof( sQMUX ) + 19));
-   /* Mux ID of the logical data channel to which the client binds. The default value is 0. 1 byte */
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 21) = index;
-
-   // success
-   return QMIWDSBindMuxDataPortPreReqSize();
+   u32 args[] = { index };
+
+   return QMIEncodeReq( &gQMIWDSBindMuxDataPortPreReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        args,
+                        ARRAY_SIZE( args ) );
 }
 
 
@@ -1076,22 +1256,42 @@ int QMICTLSyncReq(
    u16      buffSize,
    u16      transactionID )
 {
-   if (pBuffer == 0 || buffSize < QMICTLSyncReqSize() )
-   {
-      return -ENOMEM;
-   }
+   return QMIEncodeReq( &gQMICTLSyncReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
+}
 
-   // Request
-   *(u8 *)(pBuffer + sizeof( sQMUX ))  = 0x00;
-   // Transaction ID
-   *(u8 *)(pBuffer + sizeof( sQMUX ) + 1) = transactionID;
-   // Message ID
-   put_unaligned( cpu_to_le16(0x0027), (u16 *)(pBuffer + sizeof( sQMUX ) + 2) );
-   // Size of TLV's
-   put_unaligned( cpu_to_le16(0x0000), (u16 *)(pBuffer + sizeof( sQMUX ) + 4) );
+/*===========================================================================
+METHOD:
+   QMIServiceResetReq (Public Method)
+
+DESCRIPTION:
+   Fill buffer with a QMI service Reset Request
+      Message 0x0000 resets a client's state in WDS, DMS, NAS and UIM
 
-  // success
-  return sizeof( sQMUX ) + 6;
+PARAMETERS
+   pBuffer         [ 0 ] - Buffer to be filled
+   buffSize        [ I ] - Size of pBuffer
+   transactionID   [ I ] - Transaction ID
+
+RETURN VALUE:
+   int - Positive for resulting size of pBuffer
+         Negative errno for error
+===========================================================================*/
+int QMIServiceResetReq(
+   void *   pBuffer,
+   u16      buffSize,
+   u16      transactionID )
+{
+   return QMIEncodeReq( &gQMIServiceResetReq,
+                        pBuffer,
+                        buffSize,
+                        transactionID,
+                        NULL,
+                        0 );
 }
 
 /*=========================================================================*/
@@ -1119,6 +1319,7 @@ int QMICTLGetClientIDResp(
    u16    buffSize,
    u16 *  pClientID )
 {
+   sQMITLVIndex index;
    int result;
    
    // Ignore QMUX and SDU
@@ -1139,13 +1340,15 @@ int QMICTLGetClientIDResp(
       return -EFAULT;
    }
 
-   result = ValidQMIMessage( pBuffer, buffSize );
+   IndexTLVs( pBuffer, buffSize, &index );
+
+   result = ValidIndexedQMIMessage( &index );
    if (result != 0)
    {
       return -EFAULT;
    }
 
-   result = GetTLV( pBuffer, buffSize, 0x01, pClientID, 2 );
+   result = GetIndexedTLV( &index, 0x01, pClientID, 2 );
    if (result != 2)
    {
       return -EFAULT;
@@ -1244,6 +1447,7 @@ int QMIWDSEventResp(
    bool *   pbLinkState,
    bool *   pbReconfigure )
 {
+   sQMITLVIndex index;
    int result;
    u8 pktStatusRead[2];
 
@@ -1272,31 +1476,52 @@ int QMIWDSEventResp(
    // Note: Indications.  No Mandatory TLV required
 
    result = GetQMIMessageID( pBuffer, buffSize );
+   if (result == 0x01 || result == 0x22)
+   {
+      IndexTLVs( pBuffer, buffSize, &index );
+   }
+
    // QMI WDS Set Event Report Resp
    if (result == 0x01)
    {
-      // TLV's are not mandatory
-      GetTLV( pBuffer, buffSize, 0x10, (void*)pTXOk, 4 );
-      put_unaligned( le32_to_cpu(*pTXOk), pTXOk);
-      GetTLV( pBuffer, buffSize, 0x11, (void*)pRXOk, 4 );
-      put_unaligned( le32_to_cpu(*pRXOk), pRXOk);
-      GetTLV( pBuffer, buffSize, 0x12, (void*)pTXErr, 4 );
-      put_unaligned( le32_to_cpu(*pTXErr), pTXErr);
-      GetTLV( pBuffer, buffSize, 0x13, (void*)pRXErr, 4 );
-      put_unaligned( le32_to_cpu(*pRXErr), pRXErr);
-      GetTLV( pBuffer, buffSize, 0x14, (void*)pTXOfl, 4 );
-      put_unaligned( le32_to_cpu(*pTXOfl), pTXOfl);
-      GetTLV( pBuffer, buffSize, 0x15, (void*)pRXOfl, 4 );
-      put_unaligned( le32_to_cpu(*pRXOfl), pRXOfl);
-      GetTLV( pBuffer, buffSize, 0x19, (void*)pTXBytesOk, 8 );
-      put_unaligned( le64_to_cpu(*pTXBytesOk), pTXBytesOk);
-      GetTLV( pBuffer, buffSize, 0x1A, (void*)pRXBytesOk, 8 );
-      put_unaligned( le64_to_cpu(*pRXBytesOk), pRXBytesOk);
+      // TLV's are not mandatory, values stay untouched when absent
+      if (GetIndexedTLV( &index, 0x10, pTXOk, 4 ) == 4)
+      {
+         *pTXOk = le32_to_cpu( *pTXOk );
+      }
+      if (GetIndexedTLV( &index, 0x11, pRXOk, 4 ) == 4)
+      {
+         *pRXOk = le32_to_cpu( *pRXOk );
+      }
+      if (GetIndexedTLV( &index, 0x12, pTXErr, 4 ) == 4)
+      {
+         *pTXErr = le32_to_cpu( *pTXErr );
+      }
+      if (GetIndexedTLV( &index, 0x13, pRXErr, 4 ) == 4)
+      {
+         *pRXErr = le32_to_cpu( *pRXErr );
+      }
+      if (GetIndexedTLV( &index, 0x14, pTXOfl, 4 ) == 4)
+      {
+         *pTXOfl = le32_to_cpu( *pTXOfl );
+      }
+      if (GetIndexedTLV( &index, 0x15, pRXOfl, 4 ) == 4)
+      {
+         *pRXOfl = le32_to_cpu( *pRXOfl );
+      }
+      if (GetIndexedTLV( &index, 0x19, pTXBytesOk, 8 ) == 8)
+      {
+         *pTXBytesOk = le64_to_cpu( *pTXBytesOk );
+      }
+      if (GetIndexedTLV( &index, 0x1A, pRXBytesOk, 8 ) == 8)
+      {
+         *pRXBytesOk = le64_to_cpu( *pRXBytesOk );
+      }
    }
    // QMI WDS Get PKG SRVC Status Resp
    else if (result == 0x22)
    {
-      result = GetTLV( pBuffer, buffSize, 0x01, &pktStatusRead[0], 2 );
+      result = GetIndexedTLV( &index, 0x01, &pktStatusRead[0], 2 );
       // 1 or 2 bytes may be received
       if (result >= 1)
       {
@@ -1357,6 +1582,7 @@ int QMIDMSGetMEIDResp(
    char *   pMEID,
    int      meidSize )
 {
+   sQMITLVIndex index;
    int result;
 
    // Ignore QMUX and SDU
@@ -1376,13 +1602,15 @@ int QMIDMSGetMEIDResp(
       return -EFAULT;
    }
 
-   result = ValidQMIMessage( pBuffer, buffSize );
+   IndexTLVs( pBuffer, buffSize, &index );
+
+   result = ValidIndexedQMIMessage( &index );
    if (result != 0)
    {
       return -EFAULT;
    }
 
-   result = GetTLV( pBuffer, buffSize, 0x12, (void*)pMEID, 14 );
+   result = GetIndexedTLV( &index, 0x12, pMEID, 14 );
    if (result != 14)
    {
       return -EFAULT;
@@ -1410,9 +1638,8 @@ int QMIWDASetDataFormatResp(
    void *   pBuffer,
    u16      buffSize )
 {
-
+   sQMITLVIndex index;
    int result;
-
    u8 pktLinkProtocol[4];
 
    // Ignore QMUX and SDU
@@ -1433,8 +1660,10 @@ int QMIWDASetDataFormatResp(
       return -EFAULT;
    }
 
+   IndexTLVs( pBuffer, buffSize, &index );
+
    /* Check response message result TLV */
-   result = ValidQMIMessage( pBuffer, buffSize );
+   result = ValidIndexedQMIMessage( &index );
    if (result != 0)
    {
       DBG("EFAULT: Data Format Mode Bad Response\n"); 
@@ -1443,8 +1672,7 @@ int QMIWDASetDataFormatResp(
    }
 
    /* Check response message link protocol */
-   result = GetTLV( pBuffer, buffSize, 0x11,
-                     &pktLinkProtocol[0], 4);
+   result = GetIndexedTLV( &index, 0x11, &pktLinkProtocol[0], 4 );
    if (result != 4)
    {
       DBG("EFAULT: Wrong TLV format\n"); 
@@ -1490,9 +1718,8 @@ int QMIWDSBindMuxDataPortResp(
    void *   pBuffer,
    u16      buffSize )
 {
-
+   sQMITLVIndex index;
    int result;
-
    u8 pktLinkProtocol[4];
 
    // Ignore QMUX and SDU
@@ -1513,8 +1740,10 @@ int QMIWDSBindMuxDataPortResp(
       return -EFAULT;
    }
 
+   IndexTLVs( pBuffer, buffSize, &index );
+
    /* Check response message result TLV */
-   result = ValidQMIMessage( pBuffer, buffSize );
+   result = ValidIndexedQMIMessage( &index );
    if (result != 0)
    {
       DBG("EFAULT: Data Format Mode Bad Response\n"); 
@@ -1522,8 +1751,7 @@ int QMIWDSBindMuxDataPortResp(
    }
 
    /* Check response message link protocol */
-   result = GetTLV( pBuffer, buffSize, 0x02,
-                     &pktLinkProtocol[0], 4);
+   result = GetIndexedTLV( &index, 0x02, &pktLinkProtocol[0], 4 );
    if (result != 4)
    {
       DBG("EFAULT: Wrong TLV format\n"); 
@@ -1576,3 +1804,50 @@ int QMICTLSyncResp(
 
    return result;
 }
+
+/*===========================================================================
+METHOD:
+   QMIServiceResetResp (Public Method)
+
+DESCRIPTION:
+   Verify the QMI service Reset Resp is valid
+
+PARAMETERS
+   pBuffer         [ I ] - Buffer to be parsed
+   buffSize        [ I ] - Size of pBuffer
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for error
+===========================================================================*/
+int QMIServiceResetResp(
+   void *   pBuffer,
+   u16      buffSize )
+{
+   int result;
+
+   // Ignore QMUX and SDU
+   u8 offset = sizeof( sQMUX ) + 3;
+
+   if (pBuffer == 0 || buffSize < offset)
+   {
+      return -ENOMEM;
+   }
+
+   pBuffer = pBuffer + offset;
+   buffSize -= offset;
+
+   result = GetQMIMessageID( pBuffer, buffSize );
+   if (result != 0x0000)
+   {
+      return -EFAULT;
+   }
+
+   result = ValidQMIMessage( pBuffer, buffSize );
+   if (result != 0)
+   {
+      return -EFAULT;
+   }
+
+   return 0;
+}
@@ -11,6 +11,9 @@ FUNCTIONS:
       FillQMUX
    
    Generic QMI functions
+      IndexTLVs
+      GetIndexedTLV
+      ValidIndexedQMIMessage
       GetTLV
       ValidQMIMessage
       GetQMIMessageID
@@ -23,9 +26,12 @@ FUNCTIONS:
       QMIWDSSetEventReportReqSize
       QMIWDSGetPKGSRVCStatusReqSize
       QMIDMSGetMEIDReqSize
+      QMICTLSetDataFormatReqSize
       QMICTLSyncReqSize
+      QMIServiceResetReqSize
 
    Fill Buffers with QMI requests
+      QMIEncodeReq
       QMICTLGetClientIDReq
       QMICTLReleaseClientIDReq
       QMICTLReadyReq
@@ -34,12 +40,14 @@ FUNCTIONS:
       QMIDMSGetMEIDReq
       QMICTLSetDataFormatReq
       QMICTLSyncReq
+      QMIServiceResetReq
       
    Parse data from QMI responses
       QMICTLGetClientIDResp
       QMICTLReleaseClientIDResp
       QMIWDSEventResp
       QMIDMSGetMEIDResp
+      QMIServiceResetResp
 
 Copyright (c) 2011, Code Aurora Forum. All rights reserved.
 
@@ -76,16 +84,32 @@ POSSIBILITY OF SUCH DAMAGE.
 /*=========================================================================*/
 
 extern int debug;
+
+// Whether debug output is on
+//    In kernels with static keys a disabled DBG costs one patched-out jump
+#if defined( __KERNEL__ ) && defined( LINUX_VERSION_CODE )
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,3,0 ))
+#define QMI_DEBUG_KEY
+#endif
+#endif
+
+#ifdef QMI_DEBUG_KEY
+DECLARE_STATIC_KEY_FALSE( gDebugKey );
+#define QMI_DEBUG_ON() static_branch_unlikely( &gDebugKey )
+#else
+#define QMI_DEBUG_ON() (debug == 1)
+#endif
+
 // DBG macro
 #define DBG( format, arg... ) do { \
-   if (debug == 1)\
+   if (QMI_DEBUG_ON())\
    { \
       printk( KERN_INFO "GobiNet::%s " format, __FUNCTION__, ## arg ); \
    } }while(0)
 
 #if 0
 #define VDBG( format, arg... ) do { \
-   if (debug == 1)\
+   if (QMI_DEBUG_ON())\
    { \
       printk( KERN_INFO "GobiNet::%s " format, __FUNCTION__, ## arg ); \
    } } while(0)
@@ -148,6 +172,103 @@ typedef struct sQMUX
 
 }__attribute__((__packed__)) sQMUX;
 
+// Most TLVs recorded per message, later ones are found by a scan
+#define QMI_TLV_INDEX_MAX 32
+
+/*=========================================================================*/
+// Struct sQMITLVIndex
+//
+//    Structure that records where each TLV of a QMI message is
+//       Built in one pass by IndexTLVs
+/*=========================================================================*/
+typedef struct sQMITLVIndex
+{
+   /* QMI Message the offsets refer to */
+   void *     mpQMIMessage;
+
+   /* Number of TLVs indexed */
+   u8         mCount;
+
+   /* Size of the QMI Message */
+   u16        mMessageLen;
+
+   /* Offset of the first TLV left out once the index filled up, else 0 */
+   u16        mScanFrom;
+
+   /* Type, value offset and value length of each TLV */
+   u8         mType[QMI_TLV_INDEX_MAX];
+   u16        mOffset[QMI_TLV_INDEX_MAX];
+   u16        mLength[QMI_TLV_INDEX_MAX];
+
+} sQMITLVIndex;
+
+// Request field kinds, each kind doubles as its encoded size
+//    QMI_FIELD_TLV starts a TLV, its length is filled in by QMIEncodeReq
+#define QMI_FIELD_U8  1
+#define QMI_FIELD_U16 2
+#define QMI_FIELD_TLV 3
+#define QMI_FIELD_U32 4
+
+// Field takes its constant value, not a caller argument
+#define QMI_ARG_NONE  (-1)
+
+/*=========================================================================*/
+// Struct sQMIFieldDesc
+//
+//    Structure that describes one field of a QMI request
+//       For QMI_FIELD_TLV mValue is the TLV type
+/*=========================================================================*/
+typedef struct sQMIFieldDesc
+{
+   /* QMI_FIELD_* */
+   u8         mKind;
+
+   /* Caller argument replacing mValue, or QMI_ARG_NONE */
+   s8         mArg;
+
+   /* Constant value, written little endian */
+   u32        mValue;
+
+} sQMIFieldDesc;
+
+/*=========================================================================*/
+// Struct sQMIReqDesc
+//
+//    Structure that describes a QMI request as a table of fields
+/*=========================================================================*/
+typedef struct sQMIReqDesc
+{
+   /* QMI message ID */
+   u16                     mMessageID;
+
+   /* QMI CTL requests have a 1 byte transaction ID */
+   bool                    mbCTL;
+
+   /* Size of the request including QMUX */
+   u16                     mSize;
+
+   /* Fields following the message header */
+   const sQMIFieldDesc *   mpFields;
+   u8                      mFieldCount;
+
+} sQMIReqDesc;
+
+// Expand a field list into sQMIFieldDesc entries, or into its size
+#define QMI_FIELD_ENTRY( kind, value, arg ) { kind, arg, value },
+#define QMI_FIELD_BYTES( kind, value, arg ) + (kind)
+
+// Define a static sQMIReqDesc, its size is computed at compile time
+#define QMI_DEFINE_REQ( name, messageID, bCTL, FIELDS ) \
+   static const sQMIFieldDesc name##Fields[] = { FIELDS( QMI_FIELD_ENTRY ) }; \
+   static const sQMIReqDesc name = \
+   { \
+      messageID, \
+      bCTL, \
+      sizeof( sQMUX ) + ((bCTL) ? 6 : 7) FIELDS( QMI_FIELD_BYTES ), \
+      name##Fields, \
+      ARRAY_SIZE( name##Fields ) \
+   }
+
 /*=========================================================================*/
 // Generic QMUX functions
 /*=========================================================================*/
@@ -168,6 +289,22 @@ int FillQMUX(
 // Generic QMI functions
 /*=========================================================================*/
 
+// Index type, offset and length of every TLV of a QMI message
+int IndexTLVs(
+   void *            pQMIMessage,
+   u16               messageLen,
+   sQMITLVIndex *    pIndex );
+
+// Get data buffer of a specified TLV from an indexed QMI message
+int GetIndexedTLV(
+   const sQMITLVIndex * pIndex,
+   u8                   type,
+   void *               pOutDataBuf,
+   u16                  bufferLen );
+
+// Check mandatory TLV in an indexed QMI message
+int ValidIndexedQMIMessage( const sQMITLVIndex * pIndex );
+
 // Get data buffer of a specified TLV from a QMI message
 int GetTLV(
    void *   pQMIMessage,
@@ -214,13 +351,28 @@ u16 QMIDMSGetMEIDReqSize( void );
 // Get size of buffer needed for QMUX + QMIWDASetDataFormatReq
 u16 QMIWDASetDataFormatReqSize( void );
 
+// Get size of buffer needed for QMUX + QMICTLSetDataFormatReq
+u16 QMICTLSetDataFormatReqSize( void );
+
 // Get size of buffer needed for QMUX + QMICTLSyncReq
 u16 QMICTLSyncReqSize( void );
 
+// Get size of buffer needed for QMUX + QMIServiceResetReq
+u16 QMIServiceResetReqSize( void );
+
 /*=========================================================================*/
 // Fill Buffers with QMI requests
 /*=========================================================================*/
 
+// Encode a table described request after the QMUX header of pBuffer
+int QMIEncodeReq(
+   const sQMIReqDesc *  pDesc,
+   void *               pBuffer,
+   u16                  buffSize,
+   u16                  transactionID,
+   const u32 *          pArgs,
+   u8                   argCount );
+
 // Fill buffer with QMI CTL Get Client ID Request
 int QMICTLGetClientIDReq(
    void *   pBuffer,
@@ -265,11 +417,23 @@ int QMIWDASetDataFormatReq(
    u16      buffSize,
    u16      transactionID );
 
+// Fill buffer with QMI CTL Set Data Format Request
+int QMICTLSetDataFormatReq(
+   void *   pBuffer,
+   u16      buffSize,
+   u8       transactionID );
+
 int QMICTLSyncReq(
    void *   pBuffer,
    u16      buffSize,
    u16      transactionID );
 
+// Fill buffer with a QMI service Reset Request
+int QMIServiceResetReq(
+   void *   pBuffer,
+   u16      buffSize,
+   u16      transactionID );
+
 /*=========================================================================*/
 // Parse data from QMI responses
 /*=========================================================================*/
@@ -318,6 +482,11 @@ int QMICTLSyncResp(
    void *pBuffer,
    u16  buffSize );
 
+// Verify the QMI service Reset Resp is valid
+int QMIServiceResetResp(
+   void *   pBuffer,
+   u16      buffSize );
+
 // Get size of buffer needed for QMUX + QMIWDSBindMuxDataPortReq
 u16 QMIWDSBindMuxDataPortReqSize( void );
 
@@ -12,10 +12,17 @@ FUNCTIONS:
       GobiSetDownReason
       GobiClearDownReason
       GobiTestDownReason
+      GobiLog2Bucket
 
    Driver level asynchronous read functions
       ResubmitIntURB
+      QMIClientWaitQueue
+      QMIIndicationAllowed
+      QMIRxDispatch
       ReadCallback
+      QMIRxWork
+      QMIRxInit
+      QMIRxDestroy
       IntCallback
       StartRead
       KillRead
@@ -26,20 +33,122 @@ FUNCTIONS:
       ReadSync
       WriteSyncCallback
       WriteSync
+      WriteSyncURB
+
+   Control endpoint scheduler
+      QMICtrlInit
+      QMICtrlClass
+      QMICtrlGiveBack
+      QMICtrlNext
+      QMICtrlDispatch
+      QMICtrlSubmit
+      QMICtrlComplete
+      QMICtrlCancel
+      QMICtrlKillURB
+      QMICtrlUnlinkURB
+      QMICtrlFlush
+
+   Control URB pool
+      QMICtrlURBAlloc
+      QMICtrlURBFree
+      QMICtrlURBGet
+      QMICtrlURBPut
+      QMICtrlURBFill
+      QMICtrlURBPoolInit
+      QMICtrlURBPoolDestroy
+
+   Transaction latency
+      QMILatencyHistGet
+      QMILatencyTimeout
+      QMILatencyRecord
+      QMILatencyRequest
+      QMILatencyResponse
+      QMILatencyShowHist
+      QMILatencyShow
+      QMILatencyOpen
+      QMILatencyResetOpen
+      QMILatencyResetWrite
+      QMILatencyInit
+      QMILatencyDebugfsInit
+      QMILatencyDestroy
 
    Internal memory management functions
       GetClientID
+      CreateClientMem
       ReleaseClientID
+      QMIClientMemLocked
+      QMIClientMemUnlocking
       FindClientMem
       AddToReadMemList
+      AddEntryToReadMemList
+      ReadMemListFull
+      DropFromReadMemList
+      ExpireReadMemList
       PopFromReadMemList
+      PeekReadMemListSize
       AddToNotifyList
       NotifyAndPopNotifyList
       AddToURBList
       PopFromURBList
 
+   Client ID pool
+      QMIClientPoolSize
+      QMIClientPoolService
+      QMIClientPoolCount
+      QMIClientPoolGet
+      QMIClientPoolPut
+      QMIClientPoolWork
+
+   Response cache
+      QMICachePolicyFind
+      QMICacheRemove
+      QMICacheExpire
+      QMICacheAnswer
+      QMICacheDeliver
+      QMICacheFill
+      QMICacheInvalidate
+      QMICacheFlush
+
+   Request de-duplication
+      QMIDedupAllowed
+      QMIDedupRemove
+      QMIDedupExpire
+      QMIDedupJoin
+      QMIDedupFanOut
+      QMIDedupFlush
+
+   Shared memory rings
+      QMIRingGet
+      QMIRingRelease
+      QMIRingPut
+      QMIRingCopy
+      QMIRingWrite
+      QMIRingEmpty
+      QMIRingDetach
+      QMIRingVmOpen
+      QMIRingVmClose
+      QMIRingKick
+
    Internal userspace wrapper functions
       UserspaceunlockedIOCTL
+      UserspaceTransaction
+      UserspaceWriteLimit
+      UserspaceWriteCallback
+      UserspaceWriteSync
+      UserspaceWriteQueue
+      UserspaceWriteAsync
+      UserspaceFrameAppend
+      UserspaceReadBatch
+      UserspaceWriteBatch
+      UserspaceClientIDs
+      UserspaceFrameClientID
+      UserspaceAttachClient
+      UserspaceDetachClients
+      UserspaceReleaseClient
+      UserspaceAddService
+      UserspaceDataReady
+      UserspaceSetIndicationFilter
+      UserspaceGetQueueStats
 
    Userspace wrappers
       UserspaceOpen
@@ -48,12 +157,23 @@ FUNCTIONS:
       UserspaceRead
       UserspaceWrite
       UserspacePoll
+      UserspaceMmap
+
+   Sysfs attributes
+      QMISysfsGetDev
+      QMIReadyMsShow
+      QMIProbeReadyMsShow
+      QMICtrlStatsShow
+      QMIXactionTimeoutsShow
+      QMIClientMemStatsShow
+      QMIClientMemStatsStore
 
    Initializer and destructor
       RegisterQMIDevice
       DeregisterQMIDevice
 
    Driver level client management
+      QMIReadyCallback
       QMIReady
       QMIWDSCallback
       SetupQMIWDSCallback
@@ -93,6 +213,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <asm/unaligned.h>
 #include "QMIDevice.h"
 #include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+// Tracepoints are created here, GobiUSBNet.c only calls them
+#define CREATE_TRACE_POINTS
+#include "GobiTrace.h"
 
 //-----------------------------------------------------------------------------
 // Definitions
@@ -100,6 +228,14 @@ POSSIBILITY OF SUCH DAMAGE.
 
 extern int debug;
 extern int interruptible;
+extern int clientPoolSize;
+extern int writeQueueLength;
+extern int readQueueDepth;
+extern int readQueueBytes;
+extern int readQueueDropOldest;
+extern int orphanResponseTTL;
+extern int responseCache;
+extern int ctrlUrbsInFlight;
 #if (LINUX_VERSION_CODE <= KERNEL_VERSION( 2,6,22 ))
 static int s_interval;
 #endif
@@ -160,6 +296,47 @@ int GobiNetSuspend(
 
 #define IOCTL_QMI_RELEASE_SERVICE_FILE_IOCTL  (0x8BE0 + 4)
 
+// IOCTL to send a request and wait for its response, see sQMIIoctlTransaction
+#define IOCTL_QMI_TRANSACTION 0x8BE0 + 5
+
+// Largest request SDU accepted by IOCTL_QMI_TRANSACTION
+#define QMI_TRANSACTION_MAX_SIZE        4096
+
+// IOCTL to select framed batch reads and writes, arg 1 to enable, 0 to disable
+//    Each frame is an sQMIFrameHeader followed by the QMI SDU, unpadded
+#define IOCTL_QMI_SET_BATCH_MODE 0x8BE0 + 6
+
+// Most bytes a single batch read gathers
+#define QMI_BATCH_MAX_SIZE              32768
+
+// IOCTL to send the frames userspace placed in the mapped TX ring
+//    Returns the number of frames sent
+#define IOCTL_QMI_RING_KICK 0x8BE0 + 7
+
+// mmap offsets (in pages) selecting an RX only or an RX and TX mapping
+#define QMI_RING_PGOFF_RX               0
+#define QMI_RING_PGOFF_RXTX             1
+
+// Largest RX or TX ring, each must be a power of 2 of at least PAGE_SIZE
+#define QMI_RING_MAX_SIZE               (1 << 20)
+
+// Ring frames start on this boundary
+#define QMI_RING_ALIGN                  4
+
+// IOCTL to add a client for another service to this handle, arg is the
+//    service type, returns the new client ID for use in sQMIFrameHeader
+#define IOCTL_QMI_ADD_SERVICE 0x8BE0 + 8
+
+// IOCTL to limit the indications a client receives, see
+//    sQMIIoctlIndicationFilter
+#define IOCTL_QMI_SET_INDICATION_FILTER 0x8BE0 + 9
+
+// IOCTL to read a client's read queue usage, see sQMIIoctlQueueStats
+#define IOCTL_QMI_GET_QUEUE_STATS 0x8BE0 + 10
+
+// Most message IDs in one indication filter
+#define QMI_INDICATION_FILTER_MAX       256
+
 // CDC GET_ENCAPSULATED_RESPONSE packet
 #define CDC_GET_ENCAPSULATED_RESPONSE_LE 0x01A1ll
 #define CDC_GET_ENCAPSULATED_RESPONSE_BE 0xA101000000000000ll
@@ -200,6 +377,78 @@ const int i = 1;
 #define CONTROL_DTR                     0x01
 #define CONTROL_RTS                     0x02
 
+// Default deadline (in milliseconds) for driver initiated QMI transactions
+#define QMI_XACTION_TIMEOUT_MS          5000
+
+// Bind Mux Data Port Pre requests sent during bring-up (mux index 1..N)
+#define QMI_BIND_MUX_PRE_COUNT          8
+
+// Requests in flight during data path setup: format, pre binds, bind
+#define QMI_DATA_PATH_XACTIONS          (QMI_BIND_MUX_PRE_COUNT + 2)
+
+// QMIReady retransmit backoff, in milliseconds
+#define QMI_READY_INITIAL_MS            20
+#define QMI_READY_MAX_INTERVAL_MS       1000
+
+// QMICTL READY requests QMIReady keeps outstanding
+#define QMI_READY_MAX_INFLIGHT          8
+
+// Upper bound on idle clients pooled per service
+#define QMI_CLIENT_POOL_MAX             8
+
+// Services whose clients are pre-allocated when clientPoolSize is set
+static const u8 gClientPoolServices[] = { QMIWDS, QMIDMS, QMINAS, QMIUIM };
+
+// Upper bound on response cache entries per device
+#define QMI_CACHE_MAX_ENTRIES           32
+
+// Queries the response cache may answer
+static const sQMICachePolicy gCachePolicies[] =
+{
+   // DMS capabilities, manufacturer, model, revision, serial numbers
+   //    and hardware revision never change while the device is up
+   { QMIDMS, 0x0020, 0,      0 },
+   { QMIDMS, 0x0021, 0,      0 },
+   { QMIDMS, 0x0022, 0,      0 },
+   { QMIDMS, 0x0023, 0,      0 },
+   { QMIDMS, 0x0025, 0,      0 },
+   { QMIDMS, 0x002C, 0,      0 },
+
+   // MSISDN, ICCID and IMSI follow the SIM, dropped on DMS event reports
+   { QMIDMS, 0x0024, 0x0001, 0 },
+   { QMIDMS, 0x003C, 0x0001, 0 },
+   { QMIDMS, 0x0043, 0x0001, 0 },
+
+   // UIM card status, dropped on status change indications
+   { QMIUIM, 0x002F, 0x0032, 0 },
+
+   // NAS serving system, dropped on its indication, which only reaches
+   //    the driver while some NAS client has it enabled, so keep it short
+   { QMINAS, 0x0024, 0x0024, 2000 },
+};
+
+// Upper bound on requests tracked for de-duplication per device
+#define QMI_DEDUP_MAX_ENTRIES           16
+
+// Status queries whose identical copies in flight share one response,
+//    in addition to the cacheable queries above
+static const sQMIMessageKey gDedupQueries[] =
+{
+   // WDS packet service status, channel rate, statistics, settings
+   { QMIWDS, 0x0022 },
+   { QMIWDS, 0x0023 },
+   { QMIWDS, 0x0024 },
+   { QMIWDS, 0x002D },
+
+   // NAS signal strength, system info, signal info
+   { QMINAS, 0x0020 },
+   { QMINAS, 0x004D },
+   { QMINAS, 0x004F },
+
+   // DMS operating mode
+   { QMIDMS, 0x002D },
+};
+
 /*=========================================================================*/
 // UserspaceQMIFops
 //    QMI device's userspace file operations
@@ -220,6 +469,7 @@ struct file_operations UserspaceQMIFops =
    .open      = UserspaceOpen,
    .flush     = UserspaceClose,
    .poll      = UserspacePoll,
+   .mmap      = UserspaceMmap,
 };
 
 /*=========================================================================*/
@@ -310,7 +560,7 @@ void PrintHex(
    u16 pos;
    int status;
    
-   if (debug != 1)
+   if (QMI_DEBUG_ON() == false)
    {
        return;
    }
@@ -363,6 +613,7 @@ void GobiSetDownReason(
    u8                 reason )
 {
    set_bit( reason, &pDev->mDownReason );
+   trace_gobi_down_reason( pDev, reason, true );
    DBG("%s reason=%d, mDownReason=%x\n", __func__, reason, (unsigned)pDev->mDownReason);
    
    netif_carrier_off( pDev->mpNetDev->net );
@@ -387,6 +638,7 @@ void GobiClearDownReason(
    u8                 reason )
 {
    clear_bit( reason, &pDev->mDownReason );
+   trace_gobi_down_reason( pDev, reason, false );
    
    DBG("%s reason=%d, mDownReason=%x\n", __func__, reason, (unsigned)pDev->mDownReason);
 #if 0 //(LINUX_VERSION_CODE >= KERNEL_VERSION( 3,11,0 ))
@@ -420,6 +672,36 @@ bool GobiTestDownReason(
    return test_bit( reason, &pDev->mDownReason );
 }
 
+/*===========================================================================
+METHOD:
+   GobiLog2Bucket (Public Method)
+
+DESCRIPTION:
+   Histogram bucket of a value, bucket n holds [2^n, 2^(n+1))
+      0 falls in bucket 0, values past the last bucket in the last one
+
+PARAMETERS
+   value    [ I ] - Value to count
+   buckets  [ I ] - Buckets in the histogram
+
+RETURN VALUE:
+   int - bucket index
+===========================================================================*/
+int GobiLog2Bucket(
+   u64              value,
+   int              buckets )
+{
+   int bucket;
+
+   bucket = (value == 0) ? 0 : fls64( value ) - 1;
+   if (bucket >= buckets)
+   {
+      bucket = buckets - 1;
+   }
+
+   return bucket;
+}
+
 /*=========================================================================*/
 // Driver level asynchronous read functions
 /*=========================================================================*/
@@ -478,61 +760,110 @@ int ResubmitIntURB( struct urb * pIntURB )
 
 /*===========================================================================
 METHOD:
-   ReadCallback (Public Method)
+   QMIClientWaitQueue (Public Method)
 
 DESCRIPTION:
-   Put the data in storage and notify anyone waiting for data
+   Wait queue to wake as data arrives for a client
+      Clients owned by a file handle share that handle's queue, so one
+      poll() covers every service on the handle
+
+   Caller must have lock on mClientMemLock
 
 PARAMETERS
-   pReadURB       [ I ] - URB this callback is run for
+   pClientMem     [ I ] - Client memory
 
 RETURN VALUE:
-   None
+   wait_queue_head_t * - Queue to wake
 ===========================================================================*/
-#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,14 ))
-void ReadCallback( struct urb * pReadURB )
-#else
-void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
-#endif
+wait_queue_head_t * QMIClientWaitQueue( sClientMemList * pClientMem )
 {
-   int result;
-   u16 clientID;
-   sClientMemList * pClientMem;
-   void * pData;
-   void * pDataCopy;
-   u16 dataSize;
-   sGobiUSBNet * pDev;
-   unsigned long flags;
-   u16 transactionID;
-
-   if (pReadURB == NULL)
+   if (pClientMem->mpOwnerWaitQueue != NULL)
    {
-      DBG( "bad read URB\n" );
-      return;
+      return pClientMem->mpOwnerWaitQueue;
    }
-   
-   pDev = pReadURB->context;
-   if (IsDeviceValid( pDev ) == false)
+
+   return &pClientMem->mWaitQueue;
+}
+
+/*===========================================================================
+METHOD:
+   QMIIndicationAllowed (Public Method)
+
+DESCRIPTION:
+   Check an indication against a client's indication filter
+
+   Caller must have lock on mClientMemLock
+
+PARAMETERS
+   pClientMem     [ I ] - Client memory
+   msgID          [ I ] - QMI message ID of the indication
+
+RETURN VALUE:
+   bool - true if the client should receive it
+===========================================================================*/
+bool QMIIndicationAllowed(
+   sClientMemList *  pClientMem,
+   u16               msgID )
+{
+   u16 i;
+
+   if (pClientMem->mpIndicationFilter == NULL)
    {
-      DBG( "Invalid device!\n" );
-      return;
-   }   
+      return true;
+   }
 
-   if (pReadURB->status != 0)
+   for (i = 0; i < pClientMem->mIndicationFilterCount; i++)
    {
-      DBG( "Read status = %d\n", pReadURB->status );
+      if (pClientMem->mpIndicationFilter[i] == msgID)
+      {
+         return true;
+      }
+   }
 
-      // Resubmit the interrupt URB
-      ResubmitIntURB( pDev->mQMIDev.mpIntURB );
+   return false;
+}
 
-      return;
-   }
-   DBG( "Read %d bytes\n", pReadURB->actual_length );
-   
-   pData = pReadURB->transfer_buffer;
-   dataSize = pReadURB->actual_length;
+/*===========================================================================
+METHOD:
+   QMIRxDispatch (Public Method)
+
+DESCRIPTION:
+   Parse one QMUX message, put the data in storage and notify anyone
+   waiting for data
+      Runs from QMIRxWork, so copies are allocated with GFP_KERNEL before
+      mClientMemLock is taken.  The lock still disables interrupts since
+      transaction timers and URB completions take it too
+
+PARAMETERS
+   pDev           [ I ] - Device specific memory
+   pData          [ I ] - QMUX message, still owned by the caller
+   dataSize       [ I ] - Size of pData
 
-   PrintHex( pData, dataSize );
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRxDispatch(
+   sGobiUSBNet *     pDev,
+   void *            pData,
+   u16               dataSize )
+{
+   int result;
+   u16 clientID;
+   sClientMemList * pClientMem;
+   void * pDataCopy;
+   unsigned long flags;
+   u16 transactionID;
+   u16 sentTransactionID;
+   u16 msgID = 0;
+   bool bResponse;
+   bool bIndication = false;
+   bool bUserWrite = false;
+   sQMIXaction * pXaction = NULL;
+   sReadMemList * pSpare = NULL;
+   sReadMemList * pEntry;
+   int copies = 0;
+
+   trace_gobi_qmi_rx( pDev, pData, dataSize );
 
    result = ParseQMUX( &clientID,
                        pData,
@@ -541,9 +872,6 @@ void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
    {
       DBG( "Read error parsing QMUX %d\n", result );
 
-      // Resubmit the interrupt URB
-      ResubmitIntURB( pDev->mQMIDev.mpIntURB );
-
       return;
    }
    
@@ -554,24 +882,114 @@ void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
    {
       DBG( "Data buffer too small to parse\n" );
 
-      // Resubmit the interrupt URB
-      ResubmitIntURB( pDev->mQMIDev.mpIntURB );
-
       return;
    }
    
    // Transaction ID size is 1 for QMICTL, 2 for others
+   //    Response bit of the control flags is 0x01 for QMICTL, 0x02 for others
    if (clientID == QMICTL)
    {
       transactionID = *(u8*)(pData + result + 1);
+      bResponse = (*(u8*)(pData + result) & 0x01) != 0;
+      sentTransactionID = transactionID;
    }
    else
    {
       transactionID = le16_to_cpu( get_unaligned((u16*)(pData + result + 1)) );
+      bResponse = (*(u8*)(pData + result) & 0x02) != 0;
+      sentTransactionID = transactionID;
+
+      // Answers to write() go back with the ID userspace chose
+      if (bResponse == true && clientID >> 8 != 0xff)
+      {
+         bUserWrite = QMIUserTIDRestore( pDev, 
+                                         clientID, 
+                                         pData + result, 
+                                         &transactionID );
+      }
+
+      // Indication bit of the control flags is 0x04, for filtering
+      if (dataSize >= result + 5)
+      {
+         bIndication = (*(u8*)(pData + result) & 0x04) != 0;
+         msgID = le16_to_cpu( get_unaligned((u16*)(pData + result + 3)) );
+
+         // Keep the response cache in step with the modem
+         if (bIndication == true)
+         {
+            QMICacheInvalidate( pDev, clientID & 0xff, msgID );
+         }
+         else if (bResponse == true)
+         {
+            QMICacheFill( pDev,
+                          clientID,
+                          transactionID,
+                          pData + result,
+                          dataSize - result );
+
+            // Copies for the identical requests that were not sent
+            QMIDedupFanOut( pDev,
+                            clientID,
+                            transactionID,
+                            pData + result,
+                            dataSize - result );
+         }
+      }
    }
    
-   // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   if (bResponse == true && clientID >> 8 != 0xff)
+   {
+      QMILatencyResponse( pDev, clientID, sentTransactionID );
+   }
+
+   // Copies are made before the lock, one per client that will queue one
+   //    Same test as delivery below, mapped clients write their ring
+   if (clientID >> 8 == 0xff)
+   {
+      QMIClientMemLock( pDev, flags );
+      for (pClientMem = pDev->mQMIDev.mpClientMemList;
+           pClientMem != NULL;
+           pClientMem = pClientMem->mpNext)
+      {
+         if (pClientMem->mbPooled == false
+         &&  (pClientMem->mClientID | 0xff00) == clientID
+         &&  (bIndication == false
+         ||  QMIIndicationAllowed( pClientMem, msgID ) == true)
+         &&  pClientMem->mpRing == NULL)
+         {
+            copies++;
+         }
+      }
+      QMIClientMemUnlock( pDev, flags );
+   }
+   else
+   {
+      copies = 1;
+   }
+
+   for (; copies > 0; copies--)
+   {
+      pEntry = kmalloc( sizeof( sReadMemList ), GFP_KERNEL );
+      pDataCopy = kmalloc( dataSize, GFP_KERNEL );
+      if (pEntry == NULL || pDataCopy == NULL)
+      {
+         DBG( "Error allocating client data memory\n" );
+         kfree( pEntry );
+         kfree( pDataCopy );
+         break;
+      }
+
+      memcpy( pDataCopy, pData, dataSize );
+      pEntry->mpData = pDataCopy;
+      pEntry->mDataSize = dataSize;
+      pEntry->mTransactionID = transactionID;
+      pEntry->mpNext = pSpare;
+      pSpare = pEntry;
+   }
+   pDataCopy = NULL;
+
+   // Critical section, only long enough to queue the copies
+   QMIClientMemLock( pDev, flags );
 
    // Find memory storage for this service and Client ID
    // Not using FindClientMem because it can't handle broadcasts
@@ -579,57 +997,90 @@ void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
 
    while (pClientMem != NULL)
    {
-      if (pClientMem->mClientID == clientID 
+      // Idle pooled clients have no reader, skip them
+      //    Filtered indications are dropped before they are copied
+      if (pClientMem->mbPooled == false
+      &&  (pClientMem->mClientID == clientID 
       ||  (pClientMem->mClientID | 0xff00) == clientID)
+      &&  (bIndication == false
+      ||  QMIIndicationAllowed( pClientMem, msgID ) == true))
       {
-         // Make copy of pData
-         pDataCopy = kmalloc( dataSize, GFP_ATOMIC );
-         if (pDataCopy == NULL)
+         trace_gobi_qmi_dispatch( pDev,
+                                  pClientMem->mClientID,
+                                  transactionID,
+                                  msgID,
+                                  dataSize );
+
+         // Responses to in-driver transactions bypass the read list
+         if (bResponse == true 
+         &&  bUserWrite == false 
+         &&  clientID >> 8 != 0xff)
          {
-            DBG( "Error allocating client data memory\n" );
-
-            // End critical section
-            spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-
-            // Resubmit the interrupt URB
-            ResubmitIntURB( pDev->mQMIDev.mpIntURB );
-
-            return;             
+            pXaction = PopFromXactionList( pDev, clientID, transactionID );
          }
 
-         memcpy( pDataCopy, pData, dataSize );
-
-         if (AddToReadMemList( pDev,
-                               pClientMem->mClientID,
-                               transactionID,
-                               pDataCopy,
-                               dataSize ) == false)
+         if (pXaction == NULL && pClientMem->mpRing != NULL)
          {
-            DBG( "Error allocating pReadMemListEntry "
-                 "read will be discarded\n" );
-            kfree( pDataCopy );
-            
-            // End critical section
-            spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-
-            // Resubmit the interrupt URB
-            ResubmitIntURB( pDev->mQMIDev.mpIntURB );
-
-            return;
+            // Mapped clients take the message straight into their ring,
+            //    poll() only needs waking when the ring was empty
+            if (QMIRingWrite( pClientMem->mpRing,
+                              pClientMem->mClientID,
+                              pData,
+                              dataSize ) == 1)
+            {
+               wake_up_interruptible_sync( QMIClientWaitQueue( pClientMem ) );
+            }
+         }
+         else if (pSpare == NULL)
+         {
+            // Out of memory, or a broadcast reader registered since
+            DBG( "No copy for client 0x%04X\n", pClientMem->mClientID );
+            if (pXaction != NULL)
+            {
+               break;
+            }
+         }
+         else if (pXaction != NULL)
+         {
+            // The transaction takes the data, its entry is not needed
+            pDataCopy = pSpare->mpData;
+            pEntry = pSpare;
+            pSpare = pSpare->mpNext;
+            kfree( pEntry );
+            break;
+         }
+         else
+         {
+            pEntry = pSpare;
+            pSpare = pSpare->mpNext;
+
+            // A full queue only costs this client the message, other
+            //    clients of a broadcast still get theirs
+            if (AddEntryToReadMemList( pDev,
+                                       pClientMem->mClientID,
+                                       pEntry ) == false)
+            {
+               DBG( "Read for client 0x%04X will be discarded\n",
+                    pClientMem->mClientID );
+               pEntry->mpNext = pSpare;
+               pSpare = pEntry;
+            }
+            else
+            {
+               // Success
+               VDBG( "Creating new readListEntry for client 0x%04X, TID %x\n",
+                    clientID,
+                    transactionID );
+
+               // Notify this client data exists
+               NotifyAndPopNotifyList( pDev,
+                                       pClientMem->mClientID,
+                                       transactionID );
+
+               // Possibly notify poll() that data exists
+               wake_up_interruptible_sync( QMIClientWaitQueue( pClientMem ) );
+            }
          }
-
-         // Success
-         VDBG( "Creating new readListEntry for client 0x%04X, TID %x\n",
-              clientID,
-              transactionID );
-
-         // Notify this client data exists
-         NotifyAndPopNotifyList( pDev,
-                                 pClientMem->mClientID,
-                                 transactionID );
-
-         // Possibly notify poll() that data exists
-         wake_up_interruptible_sync( &pClientMem->mWaitQueue );
 
          // Not a broadcast
          if (clientID >> 8 != 0xff)
@@ -643,64 +1094,291 @@ void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
    }
    
    // End critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-   
-   // Resubmit the interrupt URB
-   ResubmitIntURB( pDev->mQMIDev.mpIntURB );
+   QMIClientMemUnlock( pDev, flags );
+
+   // Copies nobody took
+   while (pSpare != NULL)
+   {
+      pEntry = pSpare;
+      pSpare = pSpare->mpNext;
+      kfree( pEntry->mpData );
+      kfree( pEntry );
+   }
+
+   if (pXaction != NULL)
+   {
+      VDBG( "Completing transaction for client 0x%04X, TID %x\n",
+            clientID,
+            transactionID );
+      if (pDataCopy == NULL)
+      {
+         QMIXactionComplete( pXaction, -ENOMEM, NULL );
+      }
+      else
+      {
+         QMIXactionComplete( pXaction, dataSize, pDataCopy );
+      }
+      QMIXactionPut( pXaction );
+   }
 }
 
 /*===========================================================================
 METHOD:
-   IntCallback (Public Method)
+   ReadCallback (Public Method)
 
 DESCRIPTION:
-   Data is available, fire off a read URB
+   Queue a copy of the read message for QMIRxWork and resubmit the
+   interrupt URB
 
 PARAMETERS
-   pIntURB       [ I ] - URB this callback is run for
+   pReadURB       [ I ] - URB this callback is run for
 
 RETURN VALUE:
    None
 ===========================================================================*/
 #if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,14 ))
-void IntCallback( struct urb * pIntURB )
-{
+void ReadCallback( struct urb * pReadURB )
 #else
-void IntCallback(struct urb *pIntURB, struct pt_regs *regs)
-{
+void ReadCallback(struct urb *pReadURB, struct pt_regs *regs)
 #endif
-   int status;
-   u64 CDCEncResp;
-   u64 CDCEncRespMask;
+{
+   sGobiUSBNet * pDev;
+   sQMIRxMsg * pMsg;
+   unsigned long flags;
+
+   if (pReadURB == NULL)
+   {
+      DBG( "bad read URB\n" );
+      return;
+   }
    
-   sGobiUSBNet * pDev = (sGobiUSBNet *)pIntURB->context;
+   pDev = pReadURB->context;
    if (IsDeviceValid( pDev ) == false)
    {
       DBG( "Invalid device!\n" );
       return;
-   }
+   }   
 
-   // Verify this was a normal interrupt
-   if (pIntURB->status != 0)
-   {
-        DBG( "IntCallback: Int status = %d\n", pIntURB->status );
-      
-      // Ignore EOVERFLOW errors
-      if (pIntURB->status != -EOVERFLOW)
-      {
-         // Read 'thread' dies here
-         return;
-      }
-   }
-   else
+   if (pReadURB->status != 0)
    {
-      //TODO cast transfer_buffer to struct usb_cdc_notification
-      
-      // CDC GET_ENCAPSULATED_RESPONSE
-      CDC_GET_ENCAPSULATED_RESPONSE(&CDCEncResp, &CDCEncRespMask)
+      DBG( "Read status = %d\n", pReadURB->status );
 
-      VDBG( "IntCallback: Encapsulated Response = 0x%llx\n",
-          (*(u64*)pIntURB->transfer_buffer));
+      // Resubmit the interrupt URB
+      ResubmitIntURB( pDev->mQMIDev.mpIntURB );
+
+      return;
+   }
+   DBG( "Read %d bytes\n", pReadURB->actual_length );
+
+   // Only copy the message here, it is parsed and dispatched by QMIRxWork
+   //    so the read buffer can be reused right away
+   pMsg = kmalloc( sizeof( sQMIRxMsg ) + pReadURB->actual_length, 
+                   GFP_ATOMIC );
+   if (pMsg == NULL)
+   {
+      DBG( "Error allocating read message, dropped\n" );
+
+      // Resubmit the interrupt URB
+      ResubmitIntURB( pDev->mQMIDev.mpIntURB );
+
+      return;
+   }
+
+   pMsg->mSize = pReadURB->actual_length;
+   memcpy( pMsg + 1, pReadURB->transfer_buffer, pMsg->mSize );
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mRxLock, flags );
+
+   if (pDev->mQMIDev.mRxQueueDepth >= QMI_RX_QUEUE_MAX)
+   {
+      // End critical section
+      spin_unlock_irqrestore( &pDev->mQMIDev.mRxLock, flags );
+
+      DBG( "Read queue full, message dropped\n" );
+      kfree( pMsg );
+   }
+   else
+   {
+      list_add_tail( &pMsg->mList, &pDev->mQMIDev.mRxQueue );
+      pDev->mQMIDev.mRxQueueDepth++;
+
+      // End critical section
+      spin_unlock_irqrestore( &pDev->mQMIDev.mRxLock, flags );
+
+      queue_work( pDev->mQMIDev.mpRxWorkQueue, &pDev->mQMIDev.mRxWork );
+   }
+
+   // Resubmit the interrupt URB
+   ResubmitIntURB( pDev->mQMIDev.mpIntURB );
+}
+
+/*===========================================================================
+METHOD:
+   QMIRxWork (Public Method)
+
+DESCRIPTION:
+   Dispatch every queued read message in arrival order
+      Runs on the device's ordered read workqueue, takes the whole queue
+      in one batch per pass
+
+PARAMETERS
+   pWork          [ I ] - mRxWork of the device
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRxWork( struct work_struct * pWork )
+{
+   sQMIDev * pQMIDev = container_of( pWork, sQMIDev, mRxWork );
+   sGobiUSBNet * pDev = container_of( pQMIDev, sGobiUSBNet, mQMIDev );
+   struct list_head batch;
+   sQMIRxMsg * pMsg;
+   sQMIRxMsg * pNext;
+   unsigned long flags;
+
+   for (;;)
+   {
+      INIT_LIST_HEAD( &batch );
+
+      // Critical section
+      spin_lock_irqsave( &pQMIDev->mRxLock, flags );
+
+      list_splice_init( &pQMIDev->mRxQueue, &batch );
+      pQMIDev->mRxQueueDepth = 0;
+
+      // End critical section
+      spin_unlock_irqrestore( &pQMIDev->mRxLock, flags );
+
+      if (list_empty( &batch ) != 0)
+      {
+         break;
+      }
+
+      list_for_each_entry_safe( pMsg, pNext, &batch, mList )
+      {
+         QMIRxDispatch( pDev, pMsg + 1, pMsg->mSize );
+         kfree( pMsg );
+      }
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMIRxInit (Public Method)
+
+DESCRIPTION:
+   Create the device's read queue and its ordered workqueue
+
+PARAMETERS
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   int - 0 for success
+         -ENOMEM if the workqueue could not be created
+===========================================================================*/
+int QMIRxInit( sGobiUSBNet * pDev )
+{
+   spin_lock_init( &pDev->mQMIDev.mRxLock );
+   INIT_LIST_HEAD( &pDev->mQMIDev.mRxQueue );
+   pDev->mQMIDev.mRxQueueDepth = 0;
+   INIT_WORK( &pDev->mQMIDev.mRxWork, QMIRxWork );
+
+   // One worker per device keeps messages in order
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,37 ))
+   pDev->mQMIDev.mpRxWorkQueue = alloc_ordered_workqueue( "gobi_qmi_rx", 0 );
+#else
+   pDev->mQMIDev.mpRxWorkQueue = create_singlethread_workqueue( "gobi_qmi_rx" );
+#endif
+   if (pDev->mQMIDev.mpRxWorkQueue == NULL)
+   {
+      DBG( "unable to create read workqueue\n" );
+      return -ENOMEM;
+   }
+
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   QMIRxDestroy (Public Method)
+
+DESCRIPTION:
+   Deliver what is left in the read queue and destroy its workqueue
+      Reads must already be stopped
+
+PARAMETERS
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRxDestroy( sGobiUSBNet * pDev )
+{
+   if (pDev->mQMIDev.mpRxWorkQueue == NULL)
+   {
+      return;
+   }
+
+   // destroy_workqueue drains the queue first
+   destroy_workqueue( pDev->mQMIDev.mpRxWorkQueue );
+   pDev->mQMIDev.mpRxWorkQueue = NULL;
+}
+
+/*===========================================================================
+METHOD:
+   IntCallback (Public Method)
+
+DESCRIPTION:
+   Data is available, fire off a read URB
+
+PARAMETERS
+   pIntURB       [ I ] - URB this callback is run for
+
+RETURN VALUE:
+   None
+===========================================================================*/
+#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,14 ))
+void IntCallback( struct urb * pIntURB )
+{
+#else
+void IntCallback(struct urb *pIntURB, struct pt_regs *regs)
+{
+#endif
+   int status;
+   u64 CDCEncResp;
+   u64 CDCEncRespMask;
+   u32 downlinkBps;
+   u32 uplinkBps;
+   
+   sGobiUSBNet * pDev = (sGobiUSBNet *)pIntURB->context;
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "Invalid device!\n" );
+      return;
+   }
+
+   // Verify this was a normal interrupt
+   if (pIntURB->status != 0)
+   {
+        DBG( "IntCallback: Int status = %d\n", pIntURB->status );
+      
+      // Ignore EOVERFLOW errors
+      if (pIntURB->status != -EOVERFLOW)
+      {
+         // Read 'thread' dies here
+         return;
+      }
+   }
+   else
+   {
+      //TODO cast transfer_buffer to struct usb_cdc_notification
+      
+      // CDC GET_ENCAPSULATED_RESPONSE
+      CDC_GET_ENCAPSULATED_RESPONSE(&CDCEncResp, &CDCEncRespMask)
+
+      VDBG( "IntCallback: Encapsulated Response = 0x%llx\n",
+          (*(u64*)pIntURB->transfer_buffer));
 
       if ((pIntURB->actual_length == 8)
       &&  ((*(u64*)pIntURB->transfer_buffer & CDCEncRespMask) == CDCEncResp ) )
@@ -736,9 +1414,15 @@ void IntCallback(struct urb *pIntURB, struct pt_regs *regs)
          DBG( "IntCallback: Connection Speed Change = 0x%llx\n",
               (*(u64*)pIntURB->transfer_buffer));
 
+         // DLBitRate then ULBitRate, reported as the link speed
+         downlinkBps = le32_to_cpu( *(__le32*)(pIntURB->transfer_buffer + 8) );
+         uplinkBps = le32_to_cpu( *(__le32*)(pIntURB->transfer_buffer + 12) );
+         pDev->mModemStats.mDownlinkBps = downlinkBps;
+         pDev->mModemStats.mUplinkBps = uplinkBps;
+
          // if upstream or downstream is 0, stop traffic.  Otherwise resume it
-         if ((*(u32*)(pIntURB->transfer_buffer + 8) == 0)
-         ||  (*(u32*)(pIntURB->transfer_buffer + 12) == 0))
+         if ((downlinkBps == 0)
+         ||  (uplinkBps == 0))
          {
             GobiSetDownReason( pDev, CDC_CONNECTION_SPEED );
             DBG( "traffic stopping due to CONNECTION_SPEED_CHANGE\n" );
@@ -982,7 +1666,7 @@ int ReadAsync(
    }
 
    // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
 
    // Find memory storage for this client ID
    pClientMem = FindClientMem( pDev, clientID );
@@ -992,7 +1676,7 @@ int ReadAsync(
            clientID );
            
       // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemUnlock( pDev, flags );
       return -ENXIO;
    }
    
@@ -1006,7 +1690,7 @@ int ReadAsync(
       ||  transactionID == (*ppReadMemList)->mTransactionID)
       {
          // End critical section
-         spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+         QMIClientMemUnlock( pDev, flags );
 
          // Run our own callback
          pCallback( pDev, clientID, pData );
@@ -1029,7 +1713,7 @@ int ReadAsync(
    }
 
    // End critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemUnlock( pDev, flags );
 
    // Success
    return 0;
@@ -1061,6 +1745,32 @@ void UpSem(
    return;
 }
 
+/*===========================================================================
+METHOD:
+   UpCompletion (Public Method)
+
+DESCRIPTION:
+   Notification function for synchronous read with a deadline
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   pData             [ I ] - Buffer that holds completion to be completed
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void UpCompletion(
+   sGobiUSBNet * pDev,
+   u16             clientID,
+   void *          pData )
+{
+   VDBG( "0x%04X\n", clientID );
+
+   complete( (struct completion *)pData );
+   return;
+}
+
 /*===========================================================================
 METHOD:
    ReadSync (Public Method)
@@ -1086,10 +1796,43 @@ int ReadSync(
    u16                clientID,
    u16                transactionID )
 {
-   int result;
+   return ReadSyncTimeout( pDev, ppOutBuffer, clientID, transactionID, 0 );
+}
+
+/*===========================================================================
+METHOD:
+   ReadSyncTimeout (Public Method)
+
+DESCRIPTION:
+   Start synchronous read, giving up once the deadline expires
+   NOTE: Reading client's data store, not device
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   ppOutBuffer       [I/O] - On success, will be filled with a 
+                             pointer to read buffer
+   clientID          [ I ] - Requester's client ID
+   transactionID     [ I ] - Transaction ID or 0 for any
+   timeout           [ I ] - Milliseconds to wait, 0 to wait forever
+
+RETURN VALUE:
+   int - size of data read for success
+         -ETIMEDOUT if no data arrived before the deadline
+         negative errno for failure
+===========================================================================*/
+int ReadSyncTimeout(
+   sGobiUSBNet *    pDev,
+   void **            ppOutBuffer,
+   u16                clientID,
+   u16                transactionID,
+   unsigned int       timeout )
+{
+   long waitResult;
+   long waitJiffies;
+   unsigned long deadline;
    sClientMemList * pClientMem;
    sNotifyList ** ppNotifyList, * pDelNotifyListEntry;
-   struct semaphore readSem;
+   struct completion readDone;
    void * pData;
    unsigned long flags;
    u16 dataSize;
@@ -1099,9 +1842,11 @@ int ReadSync(
       DBG( "Invalid device!\n" );
       return -ENXIO;
    }
+
+   deadline = jiffies + msecs_to_jiffies( timeout );
    
    // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
 
    // Find memory storage for this Client ID
    pClientMem = FindClientMem( pDev, clientID );
@@ -1111,7 +1856,7 @@ int ReadSync(
            clientID );
       
       // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemUnlock( pDev, flags );
       return -ENXIO;
    }
    
@@ -1124,39 +1869,61 @@ int ReadSync(
                               &dataSize ) == false)
    {
       // Data does not yet exist, wait
-      sema_init( &readSem, 0 );
+      init_completion( &readDone );
+
+      if (timeout == 0)
+      {
+         waitJiffies = MAX_SCHEDULE_TIMEOUT;
+      }
+      else if (time_before( jiffies, deadline ))
+      {
+         waitJiffies = deadline - jiffies;
+      }
+      else
+      {
+         // Deadline already passed
+         QMIClientMemUnlock( pDev, flags );
+         return -ETIMEDOUT;
+      }
 
       // Add ourself to list of waiters
       if (AddToNotifyList( pDev, 
                            clientID, 
                            transactionID, 
-                           UpSem, 
-                           &readSem ) == false)
+                           UpCompletion, 
+                           &readDone ) == false)
       {
          DBG( "unable to register for notification\n" );
-         spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+         QMIClientMemUnlock( pDev, flags );
          return -EFAULT;
       }
 
       // End critical section while we block
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemUnlock( pDev, flags );
 
       // Wait for notification
-      result = down_interruptible( &readSem );
-      if (result != 0)
+      waitResult = wait_for_completion_interruptible_timeout( &readDone,
+                                                              waitJiffies );
+      if (waitResult <= 0)
       {
-         DBG( "Interrupted %d\n", result );
+         DBG( "%s %ld\n",
+              waitResult == 0 ? "Timed out" : "Interrupted",
+              waitResult );
 
-         // readSem will fall out of scope, 
+         // readDone will fall out of scope, 
          // remove from notify list so it's not referenced
-         spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
-         ppNotifyList = &(pClientMem->mpReadNotifyList);
+         QMIClientMemLock( pDev, flags );
          pDelNotifyListEntry = NULL;
 
+         // Client may have been released while we slept
+         pClientMem = FindClientMem( pDev, clientID );
+         ppNotifyList = (pClientMem != NULL) ?
+                        &(pClientMem->mpReadNotifyList) : NULL;
+
          // Find and delete matching entry
-         while (*ppNotifyList != NULL)
+         while (ppNotifyList != NULL && *ppNotifyList != NULL)
          {
-            if ((*ppNotifyList)->mpData == &readSem)
+            if ((*ppNotifyList)->mpData == &readDone)
             {
                pDelNotifyListEntry = *ppNotifyList;
                *ppNotifyList = (*ppNotifyList)->mpNext;
@@ -1168,8 +1935,16 @@ int ReadSync(
             ppNotifyList = &(*ppNotifyList)->mpNext;
          }
 
-         spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-         return -EINTR;
+         if (pDelNotifyListEntry != NULL)
+         {
+            QMIClientMemUnlock( pDev, flags );
+            return (waitResult == 0) ? -ETIMEDOUT : -EINTR;
+         }
+
+         // Entry was already popped by a notifier which is about to
+         //    complete readDone, it must not outlive this stack frame
+         QMIClientMemUnlock( pDev, flags );
+         wait_for_completion( &readDone );
       }
       
       // Verify device is still valid
@@ -1180,11 +1955,11 @@ int ReadSync(
       }
       
       // Restart critical section and continue loop
-      spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemLock( pDev, flags );
    }
    
    // End Critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemUnlock( pDev, flags );
 
    // Success
    *ppOutBuffer = pData;
@@ -1211,6 +1986,8 @@ void WriteSyncCallback( struct urb * pWriteURB )
 void WriteSyncCallback(struct urb *pWriteURB, struct pt_regs *regs)
 #endif
 {
+   sQMIWriteSyncContext * pContext;
+
    if (pWriteURB == NULL)
    {
       DBG( "null urb\n" );
@@ -1221,8 +1998,13 @@ void WriteSyncCallback(struct urb *pWriteURB, struct pt_regs *regs)
         pWriteURB->status, 
         pWriteURB->actual_length );
 
-   // Notify that write has completed by up()-ing semeaphore
-   up( (struct semaphore * )pWriteURB->context );
+   pContext = (sQMIWriteSyncContext *)pWriteURB->context;
+
+   // Free the control endpoint slot while pContext is still valid
+   QMICtrlComplete( pContext->mpDev );
+
+   // Notify that write has completed
+   complete( &pContext->mDone );
    
    return;
 }
@@ -1250,11 +2032,42 @@ int WriteSync(
    int                    writeBufferSize,
    u16                    clientID )
 {
+   return WriteSyncTimeout( pDev,
+                            pWriteBuffer,
+                            writeBufferSize,
+                            clientID,
+                            0 );
+}
+
+/*===========================================================================
+METHOD:
+   WriteSyncTimeout (Public Method)
+
+DESCRIPTION:
+   Start synchronous write, killing the URB once the deadline expires
+      The request is copied into a pooled write URB
+
+PARAMETERS:
+   pDev                 [ I ] - Device specific memory
+   pWriteBuffer         [ I ] - Data to be written
+   writeBufferSize      [ I ] - Size of data to be written
+   clientID             [ I ] - Client ID of requester
+   timeout              [ I ] - Milliseconds to wait, 0 to wait forever
+
+RETURN VALUE:
+   int - write size (includes QMUX)
+         -ETIMEDOUT if the write did not finish before the deadline
+         negative errno for failure
+===========================================================================*/
+int WriteSyncTimeout(
+   sGobiUSBNet *          pDev,
+   char *                 pWriteBuffer,
+   int                    writeBufferSize,
+   u16                    clientID,
+   unsigned int           timeout )
+{
+   sQMICtrlURB * pCtrlURB;
    int result;
-   struct semaphore writeSem;
-   struct urb * pWriteURB;
-   sURBSetupPacket writeSetup;
-   unsigned long flags;
 
    if (IsDeviceValid( pDev ) == false)
    {
@@ -1262,49 +2075,94 @@ int WriteSync(
       return -ENXIO;
    }
 
-   pWriteURB = usb_alloc_urb( 0, GFP_KERNEL );
-   if (pWriteURB == NULL)
+   if (writeBufferSize < 0 || writeBufferSize > 0xffff)
    {
-      DBG( "URB mem error\n" );
-      return -ENOMEM;
+      return -EINVAL;
    }
 
-   // Fill writeBuffer with QMUX
-   result = FillQMUX( clientID, pWriteBuffer, writeBufferSize );
-   if (result < 0)
+   pCtrlURB = QMICtrlURBGet( pDev, writeBufferSize, GFP_KERNEL );
+   if (pCtrlURB == NULL)
    {
-      usb_free_urb( pWriteURB );
-      return result;
+      DBG( "URB mem error\n" );
+      return -ENOMEM;
    }
 
-   // CDC Send Encapsulated Request packet
-   writeSetup.mRequestType = 0x21;
-   writeSetup.mRequestCode = 0;
-   writeSetup.mValue = 0;
-   writeSetup.mIndex = cpu_to_le16(pDev->mpIntf->cur_altsetting->desc.bInterfaceNumber);
-   writeSetup.mLength = cpu_to_le16(writeBufferSize);
-
-   // Create URB   
-   usb_fill_control_urb( pWriteURB,
-                         pDev->mpNetDev->udev,
-                         usb_sndctrlpipe( pDev->mpNetDev->udev, 0 ),
-                         (unsigned char *)&writeSetup,
-                         (void*)pWriteBuffer,
-                         writeBufferSize,
-                         NULL,
-                         pDev );
+   memcpy( pCtrlURB->mpBuffer, pWriteBuffer, writeBufferSize );
 
-   DBG( "Actual Write:\n" );
-   PrintHex( pWriteBuffer, writeBufferSize );
+   result = WriteSyncURB( pDev, 
+                          pCtrlURB, 
+                          writeBufferSize, 
+                          clientID, 
+                          timeout );
 
-   sema_init( &writeSem, 0 );
-   
-   pWriteURB->complete = WriteSyncCallback;
-   pWriteURB->context = &writeSem;
+   QMICtrlURBPut( pDev, pCtrlURB );
 
-   // Wake device
-   result = usb_autopm_get_interface( pDev->mpIntf );
-   if (result < 0)
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   WriteSyncURB (Public Method)
+
+DESCRIPTION:
+   Start synchronous write of a request built in place in a pooled write
+   URB, killing the URB once the deadline expires
+      The caller keeps ownership of pCtrlURB
+
+PARAMETERS:
+   pDev                 [ I ] - Device specific memory
+   pCtrlURB             [ I ] - Write URB, request in mpBuffer
+   writeBufferSize      [ I ] - Size of request (includes QMUX)
+   clientID             [ I ] - Client ID of requester
+   timeout              [ I ] - Milliseconds to wait, 0 to wait forever
+
+RETURN VALUE:
+   int - write size (includes QMUX)
+         -ETIMEDOUT if the write did not finish before the deadline
+         negative errno for failure
+===========================================================================*/
+int WriteSyncURB(
+   sGobiUSBNet *          pDev,
+   sQMICtrlURB *          pCtrlURB,
+   u16                    writeBufferSize,
+   u16                    clientID,
+   unsigned int           timeout )
+{
+   int result;
+   long waitResult;
+   long waitJiffies;
+   sQMIWriteSyncContext writeContext;
+   struct urb * pWriteURB = pCtrlURB->mpURB;
+   unsigned long flags;
+
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "Invalid device!\n" );
+      return -ENXIO;
+   }
+
+   // Fill writeBuffer with QMUX
+   result = FillQMUX( clientID, pCtrlURB->mpBuffer, writeBufferSize );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   init_completion( &writeContext.mDone );
+   writeContext.mpDev = pDev;
+
+   QMICtrlURBFill( pDev, 
+                   pCtrlURB, 
+                   writeBufferSize, 
+                   WriteSyncCallback, 
+                   &writeContext );
+
+   trace_gobi_qmi_tx( pDev, pCtrlURB->mpBuffer, writeBufferSize );
+   QMILatencyRequest( pDev, clientID, pCtrlURB->mpBuffer, writeBufferSize );
+
+   // Wake device
+   result = usb_autopm_get_interface( pDev->mpIntf );
+   if (result < 0)
    {
       DBG( "unable to resume interface: %d\n", result );
       
@@ -1320,61 +2178,73 @@ int WriteSync(
          GobiNetSuspend( pDev->mpIntf, PMSG_SUSPEND );
 #endif /* CONFIG_PM */
       }
-      usb_free_urb( pWriteURB );
 
       return result;
    }
 
    // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
 
    if (AddToURBList( pDev, clientID, pWriteURB ) == false)
    {
-      usb_free_urb( pWriteURB );
-
       // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );   
+      QMIClientMemUnlock( pDev, flags );   
       usb_autopm_put_interface( pDev->mpIntf );
       return -EINVAL;
    }
 
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-   result = usb_submit_urb( pWriteURB, GFP_KERNEL );
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemUnlock( pDev, flags );
+   result = QMICtrlSubmit( pDev, pWriteURB, clientID, GFP_KERNEL );
+   QMIClientMemLock( pDev, flags );
 
    if (result < 0)
    {
       DBG( "submit URB error %d\n", result );
       
-      // Get URB back so we can destroy it
+      // Get URB back from the client's list
       if (PopFromURBList( pDev, clientID ) != pWriteURB)
       {
          // This shouldn't happen
          DBG( "Didn't get write URB back\n" );
       }
 
-      usb_free_urb( pWriteURB );
-
       // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemUnlock( pDev, flags );
       usb_autopm_put_interface( pDev->mpIntf );
       return result;
    }
    
    // End critical section while we block
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );   
+   QMIClientMemUnlock( pDev, flags );   
+
+   waitJiffies = (timeout == 0) ? MAX_SCHEDULE_TIMEOUT 
+                                : (long)msecs_to_jiffies( timeout );
 
    // Wait for write to finish
    if (interruptible != 0)
    {
       // Allow user interrupts
-      result = down_interruptible( &writeSem );
+      waitResult = wait_for_completion_interruptible_timeout( &writeContext.mDone,
+                                                              waitJiffies );
    }
    else
    {
       // Ignore user interrupts
+      waitResult = wait_for_completion_timeout( &writeContext.mDone, 
+                                                waitJiffies );
+   }
+
+   if (waitResult > 0)
+   {
       result = 0;
-      down( &writeSem );
+   }
+   else if (waitResult == 0)
+   {
+      result = -ETIMEDOUT;
+   }
+   else
+   {
+      result = -EINTR;
    }
 
    // Write is done, release device
@@ -1385,27 +2255,27 @@ int WriteSync(
    {
       DBG( "Invalid device!\n" );
 
-      usb_free_urb( pWriteURB );
+      QMICtrlKillURB( pDev, pWriteURB );
       return -ENXIO;
    }
 
    // Restart critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
 
-   // Get URB back so we can destroy it
+   // Get URB back from the client's list
    if (PopFromURBList( pDev, clientID ) != pWriteURB)
    {
       // This shouldn't happen
       DBG( "Didn't get write URB back\n" );
    
       // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-      usb_free_urb( pWriteURB );
+      QMIClientMemUnlock( pDev, flags );
+      QMICtrlKillURB( pDev, pWriteURB );
       return -EINVAL;
    }
 
    // End critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );   
+   QMIClientMemUnlock( pDev, flags );   
 
    if (result == 0)
    {
@@ -1426,990 +2296,6428 @@ int WriteSync(
    }
    else
    {
-      // We have been forcibly interrupted
-      DBG( "Interrupted %d !!!\n", result );
+      // We have been forcibly interrupted or ran out of time
+      DBG( "%s %d !!!\n", 
+           result == -ETIMEDOUT ? "Timed out" : "Interrupted",
+           result );
       DBG( "Device may be in bad state and need reset !!!\n" );
 
-      // URB has not finished
-      usb_kill_urb( pWriteURB );
+      // URB has not finished, this also runs the callback
+      //    before writeContext falls out of scope
+      QMICtrlKillURB( pDev, pWriteURB );
    }
 
-   usb_free_urb( pWriteURB );
-
    return result;
 }
 
 /*=========================================================================*/
-// Internal memory management functions
+// Control endpoint scheduler
 /*=========================================================================*/
 
 /*===========================================================================
 METHOD:
-   GetClientID (Public Method)
+   QMICtrlInit (Public Method)
 
 DESCRIPTION:
-   Request a QMI client for the input service type and initialize memory
-   structure
+   Set up the control endpoint scheduler
 
 PARAMETERS:
    pDev           [ I ] - Device specific memory
-   serviceType    [ I ] - Desired QMI service type
 
 RETURN VALUE:
-   int - Client ID for success (positive)
-         Negative errno for error
+   None
 ===========================================================================*/
-int GetClientID( 
-   sGobiUSBNet *      pDev,
-   u8                 serviceType )
+void QMICtrlInit( sGobiUSBNet * pDev )
 {
-   u16 clientID;
-   sClientMemList ** ppClientMem;
-   int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
-   void * pReadBuffer;
-   u16 readBufferSize;
-   unsigned long flags;
-   u8 transactionID;
-   
-   if (IsDeviceValid( pDev ) == false)
+   int i;
+
+   spin_lock_init( &pDev->mQMIDev.mCtrlLock );
+   for (i = 0; i < QMI_CTRL_CLASSES; i++)
    {
-      DBG( "Invalid device!\n" );
-      return -ENXIO;
+      INIT_LIST_HEAD( &pDev->mQMIDev.mCtrlQueue[i] );
+      pDev->mQMIDev.mCtrlLastClientID[i] = 0;
    }
+   pDev->mQMIDev.mCtrlInFlight = 0;
+   memset( pDev->mQMIDev.mCtrlStats, 0, sizeof( pDev->mQMIDev.mCtrlStats ) );
+}
 
-   // Run QMI request to be asigned a Client ID
-   if (serviceType != 0)
+/*===========================================================================
+METHOD:
+   QMICtrlClass (Public Method)
+
+DESCRIPTION:
+   Priority class of a client's control writes, lower is served first
+
+   CTL keeps the device usable, WDS carries call setup, DMS/NAS are
+   the usual polling services and everything else shares the last class
+
+PARAMETERS:
+   clientID       [ I ] - Client ID
+
+RETURN VALUE:
+   int - Class in [0, QMI_CTRL_CLASSES)
+===========================================================================*/
+int QMICtrlClass( u16 clientID )
+{
+   switch (clientID & 0xff)
    {
-      writeBufferSize = QMICTLGetClientIDReqSize();
-      pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-      if (pWriteBuffer == NULL)
-      {
-         return -ENOMEM;
-      }
+      case QMICTL:
+         return 0;
+      case QMIWDS:
+         return 1;
+      case QMIDMS:
+      case QMINAS:
+         return 2;
+      default:
+         return QMI_CTRL_CLASSES - 1;
+   }
+}
 
-      transactionID = QMIXactionIDGet( pDev );
+/*===========================================================================
+METHOD:
+   QMICtrlGiveBack (Public Method)
 
-      result = QMICTLGetClientIDReq( pWriteBuffer, 
-                                     writeBufferSize,
-                                     transactionID,
-                                     serviceType );
-      if (result < 0)
-      {
-         kfree( pWriteBuffer );
-         return result;
-      }
+DESCRIPTION:
+   Complete a write URB that never reached the bus
 
-      
-      result = WriteSync( pDev,
-                          pWriteBuffer,
-                          writeBufferSize,
-                          QMICTL );
-      kfree( pWriteBuffer );
+   The caller must already have counted it as in flight, the completion
+   callback releases that slot again
 
-      if (result < 0)
-      {
-         return result;
-      }
+PARAMETERS:
+   pURB           [ I ] - URB
+   status         [ I ] - Status reported to the completion callback
 
-      result = ReadSync( pDev,
-                         &pReadBuffer,
-                         QMICTL,
-                         transactionID );
-      if (result < 0)
-      {
-         DBG( "bad read data %d\n", result );
-         return result;
-      }
-      readBufferSize = result;
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlGiveBack(
+   struct urb *      pURB,
+   int               status )
+{
+   pURB->status = status;
+   pURB->actual_length = 0;
 
-      result = QMICTLGetClientIDResp( pReadBuffer,
-                                      readBufferSize,
-                                      &clientID );
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+   // usb_kill_anchored_urbs waits for every anchored URB to leave
+   usb_unanchor_urb( pURB );
+#endif
 
-     /* Upon return from QMICTLGetClientIDResp, clientID
-      * low address contains the Service Number (SN), and
-      * clientID high address contains Client Number (CN)
-      * For the ReadCallback to function correctly,we swap
-      * the SN and CN on a Big Endian architecture.
-      */
-      clientID = le16_to_cpu(clientID);
+#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
+   pURB->complete( pURB );
+#else
+   pURB->complete( pURB, NULL );
+#endif
+}
 
-      kfree( pReadBuffer );
+/*===========================================================================
+METHOD:
+   QMICtrlNext (Public Method)
 
-      if (result < 0)
+DESCRIPTION:
+   Pick the next queued write: highest priority class first, round robin
+   between clients inside a class, oldest request first per client
+
+   Caller must hold mCtrlLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   sQMICtrlRequest * - Unlinked request
+                       NULL if nothing is queued
+===========================================================================*/
+sQMICtrlRequest * QMICtrlNext( sGobiUSBNet * pDev )
+{
+   struct list_head * pQueue;
+   sQMICtrlRequest * pEntry;
+   sQMICtrlRequest * pNext;
+   sQMICtrlRequest * pFirst;
+   sQMICtrlStats * pStats;
+   u16 lastClientID;
+   s64 waitUs;
+   int class;
+
+   for (class = 0; class < QMI_CTRL_CLASSES; class++)
+   {
+      if (list_empty( &pDev->mQMIDev.mCtrlQueue[class] ) == 0)
       {
-         return result;
+         break;
       }
    }
-   else
+
+   if (class == QMI_CTRL_CLASSES)
    {
-      // QMI CTL will always have client ID 0
-      clientID = 0;
+      return NULL;
    }
 
-   // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   pQueue = &pDev->mQMIDev.mCtrlQueue[class];
+   lastClientID = pDev->mQMIDev.mCtrlLastClientID[class];
 
-   // Verify client is not already allocated
-   if (FindClientMem( pDev, clientID ) != NULL)
+   // Entries are in arrival order, so the first hit per client is its
+   //    oldest request
+   pNext = NULL;
+   pFirst = NULL;
+   list_for_each_entry( pEntry, pQueue, mList )
    {
-      DBG( "Client memory already exists\n" );
+      if (pFirst == NULL || pEntry->mClientID < pFirst->mClientID)
+      {
+         pFirst = pEntry;
+      }
 
-      // End Critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-      return -ETOOMANYREFS;
+      if (pEntry->mClientID > lastClientID
+      &&  (pNext == NULL || pEntry->mClientID < pNext->mClientID))
+      {
+         pNext = pEntry;
+      }
    }
 
-   // Go to last entry in client mem list
-   ppClientMem = &pDev->mQMIDev.mpClientMemList;
-   while (*ppClientMem != NULL)
+   // Wrap around to the lowest client
+   if (pNext == NULL)
    {
-      ppClientMem = &(*ppClientMem)->mpNext;
+      pNext = pFirst;
    }
-   
-   // Create locations for read to place data into
-   *ppClientMem = kmalloc( sizeof( sClientMemList ), GFP_ATOMIC );
-   if (*ppClientMem == NULL)
-   {
-      DBG( "Error allocating read list\n" );
 
-      // End critical section
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-      return -ENOMEM;
-   }
-      
-   (*ppClientMem)->mClientID = clientID;
-   (*ppClientMem)->mpList = NULL;
-   (*ppClientMem)->mpReadNotifyList = NULL;
-   (*ppClientMem)->mpURBList = NULL;
-   (*ppClientMem)->mpNext = NULL;
+   list_del( &pNext->mList );
+   pDev->mQMIDev.mCtrlLastClientID[class] = pNext->mClientID;
 
-   // Initialize workqueue for poll()
-   init_waitqueue_head( &(*ppClientMem)->mWaitQueue );
+   pStats = &pDev->mQMIDev.mCtrlStats[class];
+   pStats->mDepth--;
+   waitUs = ktime_to_us( ktime_sub( ktime_get(), pNext->mQueuedAt ) );
+   if (waitUs < 0)
+   {
+      waitUs = 0;
+   }
+   pStats->mTotalWaitUs += waitUs;
+   if (waitUs > pStats->mMaxWaitUs)
+   {
+      pStats->mMaxWaitUs = (u32)min_t( s64, waitUs, 0xffffffff );
+   }
 
-   // End Critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-   
-   return (int)( (*ppClientMem)->mClientID );
+   return pNext;
 }
 
 /*===========================================================================
 METHOD:
-   ReleaseClientID (Public Method)
+   QMICtrlDispatch (Public Method)
 
 DESCRIPTION:
-   Release QMI client and free memory
+   Submit queued writes while the in-flight cap allows
 
 PARAMETERS:
    pDev           [ I ] - Device specific memory
-   clientID       [ I ] - Requester's client ID
 
 RETURN VALUE:
    None
 ===========================================================================*/
-void ReleaseClientID(
-   sGobiUSBNet *    pDev,
-   u16                clientID )
+void QMICtrlDispatch( sGobiUSBNet * pDev )
 {
-   int result;
-   sClientMemList ** ppDelClientMem;
-   sClientMemList * pNextClientMem;
-   struct urb * pDelURB;
-   void * pDelData;
-   u16 dataSize;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
-   void * pReadBuffer;
-   u16 readBufferSize;
+   sQMICtrlRequest * pEntry;
    unsigned long flags;
-   u8 transactionID;
+   int result;
 
-   // Is device is still valid?
-   if (IsDeviceValid( pDev ) == false)
+   for (;;)
    {
-      DBG( "invalid device\n" );
-      return;
-   }
-   
-   DBG( "releasing 0x%04X\n", clientID );
+      // Critical section
+      spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
 
-   // Run QMI ReleaseClientID if this isn't QMICTL   
-   if (clientID != QMICTL)
-   {
-      // Note: all errors are non fatal, as we always want to delete 
-      //    client memory in latter part of function
-      
-      writeBufferSize = QMICTLReleaseClientIDReqSize();
-      pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-      if (pWriteBuffer == NULL)
+      pEntry = NULL;
+      if (ctrlUrbsInFlight <= 0
+      ||  pDev->mQMIDev.mCtrlInFlight < ctrlUrbsInFlight)
       {
-         DBG( "memory error\n" );
+         pEntry = QMICtrlNext( pDev );
       }
-      else
-      {
-         transactionID = QMIXactionIDGet( pDev );
 
-         result = QMICTLReleaseClientIDReq( pWriteBuffer, 
-                                            writeBufferSize,
-                                            transactionID,
-                                            clientID );
-         if (result < 0)
-         {
-            kfree( pWriteBuffer );
-            DBG( "error %d filling req buffer\n", result );
-         }
-         else
-         {
-            result = WriteSync( pDev,
-                                pWriteBuffer,
-                                writeBufferSize,
-                                QMICTL );
-            kfree( pWriteBuffer );
+      if (pEntry == NULL)
+      {
+         // End critical section
+         spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+         return;
+      }
 
-            if (result < 0)
-            {
-               DBG( "bad write status %d\n", result );
-            }
-            else
-            {
-               result = ReadSync( pDev,
-                                  &pReadBuffer,
-                                  QMICTL,
-                                  transactionID );
-               if (result < 0)
-               {
-                  DBG( "bad read status %d\n", result );
-               }
-               else
-               {
-                  readBufferSize = result;
+      pDev->mQMIDev.mCtrlInFlight++;
 
-                  result = QMICTLReleaseClientIDResp( pReadBuffer,
-                                                      readBufferSize );
-                  kfree( pReadBuffer );
+      // End critical section
+      spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
 
-                  if (result < 0)
-                  {
-                     DBG( "error %d parsing response\n", result );
-                  }
-               }
-            }
-         }
+      // May run from a completion handler
+      result = usb_submit_urb( pEntry->mpURB, GFP_ATOMIC );
+      if (result < 0)
+      {
+         DBG( "deferred submit failed %d\n", result );
+         QMICtrlGiveBack( pEntry->mpURB, result );
       }
+
+      kfree( pEntry );
    }
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlSubmit (Public Method)
+
+DESCRIPTION:
+   Submit a control endpoint write, or queue it behind the in-flight cap
+
+   A queued URB is reported through its completion callback even when it
+   is cancelled or its later submit fails
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pURB           [ I ] - Write URB
+   clientID       [ I ] - Client the write belongs to
+   memFlags       [ I ] - Allocation flags for a direct submit
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno if the direct submit failed, the callback will
+         not run in that case
+===========================================================================*/
+int QMICtrlSubmit(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB,
+   u16               clientID,
+   gfp_t             memFlags )
+{
+   sQMICtrlRequest * pEntry;
+   sQMICtrlStats * pStats;
+   unsigned long flags;
+   int class = QMICtrlClass( clientID );
+   int result;
+
+   pStats = &pDev->mQMIDev.mCtrlStats[class];
 
-   // Cleaning up client memory
-   
    // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
 
-   // Can't use FindClientMem, I need to keep pointer of previous
-   ppDelClientMem = &pDev->mQMIDev.mpClientMemList;
-   while (*ppDelClientMem != NULL)
+   pStats->mRequests++;
+
+   if (ctrlUrbsInFlight > 0
+   &&  pDev->mQMIDev.mCtrlInFlight >= ctrlUrbsInFlight)
    {
-      if ((*ppDelClientMem)->mClientID == clientID)
+      pEntry = kmalloc( sizeof( sQMICtrlRequest ), GFP_ATOMIC );
+      if (pEntry != NULL)
       {
-         pNextClientMem = (*ppDelClientMem)->mpNext;
+         pEntry->mpURB = pURB;
+         pEntry->mClientID = clientID;
+         pEntry->mQueuedAt = ktime_get();
+         list_add_tail( &pEntry->mList, &pDev->mQMIDev.mCtrlQueue[class] );
 
-         // Notify all clients
-         while (NotifyAndPopNotifyList( pDev,
-                                        clientID,
-                                        0 ) == true );         
+         pStats->mQueued++;
+         pStats->mDepth++;
 
-         // Kill and free all URB's
-         pDelURB = PopFromURBList( pDev, clientID );
-         while (pDelURB != NULL)
+         // End critical section
+         spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+         return 0;
+      }
+
+      // Going over the cap beats failing the request
+      DBG( "no memory to queue, submitting directly\n" );
+   }
+
+   pDev->mQMIDev.mCtrlInFlight++;
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+   result = usb_submit_urb( pURB, memFlags );
+   if (result < 0)
+   {
+      // Give the slot to whoever is waiting
+      QMICtrlComplete( pDev );
+   }
+
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlComplete (Public Method)
+
+DESCRIPTION:
+   Release an in-flight slot and start the next queued write
+
+   Called from every control write completion callback
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlComplete( sGobiUSBNet * pDev )
+{
+   unsigned long flags;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+   if (pDev->mQMIDev.mCtrlInFlight > 0)
+   {
+      pDev->mQMIDev.mCtrlInFlight--;
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+   QMICtrlDispatch( pDev );
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlCancel (Public Method)
+
+DESCRIPTION:
+   Take a write back out of the queue before it reaches the bus
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pURB           [ I ] - Write URB
+   status         [ I ] - Status reported to the completion callback
+
+RETURN VALUE:
+   bool - true if the URB was queued and has been given back
+          false if it was already submitted (or never queued)
+===========================================================================*/
+bool QMICtrlCancel(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB,
+   int               status )
+{
+   sQMICtrlRequest * pEntry;
+   sQMICtrlRequest * pFound = NULL;
+   unsigned long flags;
+   int class;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+   for (class = 0; class < QMI_CTRL_CLASSES && pFound == NULL; class++)
+   {
+      list_for_each_entry( pEntry, &pDev->mQMIDev.mCtrlQueue[class], mList )
+      {
+         if (pEntry->mpURB == pURB)
          {
-            usb_kill_urb( pDelURB );
-            usb_free_urb( pDelURB );
-            pDelURB = PopFromURBList( pDev, clientID );
+            list_del( &pEntry->mList );
+            pDev->mQMIDev.mCtrlStats[class].mDepth--;
+            pFound = pEntry;
+            break;
          }
+      }
+   }
 
-         // Free any unread data
-         while (PopFromReadMemList( pDev, 
-                                    clientID,
-                                    0,
-                                    &pDelData,
-                                    &dataSize ) == true )
+   if (pFound != NULL)
+   {
+      // The callback releases this slot again
+      pDev->mQMIDev.mCtrlInFlight++;
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+   if (pFound == NULL)
+   {
+      return false;
+   }
+
+   QMICtrlGiveBack( pURB, status );
+   kfree( pFound );
+
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlKillURB (Public Method)
+
+DESCRIPTION:
+   usb_kill_urb for a write that may still be queued
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pURB           [ I ] - Write URB
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlKillURB(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB )
+{
+   if (QMICtrlCancel( pDev, pURB, -ENOENT ) == false)
+   {
+      usb_kill_urb( pURB );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlUnlinkURB (Public Method)
+
+DESCRIPTION:
+   usb_unlink_urb for a write that may still be queued
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pURB           [ I ] - Write URB
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlUnlinkURB(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB )
+{
+   if (QMICtrlCancel( pDev, pURB, -ECONNRESET ) == false)
+   {
+      usb_unlink_urb( pURB );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlFlush (Public Method)
+
+DESCRIPTION:
+   Give back every queued write
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlFlush( sGobiUSBNet * pDev )
+{
+   sQMICtrlRequest * pEntry;
+   struct urb * pURB;
+   unsigned long flags;
+   int class;
+
+   for (class = 0; class < QMI_CTRL_CLASSES; class++)
+   {
+      for (;;)
+      {
+         // Critical section
+         spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+         if (list_empty( &pDev->mQMIDev.mCtrlQueue[class] ) != 0)
          {
-            kfree( pDelData );
+            // End critical section
+            spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+            break;
          }
 
-         // Delete client Mem
-         if (!waitqueue_active( &(*ppDelClientMem)->mWaitQueue))
-         kfree( *ppDelClientMem );
-         else
-            DBG("memory leak!\n");
+         pEntry = list_first_entry( &pDev->mQMIDev.mCtrlQueue[class],
+                                    sQMICtrlRequest,
+                                    mList );
+         pURB = pEntry->mpURB;
+
+         // End critical section
+         spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+         // Entry may have been dispatched meanwhile, that is fine
+         QMICtrlCancel( pDev, pURB, -ESHUTDOWN );
+      }
+   }
+}
+
+/*=========================================================================*/
+// Control URB pool
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBAlloc (Public Method)
+
+DESCRIPTION:
+   Allocate a control write URB with its setup packet and payload buffer
+
+PARAMETERS:
+   bufferSize     [ I ] - Payload buffer size (including QMUX)
+   memFlags       [ I ] - Allocation flags
+
+RETURN VALUE:
+   sQMICtrlURB * - New entry, NULL for failure
+===========================================================================*/
+sQMICtrlURB * QMICtrlURBAlloc(
+   u16               bufferSize,
+   gfp_t             memFlags )
+{
+   sQMICtrlURB * pCtrlURB;
+
+   pCtrlURB = kzalloc( sizeof( sQMICtrlURB ), memFlags );
+   if (pCtrlURB == NULL)
+   {
+      DBG( "memory error\n" );
+      return NULL;
+   }
+
+   pCtrlURB->mpURB = usb_alloc_urb( 0, memFlags );
+   pCtrlURB->mpSetupPacket = kmalloc( sizeof( sURBSetupPacket ), memFlags );
+   pCtrlURB->mpBuffer = kmalloc( bufferSize, memFlags );
+   if (pCtrlURB->mpURB == NULL
+   ||  pCtrlURB->mpSetupPacket == NULL
+   ||  pCtrlURB->mpBuffer == NULL)
+   {
+      DBG( "memory error\n" );
+      QMICtrlURBFree( pCtrlURB );
+      return NULL;
+   }
+
+   pCtrlURB->mBufferSize = bufferSize;
+
+   return pCtrlURB;
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBFree (Public Method)
+
+DESCRIPTION:
+   Free a control write URB, its setup packet and payload buffer
+
+PARAMETERS:
+   pCtrlURB       [ I ] - Entry to free
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlURBFree( sQMICtrlURB * pCtrlURB )
+{
+   usb_free_urb( pCtrlURB->mpURB );
+   kfree( pCtrlURB->mpSetupPacket );
+   kfree( pCtrlURB->mpBuffer );
+   kfree( pCtrlURB );
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBGet (Public Method)
+
+DESCRIPTION:
+   Take a control write URB whose buffer holds at least size bytes
+      Served from the pool when possible, allocated otherwise
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   size           [ I ] - Payload size needed (including QMUX)
+   memFlags       [ I ] - Allocation flags if the pool cannot serve
+
+RETURN VALUE:
+   sQMICtrlURB * - Entry, NULL for failure or above QMI_CTRL_URB_MAX_SIZE
+===========================================================================*/
+sQMICtrlURB * QMICtrlURBGet(
+   sGobiUSBNet *     pDev,
+   size_t            size,
+   gfp_t             memFlags )
+{
+   sQMICtrlURB * pCtrlURB = NULL;
+   unsigned long flags;
+
+   if (size > QMI_CTRL_URB_MAX_SIZE)
+   {
+      DBG( "control write of %zu bytes too large\n", size );
+      return NULL;
+   }
+
+   if (size > QMI_CTRL_URB_BUFFER_SIZE)
+   {
+      // Rare, such requests get a buffer of their own
+      return QMICtrlURBAlloc( size, memFlags );
+   }
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+   if (pDev->mQMIDev.mpCtrlURBPool != NULL)
+   {
+      pCtrlURB = pDev->mQMIDev.mpCtrlURBPool;
+      pDev->mQMIDev.mpCtrlURBPool = pCtrlURB->mpNext;
+      pDev->mQMIDev.mCtrlURBPoolCount--;
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+   if (pCtrlURB == NULL)
+   {
+      pCtrlURB = QMICtrlURBAlloc( QMI_CTRL_URB_BUFFER_SIZE, memFlags );
+   }
+
+   return pCtrlURB;
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBPut (Public Method)
+
+DESCRIPTION:
+   Return a control write URB once its completion callback has run
+      Goes back to the pool if there is room, is freed otherwise
+      May be called from interrupt context
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pCtrlURB       [ I ] - Entry
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlURBPut(
+   sGobiUSBNet *     pDev,
+   sQMICtrlURB *     pCtrlURB )
+{
+   unsigned long flags;
+
+   if (pCtrlURB->mBufferSize == QMI_CTRL_URB_BUFFER_SIZE)
+   {
+      // Critical section
+      spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+      if (pDev->mQMIDev.mbCtrlURBPoolClosed == false
+      &&  pDev->mQMIDev.mCtrlURBPoolCount < QMI_CTRL_URB_POOL)
+      {
+         pCtrlURB->mpNext = pDev->mQMIDev.mpCtrlURBPool;
+         pDev->mQMIDev.mpCtrlURBPool = pCtrlURB;
+         pDev->mQMIDev.mCtrlURBPoolCount++;
+         pCtrlURB = NULL;
+      }
+
+      // End critical section
+      spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+   }
+
+   if (pCtrlURB != NULL)
+   {
+      QMICtrlURBFree( pCtrlURB );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBFill (Public Method)
+
+DESCRIPTION:
+   Fill a control write URB with a CDC Send Encapsulated Command of the
+   first size bytes of its payload buffer
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   pCtrlURB       [ I ] - Entry
+   size           [ I ] - Request size (including QMUX)
+   pCallback      [ I ] - Completion callback
+   pContext       [ I ] - Completion callback context
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlURBFill(
+   sGobiUSBNet *     pDev,
+   sQMICtrlURB *     pCtrlURB,
+   u16               size,
+   usb_complete_t    pCallback,
+   void *            pContext )
+{
+   // CDC Send Encapsulated Request packet
+   pCtrlURB->mpSetupPacket->mRequestType = 0x21;
+   pCtrlURB->mpSetupPacket->mRequestCode = 0;
+   pCtrlURB->mpSetupPacket->mValue = 0;
+   pCtrlURB->mpSetupPacket->mIndex = 
+      cpu_to_le16( pDev->mpIntf->cur_altsetting->desc.bInterfaceNumber );
+   pCtrlURB->mpSetupPacket->mLength = cpu_to_le16( size );
+
+   usb_fill_control_urb( pCtrlURB->mpURB,
+                         pDev->mpNetDev->udev,
+                         usb_sndctrlpipe( pDev->mpNetDev->udev, 0 ),
+                         (unsigned char *)pCtrlURB->mpSetupPacket,
+                         pCtrlURB->mpBuffer,
+                         size,
+                         pCallback,
+                         pContext );
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBPoolInit (Public Method)
+
+DESCRIPTION:
+   Fill the device's control write URB pool
+      Not fatal if memory is short, QMICtrlURBGet allocates on demand
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlURBPoolInit( sGobiUSBNet * pDev )
+{
+   sQMICtrlURB * pCtrlURB;
+   int i;
+
+   pDev->mQMIDev.mpCtrlURBPool = NULL;
+   pDev->mQMIDev.mCtrlURBPoolCount = 0;
+   pDev->mQMIDev.mbCtrlURBPoolClosed = false;
+
+   for (i = 0; i < QMI_CTRL_URB_POOL; i++)
+   {
+      pCtrlURB = QMICtrlURBAlloc( QMI_CTRL_URB_BUFFER_SIZE, GFP_KERNEL );
+      if (pCtrlURB == NULL)
+      {
+         break;
+      }
+
+      pCtrlURB->mpNext = pDev->mQMIDev.mpCtrlURBPool;
+      pDev->mQMIDev.mpCtrlURBPool = pCtrlURB;
+      pDev->mQMIDev.mCtrlURBPoolCount++;
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlURBPoolDestroy (Public Method)
+
+DESCRIPTION:
+   Free the device's control write URB pool
+      Entries still in use are freed when they are returned
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICtrlURBPoolDestroy( sGobiUSBNet * pDev )
+{
+   sQMICtrlURB * pCtrlURB;
+   unsigned long flags;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+
+   pDev->mQMIDev.mbCtrlURBPoolClosed = true;
+   while (pDev->mQMIDev.mpCtrlURBPool != NULL)
+   {
+      pCtrlURB = pDev->mQMIDev.mpCtrlURBPool;
+      pDev->mQMIDev.mpCtrlURBPool = pCtrlURB->mpNext;
+      pDev->mQMIDev.mCtrlURBPoolCount--;
+
+      // End critical section while freeing
+      spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+      QMICtrlURBFree( pCtrlURB );
+      spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+}
+
+/*=========================================================================*/
+// Transaction latency
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMILatencyHistGet (Public Method)
+
+DESCRIPTION:
+   Find or add the histogram of a service, or of one of its messages
+   
+   Caller MUST have lock on mLatencyLock
+
+PARAMETERS:
+   pLatency       [ I ] - Device's latency statistics
+   service        [ I ] - QMI service type
+   messageID      [ I ] - Message ID
+   bMessage       [ I ] - Per message histogram instead of per service
+
+RETURN VALUE:
+   sQMILatencyHist * - Histogram, NULL when the table is full
+===========================================================================*/
+sQMILatencyHist * QMILatencyHistGet(
+   sQMILatency *     pLatency,
+   u8                service,
+   u16               messageID,
+   bool              bMessage )
+{
+   sQMILatencyHist * pTable;
+   int * pCount;
+   int max;
+   int index;
+
+   if (bMessage == true)
+   {
+      pTable = pLatency->mMessage;
+      pCount = &pLatency->mMessageCount;
+      max = QMI_LATENCY_MESSAGES;
+   }
+   else
+   {
+      pTable = pLatency->mService;
+      pCount = &pLatency->mServiceCount;
+      max = QMI_LATENCY_SERVICES;
+      messageID = 0;
+   }
+
+   for (index = 0; index < *pCount; index++)
+   {
+      if (pTable[index].mService == service
+      &&  pTable[index].mMessageID == messageID)
+      {
+         return &pTable[index];
+      }
+   }
+
+   if (*pCount >= max)
+   {
+      pLatency->mUntracked++;
+      return NULL;
+   }
+
+   pTable[*pCount].mService = service;
+   pTable[*pCount].mMessageID = messageID;
+   return &pTable[(*pCount)++];
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyTimeout (Public Method)
+
+DESCRIPTION:
+   Count a request that was never answered and free its slot
+   
+   Caller MUST have lock on mLatencyLock
+
+PARAMETERS:
+   pLatency       [ I ] - Device's latency statistics
+   pPending       [ I ] - Pending request
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyTimeout(
+   sQMILatency *          pLatency,
+   sQMILatencyPending *   pPending )
+{
+   u8 service = pPending->mClientID & 0xff;
+   sQMILatencyHist * pHist;
+
+   pHist = QMILatencyHistGet( pLatency, service, 0, false );
+   if (pHist != NULL)
+   {
+      pHist->mTimeouts++;
+   }
+
+   pHist = QMILatencyHistGet( pLatency, service, pPending->mMessageID, true );
+   if (pHist != NULL)
+   {
+      pHist->mTimeouts++;
+   }
+
+   pPending->mbUsed = false;
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyRecord (Public Method)
+
+DESCRIPTION:
+   Add one response latency to a histogram
+   
+   Caller MUST have lock on mLatencyLock
+
+PARAMETERS:
+   pHist          [ I ] - Histogram, may be NULL
+   latencyUs      [ I ] - Latency in microseconds
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyRecord(
+   sQMILatencyHist * pHist,
+   u64               latencyUs )
+{
+   if (pHist == NULL)
+   {
+      return;
+   }
+
+   pHist->mResponses++;
+   pHist->mBuckets[GobiLog2Bucket( latencyUs, QMI_LATENCY_BUCKETS )]++;
+   pHist->mTotalUs += latencyUs;
+   if (latencyUs > pHist->mMaxUs)
+   {
+      pHist->mMaxUs = (u32)min_t( u64, latencyUs, 0xffffffff );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyRequest (Public Method)
+
+DESCRIPTION:
+   Timestamp a request about to be written to the modem
+      Requests older than QMI_XACTION_TIMEOUT_MS are counted as timeouts
+      when their slot is looked at, or when the oldest one is evicted
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID of the request
+   pBuffer        [ I ] - Request, including QMUX header
+   bufferSize     [ I ] - Size of pBuffer
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyRequest(
+   sGobiUSBNet *     pDev,
+   u16               clientID,
+   void *            pBuffer,
+   u16               bufferSize )
+{
+   sQMILatency * pLatency;
+   sQMILatencyPending * pSlot = NULL;
+   sQMILatencyPending * pOldest = NULL;
+   sQMILatencyPending * pPending;
+   u8 * pSDU = (u8 *)pBuffer + sizeof( sQMUX );
+   u16 transactionID;
+   u16 messageID;
+   ktime_t now = ktime_get();
+   unsigned long flags;
+   int index;
+
+   // Transaction ID size is 1 for QMICTL, 2 for others
+   if ((clientID & 0xff) == QMICTL)
+   {
+      if (bufferSize < sizeof( sQMUX ) + 4)
+      {
+         return;
+      }
+      transactionID = pSDU[1];
+      messageID = le16_to_cpu( get_unaligned( (u16 *)(pSDU + 2) ) );
+   }
+   else
+   {
+      if (bufferSize < sizeof( sQMUX ) + 5)
+      {
+         return;
+      }
+      transactionID = le16_to_cpu( get_unaligned( (u16 *)(pSDU + 1) ) );
+      messageID = le16_to_cpu( get_unaligned( (u16 *)(pSDU + 3) ) );
+   }
+
+   spin_lock_irqsave( &pDev->mQMIDev.mLatencyLock, flags );
+
+   pLatency = pDev->mQMIDev.mpLatency;
+   if (pLatency == NULL)
+   {
+      spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+      return;
+   }
+
+   for (index = 0; index < QMI_LATENCY_PENDING; index++)
+   {
+      pPending = &pLatency->mPending[index];
+
+      if (pPending->mbUsed == true
+      &&  ktime_to_us( ktime_sub( now, pPending->mSentAt ) ) 
+             > QMI_XACTION_TIMEOUT_MS * 1000)
+      {
+         QMILatencyTimeout( pLatency, pPending );
+      }
+
+      if (pPending->mbUsed == false)
+      {
+         if (pSlot == NULL)
+         {
+            pSlot = pPending;
+         }
+      }
+      else if (pOldest == NULL 
+           ||  ktime_to_ns( pPending->mSentAt ) 
+                  < ktime_to_ns( pOldest->mSentAt ))
+      {
+         pOldest = pPending;
+      }
+   }
+
+   // Full, the oldest request is the least likely to be answered
+   if (pSlot == NULL)
+   {
+      QMILatencyTimeout( pLatency, pOldest );
+      pSlot = pOldest;
+   }
+
+   pSlot->mbUsed = true;
+   pSlot->mClientID = clientID;
+   pSlot->mTransactionID = transactionID;
+   pSlot->mMessageID = messageID;
+   pSlot->mSentAt = now;
+
+   spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyResponse (Public Method)
+
+DESCRIPTION:
+   Match a response to its request and record the latency, or count it
+   as orphaned
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID of the response
+   transactionID  [ I ] - Transaction ID of the response
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyResponse(
+   sGobiUSBNet *     pDev,
+   u16               clientID,
+   u16               transactionID )
+{
+   sQMILatency * pLatency;
+   sQMILatencyPending * pPending;
+   sQMILatencyHist * pHist;
+   u64 latencyUs;
+   unsigned long flags;
+   int index;
+
+   spin_lock_irqsave( &pDev->mQMIDev.mLatencyLock, flags );
+
+   pLatency = pDev->mQMIDev.mpLatency;
+   if (pLatency == NULL)
+   {
+      spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+      return;
+   }
+
+   for (index = 0; index < QMI_LATENCY_PENDING; index++)
+   {
+      pPending = &pLatency->mPending[index];
+      if (pPending->mbUsed == true
+      &&  pPending->mClientID == clientID
+      &&  pPending->mTransactionID == transactionID)
+      {
+         break;
+      }
+   }
+
+   if (index == QMI_LATENCY_PENDING)
+   {
+      // Late, duplicated, or the request was never seen
+      pHist = QMILatencyHistGet( pLatency, clientID & 0xff, 0, false );
+      if (pHist != NULL)
+      {
+         pHist->mOrphans++;
+      }
+
+      spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+      return;
+   }
+
+   latencyUs = ktime_to_us( ktime_sub( ktime_get(), pPending->mSentAt ) );
+   pPending->mbUsed = false;
+
+   QMILatencyRecord( QMILatencyHistGet( pLatency, 
+                                        clientID & 0xff, 
+                                        0, 
+                                        false ), 
+                     latencyUs );
+   QMILatencyRecord( QMILatencyHistGet( pLatency, 
+                                        clientID & 0xff, 
+                                        pPending->mMessageID, 
+                                        true ), 
+                     latencyUs );
+
+   spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyShowHist (Public Method)
+
+DESCRIPTION:
+   Print one histogram line
+
+PARAMETERS:
+   pSeq           [ I ] - Output
+   pHist          [ I ] - Histogram
+   bMessage       [ I ] - Per message histogram
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyShowHist(
+   struct seq_file *       pSeq,
+   const sQMILatencyHist * pHist,
+   bool                    bMessage )
+{
+   int bucket;
+
+   if (bMessage == true)
+   {
+      seq_printf( pSeq, 
+                  "message 0x%02x 0x%04x", 
+                  pHist->mService, 
+                  pHist->mMessageID );
+   }
+   else
+   {
+      seq_printf( pSeq, "service 0x%02x -", pHist->mService );
+   }
+
+   seq_printf( pSeq,
+               " %u %u %u %llu %u",
+               pHist->mResponses,
+               pHist->mTimeouts,
+               pHist->mOrphans,
+               (unsigned long long)pHist->mTotalUs,
+               pHist->mMaxUs );
+
+   for (bucket = 0; bucket < QMI_LATENCY_BUCKETS; bucket++)
+   {
+      seq_printf( pSeq, " %u", pHist->mBuckets[bucket] );
+   }
+
+   seq_putc( pSeq, '\n' );
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyShow (Public Method)
+
+DESCRIPTION:
+   Print the latency histograms, one line per service, then one line per
+   message ID.  Bucket n counts responses in [2^n, 2^(n+1)) microseconds
+
+PARAMETERS:
+   pSeq           [ I ] - Output
+   pUnused        [ I ] - Unused
+
+RETURN VALUE:
+   int - 0
+===========================================================================*/
+int QMILatencyShow(
+   struct seq_file * pSeq,
+   void *            pUnused )
+{
+   sGobiUSBNet * pDev = pSeq->private;
+   sQMILatency * pSnapshot;
+   unsigned long flags;
+   int index;
+
+   pSnapshot = kmalloc( sizeof( *pSnapshot ), GFP_KERNEL );
+   if (pSnapshot == NULL)
+   {
+      return -ENOMEM;
+   }
+
+   // Consistent snapshot, printing happens unlocked
+   spin_lock_irqsave( &pDev->mQMIDev.mLatencyLock, flags );
+   if (pDev->mQMIDev.mpLatency == NULL)
+   {
+      spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+      kfree( pSnapshot );
+      return 0;
+   }
+   memcpy( pSnapshot, pDev->mQMIDev.mpLatency, sizeof( *pSnapshot ) );
+   spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+
+   seq_printf( pSeq, 
+               "# kind service msg responses timeouts orphans "
+               "total_us max_us buckets[%d]\n",
+               QMI_LATENCY_BUCKETS );
+
+   for (index = 0; index < pSnapshot->mServiceCount; index++)
+   {
+      QMILatencyShowHist( pSeq, &pSnapshot->mService[index], false );
+   }
+
+   for (index = 0; index < pSnapshot->mMessageCount; index++)
+   {
+      QMILatencyShowHist( pSeq, &pSnapshot->mMessage[index], true );
+   }
+
+   seq_printf( pSeq, "untracked %u\n", pSnapshot->mUntracked );
+
+   kfree( pSnapshot );
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyOpen (Public Method)
+
+DESCRIPTION:
+   Open the "latency" debugfs file
+
+PARAMETERS:
+   pInode         [ I ] - Debugfs inode, i_private is the device
+   pFilp          [ I ] - File being opened
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+int QMILatencyOpen(
+   struct inode *    pInode,
+   struct file *     pFilp )
+{
+   return single_open( pFilp, QMILatencyShow, pInode->i_private );
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyResetOpen (Public Method)
+
+DESCRIPTION:
+   Open the "latency_reset" debugfs file
+
+PARAMETERS:
+   pInode         [ I ] - Debugfs inode, i_private is the device
+   pFilp          [ I ] - File being opened
+
+RETURN VALUE:
+   int - 0
+===========================================================================*/
+int QMILatencyResetOpen(
+   struct inode *    pInode,
+   struct file *     pFilp )
+{
+   pFilp->private_data = pInode->i_private;
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyResetWrite (Public Method)
+
+DESCRIPTION:
+   Clear the latency histograms, any write will do
+      Requests in flight stay pending so their responses still match
+
+PARAMETERS:
+   pFilp          [ I ] - File being written
+   pBuf           [ I ] - Written data, ignored
+   size           [ I ] - Size of pBuf
+   pPos           [I/O] - File position
+
+RETURN VALUE:
+   ssize_t - size
+===========================================================================*/
+ssize_t QMILatencyResetWrite(
+   struct file *        pFilp,
+   const char __user *  pBuf,
+   size_t               size,
+   loff_t *             pPos )
+{
+   sGobiUSBNet * pDev = pFilp->private_data;
+   sQMILatency * pLatency;
+   unsigned long flags;
+
+   spin_lock_irqsave( &pDev->mQMIDev.mLatencyLock, flags );
+   pLatency = pDev->mQMIDev.mpLatency;
+   if (pLatency != NULL)
+   {
+      memset( pLatency->mService, 0, sizeof( pLatency->mService ) );
+      memset( pLatency->mMessage, 0, sizeof( pLatency->mMessage ) );
+      pLatency->mServiceCount = 0;
+      pLatency->mMessageCount = 0;
+      pLatency->mUntracked = 0;
+   }
+   spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+
+   return size;
+}
+
+static const struct file_operations QMILatencyFops =
+{
+   .owner   = THIS_MODULE,
+   .open    = QMILatencyOpen,
+   .read    = seq_read,
+   .llseek  = seq_lseek,
+   .release = single_release,
+};
+
+static const struct file_operations QMILatencyResetFops =
+{
+   .owner   = THIS_MODULE,
+   .open    = QMILatencyResetOpen,
+   .write   = QMILatencyResetWrite,
+};
+
+/*===========================================================================
+METHOD:
+   QMILatencyInit (Public Method)
+
+DESCRIPTION:
+   Allocate the device's latency statistics
+      Not fatal, without them requests and responses are not timed
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyInit( sGobiUSBNet * pDev )
+{
+   spin_lock_init( &pDev->mQMIDev.mLatencyLock );
+   pDev->mQMIDev.mpDebugDir = NULL;
+
+   pDev->mQMIDev.mpLatency = kzalloc( sizeof( sQMILatency ), GFP_KERNEL );
+   if (pDev->mQMIDev.mpLatency == NULL)
+   {
+      DBG( "no memory for latency statistics\n" );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyDebugfsInit (Public Method)
+
+DESCRIPTION:
+   Create the device's directory <debugfs>/GobiNet/qcqmiN and publish the
+   latency statistics in it as latency, cleared by writing to latency_reset
+      The data path adds its own files once probe is done
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   qmiIndex       [ I ] - N of qcqmiN
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyDebugfsInit(
+   sGobiUSBNet *     pDev,
+   int               qmiIndex )
+{
+   char name[16];
+   struct dentry * pDir;
+
+   if (IS_ERR_OR_NULL( pDev->mQMIDev.mpDebugRoot ) == true)
+   {
+      return;
+   }
+
+   snprintf( name, sizeof( name ), "qcqmi%d", qmiIndex );
+
+   pDir = debugfs_create_dir( name, pDev->mQMIDev.mpDebugRoot );
+   if (IS_ERR_OR_NULL( pDir ) == true)
+   {
+      DBG( "unable to create debugfs directory %s\n", name );
+      return;
+   }
+
+   if (pDev->mQMIDev.mpLatency != NULL)
+   {
+      debugfs_create_file( "latency", 
+                           S_IRUGO, 
+                           pDir, 
+                           pDev, 
+                           &QMILatencyFops );
+      debugfs_create_file( "latency_reset", 
+                           S_IWUSR, 
+                           pDir, 
+                           pDev, 
+                           &QMILatencyResetFops );
+   }
+
+   pDev->mQMIDev.mpDebugDir = pDir;
+}
+
+/*===========================================================================
+METHOD:
+   QMILatencyDestroy (Public Method)
+
+DESCRIPTION:
+   Remove the debugfs files and free the latency statistics
+      Requests written after this are no longer timed
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMILatencyDestroy( sGobiUSBNet * pDev )
+{
+   sQMILatency * pLatency;
+   unsigned long flags;
+
+   // Waits for readers and writers of the files to leave
+   if (pDev->mQMIDev.mpDebugDir != NULL)
+   {
+      debugfs_remove_recursive( pDev->mQMIDev.mpDebugDir );
+      pDev->mQMIDev.mpDebugDir = NULL;
+   }
+
+   spin_lock_irqsave( &pDev->mQMIDev.mLatencyLock, flags );
+   pLatency = pDev->mQMIDev.mpLatency;
+   pDev->mQMIDev.mpLatency = NULL;
+   spin_unlock_irqrestore( &pDev->mQMIDev.mLatencyLock, flags );
+
+   kfree( pLatency );
+}
+
+/*=========================================================================*/
+// Asynchronous transaction engine
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMIXactionIDNext (Public Method)
+
+DESCRIPTION:
+   Allocate the next transaction ID for an in-driver request
+   QMICTL shares the device wide 8 bit counter, all other clients have
+   their own 16 bit counter which never yields 0
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+
+RETURN VALUE:
+   u16 - Transaction ID, 0 if the client does not exist
+===========================================================================*/
+u16 QMIXactionIDNext(
+   sGobiUSBNet *      pDev,
+   u16                clientID )
+{
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   u16 transactionID = 0;
+
+   if (clientID == QMICTL)
+   {
+      return QMIXactionIDGet( pDev );
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem != NULL)
+   {
+      transactionID = pClientMem->mNextTransactionID++;
+      if (pClientMem->mNextTransactionID == 0)
+      {
+         pClientMem->mNextTransactionID = 1;
+      }
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   return transactionID;
+}
+
+/*===========================================================================
+METHOD:
+   QMIUserTIDMap (Public Method)
+
+DESCRIPTION:
+   Send a request written by userspace with a transaction ID from the
+   client's counter, so it cannot collide with an in-driver transaction,
+   and remember the ID userspace chose for QMIUserTIDRestore
+      QMICTL requests are left alone
+      Entries are held until answered or QMI_XACTION_TIMEOUT_MS has passed,
+      a live entry is never reused
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+   pSDU           [I/O] - Request without QMUX header
+   sduSize        [ I ] - Size of pSDU
+   transactionID  [ I ] - ID from QMIXactionIDNext to send with
+
+RETURN VALUE:
+   int - 0 for success
+         -EINVAL if pSDU is too short
+         -ENXIO if the client does not exist
+         -EAGAIN if QMI_USER_TID_MAP requests are awaiting responses
+===========================================================================*/
+int QMIUserTIDMap(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize,
+   u16                transactionID )
+{
+   sClientMemList * pClientMem;
+   sQMIUserTID * pEntry = NULL;
+   unsigned long flags;
+   int result = 0;
+   int i;
+
+   if (clientID == QMICTL)
+   {
+      return 0;
+   }
+
+   // Service SDU is flags then transaction ID
+   if (sduSize < 3)
+   {
+      return -EINVAL;
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      result = -ENXIO;
+   }
+   else
+   {
+      // First free or expired entry from where the last search stopped
+      for (i = 0; i < QMI_USER_TID_MAP; i++)
+      {
+         pEntry = &pClientMem->mUserTIDs[pClientMem->mUserTIDNext];
+         pClientMem->mUserTIDNext = 
+            (pClientMem->mUserTIDNext + 1) % QMI_USER_TID_MAP;
+
+         if (pEntry->mKernelTID == 0
+         ||  time_after( jiffies, pEntry->mExpires ))
+         {
+            break;
+         }
+      }
+
+      if (i == QMI_USER_TID_MAP)
+      {
+         DBG( "0x%04X has %d requests outstanding\n",
+              clientID,
+              QMI_USER_TID_MAP );
+         result = -EAGAIN;
+      }
+      else
+      {
+         pEntry->mKernelTID = transactionID;
+         pEntry->mUserTID = le16_to_cpu( get_unaligned((u16*)(pSDU + 1)) );
+         pEntry->mExpires = 
+            jiffies + msecs_to_jiffies( QMI_XACTION_TIMEOUT_MS );
+         put_unaligned( cpu_to_le16( transactionID ), (u16*)(pSDU + 1) );
+      }
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   QMIUserTIDRestore (Public Method)
+
+DESCRIPTION:
+   Put back the transaction ID userspace chose into the response to a
+   request QMIUserTIDMap sent
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client the response is for
+   pSDU           [I/O] - Response without QMUX header
+   pTransactionID [I/O] - ID of the response, replaced when it was mapped
+
+RETURN VALUE:
+   bool - true if the response answers a userspace write
+===========================================================================*/
+bool QMIUserTIDRestore(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   u16 *              pTransactionID )
+{
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   bool bMapped = false;
+   int i;
+
+   if (clientID == QMICTL || *pTransactionID == 0)
+   {
+      return false;
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   for (i = 0; pClientMem != NULL && i < QMI_USER_TID_MAP; i++)
+   {
+      if (pClientMem->mUserTIDs[i].mKernelTID == *pTransactionID)
+      {
+         *pTransactionID = pClientMem->mUserTIDs[i].mUserTID;
+         put_unaligned( cpu_to_le16( *pTransactionID ), (u16*)(pSDU + 1) );
+         pClientMem->mUserTIDs[i].mKernelTID = 0;
+         bMapped = true;
+         break;
+      }
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   return bMapped;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionTimerCallback (Public Method)
+
+DESCRIPTION:
+   Transaction deadline expired, complete it with -ETIMEDOUT
+
+PARAMETERS:
+   pTimer / data  [ I ] - Timer embedded in the transaction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,15,0 ))
+void QMIXactionTimerCallback( struct timer_list * pTimer )
+{
+   sQMIXaction * pXaction = from_timer( pXaction, pTimer, mTimer );
+#else
+void QMIXactionTimerCallback( unsigned long data )
+{
+   sQMIXaction * pXaction = (sQMIXaction *)data;
+#endif
+
+   if (QMIXactionComplete( pXaction, -ETIMEDOUT, NULL ) == true)
+   {
+      // Service type is the low byte of the client ID
+      atomic_inc( &pXaction->mpDev->mQMIDev.mXactionTimeouts[
+                     pXaction->mClientID & 0xff] );
+      DBG( "0x%04X transaction %d timed out\n",
+           pXaction->mClientID,
+           pXaction->mTransactionID );
+   }
+
+   // Drop the timer's reference
+   QMIXactionPut( pXaction );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionAlloc (Public Method)
+
+DESCRIPTION:
+   Allocate a transaction, take a pooled write URB for its request buffer
+   and assign it the next transaction ID for this client.  The buffer is
+   not cleared.  The caller fills mpWriteBuffer with
+   mTransactionID, then submits it.  The caller owns one reference which
+   must be dropped with QMIXactionPut
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   writeBufferSize   [ I ] - Size of request (including QMUX)
+   memFlags          [ I ] - Allocation flags
+
+RETURN VALUE:
+   sQMIXaction * - New transaction, 
+                   NULL for failure or above QMI_CTRL_URB_MAX_SIZE
+===========================================================================*/
+sQMIXaction * QMIXactionAlloc(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   size_t             writeBufferSize,
+   gfp_t              memFlags )
+{
+   sQMIXaction * pXaction;
+   unsigned long flags;
+
+   if (writeBufferSize > QMI_CTRL_URB_MAX_SIZE)
+   {
+      DBG( "request of %zu bytes too large\n", writeBufferSize );
+      return NULL;
+   }
+
+   pXaction = kzalloc( sizeof( sQMIXaction ), memFlags );
+   if (pXaction == NULL)
+   {
+      DBG( "memory error\n" );
+      return NULL;
+   }
+
+   pXaction->mpCtrlURB = QMICtrlURBGet( pDev, writeBufferSize, memFlags );
+   if (pXaction->mpCtrlURB == NULL)
+   {
+      DBG( "URB mem error\n" );
+      kfree( pXaction );
+      return NULL;
+   }
+
+   pXaction->mTransactionID = QMIXactionIDNext( pDev, clientID );
+   if (pXaction->mTransactionID == 0)
+   {
+      DBG( "Could not find matching client ID 0x%04X\n", clientID );
+      QMICtrlURBPut( pDev, pXaction->mpCtrlURB );
+      kfree( pXaction );
+      return NULL;
+   }
+
+   pXaction->mpDev = pDev;
+   pXaction->mClientID = clientID;
+   pXaction->mpURB = pXaction->mpCtrlURB->mpURB;
+   pXaction->mpWriteBuffer = pXaction->mpCtrlURB->mpBuffer;
+   pXaction->mWriteBufferSize = writeBufferSize;
+   atomic_set( &pXaction->mRefCount, 1 );
+   atomic_set( &pXaction->mbDone, 0 );
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,15,0 ))
+   timer_setup( &pXaction->mTimer, QMIXactionTimerCallback, 0 );
+#else
+   setup_timer( &pXaction->mTimer, 
+                QMIXactionTimerCallback, 
+                (unsigned long)pXaction );
+#endif
+
+   spin_lock_irqsave( &pDev->mQMIDev.mXactionsLiveLock, flags );
+   pDev->mQMIDev.mXactionsLive++;
+   spin_unlock_irqrestore( &pDev->mQMIDev.mXactionsLiveLock, flags );
+
+   return pXaction;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionGet (Public Method)
+
+DESCRIPTION:
+   Take a reference on a transaction
+
+PARAMETERS:
+   pXaction       [ I ] - Transaction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIXactionGet( sQMIXaction * pXaction )
+{
+   atomic_inc( &pXaction->mRefCount );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionPut (Public Method)
+
+DESCRIPTION:
+   Drop a reference on a transaction, freeing it with the last one
+
+PARAMETERS:
+   pXaction       [ I ] - Transaction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIXactionPut( sQMIXaction * pXaction )
+{
+   sGobiUSBNet * pDev = pXaction->mpDev;
+   unsigned long flags;
+
+   if (atomic_dec_and_test( &pXaction->mRefCount ))
+   {
+      QMICtrlURBPut( pDev, pXaction->mpCtrlURB );
+      kfree( pXaction );
+
+      // Last touch of pDev, QMIXactionDrain may free it after this
+      spin_lock_irqsave( &pDev->mQMIDev.mXactionsLiveLock, flags );
+      pDev->mQMIDev.mXactionsLive--;
+      spin_unlock_irqrestore( &pDev->mQMIDev.mXactionsLiveLock, flags );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionDrain (Public Method)
+
+DESCRIPTION:
+   Wait until every transaction of this device has been freed, so no
+   deadline timer or late reference still uses the device or its URB pool
+      Times out after 30 seconds (10 ms interval), which should never
+      happen as all clients have been released and their URBs killed
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIXactionDrain( sGobiUSBNet * pDev )
+{
+   unsigned long flags;
+   int live;
+   int tries;
+
+   for (tries = 0; tries < 30 * 100; tries++)
+   {
+      spin_lock_irqsave( &pDev->mQMIDev.mXactionsLiveLock, flags );
+      live = pDev->mQMIDev.mXactionsLive;
+      spin_unlock_irqrestore( &pDev->mQMIDev.mXactionsLiveLock, flags );
+
+      if (live == 0)
+      {
+         return;
+      }
+
+      DBG( "%d transactions still live\n", live );
+      msleep( 10 );
+   }
+
+   DBG( "gave up waiting for %d transactions\n", live );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionComplete (Public Method)
+
+DESCRIPTION:
+   Complete a transaction with a response or an error
+   Only the first caller wins, later callers have their buffer freed
+   May be called from interrupt context, but not with mClientMemLock held
+
+PARAMETERS:
+   pXaction       [ I ] - Transaction
+   result         [ I ] - Response size or negative errno
+   pReadBuffer    [ I ] - Response buffer (ownership is passed), or NULL
+
+RETURN VALUE:
+   bool - true if this call completed the transaction
+===========================================================================*/
+bool QMIXactionComplete(
+   sQMIXaction *      pXaction,
+   int                result,
+   void *             pReadBuffer )
+{
+   sGobiUSBNet * pDev = pXaction->mpDev;
+   sClientMemList * pClientMem;
+   sQMIXaction ** ppXaction;
+   unsigned long flags;
+
+   if (atomic_xchg( &pXaction->mbDone, 1 ) != 0)
+   {
+      // Someone else got here first
+      kfree( pReadBuffer );
+      return false;
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   // Unlink from the client's pending list if still there
+   pClientMem = FindClientMem( pDev, pXaction->mClientID );
+   if (pClientMem != NULL)
+   {
+      ppXaction = &pClientMem->mpXactionList;
+      while (*ppXaction != NULL)
+      {
+         if (*ppXaction == pXaction)
+         {
+            *ppXaction = pXaction->mpNext;
+            break;
+         }
+         ppXaction = &(*ppXaction)->mpNext;
+      }
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   // Disarm the deadline, dropping the timer's reference if it was pending
+   if (del_timer( &pXaction->mTimer ) != 0)
+   {
+      QMIXactionPut( pXaction );
+   }
+
+   // Request may still be on the bus, or waiting for it
+   if (result < 0)
+   {
+      QMICtrlUnlinkURB( pDev, pXaction->mpURB );
+   }
+
+   pXaction->mpCallback( pDev, result, pReadBuffer, pXaction->mpCallbackData );
+
+   // Drop the pending reference
+   QMIXactionPut( pXaction );
+
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionWriteCallback (Public Method)
+
+DESCRIPTION:
+   Write callback for transaction requests
+
+PARAMETERS
+   pWriteURB       [ I ] - URB this callback is run for
+
+RETURN VALUE:
+   None
+===========================================================================*/
+#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
+void QMIXactionWriteCallback( struct urb * pWriteURB )
+#else
+void QMIXactionWriteCallback(struct urb *pWriteURB, struct pt_regs *regs)
+#endif
+{
+   sQMIXaction * pXaction = pWriteURB->context;
+
+   VDBG( "Write status/size %d/%d\n", 
+         pWriteURB->status, 
+         pWriteURB->actual_length );
+
+   QMICtrlComplete( pXaction->mpDev );
+   usb_autopm_put_interface_async( pXaction->mpDev->mpIntf );
+
+   if (pWriteURB->status != 0)
+   {
+      QMIXactionComplete( pXaction, pWriteURB->status, NULL );
+   }
+   else if (pXaction->mbWriteOnly == true)
+   {
+      QMIXactionComplete( pXaction, pXaction->mWriteBufferSize, NULL );
+   }
+
+   // Drop the URB's reference
+   QMIXactionPut( pXaction );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionSubmit (Public Method)
+
+DESCRIPTION:
+   Send a transaction without waiting for it.  pCallback runs exactly once
+   with the response or an error, possibly in interrupt context.
+   Write only transactions complete as soon as the request is written.
+   Does not sleep when memFlags is GFP_ATOMIC
+
+PARAMETERS:
+   pXaction       [ I ] - Transaction from QMIXactionAlloc
+   timeout        [ I ] - Milliseconds allowed, 0 for QMI_XACTION_TIMEOUT_MS
+   pCallback      [ I ] - Completion callback
+   pData          [ I ] - Data passed (unmodified) to callback
+   memFlags       [ I ] - Flags for URB submission
+
+RETURN VALUE:
+   int - 0 for success (callback will run)
+         negative errno for failure (callback will not run)
+===========================================================================*/
+int QMIXactionSubmit(
+   sQMIXaction *      pXaction,
+   unsigned int       timeout,
+   void               (* pCallback)(sGobiUSBNet *, int, void *, void *),
+   void *             pData,
+   gfp_t              memFlags )
+{
+   sGobiUSBNet * pDev = pXaction->mpDev;
+   sClientMemList * pClientMem;
+   sQMIXaction ** ppXaction;
+   unsigned long flags;
+   int result;
+
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "Invalid device!\n" );
+      return -ENXIO;
+   }
+
+   if (timeout == 0)
+   {
+      timeout = QMI_XACTION_TIMEOUT_MS;
+   }
+
+   // Fill writeBuffer with QMUX
+   result = FillQMUX( pXaction->mClientID, 
+                      pXaction->mpWriteBuffer, 
+                      pXaction->mWriteBufferSize );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   pXaction->mpCallback = pCallback;
+   pXaction->mpCallbackData = pData;
+
+   QMICtrlURBFill( pDev,
+                   pXaction->mpCtrlURB,
+                   pXaction->mWriteBufferSize,
+                   QMIXactionWriteCallback,
+                   pXaction );
+
+   trace_gobi_qmi_tx( pDev, 
+                      pXaction->mpWriteBuffer, 
+                      pXaction->mWriteBufferSize );
+   QMILatencyRequest( pDev,
+                      pXaction->mClientID,
+                      pXaction->mpWriteBuffer, 
+                      pXaction->mWriteBufferSize );
+
+   // Wake device without sleeping
+   result = usb_autopm_get_interface_async( pDev->mpIntf );
+   if (result < 0)
+   {
+      DBG( "unable to resume interface: %d\n", result );
+      return result;
+   }
+
+   // Pending, URB and timer references
+   atomic_add( 3, &pXaction->mRefCount );
+
+   // Arm the deadline before anyone can complete us, so completion 
+   //    always finds the timer pending or already running
+   mod_timer( &pXaction->mTimer, jiffies + msecs_to_jiffies( timeout ) );
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, pXaction->mClientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find matching client ID 0x%04X\n",
+           pXaction->mClientID );
+
+      // End critical section
+      QMIClientMemUnlock( pDev, flags );
+
+      if (atomic_xchg( &pXaction->mbDone, 1 ) != 0)
+      {
+         // Already expired, the timer ran the callback
+         atomic_dec( &pXaction->mRefCount );
+         usb_autopm_put_interface_async( pDev->mpIntf );
+         return 0;
+      }
+      if (del_timer( &pXaction->mTimer ) != 0)
+      {
+         atomic_dec( &pXaction->mRefCount );
+      }
+      atomic_sub( 2, &pXaction->mRefCount );
+      usb_autopm_put_interface_async( pDev->mpIntf );
+      return -ENXIO;
+   }
+
+   // Add to end of pending list, responses are matched before the
+   //    regular read list sees them
+   //    Write only transactions leave responses to the read list
+   //    An already expired deadline has unlinked what it could, don't
+   //    leave a completed transaction behind on the list
+   pXaction->mpNext = NULL;
+   if (pXaction->mbWriteOnly == false
+   &&  atomic_read( &pXaction->mbDone ) == 0)
+   {
+      ppXaction = &pClientMem->mpXactionList;
+      while (*ppXaction != NULL)
+      {
+         ppXaction = &(*ppXaction)->mpNext;
+      }
+      *ppXaction = pXaction;
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+   usb_anchor_urb( pXaction->mpURB, &pDev->mQMIDev.mXactionAnchor );
+#endif
+   result = QMICtrlSubmit( pDev, 
+                           pXaction->mpURB, 
+                           pXaction->mClientID, 
+                           memFlags );
+   if (result < 0)
+   {
+      DBG( "submit URB error %d\n", result );
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+      usb_unanchor_urb( pXaction->mpURB );
+#endif
+
+      // Nobody may complete us anymore, the URB never started
+      if (atomic_xchg( &pXaction->mbDone, 1 ) != 0)
+      {
+         // A stale response with our ID or the deadline already 
+         //    completed us, and took care of the timer
+         atomic_dec( &pXaction->mRefCount );
+         usb_autopm_put_interface_async( pDev->mpIntf );
+         return 0;
+      }
+      if (del_timer( &pXaction->mTimer ) != 0)
+      {
+         atomic_dec( &pXaction->mRefCount );
+      }
+      QMIClientMemLock( pDev, flags );
+      ppXaction = &pClientMem->mpXactionList;
+      while (*ppXaction != NULL)
+      {
+         if (*ppXaction == pXaction)
+         {
+            *ppXaction = pXaction->mpNext;
+            break;
+         }
+         ppXaction = &(*ppXaction)->mpNext;
+      }
+      QMIClientMemUnlock( pDev, flags );
+
+      atomic_sub( 2, &pXaction->mRefCount );
+      usb_autopm_put_interface_async( pDev->mpIntf );
+      return result;
+   }
+
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionCancel (Public Method)
+
+DESCRIPTION:
+   Cancel a submitted transaction, its callback runs with -ECANCELED
+   unless it already completed.  Caller must hold a reference
+
+PARAMETERS:
+   pXaction       [ I ] - Transaction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIXactionCancel( sQMIXaction * pXaction )
+{
+   QMIXactionComplete( pXaction, -ECANCELED, NULL );
+}
+
+/*===========================================================================
+METHOD:
+   PopFromXactionList (Public Method)
+
+DESCRIPTION:
+   Remove a pending transaction from this client's list and take a
+   reference on it
+
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   transactionID     [ I ] - Transaction ID or 0 for any
+
+RETURN VALUE:
+   sQMIXaction * - Matching transaction, NULL if none
+===========================================================================*/
+sQMIXaction * PopFromXactionList(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID )
+{
+   sClientMemList * pClientMem;
+   sQMIXaction ** ppXaction;
+   sQMIXaction * pXaction;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      return NULL;
+   }
+
+   ppXaction = &pClientMem->mpXactionList;
+   while (*ppXaction != NULL)
+   {
+      if (transactionID == 0 
+      ||  transactionID == (*ppXaction)->mTransactionID)
+      {
+         pXaction = *ppXaction;
+         *ppXaction = pXaction->mpNext;
+         QMIXactionGet( pXaction );
+         return pXaction;
+      }
+      ppXaction = &(*ppXaction)->mpNext;
+   }
+
+   return NULL;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionSyncCallback (Public Method)
+
+DESCRIPTION:
+   Completion callback used by QMIXactionSync
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   result         [ I ] - Response size or negative errno
+   pReadBuffer    [ I ] - Response buffer
+   pData          [ I ] - The transaction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIXactionSyncCallback(
+   sGobiUSBNet *      pDev,
+   int                result,
+   void *             pReadBuffer,
+   void *             pData )
+{
+   sQMIXaction * pXaction = (sQMIXaction *)pData;
+
+   pXaction->mSyncResult = result;
+   pXaction->mpSyncReadBuffer = pReadBuffer;
+   complete( &pXaction->mSyncDone );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionStart (Public Method)
+
+DESCRIPTION:
+   Submit a transaction whose result will be collected by QMIXactionWait
+   Several transactions may be started before waiting on any of them
+
+PARAMETERS:
+   pXaction             [ I ] - Filled transaction from QMIXactionAlloc
+   timeout              [ I ] - Milliseconds allowed for the transaction,
+                                0 for QMI_XACTION_TIMEOUT_MS
+
+RETURN VALUE:
+   int - 0 for success
+         negative errno for failure
+===========================================================================*/
+int QMIXactionStart(
+   sQMIXaction *          pXaction,
+   unsigned int           timeout )
+{
+   init_completion( &pXaction->mSyncDone );
+
+   return QMIXactionSubmit( pXaction,
+                            timeout,
+                            QMIXactionSyncCallback,
+                            pXaction,
+                            GFP_KERNEL );
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionWait (Public Method)
+
+DESCRIPTION:
+   Wait for a transaction started with QMIXactionStart.  It is cancelled
+   if the wait is interrupted.
+
+PARAMETERS:
+   pXaction             [ I ] - Started transaction
+   ppReadBuffer         [ O ] - On success, response buffer (caller frees)
+
+RETURN VALUE:
+   int - size of response for success
+         -ETIMEDOUT if the deadline expired
+         negative errno for failure
+===========================================================================*/
+int QMIXactionWait(
+   sQMIXaction *          pXaction,
+   void **                ppReadBuffer )
+{
+   int result;
+   bool bInterrupted = false;
+
+   if (interruptible != 0)
+   {
+      if (wait_for_completion_interruptible( &pXaction->mSyncDone ) != 0)
+      {
+         DBG( "Interrupted\n" );
+         bInterrupted = true;
+         QMIXactionCancel( pXaction );
+         wait_for_completion( &pXaction->mSyncDone );
+      }
+   }
+   else
+   {
+      wait_for_completion( &pXaction->mSyncDone );
+   }
+
+   result = pXaction->mSyncResult;
+   if (result < 0)
+   {
+      kfree( pXaction->mpSyncReadBuffer );
+      return (bInterrupted == true && result == -ECANCELED) ? -EINTR : result;
+   }
+
+   *ppReadBuffer = pXaction->mpSyncReadBuffer;
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionSync (Public Method)
+
+DESCRIPTION:
+   Run a complete QMI transaction on the asynchronous engine and wait for
+   the response carrying the same transaction ID.  The write URB and the
+   pending entry are cancelled on expiry or interruption.
+
+PARAMETERS:
+   pXaction             [ I ] - Filled transaction from QMIXactionAlloc
+   ppReadBuffer         [ O ] - On success, response buffer (caller frees)
+   timeout              [ I ] - Milliseconds allowed for the transaction,
+                                0 for QMI_XACTION_TIMEOUT_MS
+
+RETURN VALUE:
+   int - size of response for success
+         -ETIMEDOUT if the deadline expired
+         negative errno for failure
+===========================================================================*/
+int QMIXactionSync(
+   sQMIXaction *          pXaction,
+   void **                ppReadBuffer,
+   unsigned int           timeout )
+{
+   int result;
+
+   result = QMIXactionStart( pXaction, timeout );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   return QMIXactionWait( pXaction, ppReadBuffer );
+}
+
+/*=========================================================================*/
+// Internal memory management functions
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   GetClientID (Public Method)
+
+DESCRIPTION:
+   Request a QMI client for the input service type and initialize memory
+   structure
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   serviceType    [ I ] - Desired QMI service type
+
+RETURN VALUE:
+   int - Client ID for success (positive)
+         Negative errno for error
+===========================================================================*/
+int GetClientID( 
+   sGobiUSBNet *      pDev,
+   u8                 serviceType )
+{
+   u16 clientID;
+   int result;
+   sQMIXaction * pXaction;
+   void * pReadBuffer;
+   u16 readBufferSize;
+   
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "Invalid device!\n" );
+      return -ENXIO;
+   }
+
+   // Run QMI request to be asigned a Client ID
+   if (serviceType != 0)
+   {
+      pXaction = QMIXactionAlloc( pDev,
+                                  QMICTL,
+                                  QMICTLGetClientIDReqSize(),
+                                  GFP_KERNEL );
+      if (pXaction == NULL)
+      {
+         return -ENOMEM;
+      }
+
+      result = QMICTLGetClientIDReq( pXaction->mpWriteBuffer, 
+                                     pXaction->mWriteBufferSize,
+                                     pXaction->mTransactionID,
+                                     serviceType );
+      if (result < 0)
+      {
+         QMIXactionPut( pXaction );
+         return result;
+      }
+
+      result = QMIXactionSync( pXaction,
+                               &pReadBuffer,
+                               QMI_XACTION_TIMEOUT_MS );
+      QMIXactionPut( pXaction );
+
+      if (result < 0)
+      {
+         DBG( "bad read data %d\n", result );
+         return result;
+      }
+      readBufferSize = result;
+
+      result = QMICTLGetClientIDResp( pReadBuffer,
+                                      readBufferSize,
+                                      &clientID );
+
+     /* Upon return from QMICTLGetClientIDResp, clientID
+      * low address contains the Service Number (SN), and
+      * clientID high address contains Client Number (CN)
+      * For the ReadCallback to function correctly,we swap
+      * the SN and CN on a Big Endian architecture.
+      */
+      clientID = le16_to_cpu(clientID);
+
+      kfree( pReadBuffer );
+
+      if (result < 0)
+      {
+         return result;
+      }
+   }
+   else
+   {
+      // QMI CTL will always have client ID 0
+      clientID = 0;
+   }
+
+   return CreateClientMem( pDev, clientID );
+}
+
+/*===========================================================================
+METHOD:
+   CreateClientMem (Public Method)
+
+DESCRIPTION:
+   Initialize the memory structure of a client, appended to the client
+   memory list
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID assigned by the device
+
+RETURN VALUE:
+   int - Client ID for success (positive)
+         Negative errno for error
+===========================================================================*/
+int CreateClientMem(
+   sGobiUSBNet *      pDev,
+   u16                clientID )
+{
+   sClientMemList ** ppClientMem;
+   unsigned long flags;
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   // Verify client is not already allocated
+   if (FindClientMem( pDev, clientID ) != NULL)
+   {
+      DBG( "Client memory already exists\n" );
+
+      // End Critical section
+      QMIClientMemUnlock( pDev, flags );
+      return -ETOOMANYREFS;
+   }
+
+   // Go to last entry in client mem list
+   ppClientMem = &pDev->mQMIDev.mpClientMemList;
+   while (*ppClientMem != NULL)
+   {
+      ppClientMem = &(*ppClientMem)->mpNext;
+   }
+   
+   // Create locations for read to place data into
+   *ppClientMem = kmalloc( sizeof( sClientMemList ), GFP_ATOMIC );
+   if (*ppClientMem == NULL)
+   {
+      DBG( "Error allocating read list\n" );
+
+      // End critical section
+      QMIClientMemUnlock( pDev, flags );
+      return -ENOMEM;
+   }
+      
+   (*ppClientMem)->mClientID = clientID;
+   (*ppClientMem)->mpList = NULL;
+   (*ppClientMem)->mpReadNotifyList = NULL;
+   (*ppClientMem)->mpURBList = NULL;
+   (*ppClientMem)->mpXactionList = NULL;
+   (*ppClientMem)->mNextTransactionID = 1;
+   memset( (*ppClientMem)->mUserTIDs, 0, sizeof( (*ppClientMem)->mUserTIDs ) );
+   (*ppClientMem)->mUserTIDNext = 0;
+   (*ppClientMem)->mbPooled = false;
+   (*ppClientMem)->mpRing = NULL;
+   (*ppClientMem)->mpOwnerWaitQueue = NULL;
+   (*ppClientMem)->mpIndicationFilter = NULL;
+   (*ppClientMem)->mIndicationFilterCount = 0;
+   (*ppClientMem)->mReadCount = 0;
+   (*ppClientMem)->mReadBytes = 0;
+   (*ppClientMem)->mReadDropped = 0;
+   (*ppClientMem)->mReadExpired = 0;
+   (*ppClientMem)->mpNext = NULL;
+
+   // Initialize workqueue for poll()
+   init_waitqueue_head( &(*ppClientMem)->mWaitQueue );
+
+   // End Critical section
+   QMIClientMemUnlock( pDev, flags );
+   
+   return (int)( (*ppClientMem)->mClientID );
+}
+
+/*===========================================================================
+METHOD:
+   ReleaseClientID (Public Method)
+
+DESCRIPTION:
+   Release QMI client and free memory
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void ReleaseClientID(
+   sGobiUSBNet *    pDev,
+   u16                clientID )
+{
+   int result;
+   sClientMemList ** ppDelClientMem;
+   sClientMemList * pNextClientMem;
+   struct urb * pDelURB;
+   void * pDelData;
+   u16 dataSize;
+   void * pReadBuffer;
+   u16 readBufferSize;
+   unsigned long flags;
+   sQMIXaction * pXaction;
+   sQMIRing * pRing = NULL;
+
+   // Is device is still valid?
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "invalid device\n" );
+      return;
+   }
+   
+   DBG( "releasing 0x%04X\n", clientID );
+
+   // Run QMI ReleaseClientID if this isn't QMICTL   
+   if (clientID != QMICTL)
+   {
+      // Note: all errors are non fatal, as we always want to delete 
+      //    client memory in latter part of function
+      
+      pXaction = QMIXactionAlloc( pDev,
+                                  QMICTL,
+                                  QMICTLReleaseClientIDReqSize(),
+                                  GFP_KERNEL );
+      if (pXaction == NULL)
+      {
+         DBG( "memory error\n" );
+      }
+      else
+      {
+         result = QMICTLReleaseClientIDReq( pXaction->mpWriteBuffer, 
+                                            pXaction->mWriteBufferSize,
+                                            pXaction->mTransactionID,
+                                            clientID );
+         if (result < 0)
+         {
+            QMIXactionPut( pXaction );
+            DBG( "error %d filling req buffer\n", result );
+         }
+         else
+         {
+            result = QMIXactionSync( pXaction,
+                                     &pReadBuffer,
+                                     QMI_XACTION_TIMEOUT_MS );
+            QMIXactionPut( pXaction );
+
+            if (result < 0)
+            {
+               DBG( "bad transaction status %d\n", result );
+            }
+            else
+            {
+               readBufferSize = result;
+
+               result = QMICTLReleaseClientIDResp( pReadBuffer,
+                                                   readBufferSize );
+               kfree( pReadBuffer );
+
+               if (result < 0)
+               {
+                  DBG( "error %d parsing response\n", result );
+               }
+            }
+         }
+      }
+   }
+
+   // Fail any in-driver transactions still waiting on this client
+   for (;;)
+   {
+      QMIClientMemLock( pDev, flags );
+      pXaction = PopFromXactionList( pDev, clientID, 0 );
+      QMIClientMemUnlock( pDev, flags );
+
+      if (pXaction == NULL)
+      {
+         break;
+      }
+
+      QMIXactionComplete( pXaction, -ENXIO, NULL );
+      QMIXactionPut( pXaction );
+   }
+
+   // Cleaning up client memory
+   
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   // Can't use FindClientMem, I need to keep pointer of previous
+   ppDelClientMem = &pDev->mQMIDev.mpClientMemList;
+   while (*ppDelClientMem != NULL)
+   {
+      if ((*ppDelClientMem)->mClientID == clientID)
+      {
+         pNextClientMem = (*ppDelClientMem)->mpNext;
+
+         // Notify all clients
+         while (NotifyAndPopNotifyList( pDev,
+                                        clientID,
+                                        0 ) == true );         
+
+         // Cancel all URB's, they are pooled and still owned by the
+         //    writers sleeping in WriteSyncURB
+         pDelURB = PopFromURBList( pDev, clientID );
+         while (pDelURB != NULL)
+         {
+            QMICtrlUnlinkURB( pDev, pDelURB );
+            pDelURB = PopFromURBList( pDev, clientID );
+         }
+
+         // Free any unread data
+         while (PopFromReadMemList( pDev, 
+                                    clientID,
+                                    0,
+                                    &pDelData,
+                                    &dataSize ) == true )
+         {
+            kfree( pDelData );
+         }
+
+         // Ring memory can only be freed outside the lock
+         pRing = (*ppDelClientMem)->mpRing;
+
+         kfree( (*ppDelClientMem)->mpIndicationFilter );
+
+         // Delete client Mem
+         if (!waitqueue_active( &(*ppDelClientMem)->mWaitQueue))
+         kfree( *ppDelClientMem );
+         else
+            DBG("memory leak!\n");
+
+         // Overwrite the pointer that was to this client mem
+         *ppDelClientMem = pNextClientMem;
+      }
+      else
+      {
+         // I now point to (a pointer of ((the node I was at)'s mpNext))
+         ppDelClientMem = &(*ppDelClientMem)->mpNext;
+      }
+   }
+   
+   // End Critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   if (pRing != NULL)
+   {
+      QMIRingPut( pRing );
+   }
+
+   return;
+}
+
+#ifdef QMI_CLIENT_MEM_STATS
+
+/*===========================================================================
+METHOD:
+   QMIClientMemLocked (Public Method)
+
+DESCRIPTION:
+   Account the time spent waiting for mClientMemLock and start timing
+   this hold
+
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   lockStart      [ I ] - When the caller started waiting for the lock
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIClientMemLocked(
+   sGobiUSBNet *      pDev,
+   ktime_t            lockStart )
+{
+   sQMIClientMemStats * pStats = &pDev->mQMIDev.mClientMemStats;
+   ktime_t now = ktime_get();
+   u64 waitNs = ktime_to_ns( ktime_sub( now, lockStart ) );
+
+   pStats->mAcquired++;
+   pStats->mTotalWaitNs += waitNs;
+   if (waitNs > pStats->mMaxWaitNs)
+   {
+      pStats->mMaxWaitNs = waitNs;
+   }
+
+   pStats->mLockedAt = now;
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientMemUnlocking (Public Method)
+
+DESCRIPTION:
+   Account how long mClientMemLock was held by the current holder
+
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIClientMemUnlocking( sGobiUSBNet * pDev )
+{
+   sQMIClientMemStats * pStats = &pDev->mQMIDev.mClientMemStats;
+   u64 holdNs = ktime_to_ns( ktime_sub( ktime_get(), pStats->mLockedAt ) );
+
+   pStats->mTotalHoldNs += holdNs;
+   if (holdNs > pStats->mMaxHoldNs)
+   {
+      pStats->mMaxHoldNs = holdNs;
+   }
+}
+
+#endif
+
+/*===========================================================================
+METHOD:
+   FindClientMem (Public Method)
+
+DESCRIPTION:
+   Find this client's memory
+
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+
+RETURN VALUE:
+   sClientMemList - Pointer to requested sClientMemList for success
+                    NULL for error
+===========================================================================*/
+sClientMemList * FindClientMem( 
+   sGobiUSBNet *      pDev,
+   u16              clientID )
+{
+   sClientMemList * pClientMem;
+   
+   if (IsDeviceValid( pDev ) == false)
+   {
+      DBG( "Invalid device\n" );
+      return NULL;
+   }
+   
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_FIND_CLIENT );
+   
+   pClientMem = pDev->mQMIDev.mpClientMemList;
+   while (pClientMem != NULL)
+   {
+      if (pClientMem->mClientID == clientID)
+      {
+         // Success
+         VDBG("Found client's 0x%x memory\n", clientID);
+         return pClientMem;
+      }
+      
+      pClientMem = pClientMem->mpNext;
+   }
+
+   DBG( "Could not find client mem 0x%04X\n", clientID );
+   return NULL;
+}
+
+/*===========================================================================
+METHOD:
+   AddToReadMemList (Public Method)
+
+DESCRIPTION:
+   Add Data to this client's ReadMem list
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+   transactionID  [ I ] - Transaction ID or 0 for any
+   pData          [ I ] - Data to add
+   dataSize       [ I ] - Size of data to add
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool AddToReadMemList( 
+   sGobiUSBNet *      pDev,
+   u16              clientID,
+   u16              transactionID,
+   void *           pData,
+   u16              dataSize )
+{
+   sReadMemList * pEntry;
+
+   pEntry = kmalloc( sizeof( sReadMemList ), GFP_ATOMIC );
+   if (pEntry == NULL)
+   {
+      DBG( "Mem error\n" );
+
+      return false;
+   }
+
+   pEntry->mpData = pData;
+   pEntry->mDataSize = dataSize;
+   pEntry->mTransactionID = transactionID;
+
+   if (AddEntryToReadMemList( pDev, clientID, pEntry ) == false)
+   {
+      kfree( pEntry );
+      return false;
+   }
+
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   AddEntryToReadMemList (Public Method)
+
+DESCRIPTION:
+   Add an allocated entry to this client's ReadMem list
+      Lets callers allocate outside the lock
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+   pEntry         [ I ] - Entry with mpData, mDataSize and mTransactionID
+                          set, owned by the list on success
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool AddEntryToReadMemList( 
+   sGobiUSBNet *      pDev,
+   u16              clientID,
+   sReadMemList *   pEntry )
+{
+   sClientMemList * pClientMem;
+   sReadMemList ** ppThisReadMemList;
+   u16 dataSize = pEntry->mDataSize;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_ADD_READ );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n",
+           clientID );
+
+      return false;
+   }
+
+   // Reclaim what no in-driver reader claimed in time
+   ExpireReadMemList( pClientMem );
+
+   // Make room under the read queue limits
+   while (ReadMemListFull( pClientMem, dataSize ) == true)
+   {
+      if (readQueueDropOldest == 0 || pClientMem->mpList == NULL)
+      {
+         DBG( "Read queue of 0x%04X full, dropping newest\n", clientID );
+         pClientMem->mReadDropped++;
+         return false;
+      }
+
+      DBG( "Read queue of 0x%04X full, dropping oldest\n", clientID );
+      DropFromReadMemList( pClientMem, &pClientMem->mpList );
+      pClientMem->mReadDropped++;
+   }
+
+   // Go to last ReadMemList entry
+   ppThisReadMemList = &pClientMem->mpList;
+   while (*ppThisReadMemList != NULL)
+   {
+      ppThisReadMemList = &(*ppThisReadMemList)->mpNext;
+   }
+   
+   pEntry->mpNext = NULL;
+   pEntry->mTimestamp = jiffies;
+   *ppThisReadMemList = pEntry;
+
+   pClientMem->mReadCount++;
+   pClientMem->mReadBytes += dataSize;
+   
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   ReadMemListFull (Public Method)
+
+DESCRIPTION:
+   Check whether another entry would exceed this client's read queue
+   limits, readQueueDepth and readQueueBytes
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pClientMem     [ I ] - Client memory
+   dataSize       [ I ] - Size of the entry to add
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool ReadMemListFull(
+   sClientMemList *  pClientMem,
+   u16               dataSize )
+{
+   if (readQueueDepth > 0 
+   &&  pClientMem->mReadCount >= readQueueDepth)
+   {
+      return true;
+   }
+
+   if (readQueueBytes > 0 
+   &&  pClientMem->mReadBytes + dataSize > readQueueBytes)
+   {
+      return true;
+   }
+
+   return false;
+}
+
+/*===========================================================================
+METHOD:
+   DropFromReadMemList (Public Method)
+
+DESCRIPTION:
+   Unlink and free one entry of this client's ReadMem list
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pClientMem     [ I ] - Client memory
+   ppReadMemList  [I/O] - Pointer to the entry, updated to the next one
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void DropFromReadMemList(
+   sClientMemList *  pClientMem,
+   sReadMemList **   ppReadMemList )
+{
+   sReadMemList * pDelReadMemList = *ppReadMemList;
+
+   *ppReadMemList = pDelReadMemList->mpNext;
+
+   pClientMem->mReadCount--;
+   pClientMem->mReadBytes -= pDelReadMemList->mDataSize;
+
+   kfree( pDelReadMemList->mpData );
+   kfree( pDelReadMemList );
+}
+
+/*===========================================================================
+METHOD:
+   ExpireReadMemList (Public Method)
+
+DESCRIPTION:
+   Free entries older than orphanResponseTTL from an in-driver client
+      In-driver readers are notified as data arrives, so anything left
+      this long is a response or indication nobody waits for.
+      Clients owned by a file handle are only bound by the queue limits
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pClientMem     [ I ] - Client memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void ExpireReadMemList( sClientMemList * pClientMem )
+{
+   sReadMemList ** ppReadMemList = &pClientMem->mpList;
+   unsigned long ttl;
+
+   if (orphanResponseTTL <= 0 || pClientMem->mpOwnerWaitQueue != NULL)
+   {
+      return;
+   }
+
+   ttl = msecs_to_jiffies( orphanResponseTTL );
+
+   while (*ppReadMemList != NULL)
+   {
+      if (time_after( jiffies, (*ppReadMemList)->mTimestamp + ttl ))
+      {
+         DBG( "expiring 0x%04X data TID = %x\n", 
+              pClientMem->mClientID,
+              (*ppReadMemList)->mTransactionID );
+         DropFromReadMemList( pClientMem, ppReadMemList );
+         pClientMem->mReadExpired++;
+      }
+      else
+      {
+         ppReadMemList = &(*ppReadMemList)->mpNext;
+      }
+   }
+}
+
+/*===========================================================================
+METHOD:
+   PopFromReadMemList (Public Method)
+
+DESCRIPTION:
+   Remove data from this client's ReadMem list if it matches 
+   the specified transaction ID.
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   transactionID     [ I ] - Transaction ID or 0 for any
+   ppData            [I/O] - On success, will be filled with a 
+                             pointer to read buffer
+   pDataSize         [I/O] - On succces, will be filled with the 
+                             read buffer's size
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool PopFromReadMemList( 
+   sGobiUSBNet *      pDev,
+   u16                  clientID,
+   u16                  transactionID,
+   void **              ppData,
+   u16 *                pDataSize )
+{
+   sClientMemList * pClientMem;
+   sReadMemList * pDelReadMemList, ** ppReadMemList;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_POP_READ );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n",
+           clientID );
+
+      return false;
+   }
+   
+   ppReadMemList = &(pClientMem->mpList);
+   pDelReadMemList = NULL;
+   
+   // Find first message that matches this transaction ID
+   while (*ppReadMemList != NULL)
+   {
+      // Do we care about transaction ID?
+      if (transactionID == 0
+      ||  transactionID == (*ppReadMemList)->mTransactionID )
+      {
+         pDelReadMemList = *ppReadMemList;
+         VDBG(  "*ppReadMemList = 0x%p pDelReadMemList = 0x%p\n",
+               *ppReadMemList, pDelReadMemList );
+         break;
+      }
+      
+      VDBG( "skipping 0x%04X data TID = %x\n", clientID, (*ppReadMemList)->mTransactionID );
+      
+      // Next
+      ppReadMemList = &(*ppReadMemList)->mpNext;
+   }
+   VDBG(  "*ppReadMemList = 0x%p pDelReadMemList = 0x%p\n",
+         *ppReadMemList, pDelReadMemList );
+   if (pDelReadMemList != NULL)
+   {
+      *ppReadMemList = (*ppReadMemList)->mpNext;
+
+      pClientMem->mReadCount--;
+      pClientMem->mReadBytes -= pDelReadMemList->mDataSize;
+      
+      // Copy to output
+      *ppData = pDelReadMemList->mpData;
+      *pDataSize = pDelReadMemList->mDataSize;
+      VDBG(  "*ppData = 0x%p pDataSize = %u\n",
+            *ppData, *pDataSize );
+      
+      // Free memory
+      kfree( pDelReadMemList );
+      
+      return true;
+   }
+   else
+   {
+      DBG( "No read memory to pop, Client 0x%04X, TID = %x\n", 
+           clientID, 
+           transactionID );
+      return false;
+   }
+}
+
+/*===========================================================================
+METHOD:
+   PeekReadMemListSize (Public Method)
+
+DESCRIPTION:
+   Size of the oldest message in this client's ReadMem list, left queued
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+
+RETURN VALUE:
+   u16 - Message size, 0 if nothing is queued
+===========================================================================*/
+u16 PeekReadMemListSize(
+   sGobiUSBNet *      pDev,
+   u16                  clientID )
+{
+   sClientMemList * pClientMem;
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL || pClientMem->mpList == NULL)
+   {
+      return 0;
+   }
+
+   return pClientMem->mpList->mDataSize;
+}
+
+/*===========================================================================
+METHOD:
+   AddToNotifyList (Public Method)
+
+DESCRIPTION:
+   Add Notify entry to this client's notify List
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   transactionID     [ I ] - Transaction ID or 0 for any
+   pNotifyFunct      [ I ] - Callback function to be run when data is available
+   pData             [ I ] - Data buffer that willl be passed (unmodified) 
+                             to callback
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool AddToNotifyList( 
+   sGobiUSBNet *      pDev,
+   u16                  clientID,
+   u16                  transactionID,
+   void                 (* pNotifyFunct)(sGobiUSBNet *, u16, void *),
+   void *               pData )
+{
+   sClientMemList * pClientMem;
+   sNotifyList ** ppThisNotifyList;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_ADD_NOTIFY );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n", clientID );
+      return false;
+   }
+
+   // Go to last URBList entry
+   ppThisNotifyList = &pClientMem->mpReadNotifyList;
+   while (*ppThisNotifyList != NULL)
+   {
+      ppThisNotifyList = &(*ppThisNotifyList)->mpNext;
+   }
+   
+   *ppThisNotifyList = kmalloc( sizeof( sNotifyList ), GFP_ATOMIC );
+   if (*ppThisNotifyList == NULL)
+   {
+      DBG( "Mem error\n" );
+      return false;
+   }   
+   
+   (*ppThisNotifyList)->mpNext = NULL;
+   (*ppThisNotifyList)->mpNotifyFunct = pNotifyFunct;
+   (*ppThisNotifyList)->mpData = pData;
+   (*ppThisNotifyList)->mTransactionID = transactionID;
+   
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   NotifyAndPopNotifyList (Public Method)
+
+DESCRIPTION:
+   Remove first Notify entry from this client's notify list 
+   and Run function
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   transactionID     [ I ] - Transaction ID or 0 for any
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool NotifyAndPopNotifyList( 
+   sGobiUSBNet *        pDev,
+   u16                  clientID,
+   u16                  transactionID )
+{
+   sClientMemList * pClientMem;
+   sNotifyList * pDelNotifyList, ** ppNotifyList;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_NOTIFY_POP );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n", clientID );
+      return false;
+   }
+
+   ppNotifyList = &(pClientMem->mpReadNotifyList);
+   pDelNotifyList = NULL;
+
+   // Remove from list
+   while (*ppNotifyList != NULL)
+   {
+      // Do we care about transaction ID?
+      if (transactionID == 0
+      ||  (*ppNotifyList)->mTransactionID == 0
+      ||  transactionID == (*ppNotifyList)->mTransactionID)
+      {
+         pDelNotifyList = *ppNotifyList;
+         break;
+      }
+      
+      DBG( "skipping data TID = %x\n", (*ppNotifyList)->mTransactionID );
+      
+      // next
+      ppNotifyList = &(*ppNotifyList)->mpNext;
+   }
+   
+   if (pDelNotifyList != NULL)
+   {
+      // Remove element
+      *ppNotifyList = (*ppNotifyList)->mpNext;
+      
+      // Run notification function
+      if (pDelNotifyList->mpNotifyFunct != NULL)
+      {
+         trace_gobi_qmi_notify( pDev, 
+                                clientID, 
+                                pDelNotifyList->mTransactionID );
+
+         // Unlock for callback
+         QMIClientMemUnlockNoIRQ( pDev );
+      
+         pDelNotifyList->mpNotifyFunct( pDev,
+                                        clientID,
+                                        pDelNotifyList->mpData );
+
+         // Restore lock
+         QMIClientMemLockNoIRQ( pDev );
+      }
+      
+      // Delete memory
+      kfree( pDelNotifyList );
+
+      return true;
+   }
+   else
+   {
+      DBG( "no one to notify for TID %x\n", transactionID );
+      
+      return false;
+   }
+}
+
+/*===========================================================================
+METHOD:
+   AddToURBList (Public Method)
+
+DESCRIPTION:
+   Add URB to this client's URB list
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev              [ I ] - Device specific memory
+   clientID          [ I ] - Requester's client ID
+   pURB              [ I ] - URB to be added
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool AddToURBList( 
+   sGobiUSBNet *      pDev,
+   u16                  clientID,
+   struct urb *     pURB )
+{
+   sClientMemList * pClientMem;
+   sURBList ** ppThisURBList;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_ADD_URB );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n", clientID );
+      return false;
+   }
+
+   // Go to last URBList entry
+   ppThisURBList = &pClientMem->mpURBList;
+   while (*ppThisURBList != NULL)
+   {
+      ppThisURBList = &(*ppThisURBList)->mpNext;
+   }
+   
+   *ppThisURBList = kmalloc( sizeof( sURBList ), GFP_ATOMIC );
+   if (*ppThisURBList == NULL)
+   {
+      DBG( "Mem error\n" );
+      return false;
+   }   
+   
+   (*ppThisURBList)->mpNext = NULL;
+   (*ppThisURBList)->mpURB = pURB;
+   
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   PopFromURBList (Public Method)
+
+DESCRIPTION:
+   Remove URB from this client's URB list
+   
+   Caller MUST have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+
+RETURN VALUE:
+   struct urb - Pointer to requested client's URB
+                NULL for error
+===========================================================================*/
+struct urb * PopFromURBList( 
+   sGobiUSBNet *      pDev,
+   u16                  clientID )
+{
+   sClientMemList * pClientMem;
+   sURBList * pDelURBList;
+   struct urb * pURB;
+
+#ifdef CONFIG_SMP
+   // Verify Lock
+   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   {
+      DBG( "unlocked\n" );
+      BUG();
+   }
+#endif
+
+   QMIClientMemOp( pDev, QMI_MEM_OP_POP_URB );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem == NULL)
+   {
+      DBG( "Could not find this client's memory 0x%04X\n", clientID );
+      return NULL;
+   }
+
+   // Remove from list
+   if (pClientMem->mpURBList != NULL)
+   {
+      pDelURBList = pClientMem->mpURBList;
+      pClientMem->mpURBList = pClientMem->mpURBList->mpNext;
+      
+      // Copy to output
+      pURB = pDelURBList->mpURB;
+      
+      // Delete memory
+      kfree( pDelURBList );
+
+      return pURB;
+   }
+   else
+   {
+      DBG( "No URB's to pop\n" );
+      
+      return NULL;
+   }
+}
+
+#ifndef f_dentry
+#define f_dentry f_path.dentry
+#endif
+
+/*=========================================================================*/
+// Client ID pool
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolSize (Public Method)
+
+DESCRIPTION:
+   Number of idle clients to keep per pooled service
+
+RETURN VALUE:
+   int - clientPoolSize clamped to 0..QMI_CLIENT_POOL_MAX
+===========================================================================*/
+int QMIClientPoolSize( void )
+{
+   if (clientPoolSize <= 0)
+   {
+      return 0;
+   }
+
+   return min_t( int, clientPoolSize, QMI_CLIENT_POOL_MAX );
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolService (Public Method)
+
+DESCRIPTION:
+   Is this service type served from the client pool?
+
+PARAMETERS:
+   serviceType    [ I ] - QMI service type
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool QMIClientPoolService( u8 serviceType )
+{
+   int i;
+
+   for (i = 0; i < ARRAY_SIZE( gClientPoolServices ); i++)
+   {
+      if (gClientPoolServices[i] == serviceType)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolCount (Public Method)
+
+DESCRIPTION:
+   Count idle pooled clients of a service
+   
+   Caller must have lock on mClientMemLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   serviceType    [ I ] - QMI service type
+
+RETURN VALUE:
+   int - Number of idle clients
+===========================================================================*/
+int QMIClientPoolCount(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType )
+{
+   sClientMemList * pClientMem;
+   int count = 0;
+
+   pClientMem = pDev->mQMIDev.mpClientMemList;
+   while (pClientMem != NULL)
+   {
+      if (pClientMem->mbPooled == true
+      &&  (pClientMem->mClientID & 0xff) == serviceType)
+      {
+         count++;
+      }
+
+      pClientMem = pClientMem->mpNext;
+   }
+
+   return count;
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolGet (Public Method)
+
+DESCRIPTION:
+   Take an idle client of a service from the pool and schedule a refill
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   serviceType    [ I ] - QMI service type
+
+RETURN VALUE:
+   int - Client ID for success (positive)
+         -ENOENT if no pooled client is available
+===========================================================================*/
+int QMIClientPoolGet(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType )
+{
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   int result = -ENOENT;
+
+   if (QMIClientPoolSize() == 0 
+   ||  QMIClientPoolService( serviceType ) == false)
+   {
+      return -ENOENT;
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = pDev->mQMIDev.mpClientMemList;
+   while (pClientMem != NULL)
+   {
+      if (pClientMem->mbPooled == true
+      &&  (pClientMem->mClientID & 0xff) == serviceType)
+      {
+         pClientMem->mbPooled = false;
+         result = pClientMem->mClientID;
+         break;
+      }
+
+      pClientMem = pClientMem->mpNext;
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   if (pDev->mbDeregisterQMIDevice == false)
+   {
+      schedule_work( &pDev->mQMIDev.mClientPoolWork );
+   }
+
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolPut (Public Method)
+
+DESCRIPTION:
+   Reset a client no longer used by userspace and return it to the pool
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID being closed
+
+RETURN VALUE:
+   bool - true if the client was pooled
+          false if the caller should release it
+===========================================================================*/
+bool QMIClientPoolPut(
+   sGobiUSBNet *      pDev,
+   u16                clientID )
+{
+   sClientMemList * pClientMem;
+   sQMIXaction * pXaction;
+   void * pReadBuffer;
+   void * pDelData;
+   u16 dataSize;
+   unsigned long flags;
+   int result;
+   u8 serviceType = clientID & 0xff;
+
+   if (QMIClientPoolSize() == 0 
+   ||  QMIClientPoolService( serviceType ) == false
+   ||  pDev->mbDeregisterQMIDevice == true)
+   {
+      return false;
+   }
+
+   QMIClientMemLock( pDev, flags );
+   result = QMIClientPoolCount( pDev, serviceType );
+   QMIClientMemUnlock( pDev, flags );
+
+   if (result >= QMIClientPoolSize())
+   {
+      return false;
+   }
+
+   // Reset so the next owner starts from a clean client
+   pXaction = QMIXactionAlloc( pDev,
+                               clientID,
+                               QMIServiceResetReqSize(),
+                               GFP_KERNEL );
+   if (pXaction == NULL)
+   {
+      return false;
+   }
+
+   result = QMIServiceResetReq( pXaction->mpWriteBuffer,
+                                pXaction->mWriteBufferSize,
+                                pXaction->mTransactionID );
+   if (result < 0)
+   {
+      QMIXactionPut( pXaction );
+      return false;
+   }
+
+   result = QMIXactionSync( pXaction,
+                            &pReadBuffer,
+                            QMI_XACTION_TIMEOUT_MS );
+   QMIXactionPut( pXaction );
+
+   if (result < 0)
+   {
+      DBG( "reset of 0x%04X failed %d\n", clientID, result );
+      return false;
+   }
+
+   result = QMIServiceResetResp( pReadBuffer, result );
+   kfree( pReadBuffer );
+
+   if (result < 0)
+   {
+      DBG( "bad reset response for 0x%04X %d\n", clientID, result );
+      return false;
+   }
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem != NULL)
+   {
+      // Drop whatever the last owner left unread
+      while (PopFromReadMemList( pDev, 
+                                 clientID,
+                                 0,
+                                 &pDelData,
+                                 &dataSize ) == true)
+      {
+         kfree( pDelData );
+      }
+
+      while (NotifyAndPopNotifyList( pDev, clientID, 0 ) == true);
+
+      // The next owner sets its own filter
+      kfree( pClientMem->mpIndicationFilter );
+      pClientMem->mpIndicationFilter = NULL;
+      pClientMem->mIndicationFilterCount = 0;
+      pClientMem->mReadDropped = 0;
+      pClientMem->mReadExpired = 0;
+
+      // Late responses to the last owner's writes are not restored
+      memset( pClientMem->mUserTIDs, 0, sizeof( pClientMem->mUserTIDs ) );
+      pClientMem->mUserTIDNext = 0;
+
+      pClientMem->mbPooled = true;
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   DBG( "pooled 0x%04X\n", clientID );
+   return true;
+}
+
+/*===========================================================================
+METHOD:
+   QMIClientPoolWork (Public Method)
+
+DESCRIPTION:
+   Allocate clients until every pooled service has clientPoolSize idle
+
+PARAMETERS:
+   pWork          [ I ] - mClientPoolWork of the device
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIClientPoolWork( struct work_struct * pWork )
+{
+   sQMIDev * pQMIDev = container_of( pWork, sQMIDev, mClientPoolWork );
+   sGobiUSBNet * pDev = container_of( pQMIDev, sGobiUSBNet, mQMIDev );
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   int count;
+   int result;
+   int i;
+
+   for (i = 0; i < ARRAY_SIZE( gClientPoolServices ); i++)
+   {
+      for (;;)
+      {
+         if (IsDeviceValid( pDev ) == false
+         ||  pDev->mbDeregisterQMIDevice == true)
+         {
+            return;
+         }
+
+         QMIClientMemLock( pDev, flags );
+         count = QMIClientPoolCount( pDev, gClientPoolServices[i] );
+         QMIClientMemUnlock( pDev, flags );
+
+         if (count >= QMIClientPoolSize())
+         {
+            break;
+         }
+
+         result = GetClientID( pDev, gClientPoolServices[i] );
+         if (result < 0)
+         {
+            // Modem is out of clients for this service, try the next
+            DBG( "unable to pool service %d client %d\n",
+                 gClientPoolServices[i],
+                 result );
+            break;
+         }
+
+         QMIClientMemLock( pDev, flags );
+         pClientMem = FindClientMem( pDev, (u16)result );
+         if (pClientMem != NULL)
+         {
+            pClientMem->mbPooled = true;
+         }
+         QMIClientMemUnlock( pDev, flags );
+      }
+   }
+}
+
+/*=========================================================================*/
+// Response cache
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMICachePolicyFind (Public Method)
+
+DESCRIPTION:
+   Look up a query in gCachePolicies
+
+PARAMETERS:
+   serviceType    [ I ] - QMI service type
+   msgID          [ I ] - QMI message ID
+
+RETURN VALUE:
+   const sQMICachePolicy * - Policy, NULL if the query is not cacheable
+===========================================================================*/
+const sQMICachePolicy * QMICachePolicyFind(
+   u8                 serviceType,
+   u16                msgID )
+{
+   int i;
+
+   for (i = 0; i < ARRAY_SIZE( gCachePolicies ); i++)
+   {
+      if (gCachePolicies[i].mServiceType == serviceType
+      &&  gCachePolicies[i].mMsgID == msgID)
+      {
+         return &gCachePolicies[i];
+      }
+   }
+
+   return NULL;
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheRemove (Public Method)
+
+DESCRIPTION:
+   Unlink and free a response cache entry
+
+   Caller must have lock on mCacheLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   ppEntry        [I/O] - Pointer to the entry, updated to the next one
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICacheRemove(
+   sGobiUSBNet *      pDev,
+   sQMICacheEntry **  ppEntry )
+{
+   sQMICacheEntry * pDelEntry = *ppEntry;
+
+   *ppEntry = pDelEntry->mpNext;
+   pDev->mQMIDev.mCacheCount--;
+
+   // Request TLVs share the entry's allocation
+   kfree( pDelEntry->mpResponse );
+   kfree( pDelEntry );
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheExpire (Public Method)
+
+DESCRIPTION:
+   Drop answers older than their policy allows, and entries whose
+   first request was never answered
+
+   Caller must have lock on mCacheLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICacheExpire( sGobiUSBNet * pDev )
+{
+   sQMICacheEntry ** ppEntry = &pDev->mQMIDev.mpCacheList;
+   u32 maxAgeMs;
+
+   while (*ppEntry != NULL)
+   {
+      if ((*ppEntry)->mpResponse == NULL)
+      {
+         maxAgeMs = QMI_XACTION_TIMEOUT_MS;
+      }
+      else
+      {
+         maxAgeMs = (*ppEntry)->mpPolicy->mMaxAgeMs;
+      }
+
+      if (maxAgeMs != 0
+      &&  time_after( jiffies, 
+                      (*ppEntry)->mTimestamp + msecs_to_jiffies( maxAgeMs ) ))
+      {
+         QMICacheRemove( pDev, ppEntry );
+      }
+      else
+      {
+         ppEntry = &(*ppEntry)->mpNext;
+      }
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheAnswer (Public Method)
+
+DESCRIPTION:
+   Answer a userspace request from the response cache
+      On a hit the cached response, carrying the request's transaction
+      ID, is queued for the client as if the modem had sent it.
+      On a miss for a cacheable query the request is remembered, so
+      ReadCallback can store the modem's response
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+   pSDU           [ I ] - Request without QMUX header
+   sduSize        [ I ] - Size of pSDU
+
+RETURN VALUE:
+   bool - true if the request was answered and must not be sent
+===========================================================================*/
+bool QMICacheAnswer(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize )
+{
+   const sQMICachePolicy * pPolicy;
+   sQMICacheEntry * pEntry;
+   sQMICacheEntry ** ppLast;
+   void * pAnswer = NULL;
+   u16 answerSize = 0;
+   u16 requestSize;
+   u16 transactionID;
+   unsigned long flags;
+
+   // Service SDU is flags, transaction ID, message ID and length
+   if (responseCache == 0 
+   ||  sduSize < 7 
+   ||  sduSize > DEFAULT_READ_URB_LENGTH)
+   {
+      return false;
+   }
+
+   pPolicy = QMICachePolicyFind( clientID & 0xff,
+                                 le16_to_cpu( get_unaligned((u16*)(pSDU + 3)) ) );
+   if (pPolicy == NULL)
+   {
+      return false;
+   }
+
+   transactionID = le16_to_cpu( get_unaligned((u16*)(pSDU + 1)) );
+   requestSize = sduSize - 7;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   QMICacheExpire( pDev );
+
+   for (pEntry = pDev->mQMIDev.mpCacheList; 
+        pEntry != NULL; 
+        pEntry = pEntry->mpNext)
+   {
+      if (pEntry->mpPolicy == pPolicy
+      &&  pEntry->mRequestSize == requestSize
+      &&  memcmp( pEntry->mpRequest, pSDU + 7, requestSize ) == 0)
+      {
+         break;
+      }
+   }
+
+   if (pEntry == NULL)
+   {
+      // Make room by dropping the oldest entry
+      if (pDev->mQMIDev.mCacheCount >= QMI_CACHE_MAX_ENTRIES)
+      {
+         ppLast = &pDev->mQMIDev.mpCacheList;
+         while ((*ppLast)->mpNext != NULL)
+         {
+            ppLast = &(*ppLast)->mpNext;
+         }
+         QMICacheRemove( pDev, ppLast );
+      }
+
+      // Remember the request, its response fills the entry
+      pEntry = kmalloc( sizeof( sQMICacheEntry ) + requestSize, GFP_ATOMIC );
+      if (pEntry != NULL)
+      {
+         pEntry->mpPolicy = pPolicy;
+         pEntry->mpRequest = pEntry + 1;
+         pEntry->mRequestSize = requestSize;
+         memcpy( pEntry->mpRequest, pSDU + 7, requestSize );
+         pEntry->mpResponse = NULL;
+         pEntry->mResponseSize = 0;
+         pEntry->mClientID = clientID;
+         pEntry->mTransactionID = transactionID;
+         pEntry->mTimestamp = jiffies;
+         pEntry->mpNext = pDev->mQMIDev.mpCacheList;
+         pDev->mQMIDev.mpCacheList = pEntry;
+         pDev->mQMIDev.mCacheCount++;
+      }
+   }
+   else if (pEntry->mpResponse != NULL)
+   {
+      answerSize = QMUXHeaderSize() + pEntry->mResponseSize;
+      pAnswer = kmalloc( answerSize, GFP_ATOMIC );
+      if (pAnswer != NULL)
+      {
+         memcpy( pAnswer + QMUXHeaderSize(), 
+                 pEntry->mpResponse, 
+                 pEntry->mResponseSize );
+      }
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+
+   if (pAnswer == NULL)
+   {
+      return false;
+   }
+
+   // The answer carries this request's transaction ID
+   FillQMUX( clientID, pAnswer, answerSize );
+   put_unaligned( cpu_to_le16( transactionID ), 
+                  (u16*)(pAnswer + QMUXHeaderSize() + 1) );
+
+   VDBG( "cached answer for 0x%04X, TID %x\n", clientID, transactionID );
+   return QMICacheDeliver( pDev, clientID, transactionID, pAnswer, answerSize );
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheDeliver (Public Method)
+
+DESCRIPTION:
+   Queue a cached response for a client, as ReadCallback does for data
+   from the device
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client to deliver to
+   transactionID  [ I ] - Transaction ID of the response
+   pData          [ I ] - Response including QMUX header, freed here
+   dataSize       [ I ] - Size of pData
+
+RETURN VALUE:
+   bool - true if the response was queued
+===========================================================================*/
+bool QMICacheDeliver(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pData,
+   u16                dataSize )
+{
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   bool bDelivered = false;
+   int result;
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem != NULL && pClientMem->mpRing != NULL)
+   {
+      result = QMIRingWrite( pClientMem->mpRing, clientID, pData, dataSize );
+      if (result == 1)
+      {
+         wake_up_interruptible_sync( QMIClientWaitQueue( pClientMem ) );
+      }
+      bDelivered = (result >= 0);
+   }
+   else if (pClientMem != NULL
+        &&  AddToReadMemList( pDev,
+                              clientID,
+                              transactionID,
+                              pData,
+                              dataSize ) == true)
+   {
+      // The read list owns pData now
+      pData = NULL;
+
+      NotifyAndPopNotifyList( pDev, clientID, transactionID );
+      wake_up_interruptible_sync( QMIClientWaitQueue( pClientMem ) );
+      bDelivered = true;
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   kfree( pData );
+   return bDelivered;
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheFill (Public Method)
+
+DESCRIPTION:
+   Store a response to a request QMICacheAnswer could not answer
+      Only successful responses are kept
+   May be called in interrupt context
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client the response is for
+   transactionID  [ I ] - Transaction ID of the response
+   pSDU           [ I ] - Response without QMUX header
+   sduSize        [ I ] - Size of pSDU
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICacheFill(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pSDU,
+   u16                sduSize )
+{
+   sQMICacheEntry ** ppEntry;
+   unsigned long flags;
+
+   // Nothing cached or waiting, the common case
+   if (pDev->mQMIDev.mpCacheList == NULL)
+   {
+      return;
+   }
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   for (ppEntry = &pDev->mQMIDev.mpCacheList;
+        *ppEntry != NULL;
+        ppEntry = &(*ppEntry)->mpNext)
+   {
+      if ((*ppEntry)->mpResponse == NULL
+      &&  (*ppEntry)->mClientID == clientID
+      &&  (*ppEntry)->mTransactionID == transactionID)
+      {
+         break;
+      }
+   }
+
+   if (*ppEntry != NULL)
+   {
+      // Skip flags and transaction ID to reach the message
+      if (sduSize > 3 && ValidQMIMessage( pSDU + 3, sduSize - 3 ) == 0)
+      {
+         (*ppEntry)->mpResponse = kmalloc( sduSize, GFP_ATOMIC );
+      }
+
+      if ((*ppEntry)->mpResponse != NULL)
+      {
+         memcpy( (*ppEntry)->mpResponse, pSDU, sduSize );
+         (*ppEntry)->mResponseSize = sduSize;
+         (*ppEntry)->mTimestamp = jiffies;
+      }
+      else
+      {
+         QMICacheRemove( pDev, ppEntry );
+      }
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheInvalidate (Public Method)
+
+DESCRIPTION:
+   Drop cached answers an indication makes stale, including requests
+   still waiting for their response
+   May be called in interrupt context
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   serviceType    [ I ] - Service type of the indication
+   msgID          [ I ] - Message ID of the indication
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICacheInvalidate(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType,
+   u16                msgID )
+{
+   sQMICacheEntry ** ppEntry;
+   unsigned long flags;
+
+   if (pDev->mQMIDev.mpCacheList == NULL)
+   {
+      return;
+   }
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   ppEntry = &pDev->mQMIDev.mpCacheList;
+   while (*ppEntry != NULL)
+   {
+      if ((*ppEntry)->mpPolicy->mServiceType == serviceType
+      &&  (*ppEntry)->mpPolicy->mInvalidateMsgID == msgID
+      &&  msgID != 0)
+      {
+         DBG( "invalidating service %d message 0x%04X\n",
+              serviceType,
+              (*ppEntry)->mpPolicy->mMsgID );
+         QMICacheRemove( pDev, ppEntry );
+      }
+      else
+      {
+         ppEntry = &(*ppEntry)->mpNext;
+      }
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   QMICacheFlush (Public Method)
+
+DESCRIPTION:
+   Drop every response cache entry
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMICacheFlush( sGobiUSBNet * pDev )
+{
+   unsigned long flags;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   while (pDev->mQMIDev.mpCacheList != NULL)
+   {
+      QMICacheRemove( pDev, &pDev->mQMIDev.mpCacheList );
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+}
+
+/*=========================================================================*/
+// Request de-duplication
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMIDedupAllowed (Public Method)
+
+DESCRIPTION:
+   Whether identical copies of a request may share one response
+      Only read-only queries, from gDedupQueries and gCachePolicies
+
+PARAMETERS:
+   serviceType    [ I ] - QMI service type
+   msgID          [ I ] - QMI message ID
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool QMIDedupAllowed(
+   u8                 serviceType,
+   u16                msgID )
+{
+   int i;
+
+   for (i = 0; i < ARRAY_SIZE( gDedupQueries ); i++)
+   {
+      if (gDedupQueries[i].mServiceType == serviceType
+      &&  gDedupQueries[i].mMsgID == msgID)
+      {
+         return true;
+      }
+   }
+
+   return (QMICachePolicyFind( serviceType, msgID ) != NULL);
+}
+
+/*===========================================================================
+METHOD:
+   QMIDedupRemove (Public Method)
+
+DESCRIPTION:
+   Unlink a de-duplication entry
+
+   Caller must have lock on mCacheLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   ppEntry        [I/O] - Pointer to the entry, updated to the next one
+
+RETURN VALUE:
+   sQMIDedupEntry * - The unlinked entry, caller frees it
+===========================================================================*/
+sQMIDedupEntry * QMIDedupRemove(
+   sGobiUSBNet *      pDev,
+   sQMIDedupEntry **  ppEntry )
+{
+   sQMIDedupEntry * pDelEntry = *ppEntry;
+
+   *ppEntry = pDelEntry->mpNext;
+   pDev->mQMIDev.mDedupCount--;
+
+   return pDelEntry;
+}
+
+/*===========================================================================
+METHOD:
+   QMIDedupExpire (Public Method)
+
+DESCRIPTION:
+   Drop requests the modem did not answer in QMI_XACTION_TIMEOUT_MS
+      Their followers get no response, as if their own request was lost
+
+   Caller must have lock on mCacheLock
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIDedupExpire( sGobiUSBNet * pDev )
+{
+   sQMIDedupEntry ** ppEntry = &pDev->mQMIDev.mpDedupList;
+   unsigned long timeout = msecs_to_jiffies( QMI_XACTION_TIMEOUT_MS );
+
+   while (*ppEntry != NULL)
+   {
+      if (time_after( jiffies, (*ppEntry)->mTimestamp + timeout ))
+      {
+         DBG( "0x%04X TID %x unanswered, dropping %d followers\n",
+              (*ppEntry)->mClientID,
+              (*ppEntry)->mTransactionID,
+              (*ppEntry)->mFollowerCount );
+         kfree( QMIDedupRemove( pDev, ppEntry ) );
+      }
+      else
+      {
+         ppEntry = &(*ppEntry)->mpNext;
+      }
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMIDedupJoin (Public Method)
+
+DESCRIPTION:
+   Attach a userspace request to an identical one already in flight
+      If there is none, the request is tracked so later identical
+      requests can join it once it is sent
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Requester's client ID
+   pSDU           [ I ] - Request without QMUX header
+   sduSize        [ I ] - Size of pSDU
+
+RETURN VALUE:
+   bool - true if the request joined one in flight and must not be sent
+===========================================================================*/
+bool QMIDedupJoin(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize )
+{
+   sQMIDedupEntry * pEntry;
+   u16 requestSize;
+   u16 transactionID;
+   u16 msgID;
+   unsigned long flags;
+   bool bJoined = false;
+
+   // Service SDU is flags, transaction ID, message ID and length
+   if (sduSize < 7 || sduSize > DEFAULT_READ_URB_LENGTH)
+   {
+      return false;
+   }
+
+   msgID = le16_to_cpu( get_unaligned((u16*)(pSDU + 3)) );
+   if (QMIDedupAllowed( clientID & 0xff, msgID ) == false)
+   {
+      return false;
+   }
+
+   transactionID = le16_to_cpu( get_unaligned((u16*)(pSDU + 1)) );
+   requestSize = sduSize - 7;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   QMIDedupExpire( pDev );
+
+   for (pEntry = pDev->mQMIDev.mpDedupList;
+        pEntry != NULL;
+        pEntry = pEntry->mpNext)
+   {
+      if (pEntry->mKey.mServiceType == (clientID & 0xff)
+      &&  pEntry->mKey.mMsgID == msgID
+      &&  pEntry->mRequestSize == requestSize
+      &&  memcmp( pEntry->mpRequest, pSDU + 7, requestSize ) == 0)
+      {
+         break;
+      }
+   }
+
+   if (pEntry != NULL)
+   {
+      // A full entry leaves this request to go out on its own
+      if (pEntry->mFollowerCount < QMI_DEDUP_MAX_FOLLOWERS)
+      {
+         pEntry->mFollowerClientIDs[pEntry->mFollowerCount] = clientID;
+         pEntry->mFollowerTransactionIDs[pEntry->mFollowerCount] = transactionID;
+         pEntry->mFollowerCount++;
+         bJoined = true;
+      }
+   }
+   else if (pDev->mQMIDev.mDedupCount < QMI_DEDUP_MAX_ENTRIES)
+   {
+      pEntry = kmalloc( sizeof( sQMIDedupEntry ) + requestSize, GFP_ATOMIC );
+      if (pEntry != NULL)
+      {
+         pEntry->mKey.mServiceType = clientID & 0xff;
+         pEntry->mKey.mMsgID = msgID;
+         pEntry->mpRequest = pEntry + 1;
+         pEntry->mRequestSize = requestSize;
+         memcpy( pEntry->mpRequest, pSDU + 7, requestSize );
+         pEntry->mClientID = clientID;
+         pEntry->mTransactionID = transactionID;
+         pEntry->mFollowerCount = 0;
+         pEntry->mTimestamp = jiffies;
+         pEntry->mpNext = pDev->mQMIDev.mpDedupList;
+         pDev->mQMIDev.mpDedupList = pEntry;
+         pDev->mQMIDev.mDedupCount++;
+      }
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+
+   if (bJoined == true)
+   {
+      VDBG( "0x%04X TID %x joined a request in flight\n",
+            clientID,
+            transactionID );
+   }
+
+   return bJoined;
+}
+
+/*===========================================================================
+METHOD:
+   QMIDedupFanOut (Public Method)
+
+DESCRIPTION:
+   Hand a response to every request that joined the one it answers,
+   each with its own client and transaction ID
+   May be called in interrupt context
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client the response is for
+   transactionID  [ I ] - Transaction ID of the response
+   pSDU           [ I ] - Response without QMUX header
+   sduSize        [ I ] - Size of pSDU
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIDedupFanOut(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pSDU,
+   u16                sduSize )
+{
+   sQMIDedupEntry ** ppEntry;
+   sQMIDedupEntry * pEntry = NULL;
+   void * pCopy;
+   unsigned long flags;
+   int i;
+
+   // Nothing in flight, the common case
+   if (pDev->mQMIDev.mpDedupList == NULL)
+   {
+      return;
+   }
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   for (ppEntry = &pDev->mQMIDev.mpDedupList;
+        *ppEntry != NULL;
+        ppEntry = &(*ppEntry)->mpNext)
+   {
+      if ((*ppEntry)->mClientID == clientID
+      &&  (*ppEntry)->mTransactionID == transactionID)
+      {
+         pEntry = QMIDedupRemove( pDev, ppEntry );
+         break;
+      }
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+
+   if (pEntry == NULL)
+   {
+      return;
+   }
+
+   for (i = 0; i < pEntry->mFollowerCount; i++)
+   {
+      pCopy = kmalloc( QMUXHeaderSize() + sduSize, GFP_ATOMIC );
+      if (pCopy == NULL)
+      {
+         DBG( "no memory for 0x%04X\n", pEntry->mFollowerClientIDs[i] );
+         continue;
+      }
+
+      FillQMUX( pEntry->mFollowerClientIDs[i], 
+                pCopy, 
+                QMUXHeaderSize() + sduSize );
+      memcpy( pCopy + QMUXHeaderSize(), pSDU, sduSize );
+      put_unaligned( cpu_to_le16( pEntry->mFollowerTransactionIDs[i] ),
+                     (u16*)(pCopy + QMUXHeaderSize() + 1) );
+
+      QMICacheDeliver( pDev,
+                       pEntry->mFollowerClientIDs[i],
+                       pEntry->mFollowerTransactionIDs[i],
+                       pCopy,
+                       QMUXHeaderSize() + sduSize );
+   }
+
+   kfree( pEntry );
+}
+
+/*===========================================================================
+METHOD:
+   QMIDedupFlush (Public Method)
+
+DESCRIPTION:
+   Drop every request tracked for de-duplication
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIDedupFlush( sGobiUSBNet * pDev )
+{
+   unsigned long flags;
+
+   // Critical section
+   spin_lock_irqsave( &pDev->mQMIDev.mCacheLock, flags );
+
+   while (pDev->mQMIDev.mpDedupList != NULL)
+   {
+      kfree( QMIDedupRemove( pDev, &pDev->mQMIDev.mpDedupList ) );
+   }
+
+   // End critical section
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCacheLock, flags );
+}
+
+/*=========================================================================*/
+// Shared memory rings
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMIRingGet (Public Method)
+
+DESCRIPTION:
+   Take a reference on a ring
+
+PARAMETERS:
+   pRing          [ I ] - Ring
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingGet( sQMIRing * pRing )
+{
+   kref_get( &pRing->mRefCount );
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingRelease (Public Method)
+
+DESCRIPTION:
+   Free a ring once its last reference is gone
+
+PARAMETERS:
+   pRefCount      [ I ] - mRefCount of the ring
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingRelease( struct kref * pRefCount )
+{
+   sQMIRing * pRing = container_of( pRefCount, sQMIRing, mRefCount );
+
+   vfree( pRing->mpHeader );
+   kfree( pRing );
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingPut (Public Method)
+
+DESCRIPTION:
+   Drop a reference on a ring
+      May free the ring, so must not be called in atomic context
+
+PARAMETERS:
+   pRing          [ I ] - Ring
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingPut( sQMIRing * pRing )
+{
+   kref_put( &pRing->mRefCount, QMIRingRelease );
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingCopy (Public Method)
+
+DESCRIPTION:
+   Copy between a linear buffer and a ring's data area, wrapping at its end
+
+PARAMETERS:
+   pRingData      [ I ] - Ring data area
+   ringSize       [ I ] - Size of data area, a power of 2
+   pos            [ I ] - Free running ring index
+   pBuffer        [I/O] - Linear buffer
+   size           [ I ] - Bytes to copy
+   bToRing        [ I ] - Copy direction
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingCopy(
+   u8 *               pRingData,
+   u32                ringSize,
+   u32                pos,
+   void *             pBuffer,
+   u32                size,
+   bool               bToRing )
+{
+   u32 offset = pos & (ringSize - 1);
+   u32 first = min_t( u32, size, ringSize - offset );
+
+   if (bToRing == true)
+   {
+      memcpy( pRingData + offset, pBuffer, first );
+      memcpy( pRingData, pBuffer + first, size - first );
+   }
+   else
+   {
+      memcpy( pBuffer, pRingData + offset, first );
+      memcpy( pBuffer + first, pRingData, size - first );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingWrite (Public Method)
+
+DESCRIPTION:
+   Deposit a received message in a client's RX ring as a frame
+   May be called in interrupt context
+
+PARAMETERS:
+   pRing          [ I ] - Ring
+   clientID       [ I ] - Client the message was read for
+   pData          [ I ] - Message including QMUX header
+   dataSize       [ I ] - Size of pData
+
+RETURN VALUE:
+   int - 1 if the ring went from empty to non-empty
+         0 if it already held data
+         -ENOSPC if the message was dropped
+===========================================================================*/
+int QMIRingWrite(
+   sQMIRing *         pRing,
+   u16                clientID,
+   void *             pData,
+   u16                dataSize )
+{
+   sQMIFrameHeader frame;
+   u32 consumer;
+   u32 used;
+   u32 recordSize;
+
+   frame.mLength = dataSize - QMUXHeaderSize();
+   frame.mClientID = clientID;
+   recordSize = ALIGN( sizeof( frame ) + frame.mLength, QMI_RING_ALIGN );
+
+   // Userspace owns the consumer index, never trust it further than
+   //    the ring size
+   consumer = pRing->mpHeader->mRxConsumer;
+   smp_rmb();
+   used = pRing->mRxProducer - consumer;
+   if (used > pRing->mRxSize || pRing->mRxSize - used < recordSize)
+   {
+      pRing->mpHeader->mRxDropped++;
+      return -ENOSPC;
+   }
+
+   QMIRingCopy( pRing->mpRxData, 
+                pRing->mRxSize, 
+                pRing->mRxProducer,
+                &frame,
+                sizeof( frame ),
+                true );
+   QMIRingCopy( pRing->mpRxData, 
+                pRing->mRxSize, 
+                pRing->mRxProducer + sizeof( frame ),
+                pData + QMUXHeaderSize(),
+                frame.mLength,
+                true );
+
+   // Publish the frame only once it is complete
+   smp_wmb();
+   pRing->mRxProducer += recordSize;
+   pRing->mpHeader->mRxProducer = pRing->mRxProducer;
+
+   return (used == 0) ? 1 : 0;
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingEmpty (Public Method)
+
+DESCRIPTION:
+   Has userspace consumed everything in the RX ring?
+
+PARAMETERS:
+   pRing          [ I ] - Ring
+
+RETURN VALUE:
+   bool
+===========================================================================*/
+bool QMIRingEmpty( sQMIRing * pRing )
+{
+   u32 consumer = pRing->mpHeader->mRxConsumer;
+
+   smp_rmb();
+   return consumer == pRing->mRxProducer;
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingDetach (Public Method)
+
+DESCRIPTION:
+   Stop delivering a client's messages to its ring and drop the
+   client's reference
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingDetach(
+   sGobiUSBNet *      pDev,
+   u16                clientID )
+{
+   sClientMemList * pClientMem;
+   sQMIRing * pRing = NULL;
+   unsigned long flags;
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, clientID );
+   if (pClientMem != NULL)
+   {
+      pRing = pClientMem->mpRing;
+      pClientMem->mpRing = NULL;
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   if (pRing != NULL)
+   {
+      QMIRingPut( pRing );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingVmOpen (Public Method)
+
+DESCRIPTION:
+   A mapping of the ring was duplicated (fork, split)
+
+PARAMETERS:
+   pVMA           [ I ] - Mapping
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingVmOpen( struct vm_area_struct * pVMA )
+{
+   QMIRingGet( (sQMIRing *)pVMA->vm_private_data );
+}
+
+/*===========================================================================
+METHOD:
+   QMIRingVmClose (Public Method)
+
+DESCRIPTION:
+   A mapping of the ring went away
+
+PARAMETERS:
+   pVMA           [ I ] - Mapping
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIRingVmClose( struct vm_area_struct * pVMA )
+{
+   QMIRingPut( (sQMIRing *)pVMA->vm_private_data );
+}
+
+static const struct vm_operations_struct QMIRingVmOps =
+{
+   .open  = QMIRingVmOpen,
+   .close = QMIRingVmClose,
+};
+
+/*===========================================================================
+METHOD:
+   QMIRingKick (Public Method)
+
+DESCRIPTION:
+   Send the requests userspace placed in the TX ring
+      Stops early when the handle reaches its in-flight write limit
+
+PARAMETERS:
+   pFilpData      [ I ] - Writer's file data
+
+RETURN VALUE:
+   int - Number of frames sent
+         Negative errno for failure
+===========================================================================*/
+int QMIRingKick( sQMIFilpStorage * pFilpData )
+{
+   sQMIRing * pRing = pFilpData->mpRing;
+   sQMIFrameHeader frame;
+   sQMIXaction * pXaction;
+   u32 producer;
+   u32 recordSize;
+   int clientID;
+   int count = 0;
+   int result;
+
+   if (pRing == NULL || pRing->mTxSize == 0)
+   {
+      return -ENODEV;
+   }
+
+   // Report an earlier write that failed after we returned
+   result = atomic_xchg( &pFilpData->mWriteError, 0 );
+   if (result != 0)
+   {
+      return result;
+   }
+
+   producer = pRing->mpHeader->mTxProducer;
+   smp_rmb();
+   if (producer - pRing->mTxConsumer > pRing->mTxSize)
+   {
+      DBG( "TX producer out of range\n" );
+      return -EINVAL;
+   }
+
+   while (pRing->mTxConsumer != producer)
+   {
+      QMIRingCopy( pRing->mpTxData,
+                   pRing->mTxSize,
+                   pRing->mTxConsumer,
+                   &frame,
+                   sizeof( frame ),
+                   false );
+      recordSize = ALIGN( sizeof( frame ) + frame.mLength, QMI_RING_ALIGN );
+      clientID = UserspaceFrameClientID( pFilpData, frame.mClientID );
+      if (frame.mLength == 0 
+      ||  frame.mLength > QMI_CTRL_URB_MAX_SIZE - QMUXHeaderSize()
+      ||  recordSize > producer - pRing->mTxConsumer
+      ||  clientID < 0)
+      {
+         DBG( "Bad TX frame at %u\n", pRing->mTxConsumer );
+         result = -EINVAL;
+         break;
+      }
+
+      if (atomic_inc_return( &pFilpData->mWritesInFlight ) 
+          > UserspaceWriteLimit())
+      {
+         atomic_dec( &pFilpData->mWritesInFlight );
+         break;
+      }
+
+      pXaction = QMIXactionAlloc( pFilpData->mpDev,
+                                  (u16)clientID,
+                                  frame.mLength + QMUXHeaderSize(),
+                                  GFP_KERNEL );
+      if (pXaction == NULL)
+      {
+         atomic_dec( &pFilpData->mWritesInFlight );
+         result = -ENOMEM;
+         break;
+      }
+
+      QMIRingCopy( pRing->mpTxData,
+                   pRing->mTxSize,
+                   pRing->mTxConsumer + sizeof( frame ),
+                   pXaction->mpWriteBuffer + QMUXHeaderSize(),
+                   frame.mLength,
+                   false );
+
+      result = UserspaceWriteQueue( pFilpData, pXaction );
+      if (result < 0)
+      {
+         break;
+      }
+
+      // Hand the slot back to userspace
+      smp_mb();
+      pRing->mTxConsumer += recordSize;
+      pRing->mpHeader->mTxConsumer = pRing->mTxConsumer;
+      count++;
+   }
+
+   if (count == 0 && result < 0)
+   {
+      return result;
+   }
+
+   return count;
+}
+
+/*=========================================================================*/
+// Internal userspace wrappers
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   UserspaceunlockedIOCTL (Public Method)
+
+DESCRIPTION:
+   Internal wrapper for Userspace IOCTL interface
+
+PARAMETERS
+   pFilp        [ I ] - userspace file descriptor
+   cmd          [ I ] - IOCTL command
+   arg          [ I ] - IOCTL argument
+
+RETURN VALUE:
+   long - 0 for success
+         Negative errno for failure
+===========================================================================*/
+long UserspaceunlockedIOCTL(
+   struct file *     pFilp,
+   unsigned int      cmd, 
+   unsigned long     arg )
+{
+   int result;
+   u32 devVIDPID;
+
+   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
+
+   if (pFilpData == NULL)
+   {
+      DBG( "Bad file data\n" );
+      return -EBADF;
+   }
+   
+   if (IsDeviceValid( pFilpData->mpDev ) == false)
+   {
+      DBG( "Invalid device! Updating f_ops\n" );
+      pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
+      return -ENXIO;
+   }
+
+   switch (cmd)
+   {
+      case IOCTL_QMI_GET_SERVICE_FILE:    
+         DBG( "Setting up QMI for service %lu\n", arg );
+         if ((u8)arg == 0)
+         {
+            DBG( "Cannot use QMICTL from userspace\n" );
+            return -EINVAL;
+         }
+
+         // Connection is already setup
+         if (pFilpData->mClientID != (u16)-1)
+         {
+            DBG( "Close the current connection before opening a new one\n" );
+            return -EBADR;
+         }
+         
+         // Hand out an idle pre-allocated client if there is one
+         result = QMIClientPoolGet( pFilpData->mpDev, (u8)arg );
+         if (result < 0)
+         {
+            result = GetClientID( pFilpData->mpDev, (u8)arg );
+         }
+// it seems QMIWDA only allow one client, if the last CM donot realese it (killed by SIGKILL).
+// can force release it at here
+#if 1
+         if (result < 0 && (u8)arg == QMIWDA)
+         {
+             ReleaseClientID( pFilpData->mpDev, QMIWDA | (1 << 8) );
+             result = GetClientID( pFilpData->mpDev, (u8)arg );
+         }
+#endif
+         if (result < 0)
+         {
+            return result;
+         }
+         pFilpData->mClientID = (u16)result;
+         UserspaceAttachClient( pFilpData, pFilpData->mClientID );
+         DBG("pFilpData->mClientID = 0x%x\n", pFilpData->mClientID );
+         return 0;
+         break;
+
+
+      case IOCTL_QMI_GET_DEVICE_VIDPID:
+         if (arg == 0)
+         {
+            DBG( "Bad VIDPID buffer\n" );
+            return -EINVAL;
+         }
+         
+         // Extra verification
+         if (pFilpData->mpDev->mpNetDev == 0)
+         {
+            DBG( "Bad mpNetDev\n" );
+            return -ENOMEM;
+         }
+         if (pFilpData->mpDev->mpNetDev->udev == 0)
+         {
+            DBG( "Bad udev\n" );
+            return -ENOMEM;
+         }
+
+         devVIDPID = ((le16_to_cpu( pFilpData->mpDev->mpNetDev->udev->descriptor.idVendor ) << 16)
+                     + le16_to_cpu( pFilpData->mpDev->mpNetDev->udev->descriptor.idProduct ) );
+
+         result = copy_to_user( (unsigned int *)arg, &devVIDPID, 4 );
+         if (result != 0)
+         {
+            DBG( "Copy to userspace failure %d\n", result );
+         }
+
+         return result;
+                 
+         break;
+
+      case IOCTL_QMI_GET_DEVICE_MEID:
+         if (arg == 0)
+         {
+            DBG( "Bad MEID buffer\n" );
+            return -EINVAL;
+         }
+         
+         result = copy_to_user( (unsigned int *)arg, &pFilpData->mpDev->mMEID[0], 14 );
+         if (result != 0)
+         {
+            DBG( "Copy to userspace failure %d\n", result );
+         }
+
+         return result;
+                 
+         break;
+
+      case IOCTL_QMI_TRANSACTION:
+         if (arg == 0)
+         {
+            DBG( "Bad transaction buffer\n" );
+            return -EINVAL;
+         }
+
+         return UserspaceTransaction( pFilpData, arg );
+
+         break;
+
+      case IOCTL_QMI_SET_BATCH_MODE:
+         pFilpData->mbBatchMode = (arg != 0);
+         return 0;
+
+         break;
+
+      case IOCTL_QMI_RING_KICK:
+         if (pFilpData->mpRing == NULL)
+         {
+            DBG( "No ring mapped\n" );
+            return -ENODEV;
+         }
+
+         mutex_lock( &pFilpData->mpRing->mTxLock );
+         result = QMIRingKick( pFilpData );
+         mutex_unlock( &pFilpData->mpRing->mTxLock );
+         return result;
+
+         break;
+
+      case IOCTL_QMI_ADD_SERVICE:
+         DBG( "Adding QMI service %lu\n", arg );
+         if ((u8)arg == 0)
+         {
+            DBG( "Cannot use QMICTL from userspace\n" );
+            return -EINVAL;
+         }
+
+         return UserspaceAddService( pFilpData, (u8)arg );
+
+         break;
+
+      case IOCTL_QMI_SET_INDICATION_FILTER:
+         if (arg == 0)
+         {
+            DBG( "Bad indication filter buffer\n" );
+            return -EINVAL;
+         }
+
+         return UserspaceSetIndicationFilter( pFilpData, arg );
+
+         break;
+
+      case IOCTL_QMI_GET_QUEUE_STATS:
+         if (arg == 0)
+         {
+            DBG( "Bad queue stats buffer\n" );
+            return -EINVAL;
+         }
+
+         return UserspaceGetQueueStats( pFilpData, arg );
+
+         break;
+         
+      default:
+         return -EBADRQC;       
+   }
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceTransaction (Public Method)
+
+DESCRIPTION:
+   Run one request/response exchange for IOCTL_QMI_TRANSACTION
+      The transaction ID in the request is replaced with one allocated
+      here, so only the matching response is returned to this caller
+
+PARAMETERS
+   pFilpData       [ I ] - Caller's file data
+   arg             [I/O] - Userspace sQMIIoctlTransaction
+
+RETURN VALUE:
+   long - 0 for success
+          Negative errno for failure
+===========================================================================*/
+long UserspaceTransaction(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg )
+{
+   sQMIIoctlTransaction req;
+   sQMIXaction * pXaction;
+   void * pReadBuffer;
+   int result;
+
+   if (pFilpData->mClientID == (u16)-1)
+   {
+      DBG( "Client ID must be set before a transaction\n" );
+      return -EBADR;
+   }
+
+   if (copy_from_user( &req, (void __user *)arg, sizeof( req ) ) != 0)
+   {
+      return -EFAULT;
+   }
+
+   // Control flags and transaction ID must be present
+   if (req.mRequestSize < 3 
+   ||  req.mRequestSize > QMI_TRANSACTION_MAX_SIZE
+   ||  req.mReserved != 0)
+   {
+      return -EINVAL;
+   }
+
+   pXaction = QMIXactionAlloc( pFilpData->mpDev,
+                               pFilpData->mClientID,
+                               req.mRequestSize + QMUXHeaderSize(),
+                               GFP_KERNEL );
+   if (pXaction == NULL)
+   {
+      return -ENOMEM;
+   }
+
+   if (copy_from_user( pXaction->mpWriteBuffer + QMUXHeaderSize(),
+                       (void __user *)(unsigned long)req.mpRequest,
+                       req.mRequestSize ) != 0)
+   {
+      QMIXactionPut( pXaction );
+      return -EFAULT;
+   }
+
+   // Service SDU: control flags, then a 16 bit transaction ID
+   put_unaligned( cpu_to_le16( pXaction->mTransactionID ),
+                  (u16 *)(pXaction->mpWriteBuffer + QMUXHeaderSize() + 1) );
+
+   result = QMIXactionSync( pXaction, &pReadBuffer, req.mTimeout );
+   QMIXactionPut( pXaction );
+
+   if (result < 0)
+   {
+      DBG( "transaction failed %d\n", result );
+      return result;
+   }
+
+   // Discard QMUX header, as read() does
+   result -= QMUXHeaderSize();
+   if (result > req.mResponseSize)
+   {
+      DBG( "Response is too large for the user buffer\n" );
+      kfree( pReadBuffer );
+      return -EOVERFLOW;
+   }
+
+   req.mResponseSize = result;
+   if (copy_to_user( (void __user *)(unsigned long)req.mpResponse,
+                     pReadBuffer + QMUXHeaderSize(),
+                     result ) != 0
+   ||  copy_to_user( (void __user *)arg, &req, sizeof( req ) ) != 0)
+   {
+      result = -EFAULT;
+   }
+   else
+   {
+      result = 0;
+   }
+
+   kfree( pReadBuffer );
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteLimit (Public Method)
+
+DESCRIPTION:
+   Number of O_NONBLOCK writes a file handle may have in flight
+
+RETURN VALUE:
+   int - writeQueueLength, at least 1
+===========================================================================*/
+int UserspaceWriteLimit( void )
+{
+   return max( writeQueueLength, 1 );
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteCallback (Public Method)
+
+DESCRIPTION:
+   Completion callback for O_NONBLOCK writes
+      Frees the in-flight slot and wakes poll() and close
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   result         [ I ] - Bytes written or negative errno
+   pReadBuffer    [ I ] - Always NULL for write only transactions
+   pData          [ I ] - Writer's sQMIFilpStorage
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void UserspaceWriteCallback(
+   sGobiUSBNet *     pDev,
+   int               result,
+   void *            pReadBuffer,
+   void *            pData )
+{
+   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pData;
+   unsigned long flags;
+
+   kfree( pReadBuffer );
+
+   if (result < 0)
+   {
+      DBG( "async write failed %d\n", result );
+      atomic_cmpxchg( &pFilpData->mWriteError, 0, result );
+   }
+
+   // Close frees pFilpData once the count drops, so hold the wait
+   //    queue lock until we are done with it
+   spin_lock_irqsave( &pFilpData->mWaitQueue.lock, flags );
+   atomic_dec( &pFilpData->mWritesInFlight );
+   wake_up_locked( &pFilpData->mWaitQueue );
+   spin_unlock_irqrestore( &pFilpData->mWaitQueue.lock, flags );
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteSync (Public Method)
+
+DESCRIPTION:
+   Send one request and wait for the write to complete
+
+PARAMETERS
+   pFilpData       [ I ] - Writer's file data
+   clientID        [ I ] - Client owned by pFilpData to send as
+   pBuf            [ I ] - write buffer
+   size            [ I ] - size of write buffer
+
+RETURN VALUE:
+   ssize_t - size for success
+             Negative errno for failure
+===========================================================================*/
+ssize_t UserspaceWriteSync(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID,
+   const char __user *  pBuf,
+   size_t               size )
+{
+   int status;
+   sQMICtrlURB * pCtrlURB;
+   void * pSDU;
+   u16 transactionID;
+
+   if (size > QMI_CTRL_URB_MAX_SIZE - QMUXHeaderSize())
+   {
+      return -EINVAL;
+   }
+
+   // Copy data from user space straight into a pooled write URB
+   pCtrlURB = QMICtrlURBGet( pFilpData->mpDev, 
+                             size + QMUXHeaderSize(), 
+                             GFP_KERNEL );
+   if (pCtrlURB == NULL)
+   {
+      return -ENOMEM;
+   }
+   pSDU = pCtrlURB->mpBuffer + QMUXHeaderSize();
+   status = copy_from_user( pSDU, pBuf, size );
+   if (status != 0)
+   {
+      DBG( "Unable to copy data from userspace %d\n", status );
+      QMICtrlURBPut( pFilpData->mpDev, pCtrlURB );
+      return -EFAULT;
+   }
+
+   // Static queries may be answered without the modem, and identical
+   //    queries in flight share one response
+   if (QMICacheAnswer( pFilpData->mpDev, clientID, pSDU, size ) == true
+   ||  QMIDedupJoin( pFilpData->mpDev, clientID, pSDU, size ) == true)
+   {
+      QMICtrlURBPut( pFilpData->mpDev, pCtrlURB );
+      return size;
+   }
+
+   // Keep clear of the IDs of in-driver transactions
+   if (clientID != QMICTL)
+   {
+      transactionID = QMIXactionIDNext( pFilpData->mpDev, clientID );
+      status = QMIUserTIDMap( pFilpData->mpDev, 
+                              clientID, 
+                              pSDU, 
+                              size, 
+                              transactionID );
+      if (transactionID == 0 || status != 0)
+      {
+         QMICtrlURBPut( pFilpData->mpDev, pCtrlURB );
+         return (status != 0) ? status : -ENXIO;
+      }
+   }
+
+   status = WriteSyncURB( pFilpData->mpDev,
+                          pCtrlURB, 
+                          size + QMUXHeaderSize(),
+                          clientID,
+                          0 );
+
+   QMICtrlURBPut( pFilpData->mpDev, pCtrlURB );
+   
+   // On success, return requested size, not full QMI reqest size
+   if (status == size + QMUXHeaderSize())
+   {
+      return size;
+   }
+   else
+   {
+      return status;
+   }
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteQueue (Public Method)
+
+DESCRIPTION:
+   Submit a filled write only transaction for a file handle
+      Caller has claimed an mWritesInFlight slot, which is given back
+      on failure
+
+PARAMETERS
+   pFilpData       [ I ] - Writer's file data
+   pXaction        [ I ] - Transaction, the caller's reference is consumed
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+int UserspaceWriteQueue(
+   sQMIFilpStorage *    pFilpData,
+   sQMIXaction *        pXaction )
+{
+   int result;
+
+   // Static queries may be answered without the modem, and identical
+   //    queries in flight share one response
+   if (QMICacheAnswer( pFilpData->mpDev,
+                       pXaction->mClientID,
+                       pXaction->mpWriteBuffer + QMUXHeaderSize(),
+                       pXaction->mWriteBufferSize - QMUXHeaderSize() ) == true
+   ||  QMIDedupJoin( pFilpData->mpDev,
+                     pXaction->mClientID,
+                     pXaction->mpWriteBuffer + QMUXHeaderSize(),
+                     pXaction->mWriteBufferSize - QMUXHeaderSize() ) == true)
+   {
+      QMIXactionPut( pXaction );
+      atomic_dec( &pFilpData->mWritesInFlight );
+      return 0;
+   }
+
+   // Send with the ID QMIXactionAlloc drew, clear of in-driver ones
+   result = QMIUserTIDMap( pFilpData->mpDev,
+                           pXaction->mClientID,
+                           pXaction->mpWriteBuffer + QMUXHeaderSize(),
+                           pXaction->mWriteBufferSize - QMUXHeaderSize(),
+                           pXaction->mTransactionID );
+   if (result < 0)
+   {
+      QMIXactionPut( pXaction );
+      atomic_dec( &pFilpData->mWritesInFlight );
+      return result;
+   }
+
+   pXaction->mbWriteOnly = true;
+   result = QMIXactionSubmit( pXaction,
+                              QMI_XACTION_TIMEOUT_MS,
+                              UserspaceWriteCallback,
+                              pFilpData,
+                              GFP_KERNEL );
+
+   // The engine holds its own references while the write is in flight
+   QMIXactionPut( pXaction );
+
+   if (result < 0)
+   {
+      atomic_dec( &pFilpData->mWritesInFlight );
+   }
+
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteAsync (Public Method)
+
+DESCRIPTION:
+   Queue an O_NONBLOCK write without waiting for it to reach the device
+
+PARAMETERS
+   pFilpData       [ I ] - Writer's file data
+   clientID        [ I ] - Client owned by pFilpData to send as
+   pBuf            [ I ] - write buffer
+   size            [ I ] - size of write buffer
+
+RETURN VALUE:
+   ssize_t - size for success
+             -EAGAIN if too many writes are in flight
+             Negative errno for failure, or from an earlier failed write
+===========================================================================*/
+ssize_t UserspaceWriteAsync(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID,
+   const char __user *  pBuf,
+   size_t               size )
+{
+   sQMIXaction * pXaction;
+   int result;
+
+   // Report an earlier write that failed after we returned
+   result = atomic_xchg( &pFilpData->mWriteError, 0 );
+   if (result != 0)
+   {
+      return result;
+   }
+
+   if (size > QMI_CTRL_URB_MAX_SIZE - QMUXHeaderSize())
+   {
+      return -EINVAL;
+   }
+
+   if (atomic_inc_return( &pFilpData->mWritesInFlight ) 
+       > UserspaceWriteLimit())
+   {
+      atomic_dec( &pFilpData->mWritesInFlight );
+      return -EAGAIN;
+   }
+
+   pXaction = QMIXactionAlloc( pFilpData->mpDev,
+                               clientID,
+                               size + QMUXHeaderSize(),
+                               GFP_KERNEL );
+   if (pXaction == NULL)
+   {
+      atomic_dec( &pFilpData->mWritesInFlight );
+      return -ENOMEM;
+   }
+
+   if (copy_from_user( pXaction->mpWriteBuffer + QMUXHeaderSize(), 
+                       pBuf, 
+                       size ) != 0)
+   {
+      DBG( "Unable to copy data from userspace\n" );
+      QMIXactionPut( pXaction );
+      atomic_dec( &pFilpData->mWritesInFlight );
+      return -EFAULT;
+   }
+
+   result = UserspaceWriteQueue( pFilpData, pXaction );
+   if (result < 0)
+   {
+      return result;
+   }
+
+   return size;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceFrameAppend (Public Method)
+
+DESCRIPTION:
+   Append one received message to a batch read buffer as a frame
+      Caller verified the frame fits
+
+PARAMETERS
+   pBatch          [ I ] - Batch buffer
+   offset          [ I ] - Where the frame starts in pBatch
+   clientID        [ I ] - Client the message was read for
+   pData           [ I ] - Message including QMUX header
+   dataSize        [ I ] - Size of pData
+
+RETURN VALUE:
+   size_t - Offset following the frame
+===========================================================================*/
+size_t UserspaceFrameAppend(
+   void *               pBatch,
+   size_t               offset,
+   u16                  clientID,
+   void *               pData,
+   u16                  dataSize )
+{
+   sQMIFrameHeader frame;
+
+   // Discard QMUX header, as read() does
+   frame.mLength = dataSize - QMUXHeaderSize();
+   frame.mClientID = clientID;
+
+   memcpy( pBatch + offset, &frame, sizeof( frame ) );
+   memcpy( pBatch + offset + sizeof( frame ), 
+           pData + QMUXHeaderSize(), 
+           frame.mLength );
+
+   return offset + sizeof( frame ) + frame.mLength;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceReadBatch (Public Method)
+
+DESCRIPTION:
+   Batch mode read, returns as many framed messages as fit in pBuf
+      Messages are gathered from every client owned by the handle, one
+      per client in turn so a busy service cannot starve the others
+      Waits for the first message unless O_NONBLOCK is set
+
+PARAMETERS
+   pFilp           [ I ] - userspace file descriptor
+   pFilpData       [ I ] - Reader's file data
+   pBuf            [ I ] - read buffer
+   size            [ I ] - size of read buffer
+
+RETURN VALUE:
+   ssize_t - Number of bytes read for success
+             -EAGAIN with O_NONBLOCK and nothing queued
+             -EOVERFLOW if the next message does not fit
+             Negative errno for failure
+===========================================================================*/
+ssize_t UserspaceReadBatch(
+   struct file *        pFilp,
+   sQMIFilpStorage *    pFilpData,
+   char __user *        pBuf,
+   size_t               size )
+{
+   sGobiUSBNet * pDev = pFilpData->mpDev;
+   u16 clientIDs[QMI_FILP_MAX_SERVICES + 1];
+   void * pBatch;
+   void * pReadData;
+   u16 readDataSize;
+   size_t batchSize;
+   size_t offset;
+   bool bProgress;
+   bool bTooLarge;
+   unsigned long flags;
+   int clientCount;
+   int i;
+   int result;
+
+   batchSize = min_t( size_t, size, QMI_BATCH_MAX_SIZE );
+   pBatch = kmalloc( batchSize, GFP_KERNEL );
+   if (pBatch == NULL)
+   {
+      return -ENOMEM;
+   }
+
+   for (;;)
+   {
+      offset = 0;
+      bTooLarge = false;
+
+      // Critical section
+      QMIClientMemLock( pDev, flags );
+
+      clientCount = UserspaceClientIDs( pFilpData, clientIDs );
+
+      // Take queued messages while they fit
+      do
+      {
+         bProgress = false;
+         for (i = 0; i < clientCount; i++)
+         {
+            readDataSize = PeekReadMemListSize( pDev, clientIDs[i] );
+            if (readDataSize == 0)
+            {
+               continue;
+            }
+            if (offset + sizeof( sQMIFrameHeader ) + readDataSize 
+                - QMUXHeaderSize() > batchSize)
+            {
+               bTooLarge = true;
+               continue;
+            }
+
+            PopFromReadMemList( pDev,
+                                clientIDs[i],
+                                0,
+                                &pReadData,
+                                &readDataSize );
+            offset = UserspaceFrameAppend( pBatch,
+                                           offset,
+                                           clientIDs[i],
+                                           pReadData,
+                                           readDataSize );
+            kfree( pReadData );
+            bProgress = true;
+         }
+      } while (bProgress == true);
+
+      // End critical section
+      QMIClientMemUnlock( pDev, flags );
+
+      if (offset != 0)
+      {
+         // Readers wait exclusively, pass what is left to the next one
+         if (bTooLarge == true)
+         {
+            wake_up_interruptible( &pFilpData->mWaitQueue );
+         }
+         break;
+      }
+
+      // Anything left queued is too large for this buffer
+      if (bTooLarge == true)
+      {
+         kfree( pBatch );
+         return -EOVERFLOW;
+      }
+
+      if ((pFilp->f_flags & O_NONBLOCK) != 0)
+      {
+         kfree( pBatch );
+         return -EAGAIN;
+      }
+
+      // One reader per message is enough, poll() waiters still all wake
+#ifdef wait_event_interruptible_exclusive
+      result = wait_event_interruptible_exclusive( pFilpData->mWaitQueue,
+                                                   UserspaceDataReady( pFilpData ) );
+#else
+      result = wait_event_interruptible( pFilpData->mWaitQueue,
+                                         UserspaceDataReady( pFilpData ) );
+#endif
+      if (result != 0)
+      {
+         kfree( pBatch );
+         return result;
+      }
+
+      if (IsDeviceValid( pDev ) == false)
+      {
+         DBG( "Invalid device!\n" );
+         kfree( pBatch );
+         return -ENXIO;
+      }
+   }
+
+   if (copy_to_user( pBuf, pBatch, offset ) != 0)
+   {
+      DBG( "Error copying read data to user\n" );
+      kfree( pBatch );
+      return -EFAULT;
+   }
+
+   kfree( pBatch );
+   return offset;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWriteBatch (Public Method)
+
+DESCRIPTION:
+   Batch mode write, sends each frame in pBuf as its own request
+      With O_NONBLOCK the frames are queued, see UserspaceWriteAsync
+
+PARAMETERS
+   pFilp           [ I ] - userspace file descriptor
+   pFilpData       [ I ] - Writer's file data
+   pBuf            [ I ] - write buffer
+   size            [ I ] - size of write buffer
+
+RETURN VALUE:
+   ssize_t - Bytes of whole frames sent for success
+             Negative errno if the first frame failed
+===========================================================================*/
+ssize_t UserspaceWriteBatch(
+   struct file *        pFilp,
+   sQMIFilpStorage *    pFilpData,
+   const char __user *  pBuf,
+   size_t               size )
+{
+   sQMIFrameHeader frame;
+   size_t offset = 0;
+   ssize_t result = -EINVAL;
+   int clientID;
+
+   while (offset + sizeof( frame ) <= size)
+   {
+      if (copy_from_user( &frame, pBuf + offset, sizeof( frame ) ) != 0)
+      {
+         result = -EFAULT;
+         break;
+      }
+
+      clientID = UserspaceFrameClientID( pFilpData, frame.mClientID );
+      if (frame.mLength == 0
+      ||  frame.mLength > QMI_CTRL_URB_MAX_SIZE - QMUXHeaderSize()
+      ||  offset + sizeof( frame ) + frame.mLength > size
+      ||  clientID < 0)
+      {
+         DBG( "Bad frame at offset %zu\n", offset );
+         result = -EINVAL;
+         break;
+      }
 
-         // Overwrite the pointer that was to this client mem
-         *ppDelClientMem = pNextClientMem;
+      if ((pFilp->f_flags & O_NONBLOCK) != 0)
+      {
+         result = UserspaceWriteAsync( pFilpData, 
+                                       (u16)clientID,
+                                       pBuf + offset + sizeof( frame ),
+                                       frame.mLength );
       }
       else
       {
-         // I now point to (a pointer of ((the node I was at)'s mpNext))
-         ppDelClientMem = &(*ppDelClientMem)->mpNext;
+         result = UserspaceWriteSync( pFilpData, 
+                                      (u16)clientID,
+                                      pBuf + offset + sizeof( frame ),
+                                      frame.mLength );
+      }
+      if (result < 0)
+      {
+         break;
       }
+
+      offset += sizeof( frame ) + frame.mLength;
    }
-   
-   // End Critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
 
-   return;
+   // Frames already sent are reported, the caller retries from there
+   if (offset > 0)
+   {
+      return offset;
+   }
+
+   return result;
 }
 
 /*===========================================================================
 METHOD:
-   FindClientMem (Public Method)
+   UserspaceClientIDs (Public Method)
 
 DESCRIPTION:
-   Find this client's memory
+   List the clients owned by a file handle, primary client first
 
-   Caller MUST have lock on mClientMemLock
+   Caller must have lock on mClientMemLock
 
-PARAMETERS:
-   pDev           [ I ] - Device specific memory
-   clientID       [ I ] - Requester's client ID
+PARAMETERS
+   pFilpData       [ I ] - Handle's file data
+   pClientIDs      [ O ] - Room for QMI_FILP_MAX_SERVICES + 1 client IDs
 
 RETURN VALUE:
-   sClientMemList - Pointer to requested sClientMemList for success
-                    NULL for error
+   int - Number of client IDs stored
 ===========================================================================*/
-sClientMemList * FindClientMem( 
-   sGobiUSBNet *      pDev,
-   u16              clientID )
+int UserspaceClientIDs(
+   sQMIFilpStorage *    pFilpData,
+   u16 *                pClientIDs )
 {
-   sClientMemList * pClientMem;
-   
-   if (IsDeviceValid( pDev ) == false)
-   {
-      DBG( "Invalid device\n" );
-      return NULL;
-   }
-   
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   int count = 0;
+   int i;
+
+   if (pFilpData->mClientID != (u16)-1)
    {
-      DBG( "unlocked\n" );
-      BUG();
+      pClientIDs[count++] = pFilpData->mClientID;
    }
-#endif
-   
-   pClientMem = pDev->mQMIDev.mpClientMemList;
-   while (pClientMem != NULL)
+
+   for (i = 0; i < pFilpData->mExtraClientCount; i++)
    {
-      if (pClientMem->mClientID == clientID)
-      {
-         // Success
-         VDBG("Found client's 0x%x memory\n", clientID);
-         return pClientMem;
-      }
-      
-      pClientMem = pClientMem->mpNext;
+      pClientIDs[count++] = pFilpData->mExtraClientIDs[i];
    }
 
-   DBG( "Could not find client mem 0x%04X\n", clientID );
-   return NULL;
+   return count;
 }
 
 /*===========================================================================
 METHOD:
-   AddToReadMemList (Public Method)
+   UserspaceFrameClientID (Public Method)
 
 DESCRIPTION:
-   Add Data to this client's ReadMem list
-   
-   Caller MUST have lock on mClientMemLock
+   Resolve the client a batch or ring frame is sent as
+      0 selects the handle's primary client, anything else must be a
+      client owned by the handle
 
-PARAMETERS:
-   pDev           [ I ] - Device specific memory
-   clientID       [ I ] - Requester's client ID
-   transactionID  [ I ] - Transaction ID or 0 for any
-   pData          [ I ] - Data to add
-   dataSize       [ I ] - Size of data to add
+PARAMETERS
+   pFilpData       [ I ] - Writer's file data
+   frameClientID   [ I ] - mClientID from the sQMIFrameHeader
 
 RETURN VALUE:
-   bool
+   int - Client ID for success
+         -EINVAL if the handle does not own the client
 ===========================================================================*/
-bool AddToReadMemList( 
-   sGobiUSBNet *      pDev,
-   u16              clientID,
-   u16              transactionID,
-   void *           pData,
-   u16              dataSize )
+int UserspaceFrameClientID(
+   sQMIFilpStorage *    pFilpData,
+   u16                  frameClientID )
 {
-   sClientMemList * pClientMem;
-   sReadMemList ** ppThisReadMemList;
-
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
-   {
-      DBG( "unlocked\n" );
-      BUG();
-   }
-#endif
+   u8 count;
+   int i;
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
+   if (frameClientID == 0 || frameClientID == pFilpData->mClientID)
    {
-      DBG( "Could not find this client's memory 0x%04X\n",
-           clientID );
-
-      return false;
+      return pFilpData->mClientID;
    }
 
-   // Go to last ReadMemList entry
-   ppThisReadMemList = &pClientMem->mpList;
-   while (*ppThisReadMemList != NULL)
+   // IDs are stored before the count is raised
+   count = pFilpData->mExtraClientCount;
+   smp_rmb();
+   for (i = 0; i < count; i++)
    {
-      ppThisReadMemList = &(*ppThisReadMemList)->mpNext;
+      if (pFilpData->mExtraClientIDs[i] == frameClientID)
+      {
+         return frameClientID;
+      }
    }
-   
-   *ppThisReadMemList = kmalloc( sizeof( sReadMemList ), GFP_ATOMIC );
-   if (*ppThisReadMemList == NULL)
-   {
-      DBG( "Mem error\n" );
 
-      return false;
-   }   
-   
-   (*ppThisReadMemList)->mpNext = NULL;
-   (*ppThisReadMemList)->mpData = pData;
-   (*ppThisReadMemList)->mDataSize = dataSize;
-   (*ppThisReadMemList)->mTransactionID = transactionID;
-   
-   return true;
+   return -EINVAL;
 }
 
 /*===========================================================================
 METHOD:
-   PopFromReadMemList (Public Method)
+   UserspaceAttachClient (Public Method)
 
 DESCRIPTION:
-   Remove data from this client's ReadMem list if it matches 
-   the specified transaction ID.
-   
-   Caller MUST have lock on mClientMemLock
+   Make a client wake its owning file handle's wait queue as data arrives
 
-PARAMETERS:
-   pDev              [ I ] - Device specific memory
-   clientID          [ I ] - Requester's client ID
-   transactionID     [ I ] - Transaction ID or 0 for any
-   ppData            [I/O] - On success, will be filled with a 
-                             pointer to read buffer
-   pDataSize         [I/O] - On succces, will be filled with the 
-                             read buffer's size
+PARAMETERS
+   pFilpData       [ I ] - Owning handle's file data
+   clientID        [ I ] - Client owned by pFilpData
 
 RETURN VALUE:
-   bool
+   None
 ===========================================================================*/
-bool PopFromReadMemList( 
-   sGobiUSBNet *      pDev,
-   u16                  clientID,
-   u16                  transactionID,
-   void **              ppData,
-   u16 *                pDataSize )
+void UserspaceAttachClient(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID )
 {
+   sGobiUSBNet * pDev = pFilpData->mpDev;
    sClientMemList * pClientMem;
-   sReadMemList * pDelReadMemList, ** ppReadMemList;
+   unsigned long flags;
 
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
-   {
-      DBG( "unlocked\n" );
-      BUG();
-   }
-#endif
+   // Critical section
+   QMIClientMemLock( pDev, flags );
 
-   // Get this client's memory location
    pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
-   {
-      DBG( "Could not find this client's memory 0x%04X\n",
-           clientID );
-
-      return false;
-   }
-   
-   ppReadMemList = &(pClientMem->mpList);
-   pDelReadMemList = NULL;
-   
-   // Find first message that matches this transaction ID
-   while (*ppReadMemList != NULL)
-   {
-      // Do we care about transaction ID?
-      if (transactionID == 0
-      ||  transactionID == (*ppReadMemList)->mTransactionID )
-      {
-         pDelReadMemList = *ppReadMemList;
-         VDBG(  "*ppReadMemList = 0x%p pDelReadMemList = 0x%p\n",
-               *ppReadMemList, pDelReadMemList );
-         break;
-      }
-      
-      VDBG( "skipping 0x%04X data TID = %x\n", clientID, (*ppReadMemList)->mTransactionID );
-      
-      // Next
-      ppReadMemList = &(*ppReadMemList)->mpNext;
-   }
-   VDBG(  "*ppReadMemList = 0x%p pDelReadMemList = 0x%p\n",
-         *ppReadMemList, pDelReadMemList );
-   if (pDelReadMemList != NULL)
-   {
-      *ppReadMemList = (*ppReadMemList)->mpNext;
-      
-      // Copy to output
-      *ppData = pDelReadMemList->mpData;
-      *pDataSize = pDelReadMemList->mDataSize;
-      VDBG(  "*ppData = 0x%p pDataSize = %u\n",
-            *ppData, *pDataSize );
-      
-      // Free memory
-      kfree( pDelReadMemList );
-      
-      return true;
-   }
-   else
+   if (pClientMem != NULL)
    {
-      DBG( "No read memory to pop, Client 0x%04X, TID = %x\n", 
-           clientID, 
-           transactionID );
-      return false;
+      pClientMem->mpOwnerWaitQueue = &pFilpData->mWaitQueue;
    }
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
 }
 
 /*===========================================================================
 METHOD:
-   AddToNotifyList (Public Method)
+   UserspaceDetachClients (Public Method)
 
 DESCRIPTION:
-   Add Notify entry to this client's notify List
-   
-   Caller MUST have lock on mClientMemLock
+   Stop every client owned by a file handle from waking its wait queue
+      Must be called before the handle's file data is freed
 
-PARAMETERS:
-   pDev              [ I ] - Device specific memory
-   clientID          [ I ] - Requester's client ID
-   transactionID     [ I ] - Transaction ID or 0 for any
-   pNotifyFunct      [ I ] - Callback function to be run when data is available
-   pData             [ I ] - Data buffer that willl be passed (unmodified) 
-                             to callback
+PARAMETERS
+   pFilpData       [ I ] - Owning handle's file data
 
 RETURN VALUE:
-   bool
+   None
 ===========================================================================*/
-bool AddToNotifyList( 
-   sGobiUSBNet *      pDev,
-   u16                  clientID,
-   u16                  transactionID,
-   void                 (* pNotifyFunct)(sGobiUSBNet *, u16, void *),
-   void *               pData )
+void UserspaceDetachClients( sQMIFilpStorage * pFilpData )
 {
+   sGobiUSBNet * pDev = pFilpData->mpDev;
    sClientMemList * pClientMem;
-   sNotifyList ** ppThisNotifyList;
+   u16 clientIDs[QMI_FILP_MAX_SERVICES + 1];
+   unsigned long flags;
+   int count;
+   int i;
 
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   count = UserspaceClientIDs( pFilpData, clientIDs );
+   for (i = 0; i < count; i++)
    {
-      DBG( "unlocked\n" );
-      BUG();
+      pClientMem = FindClientMem( pDev, clientIDs[i] );
+      if (pClientMem != NULL
+      &&  pClientMem->mpOwnerWaitQueue == &pFilpData->mWaitQueue)
+      {
+         pClientMem->mpOwnerWaitQueue = NULL;
+      }
    }
-#endif
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceReleaseClient (Public Method)
+
+DESCRIPTION:
+   Give back a client owned by a closing file handle
+      Returned to the client pool when it has room, released otherwise
+
+PARAMETERS
+   pDev            [ I ] - Device specific memory
+   clientID        [ I ] - Client to give back
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void UserspaceReleaseClient(
+   sGobiUSBNet *        pDev,
+   u16                  clientID )
+{
+   // DeregisterQMIDevice() will release this ClientID
+   if (pDev->mbDeregisterQMIDevice == true)
    {
-      DBG( "Could not find this client's memory 0x%04X\n", clientID );
-      return false;
+      return;
    }
 
-   // Go to last URBList entry
-   ppThisNotifyList = &pClientMem->mpReadNotifyList;
-   while (*ppThisNotifyList != NULL)
+   if (QMIClientPoolPut( pDev, clientID ) == false)
    {
-      ppThisNotifyList = &(*ppThisNotifyList)->mpNext;
+      ReleaseClientID( pDev, clientID );
    }
-   
-   *ppThisNotifyList = kmalloc( sizeof( sNotifyList ), GFP_ATOMIC );
-   if (*ppThisNotifyList == NULL)
-   {
-      DBG( "Mem error\n" );
-      return false;
-   }   
-   
-   (*ppThisNotifyList)->mpNext = NULL;
-   (*ppThisNotifyList)->mpNotifyFunct = pNotifyFunct;
-   (*ppThisNotifyList)->mpData = pData;
-   (*ppThisNotifyList)->mTransactionID = transactionID;
-   
-   return true;
 }
 
 /*===========================================================================
 METHOD:
-   NotifyAndPopNotifyList (Public Method)
+   UserspaceAddService (Public Method)
 
 DESCRIPTION:
-   Remove first Notify entry from this client's notify list 
-   and Run function
-   
-   Caller MUST have lock on mClientMemLock
+   Handler for IOCTL_QMI_ADD_SERVICE
+      Allocates a client for another service on this handle, so a single
+      batch read, ring or poll() serves several services
+      On a handle without a client the new client becomes its primary one
 
-PARAMETERS:
-   pDev              [ I ] - Device specific memory
-   clientID          [ I ] - Requester's client ID
-   transactionID     [ I ] - Transaction ID or 0 for any
+PARAMETERS
+   pFilpData       [ I ] - Caller's file data
+   serviceType     [ I ] - QMI service type
 
 RETURN VALUE:
-   bool
+   long - New client ID for success
+          -ENOSPC if the handle already owns QMI_FILP_MAX_SERVICES extra
+          Negative errno for failure
 ===========================================================================*/
-bool NotifyAndPopNotifyList( 
-   sGobiUSBNet *        pDev,
-   u16                  clientID,
-   u16                  transactionID )
+long UserspaceAddService(
+   sQMIFilpStorage *    pFilpData,
+   u8                   serviceType )
 {
+   sGobiUSBNet * pDev = pFilpData->mpDev;
    sClientMemList * pClientMem;
-   sNotifyList * pDelNotifyList, ** ppNotifyList;
+   unsigned long flags;
+   bool bAdded = false;
+   int result;
 
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   if (pFilpData->mExtraClientCount >= QMI_FILP_MAX_SERVICES)
    {
-      DBG( "unlocked\n" );
-      BUG();
+      DBG( "Too many services on this handle\n" );
+      return -ENOSPC;
    }
-#endif
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
+   // Hand out an idle pre-allocated client if there is one
+   result = QMIClientPoolGet( pDev, serviceType );
+   if (result < 0)
    {
-      DBG( "Could not find this client's memory 0x%04X\n", clientID );
-      return false;
+      result = GetClientID( pDev, serviceType );
+   }
+   if (result < 0)
+   {
+      return result;
    }
 
-   ppNotifyList = &(pClientMem->mpReadNotifyList);
-   pDelNotifyList = NULL;
+   // Critical section
+   QMIClientMemLock( pDev, flags );
 
-   // Remove from list
-   while (*ppNotifyList != NULL)
+   if (pFilpData->mClientID == (u16)-1)
    {
-      // Do we care about transaction ID?
-      if (transactionID == 0
-      ||  (*ppNotifyList)->mTransactionID == 0
-      ||  transactionID == (*ppNotifyList)->mTransactionID)
-      {
-         pDelNotifyList = *ppNotifyList;
-         break;
-      }
-      
-      DBG( "skipping data TID = %x\n", (*ppNotifyList)->mTransactionID );
-      
-      // next
-      ppNotifyList = &(*ppNotifyList)->mpNext;
+      pFilpData->mClientID = (u16)result;
+      bAdded = true;
    }
-   
-   if (pDelNotifyList != NULL)
+   else if (pFilpData->mExtraClientCount < QMI_FILP_MAX_SERVICES)
    {
-      // Remove element
-      *ppNotifyList = (*ppNotifyList)->mpNext;
-      
-      // Run notification function
-      if (pDelNotifyList->mpNotifyFunct != NULL)
-      {
-         // Unlock for callback
-         spin_unlock( &pDev->mQMIDev.mClientMemLock );
-      
-         pDelNotifyList->mpNotifyFunct( pDev,
-                                        clientID,
-                                        pDelNotifyList->mpData );
+      // Publish the ID before the count, writers check it unlocked
+      pFilpData->mExtraClientIDs[pFilpData->mExtraClientCount] = (u16)result;
+      smp_wmb();
+      pFilpData->mExtraClientCount++;
+      bAdded = true;
+   }
 
-         // Restore lock
-         spin_lock( &pDev->mQMIDev.mClientMemLock );
+   if (bAdded == true)
+   {
+      pClientMem = FindClientMem( pDev, (u16)result );
+      if (pClientMem != NULL)
+      {
+         pClientMem->mpOwnerWaitQueue = &pFilpData->mWaitQueue;
       }
-      
-      // Delete memory
-      kfree( pDelNotifyList );
-
-      return true;
    }
-   else
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   if (bAdded == false)
    {
-      DBG( "no one to notify for TID %x\n", transactionID );
-      
-      return false;
+      DBG( "Too many services on this handle\n" );
+      UserspaceReleaseClient( pDev, (u16)result );
+      return -ENOSPC;
    }
+
+   DBG( "added client 0x%04X\n", result );
+   return result;
 }
 
 /*===========================================================================
 METHOD:
-   AddToURBList (Public Method)
+   UserspaceDataReady (Public Method)
 
 DESCRIPTION:
-   Add URB to this client's URB list
-   
-   Caller MUST have lock on mClientMemLock
+   Wake up condition for batch reads
+      True once any client owned by the handle has a message queued, or
+      the device is going away
 
-PARAMETERS:
-   pDev              [ I ] - Device specific memory
-   clientID          [ I ] - Requester's client ID
-   pURB              [ I ] - URB to be added
+PARAMETERS
+   pFilpData       [ I ] - Reader's file data
 
 RETURN VALUE:
    bool
 ===========================================================================*/
-bool AddToURBList( 
-   sGobiUSBNet *      pDev,
-   u16                  clientID,
-   struct urb *     pURB )
+bool UserspaceDataReady( sQMIFilpStorage * pFilpData )
 {
-   sClientMemList * pClientMem;
-   sURBList ** ppThisURBList;
+   sGobiUSBNet * pDev = pFilpData->mpDev;
+   u16 clientIDs[QMI_FILP_MAX_SERVICES + 1];
+   unsigned long flags;
+   bool bReady = false;
+   int count;
+   int i;
 
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   if (IsDeviceValid( pDev ) == false)
    {
-      DBG( "unlocked\n" );
-      BUG();
+      return true;
    }
-#endif
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
-   {
-      DBG( "Could not find this client's memory 0x%04X\n", clientID );
-      return false;
-   }
+   // Critical section
+   QMIClientMemLock( pDev, flags );
 
-   // Go to last URBList entry
-   ppThisURBList = &pClientMem->mpURBList;
-   while (*ppThisURBList != NULL)
+   count = UserspaceClientIDs( pFilpData, clientIDs );
+   for (i = 0; i < count && bReady == false; i++)
    {
-      ppThisURBList = &(*ppThisURBList)->mpNext;
+      bReady = (PeekReadMemListSize( pDev, clientIDs[i] ) != 0);
    }
-   
-   *ppThisURBList = kmalloc( sizeof( sURBList ), GFP_ATOMIC );
-   if (*ppThisURBList == NULL)
-   {
-      DBG( "Mem error\n" );
-      return false;
-   }   
-   
-   (*ppThisURBList)->mpNext = NULL;
-   (*ppThisURBList)->mpURB = pURB;
-   
-   return true;
+
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   return bReady;
 }
 
 /*===========================================================================
 METHOD:
-   PopFromURBList (Public Method)
+   UserspaceSetIndicationFilter (Public Method)
 
 DESCRIPTION:
-   Remove URB from this client's URB list
-   
-   Caller MUST have lock on mClientMemLock
+   Handler for IOCTL_QMI_SET_INDICATION_FILTER
+      Replaces the list of indication message IDs a client owned by this
+      handle receives, ReadCallback drops the others before copying them
 
-PARAMETERS:
-   pDev           [ I ] - Device specific memory
-   clientID       [ I ] - Requester's client ID
+PARAMETERS
+   pFilpData       [ I ] - Caller's file data
+   arg             [ I ] - Userspace sQMIIoctlIndicationFilter
 
 RETURN VALUE:
-   struct urb - Pointer to requested client's URB
-                NULL for error
+   long - 0 for success
+          Negative errno for failure
 ===========================================================================*/
-struct urb * PopFromURBList( 
-   sGobiUSBNet *      pDev,
-   u16                  clientID )
+long UserspaceSetIndicationFilter(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg )
 {
+   sGobiUSBNet * pDev = pFilpData->mpDev;
+   sQMIIoctlIndicationFilter filter;
    sClientMemList * pClientMem;
-   sURBList * pDelURBList;
-   struct urb * pURB;
+   u16 * pMessageIDs = NULL;
+   u16 * pOldMessageIDs = NULL;
+   unsigned long flags;
+   int clientID;
 
-#ifdef CONFIG_SMP
-   // Verify Lock
-   if (spin_is_locked( &pDev->mQMIDev.mClientMemLock ) == 0)
+   if (copy_from_user( &filter, (void __user *)arg, sizeof( filter ) ) != 0)
    {
-      DBG( "unlocked\n" );
-      BUG();
+      return -EFAULT;
    }
-#endif
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pDev, clientID );
-   if (pClientMem == NULL)
+   if (filter.mReserved != 0 || filter.mCount > QMI_INDICATION_FILTER_MAX)
    {
-      DBG( "Could not find this client's memory 0x%04X\n", clientID );
-      return NULL;
+      return -EINVAL;
    }
 
-   // Remove from list
-   if (pClientMem->mpURBList != NULL)
+   clientID = UserspaceFrameClientID( pFilpData, filter.mClientID );
+   if (clientID < 0 || clientID == (u16)-1)
    {
-      pDelURBList = pClientMem->mpURBList;
-      pClientMem->mpURBList = pClientMem->mpURBList->mpNext;
-      
-      // Copy to output
-      pURB = pDelURBList->mpURB;
-      
-      // Delete memory
-      kfree( pDelURBList );
+      DBG( "Client 0x%04X not owned by this handle\n", filter.mClientID );
+      return -EINVAL;
+   }
 
-      return pURB;
+   if (filter.mpMessageIDs != 0)
+   {
+      // Keep one entry so an empty filter is not mistaken for none
+      pMessageIDs = kmalloc( max_t( u32, filter.mCount, 1 ) * sizeof( u16 ),
+                             GFP_KERNEL );
+      if (pMessageIDs == NULL)
+      {
+         return -ENOMEM;
+      }
+
+      if (copy_from_user( pMessageIDs,
+                          (void __user *)(unsigned long)filter.mpMessageIDs,
+                          filter.mCount * sizeof( u16 ) ) != 0)
+      {
+         kfree( pMessageIDs );
+         return -EFAULT;
+      }
    }
-   else
+
+   // Critical section
+   QMIClientMemLock( pDev, flags );
+
+   pClientMem = FindClientMem( pDev, (u16)clientID );
+   if (pClientMem == NULL)
    {
-      DBG( "No URB's to pop\n" );
-      
-      return NULL;
+      QMIClientMemUnlock( pDev, flags );
+      kfree( pMessageIDs );
+      return -ENXIO;
    }
-}
 
-#ifndef f_dentry
-#define f_dentry f_path.dentry
-#endif
+   pOldMessageIDs = pClientMem->mpIndicationFilter;
+   pClientMem->mpIndicationFilter = pMessageIDs;
+   pClientMem->mIndicationFilterCount = filter.mCount;
 
-/*=========================================================================*/
-// Internal userspace wrappers
-/*=========================================================================*/
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
+
+   kfree( pOldMessageIDs );
+
+   DBG( "0x%04X filters on %u indications\n", clientID, filter.mCount );
+   return 0;
+}
 
 /*===========================================================================
 METHOD:
-   UserspaceunlockedIOCTL (Public Method)
+   UserspaceGetQueueStats (Public Method)
 
 DESCRIPTION:
-   Internal wrapper for Userspace IOCTL interface
+   Handler for IOCTL_QMI_GET_QUEUE_STATS
+      Reports the read queue usage and drop counters of a client owned by
+      this handle
 
 PARAMETERS
-   pFilp        [ I ] - userspace file descriptor
-   cmd          [ I ] - IOCTL command
-   arg          [ I ] - IOCTL argument
+   pFilpData       [ I ] - Caller's file data
+   arg             [I/O] - Userspace sQMIIoctlQueueStats
 
 RETURN VALUE:
    long - 0 for success
-         Negative errno for failure
+          Negative errno for failure
 ===========================================================================*/
-long UserspaceunlockedIOCTL(
-   struct file *     pFilp,
-   unsigned int      cmd, 
-   unsigned long     arg )
+long UserspaceGetQueueStats(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg )
 {
-   int result;
-   u32 devVIDPID;
-
-   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
-
-   if (pFilpData == NULL)
-   {
-      DBG( "Bad file data\n" );
-      return -EBADF;
-   }
-   
-   if (IsDeviceValid( pFilpData->mpDev ) == false)
+   sGobiUSBNet * pDev = pFilpData->mpDev;
+   sQMIIoctlQueueStats stats;
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   int clientID;
+
+   if (copy_from_user( &stats, (void __user *)arg, sizeof( stats ) ) != 0)
    {
-      DBG( "Invalid device! Updating f_ops\n" );
-      pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
-      return -ENXIO;
+      return -EFAULT;
    }
 
-   switch (cmd)
+   if (stats.mReserved != 0)
    {
-      case IOCTL_QMI_GET_SERVICE_FILE:    
-         DBG( "Setting up QMI for service %lu\n", arg );
-         if ((u8)arg == 0)
-         {
-            DBG( "Cannot use QMICTL from userspace\n" );
-            return -EINVAL;
-         }
-
-         // Connection is already setup
-         if (pFilpData->mClientID != (u16)-1)
-         {
-            DBG( "Close the current connection before opening a new one\n" );
-            return -EBADR;
-         }
-         
-         result = GetClientID( pFilpData->mpDev, (u8)arg );
-// it seems QMIWDA only allow one client, if the last CM donot realese it (killed by SIGKILL).
-// can force release it at here
-#if 1
-         if (result < 0 && (u8)arg == QMIWDA)
-         {
-             ReleaseClientID( pFilpData->mpDev, QMIWDA | (1 << 8) );
-             result = GetClientID( pFilpData->mpDev, (u8)arg );
-         }
-#endif
-         if (result < 0)
-         {
-            return result;
-         }
-         pFilpData->mClientID = (u16)result;
-         DBG("pFilpData->mClientID = 0x%x\n", pFilpData->mClientID );
-         return 0;
-         break;
-
+      return -EINVAL;
+   }
 
-      case IOCTL_QMI_GET_DEVICE_VIDPID:
-         if (arg == 0)
-         {
-            DBG( "Bad VIDPID buffer\n" );
-            return -EINVAL;
-         }
-         
-         // Extra verification
-         if (pFilpData->mpDev->mpNetDev == 0)
-         {
-            DBG( "Bad mpNetDev\n" );
-            return -ENOMEM;
-         }
-         if (pFilpData->mpDev->mpNetDev->udev == 0)
-         {
-            DBG( "Bad udev\n" );
-            return -ENOMEM;
-         }
+   clientID = UserspaceFrameClientID( pFilpData, stats.mClientID );
+   if (clientID < 0 || clientID == (u16)-1)
+   {
+      DBG( "Client 0x%04X not owned by this handle\n", stats.mClientID );
+      return -EINVAL;
+   }
 
-         devVIDPID = ((le16_to_cpu( pFilpData->mpDev->mpNetDev->udev->descriptor.idVendor ) << 16)
-                     + le16_to_cpu( pFilpData->mpDev->mpNetDev->udev->descriptor.idProduct ) );
+   // Critical section
+   QMIClientMemLock( pDev, flags );
 
-         result = copy_to_user( (unsigned int *)arg, &devVIDPID, 4 );
-         if (result != 0)
-         {
-            DBG( "Copy to userspace failure %d\n", result );
-         }
+   pClientMem = FindClientMem( pDev, (u16)clientID );
+   if (pClientMem == NULL)
+   {
+      QMIClientMemUnlock( pDev, flags );
+      return -ENXIO;
+   }
 
-         return result;
-                 
-         break;
+   stats.mClientID = (u16)clientID;
+   stats.mReadCount = pClientMem->mReadCount;
+   stats.mReadBytes = pClientMem->mReadBytes;
+   stats.mReadDropped = pClientMem->mReadDropped;
+   stats.mReadExpired = pClientMem->mReadExpired;
 
-      case IOCTL_QMI_GET_DEVICE_MEID:
-         if (arg == 0)
-         {
-            DBG( "Bad MEID buffer\n" );
-            return -EINVAL;
-         }
-         
-         result = copy_to_user( (unsigned int *)arg, &pFilpData->mpDev->mMEID[0], 14 );
-         if (result != 0)
-         {
-            DBG( "Copy to userspace failure %d\n", result );
-         }
+   // End critical section
+   QMIClientMemUnlock( pDev, flags );
 
-         return result;
-                 
-         break;
-         
-      default:
-         return -EBADRQC;       
+   if (copy_to_user( (void __user *)arg, &stats, sizeof( stats ) ) != 0)
+   {
+      return -EFAULT;
    }
+
+   return 0;
 }
 
 /*=========================================================================*/
@@ -2478,6 +8786,12 @@ int UserspaceOpen(
    pFilpData->mClientID = (u16)-1;
    atomic_inc(&pDev->refcount);
    pFilpData->mpDev = pDev;
+   pFilpData->mbBatchMode = false;
+   pFilpData->mExtraClientCount = 0;
+   pFilpData->mpRing = NULL;
+   atomic_set( &pFilpData->mWritesInFlight, 0 );
+   atomic_set( &pFilpData->mWriteError, 0 );
+   init_waitqueue_head( &pFilpData->mWaitQueue );
 
    return 0;
 }
@@ -2594,138 +8908,360 @@ int UserspaceClose( struct file *       pFilp )
       pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
       return -ENXIO;
    }
-   
-   DBG( "0x%04X\n", pFilpData->mClientID );
-   
-   // Disable pFilpData so they can't keep sending read or write 
-   //    should this function hang
-   // Note: memory pointer is still saved in pFilpData to be deleted later
-   pFilp->private_data = NULL;
+   
+   DBG( "0x%04X\n", pFilpData->mClientID );
+   
+   // Disable pFilpData so they can't keep sending read or write 
+   //    should this function hang
+   // Note: memory pointer is still saved in pFilpData to be deleted later
+   pFilp->private_data = NULL;
+
+   // Queued writes still reference pFilpData, they end by their deadline
+   wait_event( pFilpData->mWaitQueue,
+               atomic_read( &pFilpData->mWritesInFlight ) == 0 );
+   spin_lock_irqsave( &pFilpData->mWaitQueue.lock, flags );
+   spin_unlock_irqrestore( &pFilpData->mWaitQueue.lock, flags );
+
+   // The mapping may outlive the handle, it keeps its own reference
+   if (pFilpData->mpRing != NULL)
+   {
+      QMIRingDetach( pFilpData->mpDev, pFilpData->mClientID );
+      QMIRingPut( pFilpData->mpRing );
+      pFilpData->mpRing = NULL;
+   }
+
+   // Clients must stop waking mWaitQueue before pFilpData is freed
+   UserspaceDetachClients( pFilpData );
+
+   for (count = 0; count < pFilpData->mExtraClientCount; count++)
+   {
+      UserspaceReleaseClient( pFilpData->mpDev, 
+                              pFilpData->mExtraClientIDs[count] );
+   }
+   pFilpData->mExtraClientCount = 0;
+
+   if (pFilpData->mClientID != (u16)-1)
+   {
+      UserspaceReleaseClient( pFilpData->mpDev, pFilpData->mClientID );
+      pFilpData->mClientID = (u16)-1;
+   }
+   atomic_dec(&pFilpData->mpDev->refcount);
+      
+   kfree( pFilpData );
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceRead (Public Method)
+
+DESCRIPTION:
+   Userspace read (synchronous)
+      With O_NONBLOCK returns -EAGAIN instead of waiting for data
+      Only the primary client is read, handles with several services
+      use batch mode to see which client each message is for
+
+PARAMETERS
+   pFilp           [ I ] - userspace file descriptor
+   pBuf            [ I ] - read buffer
+   size            [ I ] - size of read buffer
+   pUnusedFpos     [ I ] - (unused) file position
+
+RETURN VALUE:
+   ssize_t - Number of bytes read for success
+             Negative errno for failure
+===========================================================================*/
+ssize_t UserspaceRead( 
+   struct file *          pFilp,
+   char __user *          pBuf, 
+   size_t                 size,
+   loff_t *               pUnusedFpos )
+{
+   int result;
+   void * pReadData = NULL;
+   void * pSmallReadData;
+   u16 readDataSize;
+   unsigned long flags;
+   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
+
+   if (pFilpData == NULL)
+   {
+      DBG( "Bad file data\n" );
+      return -EBADF;
+   }
+
+   if (IsDeviceValid( pFilpData->mpDev ) == false)
+   {
+      DBG( "Invalid device! Updating f_ops\n" );
+      pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
+      return -ENXIO;
+   }
+   
+   if (pFilpData->mClientID == (u16)-1)
+   {
+      DBG( "Client ID must be set before reading 0x%04X\n",
+           pFilpData->mClientID );
+      return -EBADR;
+   }
+
+   if (pFilpData->mbBatchMode == true)
+   {
+      return UserspaceReadBatch( pFilp, pFilpData, pBuf, size );
+   }
+   
+   if ((pFilp->f_flags & O_NONBLOCK) != 0)
+   {
+      // Only take what has already arrived
+      QMIClientMemLock( pFilpData->mpDev, flags );
+      if (PopFromReadMemList( pFilpData->mpDev,
+                              pFilpData->mClientID,
+                              0,
+                              &pReadData,
+                              &readDataSize ) == true)
+      {
+         result = readDataSize;
+      }
+      else
+      {
+         result = -EAGAIN;
+      }
+      QMIClientMemUnlock( pFilpData->mpDev, flags );
+   }
+   else
+   {
+      // Perform synchronous read
+      result = ReadSync( pFilpData->mpDev,
+                         &pReadData,
+                         pFilpData->mClientID,
+                         0 );
+   }
+   if (result <= 0)
+   {
+      return result;
+   }
+   
+   // Discard QMUX header
+   result -= QMUXHeaderSize();
+   pSmallReadData = pReadData + QMUXHeaderSize();
+
+   if (result > size)
+   {
+      DBG( "Read data is too large for amount user has requested\n" );
+      kfree( pReadData );
+      return -EOVERFLOW;
+   }
+
+   DBG(  "pBuf = 0x%p pSmallReadData = 0x%p, result = %d",
+         pBuf, pSmallReadData, result );
+
+   if (copy_to_user( pBuf, pSmallReadData, result ) != 0)
+   {
+      DBG( "Error copying read data to user\n" );
+      result = -EFAULT;
+   }
+   
+   // Reader is responsible for freeing read buffer
+   kfree( pReadData );
+   
+   return result;
+}
+
+/*===========================================================================
+METHOD:
+   UserspaceWrite (Public Method)
+
+DESCRIPTION:
+   Userspace write (synchronous)
+      With O_NONBLOCK the write is queued, see UserspaceWriteAsync
+
+PARAMETERS
+   pFilp           [ I ] - userspace file descriptor
+   pBuf            [ I ] - write buffer
+   size            [ I ] - size of write buffer
+   pUnusedFpos     [ I ] - (unused) file position
+
+RETURN VALUE:
+   ssize_t - Number of bytes read for success
+             Negative errno for failure
+===========================================================================*/
+ssize_t UserspaceWrite(
+   struct file *        pFilp, 
+   const char __user *  pBuf, 
+   size_t               size,
+   loff_t *             pUnusedFpos )
+{
+   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
+
+   if (pFilpData == NULL)
+   {
+      DBG( "Bad file data\n" );
+      return -EBADF;
+   }
+
+   if (IsDeviceValid( pFilpData->mpDev ) == false)
+   {
+      DBG( "Invalid device! Updating f_ops\n" );
+      pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
+      return -ENXIO;
+   }
 
-   if (pFilpData->mClientID != (u16)-1)
+   if (pFilpData->mClientID == (u16)-1)
    {
-      if (pFilpData->mpDev->mbDeregisterQMIDevice)
-         pFilpData->mClientID = (u16)-1; //DeregisterQMIDevice() will release this ClientID
-      else
-      ReleaseClientID( pFilpData->mpDev,
-                       pFilpData->mClientID );
+      DBG( "Client ID must be set before writing 0x%04X\n",
+           pFilpData->mClientID );
+      return -EBADR;
    }
-   atomic_dec(&pFilpData->mpDev->refcount);
-      
-   kfree( pFilpData );
-   return 0;
+
+   if (pFilpData->mbBatchMode == true)
+   {
+      return UserspaceWriteBatch( pFilp, pFilpData, pBuf, size );
+   }
+
+   if ((pFilp->f_flags & O_NONBLOCK) != 0)
+   {
+      return UserspaceWriteAsync( pFilpData, 
+                                  pFilpData->mClientID, 
+                                  pBuf, 
+                                  size );
+   }
+
+   return UserspaceWriteSync( pFilpData, pFilpData->mClientID, pBuf, size );
 }
 
 /*===========================================================================
 METHOD:
-   UserspaceRead (Public Method)
+   UserspacePoll (Public Method)
 
 DESCRIPTION:
-   Userspace read (synchronous)
+   Used to determine if read/write operations are possible without blocking
 
 PARAMETERS
-   pFilp           [ I ] - userspace file descriptor
-   pBuf            [ I ] - read buffer
-   size            [ I ] - size of read buffer
-   pUnusedFpos     [ I ] - (unused) file position
+   pFilp              [ I ] - userspace file descriptor
+   pPollTable         [I/O] - Wait object to notify the kernel when data 
+                              is ready
 
 RETURN VALUE:
-   ssize_t - Number of bytes read for success
-             Negative errno for failure
+   unsigned int - bitmask of what operations can be done immediately
 ===========================================================================*/
-ssize_t UserspaceRead( 
-   struct file *          pFilp,
-   char __user *          pBuf, 
-   size_t                 size,
-   loff_t *               pUnusedFpos )
+unsigned int UserspacePoll(
+   struct file *                  pFilp,
+   struct poll_table_struct *     pPollTable )
 {
-   int result;
-   void * pReadData = NULL;
-   void * pSmallReadData;
    sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
+   sClientMemList * pClientMem;
+   u16 clientIDs[QMI_FILP_MAX_SERVICES + 1];
+   unsigned long flags;
+   unsigned long status = 0;
+   int count;
+   int i;
 
    if (pFilpData == NULL)
    {
       DBG( "Bad file data\n" );
-      return -EBADF;
+      return POLLERR;
    }
 
    if (IsDeviceValid( pFilpData->mpDev ) == false)
    {
       DBG( "Invalid device! Updating f_ops\n" );
       pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
-      return -ENXIO;
+      return POLLERR;
    }
-   
+
+   if (pFilpData->mpDev->mbDeregisterQMIDevice)
+   {
+      DBG( "DeregisterQMIDevice ing\n" );
+      return POLLHUP | POLLERR;
+   }
+
    if (pFilpData->mClientID == (u16)-1)
    {
-      DBG( "Client ID must be set before reading 0x%04X\n",
+      DBG( "Client ID must be set before polling 0x%04X\n",
            pFilpData->mClientID );
-      return -EBADR;
+      return POLLERR;
    }
-   
-   // Perform synchronous read
-   result = ReadSync( pFilpData->mpDev,
-                      &pReadData,
-                      pFilpData->mClientID,
-                      0 );
-   if (result <= 0)
+
+   // Critical section
+   QMIClientMemLock( pFilpData->mpDev, flags );
+
+   // Get this client's memory location
+   pClientMem = FindClientMem( pFilpData->mpDev, 
+                               pFilpData->mClientID );
+   if (pClientMem == NULL)
    {
-      return result;
+      DBG( "Could not find this client's memory 0x%04X\n",
+           pFilpData->mClientID );
+
+      QMIClientMemUnlock( pFilpData->mpDev, flags );
+      return POLLERR;
    }
    
-   // Discard QMUX header
-   result -= QMUXHeaderSize();
-   pSmallReadData = pReadData + QMUXHeaderSize();
+   // Every client owned by this handle wakes the handle's queue
+   poll_wait( pFilp, &pFilpData->mWaitQueue, pPollTable );
 
-   if (result > size)
+   if (pClientMem->mpRing != NULL && QMIRingEmpty( pClientMem->mpRing ) == false)
    {
-      DBG( "Read data is too large for amount user has requested\n" );
-      kfree( pReadData );
-      return -EOVERFLOW;
+      status |= POLLIN | POLLRDNORM;
    }
 
-   DBG(  "pBuf = 0x%p pSmallReadData = 0x%p, result = %d",
-         pBuf, pSmallReadData, result );
+   count = UserspaceClientIDs( pFilpData, clientIDs );
+   for (i = 0; i < count; i++)
+   {
+      if (PeekReadMemListSize( pFilpData->mpDev, clientIDs[i] ) != 0)
+      {
+         status |= POLLIN | POLLRDNORM;
+         break;
+      }
+   }
 
-   if (copy_to_user( pBuf, pSmallReadData, result ) != 0)
+   // End critical section
+   QMIClientMemUnlock( pFilpData->mpDev, flags );
+
+   // Writable while below the in-flight limit
+   if (atomic_read( &pFilpData->mWritesInFlight ) < UserspaceWriteLimit())
    {
-      DBG( "Error copying read data to user\n" );
-      result = -EFAULT;
+      status |= POLLOUT | POLLWRNORM;
    }
-   
-   // Reader is responsible for freeing read buffer
-   kfree( pReadData );
-   
-   return result;
+
+   if (atomic_read( &pFilpData->mWriteError ) != 0)
+   {
+      status |= POLLERR;
+   }
+
+   return status;
 }
 
 /*===========================================================================
 METHOD:
-   UserspaceWrite (Public Method)
+   UserspaceMmap (Public Method)
 
 DESCRIPTION:
-   Userspace write (synchronous)
+   Map a shared message ring for this handle's client
+      The first page holds an sQMIRingHeader, the RX ring and, with
+      QMI_RING_PGOFF_RXTX, an equally sized TX ring follow it.
+      Messages are delivered to the RX ring instead of read() from now on
 
 PARAMETERS
    pFilp           [ I ] - userspace file descriptor
-   pBuf            [ I ] - write buffer
-   size            [ I ] - size of write buffer
-   pUnusedFpos     [ I ] - (unused) file position
+   pVMA            [ I ] - Mapping being created
 
 RETURN VALUE:
-   ssize_t - Number of bytes read for success
-             Negative errno for failure
+   int - 0 for success
+         Negative errno for failure
 ===========================================================================*/
-ssize_t UserspaceWrite(
-   struct file *        pFilp, 
-   const char __user *  pBuf, 
-   size_t               size,
-   loff_t *             pUnusedFpos )
+int UserspaceMmap(
+   struct file *              pFilp,
+   struct vm_area_struct *    pVMA )
 {
-   int status;
-   void * pWriteBuffer;
    sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
+   sClientMemList * pClientMem;
+   sQMIRing * pRing;
+   unsigned long length = pVMA->vm_end - pVMA->vm_start;
+   unsigned long ringSize;
+   void * pDelData;
+   u16 dataSize;
+   unsigned long flags;
+   int result;
 
    if (pFilpData == NULL)
    {
@@ -2742,136 +9278,465 @@ ssize_t UserspaceWrite(
 
    if (pFilpData->mClientID == (u16)-1)
    {
-      DBG( "Client ID must be set before writing 0x%04X\n",
+      DBG( "Client ID must be set before mapping 0x%04X\n",
            pFilpData->mClientID );
       return -EBADR;
    }
-   
-   // Copy data from user to kernel space
-   pWriteBuffer = kmalloc( size + QMUXHeaderSize(), GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+
+   if (pFilpData->mpRing != NULL)
+   {
+      return -EBUSY;
+   }
+
+   if (length <= PAGE_SIZE)
+   {
+      return -EINVAL;
+   }
+
+   ringSize = length - PAGE_SIZE;
+   if (pVMA->vm_pgoff == QMI_RING_PGOFF_RXTX)
+   {
+      ringSize /= 2;
+   }
+   else if (pVMA->vm_pgoff != QMI_RING_PGOFF_RX)
+   {
+      return -EINVAL;
+   }
+
+   if (is_power_of_2( ringSize ) == 0
+   ||  ringSize < PAGE_SIZE
+   ||  ringSize > QMI_RING_MAX_SIZE)
+   {
+      DBG( "Bad ring size %lu\n", ringSize );
+      return -EINVAL;
+   }
+
+   pRing = kzalloc( sizeof( sQMIRing ), GFP_KERNEL );
+   if (pRing == NULL)
+   {
+      return -ENOMEM;
+   }
+
+   pRing->mpHeader = vmalloc_user( length );
+   if (pRing->mpHeader == NULL)
+   {
+      kfree( pRing );
+      return -ENOMEM;
+   }
+
+   // This first reference belongs to the mapping
+   kref_init( &pRing->mRefCount );
+   mutex_init( &pRing->mTxLock );
+   pRing->mpRxData = (u8 *)pRing->mpHeader + PAGE_SIZE;
+   pRing->mRxSize = ringSize;
+   pRing->mpHeader->mRxSize = ringSize;
+   if (pVMA->vm_pgoff == QMI_RING_PGOFF_RXTX)
+   {
+      pRing->mpTxData = pRing->mpRxData + ringSize;
+      pRing->mTxSize = ringSize;
+      pRing->mpHeader->mTxSize = ringSize;
+   }
+
+   // Critical section
+   QMIClientMemLock( pFilpData->mpDev, flags );
+
+   pClientMem = FindClientMem( pFilpData->mpDev, pFilpData->mClientID );
+   if (pClientMem == NULL || pClientMem->mpRing != NULL)
+   {
+      QMIClientMemUnlock( pFilpData->mpDev, flags );
+      QMIRingPut( pRing );
+      return -EBUSY;
+   }
+
+   QMIRingGet( pRing );
+   pClientMem->mpRing = pRing;
+
+   // Move anything already queued so ordering is kept
+   while (PopFromReadMemList( pFilpData->mpDev,
+                              pFilpData->mClientID,
+                              0,
+                              &pDelData,
+                              &dataSize ) == true)
+   {
+      QMIRingWrite( pRing, pFilpData->mClientID, pDelData, dataSize );
+      kfree( pDelData );
+   }
+
+   // End critical section
+   QMIClientMemUnlock( pFilpData->mpDev, flags );
+
+   result = remap_vmalloc_range( pVMA, pRing->mpHeader, 0 );
+   if (result != 0)
+   {
+      DBG( "remap_vmalloc_range failed %d\n", result );
+      QMIRingDetach( pFilpData->mpDev, pFilpData->mClientID );
+      QMIRingPut( pRing );
+      return result;
+   }
+
+   pVMA->vm_ops = &QMIRingVmOps;
+   pVMA->vm_private_data = pRing;
+
+   QMIRingGet( pRing );
+   pFilpData->mpRing = pRing;
+
+   return 0;
+}
+
+/*=========================================================================*/
+// Sysfs attributes
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMISysfsGetDev (Public Method)
+
+DESCRIPTION:
+   Find the device specific memory behind a sysfs attribute
+
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+
+RETURN VALUE:
+   sGobiUSBNet * - Device specific memory
+                   NULL if the interface is not bound
+===========================================================================*/
+sGobiUSBNet * QMISysfsGetDev( struct device * pDevice )
+{
+   struct usb_interface * pIntf = to_usb_interface( pDevice );
+   struct usbnet * pNet;
+
+#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,23 ))
+   pNet = usb_get_intfdata( pIntf );
+#else
+   pNet = (struct usbnet *)pIntf->dev.platform_data;
+#endif
+
+   if (pNet == NULL)
+   {
+      return NULL;
+   }
+
+   return (sGobiUSBNet *)pNet->data[0];
+}
+
+/*===========================================================================
+METHOD:
+   QMIReadyMsShow (Public Method)
+
+DESCRIPTION:
+   Show how long QMIReady waited for the first QMICTL response
+
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being read
+   pBuf        [ O ] - Output page
+
+RETURN VALUE:
+   ssize_t - Characters written
+===========================================================================*/
+ssize_t QMIReadyMsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf )
+{
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+
+   if (pDev == NULL)
+   {
+      return -ENODEV;
+   }
+
+   return scnprintf( pBuf, PAGE_SIZE, "%u\n", pDev->mQMICTLReadyMs );
+}
+
+/*===========================================================================
+METHOD:
+   QMIProbeReadyMsShow (Public Method)
+
+DESCRIPTION:
+   Show how long QMI bring-up took from RegisterQMIDevice, 0 until ready
+
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being read
+   pBuf        [ O ] - Output page
+
+RETURN VALUE:
+   ssize_t - Characters written
+===========================================================================*/
+ssize_t QMIProbeReadyMsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf )
+{
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+
+   if (pDev == NULL)
+   {
+      return -ENODEV;
+   }
+
+   return scnprintf( pBuf, PAGE_SIZE, "%u\n", pDev->mQMIReadyMs );
+}
+
+/*===========================================================================
+METHOD:
+   QMICtrlStatsShow (Public Method)
+
+DESCRIPTION:
+   Show control endpoint queueing statistics, one line per priority class:
+   class requests queued depth total_wait_us max_wait_us
+
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being read
+   pBuf        [ O ] - Output page
+
+RETURN VALUE:
+   ssize_t - Characters written
+===========================================================================*/
+ssize_t QMICtrlStatsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf )
+{
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+   sQMICtrlStats stats[QMI_CTRL_CLASSES];
+   unsigned long flags;
+   ssize_t count = 0;
+   int class;
+
+   if (pDev == NULL)
    {
-      return -ENOMEM;
+      return -ENODEV;
    }
-   status = copy_from_user( pWriteBuffer + QMUXHeaderSize(), pBuf, size );
-   if (status != 0)
+
+   // Consistent snapshot
+   spin_lock_irqsave( &pDev->mQMIDev.mCtrlLock, flags );
+   memcpy( stats, pDev->mQMIDev.mCtrlStats, sizeof( stats ) );
+   spin_unlock_irqrestore( &pDev->mQMIDev.mCtrlLock, flags );
+
+   for (class = 0; class < QMI_CTRL_CLASSES; class++)
    {
-      DBG( "Unable to copy data from userspace %d\n", status );
-      kfree( pWriteBuffer );
-      return status;
+      count += scnprintf( pBuf + count,
+                          PAGE_SIZE - count,
+                          "%d %u %u %u %llu %u\n",
+                          class,
+                          stats[class].mRequests,
+                          stats[class].mQueued,
+                          stats[class].mDepth,
+                          (unsigned long long)stats[class].mTotalWaitUs,
+                          stats[class].mMaxWaitUs );
    }
 
-   status = WriteSync( pFilpData->mpDev,
-                       pWriteBuffer, 
-                       size + QMUXHeaderSize(),
-                       pFilpData->mClientID );
+   return count;
+}
+
+/*===========================================================================
+METHOD:
+   QMIXactionTimeoutsShow (Public Method)
 
-   kfree( pWriteBuffer );
-   
-   // On success, return requested size, not full QMI reqest size
-   if (status == size + QMUXHeaderSize())
+DESCRIPTION:
+   Show expired transactions per QMI service, one "service count" line
+   for each service that had any
+
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being read
+   pBuf        [ O ] - Output page
+
+RETURN VALUE:
+   ssize_t - Characters written
+===========================================================================*/
+ssize_t QMIXactionTimeoutsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf )
+{
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+   ssize_t count = 0;
+   int service;
+   int timeouts;
+
+   if (pDev == NULL)
    {
-      return size;
+      return -ENODEV;
    }
-   else
+
+   for (service = 0; service < QMI_SERVICE_COUNT; service++)
    {
-      return status;
+      timeouts = atomic_read( &pDev->mQMIDev.mXactionTimeouts[service] );
+      if (timeouts == 0)
+      {
+         continue;
+      }
+
+      count += scnprintf( pBuf + count,
+                          PAGE_SIZE - count,
+                          "0x%02x %d\n",
+                          service,
+                          timeouts );
    }
+
+   return count;
 }
 
+#ifdef QMI_CLIENT_MEM_STATS
+
 /*===========================================================================
 METHOD:
-   UserspacePoll (Public Method)
+   QMIClientMemStatsShow (Public Method)
 
 DESCRIPTION:
-   Used to determine if read/write operations are possible without blocking
+   Show mClientMemLock wait and hold times and client memory operation
+   counts, one "name value" pair per line
 
-PARAMETERS
-   pFilp              [ I ] - userspace file descriptor
-   pPollTable         [I/O] - Wait object to notify the kernel when data 
-                              is ready
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being read
+   pBuf        [ O ] - Output page
 
 RETURN VALUE:
-   unsigned int - bitmask of what operations can be done immediately
+   ssize_t - Characters written
 ===========================================================================*/
-unsigned int UserspacePoll(
-   struct file *                  pFilp,
-   struct poll_table_struct *     pPollTable )
+ssize_t QMIClientMemStatsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf )
 {
-   sQMIFilpStorage * pFilpData = (sQMIFilpStorage *)pFilp->private_data;
-   sClientMemList * pClientMem;
+   static const char * opNames[QMI_MEM_OPS] =
+   {
+      "find_client",
+      "add_read",
+      "pop_read",
+      "add_notify",
+      "notify_pop",
+      "add_urb",
+      "pop_urb"
+   };
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+   sQMIClientMemStats stats;
    unsigned long flags;
+   ssize_t count;
+   int op;
 
-   // Always ready to write
-   unsigned long status = POLLOUT | POLLWRNORM;
-
-   if (pFilpData == NULL)
+   if (pDev == NULL)
    {
-      DBG( "Bad file data\n" );
-      return POLLERR;
+      return -ENODEV;
    }
 
-   if (IsDeviceValid( pFilpData->mpDev ) == false)
-   {
-      DBG( "Invalid device! Updating f_ops\n" );
-      pFilp->f_op = pFilp->f_dentry->d_inode->i_fop;
-      return POLLERR;
-   }
+   // Consistent snapshot, not counted as a client memory hold
+   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   stats = pDev->mQMIDev.mClientMemStats;
+   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
 
-   if (pFilpData->mpDev->mbDeregisterQMIDevice)
-   {
-      DBG( "DeregisterQMIDevice ing\n" );
-      return POLLHUP | POLLERR;
-   }
+   count = scnprintf( pBuf,
+                      PAGE_SIZE,
+                      "acquired %llu\n"
+                      "total_wait_ns %llu\n"
+                      "max_wait_ns %llu\n"
+                      "total_hold_ns %llu\n"
+                      "max_hold_ns %llu\n",
+                      (unsigned long long)stats.mAcquired,
+                      (unsigned long long)stats.mTotalWaitNs,
+                      (unsigned long long)stats.mMaxWaitNs,
+                      (unsigned long long)stats.mTotalHoldNs,
+                      (unsigned long long)stats.mMaxHoldNs );
+
+   for (op = 0; op < QMI_MEM_OPS; op++)
+   {
+      count += scnprintf( pBuf + count,
+                          PAGE_SIZE - count,
+                          "%s %llu\n",
+                          opNames[op],
+                          (unsigned long long)stats.mOps[op] );
+   }
+
+   return count;
+}
 
-   if (pFilpData->mClientID == (u16)-1)
-   {
-      DBG( "Client ID must be set before polling 0x%04X\n",
-           pFilpData->mClientID );
-      return POLLERR;
-   }
+/*===========================================================================
+METHOD:
+   QMIClientMemStatsStore (Public Method)
 
-   // Critical section
-   spin_lock_irqsave( &pFilpData->mpDev->mQMIDev.mClientMemLock, flags );
+DESCRIPTION:
+   Reset mClientMemLock and client memory statistics, any write will do
 
-   // Get this client's memory location
-   pClientMem = FindClientMem( pFilpData->mpDev, 
-                               pFilpData->mClientID );
-   if (pClientMem == NULL)
-   {
-      DBG( "Could not find this client's memory 0x%04X\n",
-           pFilpData->mClientID );
+PARAMETERS:
+   pDevice     [ I ] - Interface's struct device
+   pAttr       [ I ] - Attribute being written
+   pBuf        [ I ] - Written data, ignored
+   count       [ I ] - Size of pBuf
 
-      spin_unlock_irqrestore( &pFilpData->mpDev->mQMIDev.mClientMemLock, 
-                              flags );
-      return POLLERR;
-   }
-   
-   poll_wait( pFilp, &pClientMem->mWaitQueue, pPollTable );
+RETURN VALUE:
+   ssize_t - count for success
+             Negative errno for failure
+===========================================================================*/
+ssize_t QMIClientMemStatsStore(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   const char *               pBuf,
+   size_t                     count )
+{
+   sGobiUSBNet * pDev = QMISysfsGetDev( pDevice );
+   unsigned long flags;
 
-   if (pClientMem->mpList != NULL)
+   if (pDev == NULL)
    {
-      status |= POLLIN | POLLRDNORM;
+      return -ENODEV;
    }
 
-   // End critical section
-   spin_unlock_irqrestore( &pFilpData->mpDev->mQMIDev.mClientMemLock, flags );
+   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   memset( &pDev->mQMIDev.mClientMemStats, 
+           0, 
+           sizeof( pDev->mQMIDev.mClientMemStats ) );
+   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
 
-   // Always ready to write 
-   return (status | POLLOUT | POLLWRNORM);
+   return count;
 }
 
+#endif
+
+static DEVICE_ATTR( ready_ms, S_IRUGO, QMIReadyMsShow, NULL );
+static DEVICE_ATTR( probe_to_ready_ms, S_IRUGO, QMIProbeReadyMsShow, NULL );
+static DEVICE_ATTR( ctrl_queue_stats, S_IRUGO, QMICtrlStatsShow, NULL );
+static DEVICE_ATTR( xaction_timeouts, S_IRUGO, QMIXactionTimeoutsShow, NULL );
+#ifdef QMI_CLIENT_MEM_STATS
+static DEVICE_ATTR( client_mem_stats, 
+                    S_IRUGO | S_IWUSR, 
+                    QMIClientMemStatsShow, 
+                    QMIClientMemStatsStore );
+#endif
+
+static struct attribute * QMIDeviceAttrs[] =
+{
+   &dev_attr_ready_ms.attr,
+   &dev_attr_probe_to_ready_ms.attr,
+   &dev_attr_ctrl_queue_stats.attr,
+   &dev_attr_xaction_timeouts.attr,
+#ifdef QMI_CLIENT_MEM_STATS
+   &dev_attr_client_mem_stats.attr,
+#endif
+   NULL
+};
+
+// Published as <interface>/qmi/
+static struct attribute_group QMIDeviceAttrGroup =
+{
+   .name  = "qmi",
+   .attrs = QMIDeviceAttrs,
+};
+
 /*=========================================================================*/
 // Initializer and destructor
 /*=========================================================================*/
 int QMICTLSyncProc(sGobiUSBNet *pDev)
 {
-   void *pWriteBuffer;
+   sQMIXaction *pXaction;
    void *pReadBuffer;
    int result;
-   u16 writeBufferSize;
    u16 readBufferSize;
-   u8 transactionID;
    unsigned long flags;
 
    if (IsDeviceValid( pDev ) == false)
@@ -2880,41 +9745,31 @@ int QMICTLSyncProc(sGobiUSBNet *pDev)
       return -EFAULT;
    }
 
-   writeBufferSize= QMICTLSyncReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+   pXaction = QMIXactionAlloc( pDev, 
+                               QMICTL, 
+                               QMICTLSyncReqSize(), 
+                               GFP_KERNEL );
+   if (pXaction == NULL)
    {
       return -ENOMEM;
    }
 
-   transactionID = QMIXactionIDGet(pDev);
-
    /* send a QMI_CTL_SYNC_REQ (0x0027) */
-   result = QMICTLSyncReq( pWriteBuffer,
-                           writeBufferSize,
-                           transactionID );
-   if (result < 0)
-   {
-      kfree( pWriteBuffer );
-      return result;
-   }
-
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       QMICTL );
-
+   result = QMICTLSyncReq( pXaction->mpWriteBuffer,
+                           pXaction->mWriteBufferSize,
+                           pXaction->mTransactionID );
    if (result < 0)
    {
-      kfree( pWriteBuffer );
+      QMIXactionPut( pXaction );
       return result;
    }
 
    // QMI CTL Sync Response
-   result = ReadSync( pDev,
-                      &pReadBuffer,
-                      QMICTL,
-                      transactionID );
+   result = QMIXactionSync( pXaction,
+                            &pReadBuffer,
+                            QMI_XACTION_TIMEOUT_MS );
+   QMIXactionPut( pXaction );
+
    if (result < 0)
    {
       return result;
@@ -2935,7 +9790,7 @@ int QMICTLSyncProc(sGobiUSBNet *pDev)
 
 #if 1 //free these ununsed qmi response, or when these transactionID re-used, they will be regarded as qmi response of the qmi request that have same transactionID
    // Enter critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
 
    // Free any unread data
    while (PopFromReadMemList( pDev, QMICTL, 0, &pReadBuffer, &readBufferSize) == true) {	
@@ -2943,24 +9798,38 @@ int QMICTLSyncProc(sGobiUSBNet *pDev)
    }
    
    // End critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );    
+   QMIClientMemUnlock( pDev, flags );    
 #endif
   
    // Success
    return 0;
 }
 
-static int qmi_sync_thread(void *data) {
-    sGobiUSBNet * pDev = (sGobiUSBNet *)data;
-    int result = 0;
+/*===========================================================================
+METHOD:
+   QMIDeviceBringUp (Public Method)
+
+DESCRIPTION:
+   Wait for QMI, sync QMICTL, set up the data path and the WDS callback
+   Used by both the synchronous probe and qmi_sync_thread
+
+PARAMETERS:
+   pDev     [ I ] - Device specific memory
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+int QMIDeviceBringUp( sGobiUSBNet * pDev )
+{
+   int result;
 
-#if 1  
    // Device is not ready for QMI connections right away
    //   Wait up to 30 seconds before failing
    if (QMIReady( pDev, 30000 ) == false)
    {
       DBG( "Device unresponsive to QMI\n" );
-      goto __qmi_sync_finished;
+      return -ETIMEDOUT;
    }
 
    // Initiate QMI CTL Sync Procedure
@@ -2969,61 +9838,60 @@ static int qmi_sync_thread(void *data) {
    if (result != 0)
    {
       DBG( "QMI CTL Sync Procedure Error\n" );
-      goto __qmi_sync_finished;
+      return result;
    }
    else
    {
       DBG( "QMI CTL Sync Procedure Successful\n" );
    }
 
-   // Setup Data Format
-   result = QMIWDASetDataFormat (pDev);
+   // Setup Data Format and Bind Mux Data Ports
+   result = QMISetupDataPath( pDev );
    if (result != 0)
    {
-      goto __qmi_sync_finished;
+      DBG( "QMISetupDataPath result %d\n", result );
+      return result;
    }
 
    // Setup WDS callback
    result = SetupQMIWDSCallback( pDev );
    if (result != 0)
    {
-      goto __qmi_sync_finished;
+      return result;
    }
 
-   // Fill MEID for device
-   result = QMIDMSGetMEID( pDev );
-   if (result != 0)
-   {
-      goto __qmi_sync_finished;
-   }
+   pDev->mQMIReadyMs = jiffies_to_msecs( jiffies - pDev->mQMIProbeTime );
+   INFO( "QMI ready %u ms after probe\n", pDev->mQMIReadyMs );
 
-   //Bind Mux Data Port Pre
+   // Fill the client pool in the background
+   if (QMIClientPoolSize() > 0)
    {
-      int i =1;
-      for(i=1;i<9;i++)
-      {
-         result = QMIWDSBindMuxDataPre(pDev, i);
-         if (result != 0)
-         {
-            DBG( "QMIWDSBindMuxDataPre result %d %d-%s\n", i, result, __func__);
-            goto __qmi_sync_finished;
-         }
-      }
+      schedule_work( &pDev->mQMIDev.mClientPoolWork );
    }
 
-   //Bind Mux Data Port
-   result = QMIWDSBindMuxData(pDev);
-   if (result != 0)
-   {
-      DBG( "QMIWDSBindMuxData result %d-%s\n", result, __func__);
-      goto __qmi_sync_finished;
-   }
+   return 0;
+}
 
-#endif
+static int qmi_sync_thread(void *data) {
+    sGobiUSBNet * pDev = (sGobiUSBNet *)data;
+    int result = 0;
 
-__qmi_sync_finished:
+   result = QMIDeviceBringUp( pDev );
+
+   // Userspace may open the device now
    pDev->mbQMIReady = true;
    complete_all(&pDev->mQMIReadyCompletion);
+
+   // MEID is not needed to bring the device up, fill it in afterwards
+   if (result == 0 && pDev->mbDeregisterQMIDevice == false)
+   {
+      result = QMIDMSGetMEID( pDev );
+   }
+
+   // DeregisterQMIDevice waits for this before tearing the engine down,
+   //    our reference keeps pDev itself alive until the decrement below
+   complete( &pDev->mQMISyncDone );
+
    if (atomic_dec_and_test(&pDev->refcount)) {
       kfree( pDev );
    }
@@ -3060,6 +9928,35 @@ int RegisterQMIDevice( sGobiUSBNet * pDev )
  
    pDev->mbQMIValid = true;
    pDev->mbDeregisterQMIDevice = false;
+   pDev->mQMIProbeTime = jiffies;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+   init_usb_anchor( &pDev->mQMIDev.mXactionAnchor );
+#endif
+   INIT_WORK( &pDev->mQMIDev.mClientPoolWork, QMIClientPoolWork );
+   spin_lock_init( &pDev->mQMIDev.mXactionsLiveLock );
+   pDev->mQMIDev.mXactionsLive = 0;
+   QMICtrlInit( pDev );
+   QMICtrlURBPoolInit( pDev );
+   QMILatencyInit( pDev );
+
+   result = QMIRxInit( pDev );
+   if (result != 0)
+   {
+      pDev->mbQMIValid = false;
+      return result;
+   }
+
+   // Not fatal, the attributes are informational only
+   result = sysfs_create_group( &pDev->mpIntf->dev.kobj, &QMIDeviceAttrGroup );
+   if (result != 0)
+   {
+      DBG( "unable to create sysfs attributes %d\n", result );
+   }
+   else
+   {
+      pDev->mQMIDev.mbSysfsCreated = true;
+   }
 
    // Set up for QMICTL
    //    (does not send QMI message, just sets up memory)
@@ -3100,8 +9997,11 @@ int RegisterQMIDevice( sGobiUSBNet * pDev )
       atomic_inc(&pDev->refcount);
       init_completion(&pDev->mQMIReadyCompletion);
       pDev->mbQMIReady = false;
+      init_completion( &pDev->mQMISyncDone );
+      pDev->mbQMISyncThread = true;
       qmi_sync_task = kthread_run(qmi_sync_thread, (void *)pDev, "qmi_sync/%d", pDev->mpNetDev->udev->devnum);
        if (IS_ERR(qmi_sync_task)) {
+         pDev->mbQMISyncThread = false;
          atomic_dec(&pDev->refcount);
          DBG( "Create qmi_sync_thread fail\n" );
          return PTR_ERR(qmi_sync_task);
@@ -3109,40 +10009,11 @@ int RegisterQMIDevice( sGobiUSBNet * pDev )
       goto __register_chardev_qccmi;
    }
    
-   // Device is not ready for QMI connections right away
-   //   Wait up to 30 seconds before failing
-   if (QMIReady( pDev, 30000 ) == false)
-   {
-      DBG( "Device unresponsive to QMI\n" );
-      return -ETIMEDOUT;
-   }
-
-   // Initiate QMI CTL Sync Procedure
-   DBG( "Sending QMI CTL Sync Request\n" );
-   result = QMICTLSyncProc(pDev);
+   result = QMIDeviceBringUp( pDev );
    if (result != 0)
    {
-      DBG( "QMI CTL Sync Procedure Error\n" );
       return result;
    }
-   else
-   {
-      DBG( "QMI CTL Sync Procedure Successful\n" );
-   }
-
-   // Setup Data Format
-   result = QMIWDASetDataFormat (pDev);
-   if (result != 0)
-   {
-       return result;
-   }
-
-   // Setup WDS callback
-   result = SetupQMIWDSCallback( pDev );
-   if (result != 0)
-   {
-	  return result;
-   }
 
    // Fill MEID for device
    result = QMIDMSGetMEID( pDev );
@@ -3151,28 +10022,6 @@ int RegisterQMIDevice( sGobiUSBNet * pDev )
       return result;
    }
 
-   //Bind Mux Data Port Pre
-   {
-      int i =1;
-      for(i=1;i<9;i++)
-      {
-         result = QMIWDSBindMuxDataPre(pDev, i);
-         if (result != 0)
-         {
-            DBG( "QMIWDSBindMuxDataPre result %d %d-%s\n", i, result, __func__);
-            return result;
-         }
-      }
-   }
-
-   //Bind Mux Data Port
-   result = QMIWDSBindMuxData(pDev);
-   if (result != 0)
-   {
-      DBG( "QMIWDSBindMuxData result %d\n", result);
-      return result;
-   }
-
 __register_chardev_qccmi:
    // allocate and fill devno with numbers
    result = alloc_chrdev_region( &devno, 0, 1, "qcqmi" );
@@ -3233,6 +10082,8 @@ __register_chardev_qccmi:
    
    pDev->mQMIDev.mDevNum = devno;
 
+   QMILatencyDebugfsInit( pDev, GobiQMIIndex );
+
    // Success
    return 0;
 }
@@ -3273,32 +10124,80 @@ void DeregisterQMIDevice( sGobiUSBNet * pDev )
 
    pDev->mbDeregisterQMIDevice = true;
 
+   // qmi_sync_thread still sends requests after QMI became ready,
+   //    wait for it before anything it uses is torn down
+   if (pDev->mbQMISyncThread == true)
+   {
+      wait_for_completion( &pDev->mQMISyncDone );
+      pDev->mbQMISyncThread = false;
+   }
+
+   // Pool refills allocate clients, stop them before releasing
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,22 ))
+   cancel_work_sync( &pDev->mQMIDev.mClientPoolWork );
+#else
+   flush_scheduled_work();
+#endif
+
    // Release all clients
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
    while (pDev->mQMIDev.mpClientMemList != NULL)
    {
       u16 mClientID = pDev->mQMIDev.mpClientMemList->mClientID;
+
+      // Handles owning this client poll on their own queue
+      if (pDev->mQMIDev.mpClientMemList->mpOwnerWaitQueue != NULL)
+      {
+         wake_up_interruptible_sync( 
+            pDev->mQMIDev.mpClientMemList->mpOwnerWaitQueue );
+      }
+
       if (waitqueue_active(&pDev->mQMIDev.mpClientMemList->mWaitQueue)) {
          DBG("WaitQueue 0x%04X\n", mClientID);
          wake_up_interruptible_sync( &pDev->mQMIDev.mpClientMemList->mWaitQueue );
-         spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );      
+         QMIClientMemUnlock( pDev, flags );      
          msleep(10);
-         spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+         QMIClientMemLock( pDev, flags );
          continue;
       }
 
       DBG( "release 0x%04X\n", pDev->mQMIDev.mpClientMemList->mClientID );
    
-      spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemUnlock( pDev, flags );
       ReleaseClientID( pDev, mClientID );
       // NOTE: pDev->mQMIDev.mpClientMemList will 
       //       be updated in ReleaseClientID()
-      spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+      QMIClientMemLock( pDev, flags );
    }
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemUnlock( pDev, flags );
+
+   // Queued writes were never submitted, anchored ones must be given
+   //    back before the anchor is emptied
+   QMICtrlFlush( pDev );
 
-   // Stop all reads
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+   // Transactions were failed with their clients, flush their writes
+   usb_kill_anchored_urbs( &pDev->mQMIDev.mXactionAnchor );
+#endif
+
+   // Stop all reads, then let the read worker finish what was queued
    KillRead( pDev );
+   QMIRxDestroy( pDev );
+   QMILatencyDestroy( pDev );
+
+   // Answers belong to this modem instance
+   QMICacheFlush( pDev );
+   QMIDedupFlush( pDev );
+
+   // Expiring deadlines and late puts still reach the URB pool and pDev
+   QMIXactionDrain( pDev );
+   QMICtrlURBPoolDestroy( pDev );
+
+   if (pDev->mQMIDev.mbSysfsCreated == true)
+   {
+      sysfs_remove_group( &pDev->mpIntf->dev.kobj, &QMIDeviceAttrGroup );
+      pDev->mQMIDev.mbSysfsCreated = false;
+   }
 
    pDev->mbQMIValid = false;
 
@@ -3401,20 +10300,56 @@ void DeregisterQMIDevice( sGobiUSBNet * pDev )
    
    unregister_chrdev_region( pDev->mQMIDev.mDevNum, 1 );
 
-   return;
+   return;
+}
+
+/*=========================================================================*/
+// Driver level client management
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   QMIReadyCallback (Public Method)
+
+DESCRIPTION:
+   Completion callback for QMICTL READY requests sent by QMIReady
+   Any response means the modem's QMI service is up
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   result         [ I ] - Response size or negative errno
+   pReadBuffer    [ I ] - Response buffer, owned by the callback
+   pData          [ I ] - Unused
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void QMIReadyCallback(
+   sGobiUSBNet *     pDev,
+   int               result,
+   void *            pReadBuffer,
+   void *            pData )
+{
+   // We don't care about the contents
+   kfree( pReadBuffer );
+
+   if (result >= 0)
+   {
+      complete( &pDev->mQMIDev.mCTLReady );
+   }
 }
 
-/*=========================================================================*/
-// Driver level client management
-/*=========================================================================*/
-
 /*===========================================================================
 METHOD:
    QMIReady (Public Method)
 
 DESCRIPTION:
-   Send QMI CTL GET VERSION INFO REQ and SET DATA FORMAT REQ
-   Wait for response or timeout
+   Send QMI CTL GET VERSION INFO REQ until the device responds or timeout
+
+   Requests are retransmitted with an exponential backoff starting at
+   QMI_READY_INITIAL_MS and capped at QMI_READY_MAX_INTERVAL_MS.  Earlier
+   requests stay outstanding, so a late response to any of them ends the
+   wait as soon as it arrives.
 
 PARAMETERS:
    pDev     [ I ] - Device specific memory
@@ -3428,14 +10363,14 @@ bool QMIReady(
    u16                timeout )
 {
    int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
-   void * pReadBuffer;
-   u16 readBufferSize;
-   struct semaphore readSem;
-   u16 curTime;
-   unsigned long flags;
-   u8 transactionID;
+   int i;
+   sQMIXaction * pXaction;
+   sQMIXaction * pXactions[QMI_READY_MAX_INFLIGHT];
+   unsigned int slot = 0;
+   unsigned int interval = QMI_READY_INITIAL_MS;
+   unsigned int elapsed = 0;
+   unsigned long startTime;
+   bool bReady = false;
    
    if (IsDeviceValid( pDev ) == false)
    {
@@ -3443,99 +10378,89 @@ bool QMIReady(
       return false;
    }
 
-   writeBufferSize = QMICTLReadyReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
-   {
-      return false;
-   }
-
-   // An implimentation of down_timeout has not been agreed on,
-   //    so it's been added and removed from the kernel several times.
-   //    We're just going to ignore it and poll the semaphore.
+   memset( pXactions, 0, sizeof( pXactions ) );
+   init_completion( &pDev->mQMIDev.mCTLReady );
+   startTime = jiffies;
 
-   // Send a write every 1000 ms and see if we get a response
-   for (curTime = 0; curTime < timeout; curTime += 1000)
+   // Give up early on unplug, DeregisterQMIDevice waits for qmi_sync_thread
+   while (elapsed < timeout && pDev->mbDeregisterQMIDevice == false)
    {
-      // Start read
-      sema_init( &readSem, 0 );
-   
-      transactionID = QMIXactionIDGet( pDev );
+      // Retire the oldest request once the ring is full
+      if (pXactions[slot] != NULL)
+      {
+         QMIXactionCancel( pXactions[slot] );
+         QMIXactionPut( pXactions[slot] );
+         pXactions[slot] = NULL;
+      }
 
-      result = ReadAsync( pDev, QMICTL, transactionID, UpSem, &readSem );
-      if (result != 0)
+      pXaction = QMIXactionAlloc( pDev,
+                                  QMICTL,
+                                  QMICTLReadyReqSize(),
+                                  GFP_KERNEL );
+      if (pXaction == NULL)
       {
-         kfree( pWriteBuffer );
-         return false;
+         break;
       }
 
-      // Fill buffer
-      result = QMICTLReadyReq( pWriteBuffer, 
-                               writeBufferSize,
-                               transactionID );
+      result = QMICTLReadyReq( pXaction->mpWriteBuffer,
+                               pXaction->mWriteBufferSize,
+                               pXaction->mTransactionID );
       if (result < 0)
       {
-         kfree( pWriteBuffer );
-         return false;
+         QMIXactionPut( pXaction );
+         break;
       }
 
-      // Disregard status.  On errors, just try again
-      WriteSync( pDev,
-                 pWriteBuffer,
-                 writeBufferSize,
-                 QMICTL );
-
-      msleep( 1000 );
-      if (down_trylock( &readSem ) == 0)
+      // Disregard submit errors, just try again after the interval
+      result = QMIXactionSubmit( pXaction,
+                                 timeout - elapsed,
+                                 QMIReadyCallback,
+                                 NULL,
+                                 GFP_KERNEL );
+      if (result == 0)
       {
-         // Enter critical section
-         spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
-
-         // Pop the read data
-         if (PopFromReadMemList( pDev,
-                                 QMICTL,
-                                 transactionID,
-                                 &pReadBuffer,
-                                 &readBufferSize ) == true)
-         {
-            // Success
-
-            // End critical section
-            spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-         
-            // We don't care about the result
-            kfree( pReadBuffer );
-
-            break;
-         }
-         else
-         {
-            // Read mismatch/failure, unlock and continue
-            spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
-         }
+         pXactions[slot] = pXaction;
+         slot = (slot + 1) % QMI_READY_MAX_INFLIGHT;
       }
       else
       {
-         // Enter critical section
-         spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
-         
-         // Timeout, remove the async read
-         NotifyAndPopNotifyList( pDev, QMICTL, transactionID );
-         
-         // End critical section
-         spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+         DBG( "QMICTL READY submit failed %d\n", result );
+         QMIXactionPut( pXaction );
+      }
+
+      if (wait_for_completion_timeout( &pDev->mQMIDev.mCTLReady,
+             msecs_to_jiffies( min_t( unsigned int,
+                                      interval,
+                                      timeout - elapsed ) ) ) != 0)
+      {
+         bReady = true;
+         break;
       }
+
+      interval = min_t( unsigned int,
+                        interval * 2,
+                        QMI_READY_MAX_INTERVAL_MS );
+      elapsed = jiffies_to_msecs( jiffies - startTime );
    }
 
-   kfree( pWriteBuffer );
+   // Stop any requests still outstanding
+   for (i = 0; i < QMI_READY_MAX_INFLIGHT; i++)
+   {
+      if (pXactions[i] != NULL)
+      {
+         QMIXactionCancel( pXactions[i] );
+         QMIXactionPut( pXactions[i] );
+      }
+   }
 
    // Did we time out?   
-   if (curTime >= timeout)
+   if (bReady == false)
    {
       return false;
    }
    
-   DBG( "QMI Ready after %u milliseconds\n", curTime );
+   pDev->mQMICTLReadyMs = jiffies_to_msecs( jiffies - startTime );
+   DBG( "QMI Ready after %u milliseconds\n", pDev->mQMICTLReadyMs );
 
    // Success
    return true;
@@ -3592,7 +10517,7 @@ void QMIWDSCallback(
    }
 
    // Critical section
-   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   QMIClientMemLock( pDev, flags );
    
    bRet = PopFromReadMemList( pDev,
                               clientID,
@@ -3601,7 +10526,7 @@ void QMIWDSCallback(
                               &readBufferSize );
    
    // End critical section
-   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags ); 
+   QMIClientMemUnlock( pDev, flags ); 
    
    if (bRet == false)
    {
@@ -3633,44 +10558,53 @@ void QMIWDSCallback(
    {
 
       // Fill in new values, ignore max values
+      //    The raw counters are also kept for ethtool
       if (TXOfl != (u32)-1)
       {
          pStats->tx_fifo_errors = TXOfl;
+         pDev->mModemStats.mTXOfl = TXOfl;
       }
       
       if (RXOfl != (u32)-1)
       {
          pStats->rx_fifo_errors = RXOfl;
+         pDev->mModemStats.mRXOfl = RXOfl;
       }
 
       if (TXErr != (u32)-1)
       {
          pStats->tx_errors = TXErr;
+         pDev->mModemStats.mTXErr = TXErr;
       }
       
       if (RXErr != (u32)-1)
       {
          pStats->rx_errors = RXErr;
+         pDev->mModemStats.mRXErr = RXErr;
       }
 
       if (TXOk != (u32)-1)
       {
          pStats->tx_packets = TXOk + pStats->tx_errors;
+         pDev->mModemStats.mTXOk = TXOk;
       }
       
       if (RXOk != (u32)-1)
       {
          pStats->rx_packets = RXOk + pStats->rx_errors;
+         pDev->mModemStats.mRXOk = RXOk;
       }
 
       if (TXBytesOk != (u64)-1)
       {
          pStats->tx_bytes = TXBytesOk;
+         pDev->mModemStats.mTXBytesOk = TXBytesOk;
       }
       
       if (RXBytesOk != (u64)-1)
       {
          pStats->rx_bytes = RXBytesOk;
+         pDev->mModemStats.mRXBytesOk = RXBytesOk;
       }
 
       if (bReconfigure == true)
@@ -3732,7 +10666,7 @@ RETURN VALUE:
 int SetupQMIWDSCallback( sGobiUSBNet * pDev )
 {
    int result;
-   void * pWriteBuffer;
+   sQMICtrlURB * pCtrlURB;
    u16 writeBufferSize;
    u16 WDSClientID;
 
@@ -3749,56 +10683,48 @@ int SetupQMIWDSCallback( sGobiUSBNet * pDev )
    }
    WDSClientID = result;
 
-   // QMI WDS Set Event Report
-   writeBufferSize = QMIWDSSetEventReportReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+   // Both requests are built in place in one pooled write URB
+   pCtrlURB = QMICtrlURBGet( pDev, 
+                             max( QMIWDSSetEventReportReqSize(),
+                                  QMIWDSGetPKGSRVCStatusReqSize() ),
+                             GFP_KERNEL );
+   if (pCtrlURB == NULL)
    {
       return -ENOMEM;
    }
-   
-   result = QMIWDSSetEventReportReq( pWriteBuffer, 
+
+   // QMI WDS Set Event Report
+   writeBufferSize = QMIWDSSetEventReportReqSize();
+   result = QMIWDSSetEventReportReq( pCtrlURB->mpBuffer, 
                                      writeBufferSize,
                                      1 );
-   if (result < 0)
-   {
-      kfree( pWriteBuffer );
-      return result;
-   }
-
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       WDSClientID );
-   kfree( pWriteBuffer );
-
-   if (result < 0)
+   if (result >= 0)
    {
-      return result;
+      result = WriteSyncURB( pDev,
+                             pCtrlURB,
+                             writeBufferSize,
+                             WDSClientID,
+                             QMI_XACTION_TIMEOUT_MS );
    }
 
    // QMI WDS Get PKG SRVC Status
-   writeBufferSize = QMIWDSGetPKGSRVCStatusReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+   if (result >= 0)
    {
-      return -ENOMEM;
+      writeBufferSize = QMIWDSGetPKGSRVCStatusReqSize();
+      result = QMIWDSGetPKGSRVCStatusReq( pCtrlURB->mpBuffer, 
+                                          writeBufferSize,
+                                          2 );
    }
-
-   result = QMIWDSGetPKGSRVCStatusReq( pWriteBuffer, 
-                                       writeBufferSize,
-                                       2 );
-   if (result < 0)
+   if (result >= 0)
    {
-      kfree( pWriteBuffer );
-      return result;
+      result = WriteSyncURB( pDev,
+                             pCtrlURB,
+                             writeBufferSize,
+                             WDSClientID,
+                             QMI_XACTION_TIMEOUT_MS );
    }
-   
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       WDSClientID );
-   kfree( pWriteBuffer );
+
+   QMICtrlURBPut( pDev, pCtrlURB );
 
    if (result < 0)
    {
@@ -3856,8 +10782,7 @@ RETURN VALUE:
 int QMIDMSGetMEID( sGobiUSBNet * pDev )
 {
    int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
+   sQMIXaction * pXaction;
    void * pReadBuffer;
    u16 readBufferSize;
    u16 DMSClientID;
@@ -3876,42 +10801,37 @@ int QMIDMSGetMEID( sGobiUSBNet * pDev )
    DMSClientID = result;
 
    // QMI DMS Get Serial numbers Req
-   writeBufferSize = QMIDMSGetMEIDReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+   pXaction = QMIXactionAlloc( pDev, 
+                               DMSClientID, 
+                               QMIDMSGetMEIDReqSize(), 
+                               GFP_KERNEL );
+   if (pXaction == NULL)
    {
+      ReleaseClientID( pDev, DMSClientID );
       return -ENOMEM;
    }
 
-   result = QMIDMSGetMEIDReq( pWriteBuffer, 
-                              writeBufferSize,
-                              1 );
+   result = QMIDMSGetMEIDReq( pXaction->mpWriteBuffer,
+                              pXaction->mWriteBufferSize,
+                              pXaction->mTransactionID );
    if (result < 0)
    {
-      kfree( pWriteBuffer );
+      QMIXactionPut( pXaction );
+      ReleaseClientID( pDev, DMSClientID );
       return result;
    }
 
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       DMSClientID );
-   kfree( pWriteBuffer );
+   result = QMIXactionSync( pXaction, 
+                            &pReadBuffer, 
+                            QMI_XACTION_TIMEOUT_MS );
+   QMIXactionPut( pXaction );
 
    if (result < 0)
    {
+      ReleaseClientID( pDev, DMSClientID );
       return result;
    }
 
-   // QMI DMS Get Serial numbers Resp
-   result = ReadSync( pDev,
-                      &pReadBuffer,
-                      DMSClientID,
-                      1 );
-   if (result < 0)
-   {
-      return result;
-   }
    readBufferSize = result;
 
    result = QMIDMSGetMEIDResp( pReadBuffer,
@@ -3937,27 +10857,32 @@ int QMIDMSGetMEID( sGobiUSBNet * pDev )
 
 /*===========================================================================
 METHOD:
-   QMIWDASetDataFormat (Public Method)
+   QMISetupDataPath (Public Method)
 
 DESCRIPTION:
-   Register WDA client
-   send Data format request and parse response
-   Release WDA client
+   Register WDA and WDS clients
+   Send the data format request and all Bind Mux Data Port requests at
+   once, each with its own transaction ID, then parse the responses
+   Release the clients
 
 PARAMETERS:
    pDev     [ I ] - Device specific memory
 
 RETURN VALUE:
-   None
+   int - 0 for success
+         Negative errno for failure
 ===========================================================================*/
-int QMIWDASetDataFormat( sGobiUSBNet * pDev )
+int QMISetupDataPath( sGobiUSBNet * pDev )
 {
+   sQMIXaction * pXactions[QMI_DATA_PATH_XACTIONS];
+   int count = 0;
+   int started;
+   int status = 0;
    int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
+   int i;
    void * pReadBuffer;
-   u16 readBufferSize;
    u16 WDAClientID;
+   u16 WDSClientID;
 
    DBG("\n");
 
@@ -3974,254 +10899,141 @@ int QMIWDASetDataFormat( sGobiUSBNet * pDev )
    }
    WDAClientID = result;
 
-   // QMI WDA Set Data Format Request
-   writeBufferSize = QMIWDASetDataFormatReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
-   {
-      return -ENOMEM;
-   }
-
-   result = QMIWDASetDataFormatReq( pWriteBuffer,
-                              writeBufferSize,
-                                    1 );
-   if (result < 0)
-   {
-      kfree( pWriteBuffer );
-      return result;
-   }
-
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       WDAClientID );
-   kfree( pWriteBuffer );
-
-   if (result < 0)
-   {
-      return result;
-   }
-
-   // QMI DMS Get Serial numbers Resp
-   result = ReadSync( pDev,
-                      &pReadBuffer,
-                      WDAClientID,
-                      1 );
-   if (result < 0)
-   {
-      return result;
-   }
-   readBufferSize = result;
-
-   result = QMIWDASetDataFormatResp( pReadBuffer,
-                                     readBufferSize );
-
-   kfree( pReadBuffer );
-
-#if 1 //def DATA_MODE_RP
-   pDev->mbRawIPMode = (result == 2);
-   if (pDev->mbRawIPMode) {
-       pDev->mpNetDev->net->flags |= IFF_NOARP;
-   }
-#endif
-
-   if (result < 0)
-   {
-      DBG( "Data Format Cannot be set\n" );
-   }
-
-   ReleaseClientID( pDev, WDAClientID );
-
-   // Success
-    return 0;
-}
-
-/*===========================================================================
-METHOD:
-   QMIWDSBindMuxData (Public Method)
-
-DESCRIPTION:
-   Register WDS client
-   send Bind Mux Data Port request and parse response
-   Release WDS client
-
-PARAMETERS:
-   pDev     [ I ] - Device specific memory
-
-RETURN VALUE:
-   None
-===========================================================================*/
-int QMIWDSBindMuxData( sGobiUSBNet * pDev )
-{
-   int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
-   void * pReadBuffer;
-   u16 readBufferSize;
-   u16 WDSClientID;
-
-   DBG("\n");
-
-   if (IsDeviceValid( pDev ) == false)
-   {
-      DBG( "Invalid device\n" );
-      return -EFAULT;
-   }
-
+   // One WDS client carries every bind request
    result = GetClientID( pDev, QMIWDS );
    if (result < 0)
    {
+      ReleaseClientID( pDev, WDAClientID );
       return result;
    }
    WDSClientID = result;
 
-   // QMI WDS Bind Mux Data Request
-   writeBufferSize = QMIWDSBindMuxDataPortReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
-   {
-      return -ENOMEM;
-   }
-
-   result = QMIWDSBindMuxDataPortReq( pWriteBuffer,
-                              writeBufferSize,
-                                    1 );
+   // QMI WDA Set Data Format Request
+   pXactions[count] = QMIXactionAlloc( pDev,
+                                       WDAClientID,
+                                       QMIWDASetDataFormatReqSize(),
+                                       GFP_KERNEL );
+   if (pXactions[count] == NULL)
+   {
+      status = -ENOMEM;
+      goto cleanup;
+   }
+   result = QMIWDASetDataFormatReq( pXactions[count]->mpWriteBuffer,
+                                    pXactions[count]->mWriteBufferSize,
+                                    pXactions[count]->mTransactionID );
+   count++;
    if (result < 0)
    {
-      kfree( pWriteBuffer );
-      return result;
+      status = result;
+      goto cleanup;
    }
 
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       WDSClientID );
-   kfree( pWriteBuffer );
-
-   if (result < 0)
+   // QMI WDS Bind Mux Data Port Pre Requests
+   for (i = 1; i <= QMI_BIND_MUX_PRE_COUNT; i++)
    {
-      return result;
+      pXactions[count] = QMIXactionAlloc( pDev,
+                                          WDSClientID,
+                                          QMIWDSBindMuxDataPortPreReqSize(),
+                                          GFP_KERNEL );
+      if (pXactions[count] == NULL)
+      {
+         status = -ENOMEM;
+         goto cleanup;
+      }
+      result = QMIWDSBindMuxDataPortPreReq( pXactions[count]->mpWriteBuffer,
+                                            pXactions[count]->mWriteBufferSize,
+                                            pXactions[count]->mTransactionID,
+                                            i );
+      count++;
+      if (result < 0)
+      {
+         status = result;
+         goto cleanup;
+      }
    }
 
-   // QMI DMS Get Serial numbers Resp
-   result = ReadSync( pDev,
-                      &pReadBuffer,
-                      WDSClientID,
-                      1 );
-   if (result < 0)
+   // QMI WDS Bind Mux Data Port Request
+   pXactions[count] = QMIXactionAlloc( pDev,
+                                       WDSClientID,
+                                       QMIWDSBindMuxDataPortReqSize(),
+                                       GFP_KERNEL );
+   if (pXactions[count] == NULL)
    {
-      return result;
+      status = -ENOMEM;
+      goto cleanup;
    }
-   readBufferSize = result;
-
-   result = QMIWDSBindMuxDataPortResp( pReadBuffer,
-                                     readBufferSize );
-
-   kfree( pReadBuffer );
-
+   result = QMIWDSBindMuxDataPortReq( pXactions[count]->mpWriteBuffer,
+                                      pXactions[count]->mWriteBufferSize,
+                                      pXactions[count]->mTransactionID );
+   count++;
    if (result < 0)
    {
-      DBG( "Data Format Cannot be set\n" );
-   }
-
-   ReleaseClientID( pDev, WDSClientID );
-
-   // Success
-    return 0;
-}
-
-/*===========================================================================
-METHOD:
-   QMIWDSBindMuxDataPre (Public Method)
-
-DESCRIPTION:
-   Register WDS client
-   send Bind Mux Data Port request and parse response
-   Release WDS client
-
-PARAMETERS:
-   pDev     [ I ] - Device specific memory
-
-RETURN VALUE:
-   None
-===========================================================================*/
-int QMIWDSBindMuxDataPre( sGobiUSBNet * pDev, unsigned int index )
-{
-   int result;
-   void * pWriteBuffer;
-   u16 writeBufferSize;
-   void * pReadBuffer;
-   u16 readBufferSize;
-   u16 WDSClientID;
-
-   DBG("\n");
-
-   if (IsDeviceValid( pDev ) == false)
-   {
-      DBG( "Invalid device\n" );
-      return -EFAULT;
+      status = result;
+      goto cleanup;
    }
 
-   result = GetClientID( pDev, QMIWDS );
-   if (result < 0)
+   // Put every request on the wire before waiting for any response
+   for (started = 0; started < count; started++)
    {
-      return result;
+      result = QMIXactionStart( pXactions[started], QMI_XACTION_TIMEOUT_MS );
+      if (result < 0)
+      {
+         status = result;
+         break;
+      }
    }
-   WDSClientID = result;
 
-   // QMI WDS Bind Mux Data Request
-   writeBufferSize = QMIWDSBindMuxDataPortPreReqSize();
-   pWriteBuffer = kmalloc( writeBufferSize, GFP_KERNEL );
-   if (pWriteBuffer == NULL)
+   // Collect responses, the slowest one bounds the whole exchange
+   for (i = 0; i < started; i++)
    {
-      return -ENOMEM;
-   }
+      result = QMIXactionWait( pXactions[i], &pReadBuffer );
+      if (result < 0)
+      {
+         DBG( "transaction %d failed %d\n", i, result );
+         if (status == 0)
+         {
+            status = result;
+         }
+         continue;
+      }
 
-   result = QMIWDSBindMuxDataPortPreReq( pWriteBuffer,
-                              writeBufferSize,
-                                    1, index);
-   if (result < 0)
-   {
-      kfree( pWriteBuffer );
-      return result;
-   }
+      if (i == 0)
+      {
+         result = QMIWDASetDataFormatResp( pReadBuffer, result );
 
-   result = WriteSync( pDev,
-                       pWriteBuffer,
-                       writeBufferSize,
-                       WDSClientID );
-   kfree( pWriteBuffer );
+#if 1 //def DATA_MODE_RP
+         pDev->mbRawIPMode = (result == 2);
+         if (pDev->mbRawIPMode) {
+             pDev->mpNetDev->net->flags |= IFF_NOARP;
+         }
+#endif
 
-   if (result < 0)
-   {
-      return result;
-   }
+         if (result < 0)
+         {
+            DBG( "Data Format Cannot be set\n" );
+         }
+      }
+      else
+      {
+         result = QMIWDSBindMuxDataPortResp( pReadBuffer, result );
+         if (result < 0)
+         {
+            DBG( "Bind Mux Data Port %d Cannot be set\n", i );
+         }
+      }
 
-   // QMI DMS Get Serial numbers Resp
-   result = ReadSync( pDev,
-                      &pReadBuffer,
-                      WDSClientID,
-                      1 );
-   if (result < 0)
-   {
-      return result;
+      kfree( pReadBuffer );
    }
-   readBufferSize = result;
 
-   result = QMIWDSBindMuxDataPortResp( pReadBuffer,
-                                     readBufferSize );
-
-   kfree( pReadBuffer );
-
-   if (result < 0)
+cleanup:
+   for (i = 0; i < count; i++)
    {
-      DBG( "Data Format Cannot be set\n" );
+      QMIXactionPut( pXactions[i] );
    }
 
    ReleaseClientID( pDev, WDSClientID );
+   ReleaseClientID( pDev, WDAClientID );
 
-   // Success
-    return 0;
+   return status;
 }
 
-
@@ -12,10 +12,17 @@ FUNCTIONS:
       GobiSetDownReason
       GobiClearDownReason
       GobiTestDownReason
+      GobiLog2Bucket
 
    Driver level asynchronous read functions
       ResubmitIntURB
+      QMIClientWaitQueue
+      QMIIndicationAllowed
+      QMIRxDispatch
       ReadCallback
+      QMIRxWork
+      QMIRxInit
+      QMIRxDestroy
       IntCallback
       StartRead
       KillRead
@@ -23,23 +30,147 @@ FUNCTIONS:
    Internal read/write functions
       ReadAsync
       UpSem
+      UpCompletion
       ReadSync
+      ReadSyncTimeout
       WriteSyncCallback
       WriteSync
+      WriteSyncTimeout
+      WriteSyncURB
+
+   Control endpoint scheduler
+      QMICtrlInit
+      QMICtrlClass
+      QMICtrlGiveBack
+      QMICtrlNext
+      QMICtrlDispatch
+      QMICtrlSubmit
+      QMICtrlComplete
+      QMICtrlCancel
+      QMICtrlKillURB
+      QMICtrlUnlinkURB
+      QMICtrlFlush
+
+   Control URB pool
+      QMICtrlURBAlloc
+      QMICtrlURBFree
+      QMICtrlURBGet
+      QMICtrlURBPut
+      QMICtrlURBFill
+      QMICtrlURBPoolInit
+      QMICtrlURBPoolDestroy
+
+   Transaction latency
+      QMILatencyHistGet
+      QMILatencyTimeout
+      QMILatencyRecord
+      QMILatencyRequest
+      QMILatencyResponse
+      QMILatencyShowHist
+      QMILatencyShow
+      QMILatencyOpen
+      QMILatencyResetOpen
+      QMILatencyResetWrite
+      QMILatencyInit
+      QMILatencyDebugfsInit
+      QMILatencyDestroy
+
+   Asynchronous transaction engine
+      QMIXactionIDNext
+      QMIUserTIDMap
+      QMIUserTIDRestore
+      QMIXactionTimerCallback
+      QMIXactionAlloc
+      QMIXactionGet
+      QMIXactionPut
+      QMIXactionDrain
+      QMIXactionComplete
+      QMIXactionWriteCallback
+      QMIXactionSubmit
+      QMIXactionCancel
+      PopFromXactionList
+      QMIXactionSyncCallback
+      QMIXactionStart
+      QMIXactionWait
+      QMIXactionSync
 
    Internal memory management functions
       GetClientID
+      CreateClientMem
       ReleaseClientID
+      QMIClientMemLocked
+      QMIClientMemUnlocking
       FindClientMem
       AddToReadMemList
+      AddEntryToReadMemList
+      ReadMemListFull
+      DropFromReadMemList
+      ExpireReadMemList
       PopFromReadMemList
+      PeekReadMemListSize
       AddToNotifyList
       NotifyAndPopNotifyList
       AddToURBList
       PopFromURBList
 
+   Client ID pool
+      QMIClientPoolSize
+      QMIClientPoolService
+      QMIClientPoolCount
+      QMIClientPoolGet
+      QMIClientPoolPut
+      QMIClientPoolWork
+
+   Response cache
+      QMICachePolicyFind
+      QMICacheRemove
+      QMICacheExpire
+      QMICacheAnswer
+      QMICacheDeliver
+      QMICacheFill
+      QMICacheInvalidate
+      QMICacheFlush
+
+   Request de-duplication
+      QMIDedupAllowed
+      QMIDedupRemove
+      QMIDedupExpire
+      QMIDedupJoin
+      QMIDedupFanOut
+      QMIDedupFlush
+
+   Shared memory rings
+      QMIRingGet
+      QMIRingRelease
+      QMIRingPut
+      QMIRingCopy
+      QMIRingWrite
+      QMIRingEmpty
+      QMIRingDetach
+      QMIRingVmOpen
+      QMIRingVmClose
+      QMIRingKick
+
    Internal userspace wrapper functions
       UserspaceunlockedIOCTL
+      UserspaceTransaction
+      UserspaceWriteLimit
+      UserspaceWriteCallback
+      UserspaceWriteSync
+      UserspaceWriteQueue
+      UserspaceWriteAsync
+      UserspaceFrameAppend
+      UserspaceReadBatch
+      UserspaceWriteBatch
+      UserspaceClientIDs
+      UserspaceFrameClientID
+      UserspaceAttachClient
+      UserspaceDetachClients
+      UserspaceReleaseClient
+      UserspaceAddService
+      UserspaceDataReady
+      UserspaceSetIndicationFilter
+      UserspaceGetQueueStats
 
    Userspace wrappers
       UserspaceOpen
@@ -48,16 +179,29 @@ FUNCTIONS:
       UserspaceRead
       UserspaceWrite
       UserspacePoll
+      UserspaceMmap
+
+   Sysfs attributes
+      QMISysfsGetDev
+      QMIReadyMsShow
+      QMIProbeReadyMsShow
+      QMICtrlStatsShow
+      QMIXactionTimeoutsShow
+      QMIClientMemStatsShow
+      QMIClientMemStatsStore
 
    Initializer and destructor
+      QMIDeviceBringUp
       RegisterQMIDevice
       DeregisterQMIDevice
 
    Driver level client management
+      QMIReadyCallback
       QMIReady
       QMIWDSCallback
       SetupQMIWDSCallback
       QMIDMSGetMEID
+      QMISetupDataPath
 
 Copyright (c) 2011, Code Aurora Forum. All rights reserved.
 
@@ -125,6 +269,11 @@ bool GobiTestDownReason(
    sGobiUSBNet *    pDev,
    u8                 reason );
 
+// Log2 histogram bucket of a value
+int GobiLog2Bucket(
+   u64              value,
+   int              buckets );
+
 /*=========================================================================*/
 // Driver level asynchronous read functions
 /*=========================================================================*/
@@ -132,14 +281,38 @@ bool GobiTestDownReason(
 // Resubmit interrupt URB, re-using same values
 int ResubmitIntURB( struct urb * pIntURB );
 
+// Wait queue to wake as data arrives for a client
+wait_queue_head_t * QMIClientWaitQueue( sClientMemList * pClientMem );
+
+// Check an indication against a client's indication filter
+bool QMIIndicationAllowed(
+   sClientMemList *  pClientMem,
+   u16               msgID );
+
+// Parse one QMUX message, put the data in storage and notify anyone
+//    waiting for data
+void QMIRxDispatch(
+   sGobiUSBNet *     pDev,
+   void *            pData,
+   u16               dataSize );
+
 // Read callback
-//    Put the data in storage and notify anyone waiting for data
+//    Queue a copy of the message for QMIRxWork
 #if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
 void ReadCallback( struct urb * pReadURB );
 #else
 void ReadCallback(struct urb *pReadURB, struct pt_regs *regs);
 #endif
 
+// Dispatch every queued read message in arrival order
+void QMIRxWork( struct work_struct * pWork );
+
+// Create the device's read queue and its ordered workqueue
+int QMIRxInit( sGobiUSBNet * pDev );
+
+// Deliver what is left in the read queue and destroy its workqueue
+void QMIRxDestroy( sGobiUSBNet * pDev );
+
 // Inturrupt callback
 //    Data is available, start a read URB
 #if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
@@ -173,6 +346,12 @@ void UpSem(
    u16                clientID,
    void *             pData );
 
+// Notification function for synchronous read with a deadline
+void UpCompletion(
+   sGobiUSBNet *    pDev,
+   u16                clientID,
+   void *             pData );
+
 // Start synchronous read
 //     Reading client's data store, not device
 int ReadSync(
@@ -181,6 +360,14 @@ int ReadSync(
    u16                clientID,
    u16                transactionID );
 
+// Start synchronous read, give up after timeout milliseconds (0 = forever)
+int ReadSyncTimeout(
+   sGobiUSBNet *    pDev,
+   void **            ppOutBuffer,
+   u16                clientID,
+   u16                transactionID,
+   unsigned int       timeout );
+
 // Write callback
 #if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
 void WriteSyncCallback( struct urb * pWriteURB );
@@ -195,6 +382,282 @@ int WriteSync(
    int                size,
    u16                clientID );
 
+// Start synchronous write, kill the URB after timeout milliseconds (0 = forever)
+int WriteSyncTimeout(
+   sGobiUSBNet *    pDev,
+   char *             pInWriteBuffer,
+   int                size,
+   u16                clientID,
+   unsigned int       timeout );
+
+// Start synchronous write of a request built in a pooled write URB
+int WriteSyncURB(
+   sGobiUSBNet *      pDev,
+   sQMICtrlURB *      pCtrlURB,
+   u16                writeBufferSize,
+   u16                clientID,
+   unsigned int       timeout );
+
+/*=========================================================================*/
+// Control endpoint scheduler
+/*=========================================================================*/
+
+// Set up the control endpoint scheduler
+void QMICtrlInit( sGobiUSBNet * pDev );
+
+// Priority class of a client's control writes, lower is served first
+int QMICtrlClass( u16 clientID );
+
+// Complete a write URB that never reached the bus
+void QMICtrlGiveBack(
+   struct urb *      pURB,
+   int               status );
+
+// Unlink the next queued write by class, client round robin and age
+sQMICtrlRequest * QMICtrlNext( sGobiUSBNet * pDev );
+
+// Submit queued writes while the in-flight cap allows
+void QMICtrlDispatch( sGobiUSBNet * pDev );
+
+// Submit a control endpoint write, or queue it behind the in-flight cap
+int QMICtrlSubmit(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB,
+   u16               clientID,
+   gfp_t             memFlags );
+
+// Release an in-flight slot and start the next queued write
+void QMICtrlComplete( sGobiUSBNet * pDev );
+
+// Take a write back out of the queue before it reaches the bus
+bool QMICtrlCancel(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB,
+   int               status );
+
+// usb_kill_urb for a write that may still be queued
+void QMICtrlKillURB(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB );
+
+// usb_unlink_urb for a write that may still be queued
+void QMICtrlUnlinkURB(
+   sGobiUSBNet *     pDev,
+   struct urb *      pURB );
+
+// Give back every queued write
+void QMICtrlFlush( sGobiUSBNet * pDev );
+
+/*=========================================================================*/
+// Control URB pool
+/*=========================================================================*/
+
+// Allocate a control write URB with its setup packet and payload buffer
+sQMICtrlURB * QMICtrlURBAlloc(
+   u16               bufferSize,
+   gfp_t             memFlags );
+
+// Free a control write URB, its setup packet and payload buffer
+void QMICtrlURBFree( sQMICtrlURB * pCtrlURB );
+
+// Take a control write URB from the pool, or allocate one
+sQMICtrlURB * QMICtrlURBGet(
+   sGobiUSBNet *     pDev,
+   size_t            size,
+   gfp_t             memFlags );
+
+// Return a control write URB to the pool, or free it
+void QMICtrlURBPut(
+   sGobiUSBNet *     pDev,
+   sQMICtrlURB *     pCtrlURB );
+
+// Fill a control write URB with a CDC Send Encapsulated Command
+void QMICtrlURBFill(
+   sGobiUSBNet *     pDev,
+   sQMICtrlURB *     pCtrlURB,
+   u16               size,
+   usb_complete_t    pCallback,
+   void *            pContext );
+
+// Fill the device's control write URB pool
+void QMICtrlURBPoolInit( sGobiUSBNet * pDev );
+
+// Free the device's control write URB pool
+void QMICtrlURBPoolDestroy( sGobiUSBNet * pDev );
+
+/*=========================================================================*/
+// Transaction latency
+/*=========================================================================*/
+
+// Find or add the histogram of a service or message ID
+sQMILatencyHist * QMILatencyHistGet(
+   sQMILatency *     pLatency,
+   u8                service,
+   u16               messageID,
+   bool              bMessage );
+
+// Count an unanswered request and free its slot
+void QMILatencyTimeout(
+   sQMILatency *          pLatency,
+   sQMILatencyPending *   pPending );
+
+// Add one response latency to a histogram
+void QMILatencyRecord(
+   sQMILatencyHist * pHist,
+   u64               latencyUs );
+
+// Timestamp a request about to be written
+void QMILatencyRequest(
+   sGobiUSBNet *     pDev,
+   u16               clientID,
+   void *            pBuffer,
+   u16               bufferSize );
+
+// Match a response to its request and record the latency
+void QMILatencyResponse(
+   sGobiUSBNet *     pDev,
+   u16               clientID,
+   u16               transactionID );
+
+// Print one histogram line
+void QMILatencyShowHist(
+   struct seq_file *       pSeq,
+   const sQMILatencyHist * pHist,
+   bool                    bMessage );
+
+// Print the latency histograms
+int QMILatencyShow(
+   struct seq_file * pSeq,
+   void *            pUnused );
+
+// Open the "latency" debugfs file
+int QMILatencyOpen(
+   struct inode *    pInode,
+   struct file *     pFilp );
+
+// Open the "latency_reset" debugfs file
+int QMILatencyResetOpen(
+   struct inode *    pInode,
+   struct file *     pFilp );
+
+// Clear the latency histograms
+ssize_t QMILatencyResetWrite(
+   struct file *        pFilp,
+   const char __user *  pBuf,
+   size_t               size,
+   loff_t *             pPos );
+
+// Allocate the device's latency statistics
+void QMILatencyInit( sGobiUSBNet * pDev );
+
+// Publish the latency statistics in debugfs
+void QMILatencyDebugfsInit(
+   sGobiUSBNet *     pDev,
+   int               qmiIndex );
+
+// Remove the debugfs files and free the latency statistics
+void QMILatencyDestroy( sGobiUSBNet * pDev );
+
+/*=========================================================================*/
+// Asynchronous transaction engine
+/*=========================================================================*/
+
+// Allocate the next in-driver transaction ID for this client
+u16 QMIXactionIDNext(
+   sGobiUSBNet *    pDev,
+   u16                clientID );
+
+// Send a userspace request with an ID of the client's counter
+int QMIUserTIDMap(
+   sGobiUSBNet *    pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize,
+   u16                transactionID );
+
+// Restore the ID userspace chose in the response to its request
+bool QMIUserTIDRestore(
+   sGobiUSBNet *    pDev,
+   u16                clientID,
+   void *             pSDU,
+   u16 *              pTransactionID );
+
+// Transaction deadline expired
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 4,15,0 ))
+void QMIXactionTimerCallback( struct timer_list * pTimer );
+#else
+void QMIXactionTimerCallback( unsigned long data );
+#endif
+
+// Allocate a transaction with request buffer and transaction ID
+sQMIXaction * QMIXactionAlloc(
+   sGobiUSBNet *    pDev,
+   u16                clientID,
+   size_t             writeBufferSize,
+   gfp_t              memFlags );
+
+// Take a reference on a transaction
+void QMIXactionGet( sQMIXaction * pXaction );
+
+// Drop a reference on a transaction
+void QMIXactionPut( sQMIXaction * pXaction );
+
+// Wait until every transaction of this device has been freed
+void QMIXactionDrain( sGobiUSBNet * pDev );
+
+// Complete a transaction, first caller wins
+bool QMIXactionComplete(
+   sQMIXaction *    pXaction,
+   int                result,
+   void *             pReadBuffer );
+
+// Write callback for transaction requests
+#if (LINUX_VERSION_CODE > KERNEL_VERSION( 2,6,18 ))
+void QMIXactionWriteCallback( struct urb * pWriteURB );
+#else
+void QMIXactionWriteCallback(struct urb *pWriteURB, struct pt_regs *regs);
+#endif
+
+// Send a transaction, callback runs once with the response or an error
+int QMIXactionSubmit(
+   sQMIXaction *    pXaction,
+   unsigned int       timeout,
+   void               (* pCallback)(sGobiUSBNet *, int, void *, void *),
+   void *             pData,
+   gfp_t              memFlags );
+
+// Cancel a submitted transaction
+void QMIXactionCancel( sQMIXaction * pXaction );
+
+// Remove a pending transaction from this client's list
+sQMIXaction * PopFromXactionList(
+   sGobiUSBNet *    pDev,
+   u16                clientID,
+   u16                transactionID );
+
+// Completion callback used by QMIXactionSync
+void QMIXactionSyncCallback(
+   sGobiUSBNet *    pDev,
+   int                result,
+   void *             pReadBuffer,
+   void *             pData );
+
+// Submit a transaction, QMIXactionWait collects the result
+int QMIXactionStart(
+   sQMIXaction *    pXaction,
+   unsigned int       timeout );
+
+// Wait for a transaction started by QMIXactionStart
+int QMIXactionWait(
+   sQMIXaction *    pXaction,
+   void **            ppReadBuffer );
+
+// Submit a transaction and wait for its response within a deadline
+int QMIXactionSync(
+   sQMIXaction *    pXaction,
+   void **            ppReadBuffer,
+   unsigned int       timeout );
+
 /*=========================================================================*/
 // Internal memory management functions
 /*=========================================================================*/
@@ -204,11 +667,72 @@ int GetClientID(
    sGobiUSBNet *      pDev,
    u8                   serviceType );
 
+// Initialize memory of a client the device assigned
+int CreateClientMem(
+   sGobiUSBNet *      pDev,
+   u16                  clientID );
+
 // Release client and free memory
 void ReleaseClientID(
    sGobiUSBNet *      pDev,
    u16                  clientID );
 
+#ifdef QMI_CLIENT_MEM_STATS
+
+// mClientMemLock taken, account the wait
+void QMIClientMemLocked(
+   sGobiUSBNet *      pDev,
+   ktime_t            lockStart );
+
+// mClientMemLock about to be released, account the hold
+void QMIClientMemUnlocking( sGobiUSBNet * pDev );
+
+// Take and release mClientMemLock, recording wait and hold times
+#define QMIClientMemLock( pDev, flags ) do { \
+      ktime_t lockStart = ktime_get(); \
+      spin_lock_irqsave( &(pDev)->mQMIDev.mClientMemLock, flags ); \
+      QMIClientMemLocked( (pDev), lockStart ); \
+   } while (0)
+
+#define QMIClientMemUnlock( pDev, flags ) do { \
+      QMIClientMemUnlocking( pDev ); \
+      spin_unlock_irqrestore( &(pDev)->mQMIDev.mClientMemLock, flags ); \
+   } while (0)
+
+// Same, leaving the interrupt state alone
+#define QMIClientMemLockNoIRQ( pDev ) do { \
+      ktime_t lockStart = ktime_get(); \
+      spin_lock( &(pDev)->mQMIDev.mClientMemLock ); \
+      QMIClientMemLocked( (pDev), lockStart ); \
+   } while (0)
+
+#define QMIClientMemUnlockNoIRQ( pDev ) do { \
+      QMIClientMemUnlocking( pDev ); \
+      spin_unlock( &(pDev)->mQMIDev.mClientMemLock ); \
+   } while (0)
+
+// Count one QMI_MEM_OP_*, caller holds mClientMemLock
+#define QMIClientMemOp( pDev, op ) \
+   ((pDev)->mQMIDev.mClientMemStats.mOps[op]++)
+
+#else
+
+#define QMIClientMemLock( pDev, flags ) \
+   spin_lock_irqsave( &(pDev)->mQMIDev.mClientMemLock, flags )
+
+#define QMIClientMemUnlock( pDev, flags ) \
+   spin_unlock_irqrestore( &(pDev)->mQMIDev.mClientMemLock, flags )
+
+#define QMIClientMemLockNoIRQ( pDev ) \
+   spin_lock( &(pDev)->mQMIDev.mClientMemLock )
+
+#define QMIClientMemUnlockNoIRQ( pDev ) \
+   spin_unlock( &(pDev)->mQMIDev.mClientMemLock )
+
+#define QMIClientMemOp( pDev, op ) do { } while (0)
+
+#endif
+
 // Find this client's memory
 sClientMemList * FindClientMem(
    sGobiUSBNet *      pDev,
@@ -222,6 +746,25 @@ bool AddToReadMemList(
    void *               pData,
    u16                  dataSize );
 
+// Add an allocated entry to this client's ReadMem list
+bool AddEntryToReadMemList( 
+   sGobiUSBNet *      pDev,
+   u16                  clientID,
+   sReadMemList *       pEntry );
+
+// Check whether another entry would exceed the read queue limits
+bool ReadMemListFull(
+   sClientMemList *  pClientMem,
+   u16               dataSize );
+
+// Unlink and free one entry of this client's ReadMem list
+void DropFromReadMemList(
+   sClientMemList *  pClientMem,
+   sReadMemList **   ppReadMemList );
+
+// Free entries older than orphanResponseTTL from an in-driver client
+void ExpireReadMemList( sClientMemList * pClientMem );
+
 // Remove data from this client's ReadMem list if it matches 
 // the specified transaction ID.
 bool PopFromReadMemList( 
@@ -231,6 +774,11 @@ bool PopFromReadMemList(
    void **              ppData,
    u16 *                pDataSize );
 
+// Size of the oldest message in this client's ReadMem list
+u16 PeekReadMemListSize(
+   sGobiUSBNet *      pDev,
+   u16                  clientID );
+
 // Add Notify entry to this client's notify List
 bool AddToNotifyList( 
    sGobiUSBNet *      pDev,
@@ -257,6 +805,164 @@ struct urb * PopFromURBList(
    sGobiUSBNet *      pDev,
    u16                  clientID );
 
+/*=========================================================================*/
+// Client ID pool
+/*=========================================================================*/
+
+// Number of idle clients to keep per pooled service
+int QMIClientPoolSize( void );
+
+// Is this service type served from the client pool?
+bool QMIClientPoolService( u8 serviceType );
+
+// Count idle pooled clients of a service
+int QMIClientPoolCount(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType );
+
+// Take an idle client of a service from the pool
+int QMIClientPoolGet(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType );
+
+// Reset a closed client and return it to the pool
+bool QMIClientPoolPut(
+   sGobiUSBNet *      pDev,
+   u16                clientID );
+
+// Allocate clients until every pooled service is topped up
+void QMIClientPoolWork( struct work_struct * pWork );
+
+/*=========================================================================*/
+// Response cache
+/*=========================================================================*/
+
+// Look up a query in the cache policy table
+const sQMICachePolicy * QMICachePolicyFind(
+   u8                 serviceType,
+   u16                msgID );
+
+// Unlink and free a response cache entry
+void QMICacheRemove(
+   sGobiUSBNet *      pDev,
+   sQMICacheEntry **  ppEntry );
+
+// Drop answers older than their policy allows
+void QMICacheExpire( sGobiUSBNet * pDev );
+
+// Answer a userspace request from the response cache
+bool QMICacheAnswer(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize );
+
+// Queue a cached response for a client
+bool QMICacheDeliver(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pData,
+   u16                dataSize );
+
+// Store the response to a cacheable request
+void QMICacheFill(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pSDU,
+   u16                sduSize );
+
+// Drop cached answers an indication makes stale
+void QMICacheInvalidate(
+   sGobiUSBNet *      pDev,
+   u8                 serviceType,
+   u16                msgID );
+
+// Drop every response cache entry
+void QMICacheFlush( sGobiUSBNet * pDev );
+
+/*=========================================================================*/
+// Request de-duplication
+/*=========================================================================*/
+
+// Whether identical copies of a request may share one response
+bool QMIDedupAllowed(
+   u8                 serviceType,
+   u16                msgID );
+
+// Unlink a de-duplication entry
+sQMIDedupEntry * QMIDedupRemove(
+   sGobiUSBNet *      pDev,
+   sQMIDedupEntry **  ppEntry );
+
+// Drop requests the modem did not answer in time
+void QMIDedupExpire( sGobiUSBNet * pDev );
+
+// Attach a userspace request to an identical one already in flight
+bool QMIDedupJoin(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   void *             pSDU,
+   size_t             sduSize );
+
+// Hand a response to every request that joined the one it answers
+void QMIDedupFanOut(
+   sGobiUSBNet *      pDev,
+   u16                clientID,
+   u16                transactionID,
+   void *             pSDU,
+   u16                sduSize );
+
+// Drop every request tracked for de-duplication
+void QMIDedupFlush( sGobiUSBNet * pDev );
+
+/*=========================================================================*/
+// Shared memory rings
+/*=========================================================================*/
+
+// Take a reference on a ring
+void QMIRingGet( sQMIRing * pRing );
+
+// Free a ring once its last reference is gone
+void QMIRingRelease( struct kref * pRefCount );
+
+// Drop a reference on a ring
+void QMIRingPut( sQMIRing * pRing );
+
+// Copy between a linear buffer and a ring, wrapping at its end
+void QMIRingCopy(
+   u8 *               pRingData,
+   u32                ringSize,
+   u32                pos,
+   void *             pBuffer,
+   u32                size,
+   bool               bToRing );
+
+// Deposit a received message in a client's RX ring
+int QMIRingWrite(
+   sQMIRing *         pRing,
+   u16                clientID,
+   void *             pData,
+   u16                dataSize );
+
+// Has userspace consumed everything in the RX ring?
+bool QMIRingEmpty( sQMIRing * pRing );
+
+// Stop delivering a client's messages to its ring
+void QMIRingDetach(
+   sGobiUSBNet *      pDev,
+   u16                clientID );
+
+// A mapping of the ring was duplicated
+void QMIRingVmOpen( struct vm_area_struct * pVMA );
+
+// A mapping of the ring went away
+void QMIRingVmClose( struct vm_area_struct * pVMA );
+
+// Send the requests userspace placed in the TX ring
+int QMIRingKick( sQMIFilpStorage * pFilpData );
+
 /*=========================================================================*/
 // Internal userspace wrappers
 /*=========================================================================*/
@@ -267,6 +973,103 @@ long UserspaceunlockedIOCTL(
    unsigned int      cmd,
    unsigned long     arg );
 
+// Request/response exchange for IOCTL_QMI_TRANSACTION
+long UserspaceTransaction(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg );
+
+// O_NONBLOCK writes a file handle may have in flight
+int UserspaceWriteLimit( void );
+
+// Completion callback for O_NONBLOCK writes
+void UserspaceWriteCallback(
+   sGobiUSBNet *     pDev,
+   int               result,
+   void *            pReadBuffer,
+   void *            pData );
+
+// Send one request and wait for the write to complete
+ssize_t UserspaceWriteSync(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID,
+   const char __user *  pBuf,
+   size_t               size );
+
+// Submit a filled write only transaction for a file handle
+int UserspaceWriteQueue(
+   sQMIFilpStorage *    pFilpData,
+   sQMIXaction *        pXaction );
+
+// Queue an O_NONBLOCK write
+ssize_t UserspaceWriteAsync(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID,
+   const char __user *  pBuf,
+   size_t               size );
+
+// Append one received message to a batch read buffer as a frame
+size_t UserspaceFrameAppend(
+   void *               pBatch,
+   size_t               offset,
+   u16                  clientID,
+   void *               pData,
+   u16                  dataSize );
+
+// Batch mode read of as many framed messages as fit
+ssize_t UserspaceReadBatch(
+   struct file *        pFilp,
+   sQMIFilpStorage *    pFilpData,
+   char __user *        pBuf,
+   size_t               size );
+
+// Batch mode write of several framed requests
+ssize_t UserspaceWriteBatch(
+   struct file *        pFilp,
+   sQMIFilpStorage *    pFilpData,
+   const char __user *  pBuf,
+   size_t               size );
+
+// List the clients owned by a file handle, primary client first
+int UserspaceClientIDs(
+   sQMIFilpStorage *    pFilpData,
+   u16 *                pClientIDs );
+
+// Resolve the client a batch or ring frame is sent as
+int UserspaceFrameClientID(
+   sQMIFilpStorage *    pFilpData,
+   u16                  frameClientID );
+
+// Make a client wake its owning file handle's wait queue
+void UserspaceAttachClient(
+   sQMIFilpStorage *    pFilpData,
+   u16                  clientID );
+
+// Stop every client owned by a file handle from waking it
+void UserspaceDetachClients( sQMIFilpStorage * pFilpData );
+
+// Give back a client owned by a closing file handle
+void UserspaceReleaseClient(
+   sGobiUSBNet *        pDev,
+   u16                  clientID );
+
+// Handler for IOCTL_QMI_ADD_SERVICE
+long UserspaceAddService(
+   sQMIFilpStorage *    pFilpData,
+   u8                   serviceType );
+
+// Wake up condition for batch reads
+bool UserspaceDataReady( sQMIFilpStorage * pFilpData );
+
+// Handler for IOCTL_QMI_SET_INDICATION_FILTER
+long UserspaceSetIndicationFilter(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg );
+
+// Handler for IOCTL_QMI_GET_QUEUE_STATS
+long UserspaceGetQueueStats(
+   sQMIFilpStorage *    pFilpData,
+   unsigned long        arg );
+
 /*=========================================================================*/
 // Userspace wrappers
 /*=========================================================================*/
@@ -310,10 +1113,69 @@ unsigned int UserspacePoll(
    struct file *                  pFilp,
    struct poll_table_struct *     pPollTable );
 
+// Map a shared message ring for this handle's client
+int UserspaceMmap(
+   struct file *              pFilp,
+   struct vm_area_struct *    pVMA );
+
+/*=========================================================================*/
+// Sysfs attributes
+/*=========================================================================*/
+
+// Device specific memory behind an interface's sysfs attribute
+sGobiUSBNet * QMISysfsGetDev( struct device * pDevice );
+
+// Show milliseconds QMIReady waited for the first QMICTL response
+ssize_t QMIReadyMsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf );
+
+// Show milliseconds from RegisterQMIDevice until QMI was usable
+ssize_t QMIProbeReadyMsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf );
+
+// Show control endpoint queueing statistics per priority class
+ssize_t QMICtrlStatsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf );
+
+#ifdef GOBI_KUNIT
+// Run the client memory KUnit suite, kernels before 6.0
+int GobiKUnitRun( void );
+#endif
+
+// Show expired transactions per QMI service
+ssize_t QMIXactionTimeoutsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf );
+
+#ifdef QMI_CLIENT_MEM_STATS
+// Show mClientMemLock and client memory statistics
+ssize_t QMIClientMemStatsShow(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   char *                     pBuf );
+
+// Reset mClientMemLock and client memory statistics
+ssize_t QMIClientMemStatsStore(
+   struct device *            pDevice,
+   struct device_attribute *  pAttr,
+   const char *               pBuf,
+   size_t                     count );
+#endif
+
 /*=========================================================================*/
 // Initializer and destructor
 /*=========================================================================*/
 
+// Wait for QMI and set up data path and WDS callback
+int QMIDeviceBringUp( sGobiUSBNet * pDev );
+
 // QMI Device initialization function
 int RegisterQMIDevice( sGobiUSBNet * pDev );
 
@@ -324,6 +1186,13 @@ void DeregisterQMIDevice( sGobiUSBNet * pDev );
 // Driver level client management
 /*=========================================================================*/
 
+// Completion callback for QMICTL READY requests
+void QMIReadyCallback(
+   sGobiUSBNet *     pDev,
+   int               result,
+   void *            pReadBuffer,
+   void *            pData );
+
 // Check if QMI is ready for use
 bool QMIReady(
    sGobiUSBNet *    pDev,
@@ -341,11 +1210,6 @@ int SetupQMIWDSCallback( sGobiUSBNet * pDev );
 // Register client, send req and parse MEID response, release client
 int QMIDMSGetMEID( sGobiUSBNet * pDev );
 
-// Register client, send req and parse Data format response, release client
-int QMIWDASetDataFormat( sGobiUSBNet * pDev );
-
-// Register client, send req and parse Bind Mux Data Port response, release client
-int QMIWDSBindMuxData( sGobiUSBNet * pDev );
-
-// Register client, send req and parse Bind Mux Data Port Pre response, release client
-int QMIWDSBindMuxDataPre( sGobiUSBNet * pDev, unsigned int index );
+// Register clients, send Data format and all Bind Mux Data Port reqs at once,
+//    parse responses, release clients
+int QMISetupDataPath( sGobiUSBNet * pDev );
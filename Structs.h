@@ -53,6 +53,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <linux/kthread.h>
 #include <linux/poll.h>
 #include <linux/completion.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,36 ))
+#include <linux/u64_stats_sync.h>
+#endif
 
 #if (LINUX_VERSION_CODE <= KERNEL_VERSION( 2,6,21 ))
 static inline void skb_reset_mac_header(struct sk_buff *skb)
@@ -151,6 +160,8 @@ static inline void usb_mark_last_busy(struct usb_device *udev)
 
 // Used in recursion, defined later below
 struct sGobiUSBNet;
+struct sQMIXaction;
+struct sQMIRing;
 
 /*=========================================================================*/
 // Struct sReadMemList
@@ -168,6 +179,9 @@ typedef struct sReadMemList
    /* Size of data buffer */
    u16                        mDataSize;
 
+   /* jiffies when the entry was queued */
+   unsigned long              mTimestamp;
+
    /* Next entry in linked list */
    struct sReadMemList *      mpNext;
 
@@ -209,6 +223,27 @@ typedef struct sURBList
 
 } sURBList;
 
+// Requests written by userspace whose transaction IDs are remembered
+#define QMI_USER_TID_MAP 64
+
+/*=========================================================================*/
+// Struct sQMIUserTID
+//
+//    Transaction ID a userspace write() chose, and the one it was sent with
+/*=========================================================================*/
+typedef struct sQMIUserTID
+{
+   /* ID the request was sent with, 0 for a free entry */
+   u16                          mKernelTID;
+
+   /* ID restored in the response */
+   u16                          mUserTID;
+
+   /* Jiffies after which no response is expected and the entry is free */
+   unsigned long                mExpires;
+
+} sQMIUserTID;
+
 /*=========================================================================*/
 // Struct sClientMemList
 //
@@ -233,6 +268,45 @@ typedef struct sClientMemList
    /*    Stores pointers to outstanding URBs which need canceled 
          when the client is deregistered or the device is removed */
    sURBList *                   mpURBList;
+
+   /* Linked list of in-driver transactions awaiting a response */
+   struct sQMIXaction *         mpXactionList;
+
+   /* Next transaction ID handed out to in-driver and userspace requests */
+   u16                          mNextTransactionID;
+
+   /* Userspace requests in flight, oldest overwritten when full */
+   sQMIUserTID                  mUserTIDs[QMI_USER_TID_MAP];
+   u8                           mUserTIDNext;
+
+   /* Idle in the client pool, waiting for IOCTL_QMI_GET_SERVICE_FILE */
+   bool                         mbPooled;
+
+   /* Mapped RX ring, messages go here instead of mpList when set */
+   struct sQMIRing *            mpRing;
+
+   /* Wait queue of the file handle owning this client, woken instead of
+      mWaitQueue when set */
+   wait_queue_head_t *          mpOwnerWaitQueue;
+
+   /* Indication message IDs delivered to this client, NULL for all */
+   u16 *                        mpIndicationFilter;
+
+   /* Number of entries in mpIndicationFilter */
+   u16                          mIndicationFilterCount;
+
+   /* Entries in mpList */
+   u32                          mReadCount;
+
+   /* Bytes held by mpList */
+   u32                          mReadBytes;
+
+   /* Messages discarded by the read queue limits */
+   u32                          mReadDropped;
+
+   /* Unclaimed messages of an in-driver client reclaimed after
+      orphanResponseTTL */
+   u32                          mReadExpired;
    
    /* Next entry in linked list */
    struct sClientMemList *      mpNext;
@@ -270,6 +344,94 @@ typedef struct sURBSetupPacket
 // Common value for sURBSetupPacket.mLength
 #define DEFAULT_READ_URB_LENGTH 0x1000
 
+// Control write URBs kept ready per device, and their payload size
+#define QMI_CTRL_URB_POOL 8
+#define QMI_CTRL_URB_BUFFER_SIZE DEFAULT_READ_URB_LENGTH
+
+// Largest control write, wLength of the setup packet is 16 bits
+#define QMI_CTRL_URB_MAX_SIZE 0xffff
+
+/*=========================================================================*/
+// Struct sQMICtrlURB
+//
+//    Structure that defines a control write URB with its own setup packet
+//    and payload buffer, both separately kmalloc'd so they can be mapped
+//    for DMA.  Allocated once and recycled through the device's pool
+/*=========================================================================*/
+typedef struct sQMICtrlURB
+{
+   /* Next free entry in the pool */
+   struct sQMICtrlURB *       mpNext;
+
+   /* Write URB */
+   struct urb *               mpURB;
+
+   /* Setup packet */
+   sURBSetupPacket *          mpSetupPacket;
+
+   /* Payload buffer (including room for QMUX) and its size */
+   void *                     mpBuffer;
+   u16                        mBufferSize;
+
+} sQMICtrlURB;
+
+/*=========================================================================*/
+// Struct sQMIXaction
+//
+//    Structure that defines an asynchronous in-driver QMI transaction
+/*=========================================================================*/
+typedef struct sQMIXaction
+{
+   /* Device this transaction runs on */
+   struct sGobiUSBNet *       mpDev;
+
+   /* Client and transaction IDs of the request */
+   u16                        mClientID;
+   u16                        mTransactionID;
+
+   /* Request buffer (including room for QMUX) and its size */
+   void *                     mpWriteBuffer;
+   u16                        mWriteBufferSize;
+
+   /* Pooled write URB with setup packet and request buffer */
+   sQMICtrlURB *              mpCtrlURB;
+   struct urb *               mpURB;
+
+   /* Deadline for the response */
+   struct timer_list          mTimer;
+
+   /* Completion callback, runs exactly once and may run in interrupt
+      context.  Receives the response size (or negative errno) and owns
+      the response buffer */
+   void                       (* mpCallback)(struct sGobiUSBNet *, 
+                                             int, 
+                                             void *, 
+                                             void *);
+   void *                     mpCallbackData;
+
+   /* Complete when the write finishes instead of on a response.
+      Set before QMIXactionSubmit, the callback gets the write size */
+   bool                       mbWriteOnly;
+
+   /* Set once the transaction has been completed */
+   atomic_t                   mbDone;
+
+   /* References held by owner, pending state, URB and timer */
+   atomic_t                   mRefCount;
+
+   /* Used by QMIXactionSync to wait for the result */
+   struct completion          mSyncDone;
+   int                        mSyncResult;
+   void *                     mpSyncReadBuffer;
+
+   /* Next entry in client's pending list */
+   struct sQMIXaction *       mpNext;
+
+} sQMIXaction;
+
+// Number of possible QMI service types (low byte of a client ID)
+#define QMI_SERVICE_COUNT 0x100
+
 #ifdef CONFIG_PM
 #if (LINUX_VERSION_CODE < KERNEL_VERSION( 2,6,29 ))
 /*=========================================================================*/
@@ -304,6 +466,9 @@ typedef struct sAutoPM
 
    /* Active URB lock (for adding and removing elements) */
    spinlock_t                 mActiveURBLock;
+
+   /* When mpActiveURB was submitted */
+   ktime_t                    mActiveURBSubmitted;
    
    /* Duplicate pointer to USB device interface */
    struct usb_interface *     mpIntf;
@@ -312,6 +477,319 @@ typedef struct sAutoPM
 #endif
 #endif /* CONFIG_PM */
 
+/*=========================================================================*/
+// Struct sQMICachePolicy
+//
+//    Entry of the table of QMI queries the response cache may answer
+/*=========================================================================*/
+typedef struct sQMICachePolicy
+{
+   /* Service type of the query */
+   u8                         mServiceType;
+
+   /* Message ID of the query */
+   u16                        mMsgID;
+
+   /* Indication of the same service dropping the cached answer, 0 for none */
+   u16                        mInvalidateMsgID;
+
+   /* Milliseconds an answer stays valid, 0 until invalidated */
+   u32                        mMaxAgeMs;
+
+} sQMICachePolicy;
+
+/*=========================================================================*/
+// Struct sQMICacheEntry
+//
+//    Cached response to a QMI query, keyed by service, message ID and the
+//    request TLVs, which are stored right after the entry
+/*=========================================================================*/
+typedef struct sQMICacheEntry
+{
+   /* Policy this entry was created for */
+   const sQMICachePolicy *    mpPolicy;
+
+   /* Request TLVs */
+   void *                     mpRequest;
+
+   /* Size of mpRequest */
+   u16                        mRequestSize;
+
+   /* Response SDU, NULL until the modem answers the first request */
+   void *                     mpResponse;
+
+   /* Size of mpResponse */
+   u16                        mResponseSize;
+
+   /* Client and transaction ID of the request filling this entry */
+   u16                        mClientID;
+   u16                        mTransactionID;
+
+   /* jiffies when the entry was created or filled */
+   unsigned long              mTimestamp;
+
+   /* Next entry in linked list, newest first */
+   struct sQMICacheEntry *    mpNext;
+
+} sQMICacheEntry;
+
+/*=========================================================================*/
+// Struct sQMIMessageKey
+//
+//    Service type and message ID naming a QMI message
+/*=========================================================================*/
+typedef struct sQMIMessageKey
+{
+   /* Service type */
+   u8                         mServiceType;
+
+   /* Message ID */
+   u16                        mMsgID;
+
+} sQMIMessageKey;
+
+/* Most requests sharing the response of one request in flight */
+#define QMI_DEDUP_MAX_FOLLOWERS 8
+
+/*=========================================================================*/
+// Struct sQMIDedupEntry
+//
+//    Request in flight whose response is shared with identical requests
+//    of other clients. Request TLVs are stored right after the entry
+/*=========================================================================*/
+typedef struct sQMIDedupEntry
+{
+   /* Service type and message ID of the request */
+   sQMIMessageKey             mKey;
+
+   /* Request TLVs */
+   void *                     mpRequest;
+
+   /* Size of mpRequest */
+   u16                        mRequestSize;
+
+   /* Client and transaction ID of the request sent to the modem */
+   u16                        mClientID;
+   u16                        mTransactionID;
+
+   /* Clients and transaction IDs of the requests not sent */
+   u16                        mFollowerClientIDs[QMI_DEDUP_MAX_FOLLOWERS];
+   u16                        mFollowerTransactionIDs[QMI_DEDUP_MAX_FOLLOWERS];
+
+   /* Number of valid follower entries */
+   u16                        mFollowerCount;
+
+   /* jiffies when the request was sent */
+   unsigned long              mTimestamp;
+
+   /* Next entry in linked list */
+   struct sQMIDedupEntry *    mpNext;
+
+} sQMIDedupEntry;
+
+/* Priority classes of the control endpoint scheduler, 0 is served first */
+#define QMI_CTRL_CLASSES 4
+
+/*=========================================================================*/
+// Struct sQMICtrlRequest
+//
+//    Control endpoint write waiting for a free slot
+/*=========================================================================*/
+typedef struct sQMICtrlRequest
+{
+   /* Entry in the priority class queue */
+   struct list_head           mList;
+
+   /* Filled write URB */
+   struct urb *               mpURB;
+
+   /* Client ID of requester */
+   u16                        mClientID;
+
+   /* When the request was queued */
+   ktime_t                    mQueuedAt;
+
+} sQMICtrlRequest;
+
+/*=========================================================================*/
+// Struct sQMIWriteSyncContext
+//
+//    Context of a WriteSyncTimeout URB
+/*=========================================================================*/
+typedef struct sQMIWriteSyncContext
+{
+   /* Completed by WriteSyncCallback */
+   struct completion          mDone;
+
+   /* Device the URB is written to */
+   struct sGobiUSBNet *       mpDev;
+
+} sQMIWriteSyncContext;
+
+/*=========================================================================*/
+// Struct sQMICtrlStats
+//
+//    Queue wait statistics of one control endpoint priority class
+/*=========================================================================*/
+typedef struct sQMICtrlStats
+{
+   /* Writes submitted */
+   u32                        mRequests;
+
+   /* Writes that had to wait for a free slot */
+   u32                        mQueued;
+
+   /* Writes waiting right now */
+   u32                        mDepth;
+
+   /* Longest wait, in microseconds */
+   u32                        mMaxWaitUs;
+
+   /* Sum of all waits, in microseconds */
+   u64                        mTotalWaitUs;
+
+} sQMICtrlStats;
+
+// Client memory operations counted in QMI_CLIENT_MEM_STATS builds
+enum
+{
+   QMI_MEM_OP_FIND_CLIENT,
+   QMI_MEM_OP_ADD_READ,
+   QMI_MEM_OP_POP_READ,
+   QMI_MEM_OP_ADD_NOTIFY,
+   QMI_MEM_OP_NOTIFY_POP,
+   QMI_MEM_OP_ADD_URB,
+   QMI_MEM_OP_POP_URB,
+   QMI_MEM_OPS
+};
+
+/*=========================================================================*/
+// Struct sQMIClientMemStats
+//
+//    mClientMemLock contention and client memory operation counts
+//       Only built with QMI_CLIENT_MEM_STATS, updated under mClientMemLock
+/*=========================================================================*/
+typedef struct sQMIClientMemStats
+{
+   /* Lock acquisitions */
+   u64                        mAcquired;
+
+   /* Time spent spinning for the lock, in nanoseconds */
+   u64                        mTotalWaitNs;
+   u64                        mMaxWaitNs;
+
+   /* Time the lock was held, in nanoseconds */
+   u64                        mTotalHoldNs;
+   u64                        mMaxHoldNs;
+
+   /* When the current holder took the lock */
+   ktime_t                    mLockedAt;
+
+   /* Calls per QMI_MEM_OP_* */
+   u64                        mOps[QMI_MEM_OPS];
+
+} sQMIClientMemStats;
+
+// Latency histograms: bucket n counts responses in [2^n, 2^(n+1))
+//    microseconds, the last bucket also takes anything slower
+#define QMI_LATENCY_BUCKETS  24
+
+// Requests waiting for a response, and histograms kept per device
+#define QMI_LATENCY_PENDING  64
+#define QMI_LATENCY_SERVICES 16
+#define QMI_LATENCY_MESSAGES 64
+
+/*=========================================================================*/
+// Struct sQMILatencyHist
+//
+//    Response latency histogram of one service, or of one message ID
+/*=========================================================================*/
+typedef struct sQMILatencyHist
+{
+   /* QMI service type */
+   u8                         mService;
+
+   /* Message ID, unused in a per service histogram */
+   u16                        mMessageID;
+
+   /* Responses matched to a request */
+   u32                        mResponses;
+
+   /* Requests never answered in time */
+   u32                        mTimeouts;
+
+   /* Responses without a request, per service histograms only */
+   u32                        mOrphans;
+
+   /* Sum and worst of all latencies, in microseconds */
+   u64                        mTotalUs;
+   u32                        mMaxUs;
+
+   /* Responses per log2 latency bucket */
+   u32                        mBuckets[QMI_LATENCY_BUCKETS];
+
+} sQMILatencyHist;
+
+/*=========================================================================*/
+// Struct sQMILatencyPending
+//
+//    Request written to the modem and waiting for its response
+/*=========================================================================*/
+typedef struct sQMILatencyPending
+{
+   /* Whether this slot holds a request */
+   bool                       mbUsed;
+
+   /* Client, transaction and message IDs of the request */
+   u16                        mClientID;
+   u16                        mTransactionID;
+   u16                        mMessageID;
+
+   /* When the request was written */
+   ktime_t                    mSentAt;
+
+} sQMILatencyPending;
+
+/*=========================================================================*/
+// Struct sQMILatency
+//
+//    Transaction latency statistics of a device, under mLatencyLock
+/*=========================================================================*/
+typedef struct sQMILatency
+{
+   /* Requests waiting for a response */
+   sQMILatencyPending         mPending[QMI_LATENCY_PENDING];
+
+   /* Histograms per service and per message ID, filled in order */
+   sQMILatencyHist            mService[QMI_LATENCY_SERVICES];
+   int                        mServiceCount;
+   sQMILatencyHist            mMessage[QMI_LATENCY_MESSAGES];
+   int                        mMessageCount;
+
+   /* Requests or responses the tables had no room for */
+   u32                        mUntracked;
+
+} sQMILatency;
+
+// Read messages waiting for QMIRxWork before new ones are dropped
+#define QMI_RX_QUEUE_MAX 256
+
+/*=========================================================================*/
+// Struct sQMIRxMsg
+//
+//    Read message queued by ReadCallback for QMIRxWork
+//       The message follows the structure in the same allocation
+/*=========================================================================*/
+typedef struct sQMIRxMsg
+{
+   /* Entry in the device's read queue */
+   struct list_head           mList;
+
+   /* Size of the message */
+   u16                        mSize;
+
+} sQMIRxMsg;
+
 /*=========================================================================*/
 // Struct sQMIDev
 //
@@ -353,11 +831,188 @@ typedef struct sQMIDev
    /* Spinlock for client Memory entries */
    spinlock_t                 mClientMemLock;
 
+#ifdef QMI_CLIENT_MEM_STATS
+   /* mClientMemLock and client memory statistics */
+   sQMIClientMemStats         mClientMemStats;
+#endif
+
    /* Transaction ID associated with QMICTL "client" */
    atomic_t                   mQMICTLTransactionID;
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,23 ))
+   /* Write URBs of in-flight transactions */
+   struct usb_anchor          mXactionAnchor;
+#endif
+
+   /* Number of expired transactions, indexed by QMI service type */
+   atomic_t                   mXactionTimeouts[QMI_SERVICE_COUNT];
+
+   /* Transactions allocated and not yet freed, and its spinlock */
+   int                        mXactionsLive;
+   spinlock_t                 mXactionsLiveLock;
+
+   /* Signalled by the first QMICTL READY response */
+   struct completion          mCTLReady;
+
+   /* Whether the "qmi" sysfs attribute group was created */
+   bool                       mbSysfsCreated;
+
+   /* Tops up the client pool outside of the ioctl path */
+   struct work_struct         mClientPoolWork;
+
+   /* Response cache entries */
+   sQMICacheEntry *           mpCacheList;
+
+   /* Number of entries in mpCacheList */
+   u16                        mCacheCount;
+
+   /* Requests in flight that identical requests may share */
+   sQMIDedupEntry *           mpDedupList;
+
+   /* Number of entries in mpDedupList */
+   u16                        mDedupCount;
+
+   /* Spinlock for the response cache and mpDedupList */
+   spinlock_t                 mCacheLock;
+
+   /* Control endpoint writes waiting, one queue per priority class */
+   struct list_head           mCtrlQueue[QMI_CTRL_CLASSES];
+
+   /* Client served last in each class, for round robin between clients */
+   u16                        mCtrlLastClientID[QMI_CTRL_CLASSES];
+
+   /* Control endpoint writes submitted and not yet completed */
+   int                        mCtrlInFlight;
+
+   /* Queue wait statistics per priority class */
+   sQMICtrlStats              mCtrlStats[QMI_CTRL_CLASSES];
+
+   /* Free pooled control write URBs and their count */
+   sQMICtrlURB *              mpCtrlURBPool;
+   int                        mCtrlURBPoolCount;
+
+   /* Set once the pool is destroyed, late returns are freed */
+   bool                       mbCtrlURBPoolClosed;
+
+   /* Spinlock for the control endpoint scheduler and URB pool */
+   spinlock_t                 mCtrlLock;
+
+   /* Read messages waiting to be parsed, and how many */
+   struct list_head           mRxQueue;
+   int                        mRxQueueDepth;
+
+   /* Spinlock for mRxQueue */
+   spinlock_t                 mRxLock;
+
+   /* Ordered workqueue and work item parsing read messages */
+   struct workqueue_struct *  mpRxWorkQueue;
+   struct work_struct         mRxWork;
+
+   /* Transaction latency statistics, NULL when unavailable */
+   sQMILatency *              mpLatency;
+
+   /* Spinlock for mpLatency */
+   spinlock_t                 mLatencyLock;
+
+   /* Module's debugfs directory, and this device's under it */
+   struct dentry *            mpDebugRoot;
+   struct dentry *            mpDebugDir;
+
 } sQMIDev;
 
+// Log2 buckets of the data path histograms
+#define GOBI_DATA_SIZE_BUCKETS   16
+#define GOBI_DATA_TIME_BUCKETS   24
+#define GOBI_DATA_COUNT_BUCKETS  8
+
+/*=========================================================================*/
+// Struct sGobiDataStats
+//
+//    Bulk URB statistics of the data path, bucket n of a histogram counts
+//    values in [2^n, 2^(n+1)), the last bucket everything above
+/*=========================================================================*/
+typedef struct sGobiDataStats
+{
+   /* Bulk URBs seen by the fixups, and the packets they carried */
+   u64                        mRxURBs;
+   u64                        mRxPackets;
+   u64                        mTxURBs;
+   u64                        mTxPackets;
+
+   /* Transfers of whole max size packets, ended by a zero length packet */
+   u64                        mRxZLPs;
+   u64                        mTxZLPs;
+
+   /* Bytes per bulk URB */
+   u32                        mRxBytes[GOBI_DATA_SIZE_BUCKETS];
+   u32                        mTxBytes[GOBI_DATA_SIZE_BUCKETS];
+
+   /* Packets per bulk URB */
+   u32                        mRxPacketsPerURB[GOBI_DATA_COUNT_BUCKETS];
+   u32                        mTxPacketsPerURB[GOBI_DATA_COUNT_BUCKETS];
+
+   /* Microseconds between bulk-in URB completions */
+   u32                        mRxIdleUs[GOBI_DATA_TIME_BUCKETS];
+
+   /* Microseconds from submit to completion of driver owned bulk-out URBs */
+   u32                        mTxLatencyUs[GOBI_DATA_TIME_BUCKETS];
+
+   /* Bulk-out URBs already queued when another one is fixed up */
+   u32                        mTxInFlight[GOBI_DATA_COUNT_BUCKETS];
+
+   /* Completion of the previous bulk-in URB */
+   ktime_t                    mLastRx;
+
+} sGobiDataStats;
+
+/*=========================================================================*/
+// Struct sGobiDataStat
+//
+//    Entry of the tables naming the counters and histograms of 
+//    sGobiDataStats and sGobiModemStats, in the order ethtool and debugfs
+//    list them
+/*=========================================================================*/
+typedef struct sGobiDataStat
+{
+   /* Name, histogram buckets get _<n> appended for ethtool */
+   const char *               mpName;
+
+   /* Offset of the field in the statistics structure */
+   size_t                     mOffset;
+
+   /* u32 buckets of a histogram, 0 for a u64 counter */
+   int                        mBuckets;
+
+} sGobiDataStat;
+
+/*=========================================================================*/
+// Struct sGobiModemStats
+//
+//    Counters from WDS event reports and channel rates from CDC 
+//    CONNECTION_SPEED_CHANGE, as the modem last reported them
+/*=========================================================================*/
+typedef struct sGobiModemStats
+{
+   /* Packets and bytes transferred without errors */
+   u64                        mTXOk;
+   u64                        mRXOk;
+   u64                        mTXBytesOk;
+   u64                        mRXBytesOk;
+
+   /* Packets with framing errors */
+   u64                        mTXErr;
+   u64                        mRXErr;
+
+   /* Packets dropped due to overflow */
+   u64                        mTXOfl;
+   u64                        mRXOfl;
+
+   /* Channel bit rates, 0 when unknown or traffic is stopped */
+   u64                        mDownlinkBps;
+   u64                        mUplinkBps;
+
+} sGobiModemStats;
+
 /*=========================================================================*/
 // Struct sGobiUSBNet
 //
@@ -378,12 +1033,42 @@ typedef struct sGobiUSBNet
    struct completion mQMIReadyCompletion;
    bool                   mbQMIReady;
 
+   /* qmi_sync_thread was started, mQMISyncDone fires once it is done */
+   bool                   mbQMISyncThread;
+   struct completion      mQMISyncDone;
+
+   /* Time RegisterQMIDevice started, in jiffies */
+   unsigned long          mQMIProbeTime;
+
+   /* Milliseconds from RegisterQMIDevice until QMI was usable */
+   unsigned int           mQMIReadyMs;
+
+   /* Milliseconds QMIReady waited for the first QMICTL response */
+   unsigned int           mQMICTLReadyMs;
+
    /* Usb device interface */
    struct usb_interface * mpIntf;
 
    /* Pointers to usbnet_open and usbnet_stop functions */
    int                  (* mpUSBNetOpen)(struct net_device *);
    int                  (* mpUSBNetStop)(struct net_device *);
+
+   /* Copy of usbnet's ethtool operations with statistics added */
+   struct ethtool_ops *   mpEthtoolOps;
+
+   /* Data path statistics */
+   sGobiDataStats         mDataStats;
+
+   /* Serializes the writers of mDataStats, fixups and reset alike */
+   spinlock_t             mDataStatsLock;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 2,6,36 ))
+   /* Lets readers of mDataStats retry instead of seeing torn u64s */
+   struct u64_stats_sync  mDataStatsSync;
+#endif
+
+   /* Modem reported statistics */
+   sGobiModemStats        mModemStats;
    
    /* Reason(s) why interface is down */
    /* Used by Gobi*DownReason */
@@ -412,6 +1097,9 @@ typedef struct sGobiUSBNet
 #endif /* CONFIG_PM */
 } sGobiUSBNet;
 
+/* Maximum number of services multiplexed on one file handle */
+#define QMI_FILP_MAX_SERVICES 8
+
 /*=========================================================================*/
 // Struct sQMIFilpStorage
 //
@@ -426,5 +1114,185 @@ typedef struct sQMIFilpStorage
    /* Device pointer */
    sGobiUSBNet *        mpDev;
 
+   /* Reads and writes use sQMIFrameHeader framing */
+   bool                 mbBatchMode;
+
+   /* Additional clients added with IOCTL_QMI_ADD_SERVICE */
+   u16                  mExtraClientIDs[QMI_FILP_MAX_SERVICES];
+
+   /* Number of valid entries in mExtraClientIDs */
+   u8                   mExtraClientCount;
+
+   /* Ring mapped through this handle */
+   struct sQMIRing *    mpRing;
+
+   /* O_NONBLOCK writes submitted but not yet completed */
+   atomic_t             mWritesInFlight;
+
+   /* First error of a failed O_NONBLOCK write, reported by the next write */
+   atomic_t             mWriteError;
+
+   /* Woken as O_NONBLOCK writes complete and as messages arrive for any
+      client owned by this handle, for read(), poll() and close */
+   wait_queue_head_t    mWaitQueue;
+
 } sQMIFilpStorage;
 
+/*=========================================================================*/
+// Struct sQMIIoctlTransaction
+//
+//    Argument of IOCTL_QMI_TRANSACTION
+//       Buffers hold the QMI SDU without QMUX header, as read() and write()
+/*=========================================================================*/
+typedef struct sQMIIoctlTransaction
+{
+   /* Userspace request buffer, its transaction ID is replaced */
+   u64                  mpRequest;
+
+   /* Userspace response buffer */
+   u64                  mpResponse;
+
+   /* Request length */
+   u32                  mRequestSize;
+
+   /* In: response buffer size, Out: response length */
+   u32                  mResponseSize;
+
+   /* Milliseconds to wait for the response, 0 for the driver default */
+   u32                  mTimeout;
+
+   /* Must be 0 */
+   u32                  mReserved;
+
+} sQMIIoctlTransaction;
+
+/*=========================================================================*/
+// Struct sQMIIoctlIndicationFilter
+//
+//    Argument of IOCTL_QMI_SET_INDICATION_FILTER
+//       Indications with a message ID not listed are dropped for the client
+/*=========================================================================*/
+typedef struct sQMIIoctlIndicationFilter
+{
+   /* Userspace array of u16 message IDs, 0 removes the filter */
+   u64                  mpMessageIDs;
+
+   /* Entries in mpMessageIDs, 0 with a buffer drops every indication */
+   u32                  mCount;
+
+   /* Client to filter, 0 for this handle's primary client */
+   u16                  mClientID;
+
+   /* Must be 0 */
+   u16                  mReserved;
+
+} sQMIIoctlIndicationFilter;
+
+/*=========================================================================*/
+// Struct sQMIIoctlQueueStats
+//
+//    Argument of IOCTL_QMI_GET_QUEUE_STATS
+/*=========================================================================*/
+typedef struct sQMIIoctlQueueStats
+{
+   /* In: client to report, 0 for this handle's primary client */
+   u16                  mClientID;
+
+   /* Must be 0 */
+   u16                  mReserved;
+
+   /* Unread messages queued */
+   u32                  mReadCount;
+
+   /* Bytes of unread messages queued */
+   u32                  mReadBytes;
+
+   /* Messages discarded by the read queue limits */
+   u32                  mReadDropped;
+
+   /* Unclaimed messages reclaimed after their TTL */
+   u32                  mReadExpired;
+
+} sQMIIoctlQueueStats;
+
+/*=========================================================================*/
+// Struct sQMIFrameHeader
+//
+//    Precedes each QMI SDU in batch mode reads and writes
+/*=========================================================================*/
+typedef struct sQMIFrameHeader
+{
+   /* Length of the SDU that follows */
+   u16                  mLength;
+
+   /* Client the SDU belongs to, 0 on write means this handle's client */
+   u16                  mClientID;
+
+} sQMIFrameHeader;
+
+/*=========================================================================*/
+// Struct sQMIRingHeader
+//
+//    First page of a mapped QMI ring, shared with userspace
+//       Indices are free running byte counts, masked with the ring size.
+//       Each entry is an sQMIFrameHeader and SDU padded to 4 bytes, and
+//       may wrap around the end of the ring.
+/*=========================================================================*/
+typedef struct sQMIRingHeader
+{
+   /* RX ring size in bytes */
+   u32                  mRxSize;
+
+   /* Advanced by the driver after writing a frame */
+   u32                  mRxProducer;
+
+   /* Advanced by userspace after consuming a frame */
+   u32                  mRxConsumer;
+
+   /* Messages dropped because the RX ring was full */
+   u32                  mRxDropped;
+
+   /* TX ring size in bytes, 0 if not mapped */
+   u32                  mTxSize;
+
+   /* Advanced by userspace after writing a frame */
+   u32                  mTxProducer;
+
+   /* Advanced by the driver after sending a frame */
+   u32                  mTxConsumer;
+
+   /* Must be 0 */
+   u32                  mReserved;
+
+} sQMIRingHeader;
+
+/*=========================================================================*/
+// Struct sQMIRing
+//
+//    Driver side state of a mapped ring
+//       The driver keeps its own indices and sizes, userspace may scribble
+//       over the shared header
+/*=========================================================================*/
+typedef struct sQMIRing
+{
+   /* Held by the mapping, the client and the file handle */
+   struct kref          mRefCount;
+
+   /* vmalloc_user() area, header page followed by the rings */
+   sQMIRingHeader *     mpHeader;
+
+   /* RX ring data and size */
+   u8 *                 mpRxData;
+   u32                  mRxSize;
+   u32                  mRxProducer;
+
+   /* TX ring data and size, 0 if not mapped */
+   u8 *                 mpTxData;
+   u32                  mTxSize;
+   u32                  mTxConsumer;
+
+   /* Serializes IOCTL_QMI_RING_KICK */
+   struct mutex         mTxLock;
+
+} sQMIRing;
+
@@ -0,0 +1,754 @@
+/*===========================================================================
+FILE:
+   gobi_clientmem_kunit.c
+
+DESCRIPTION:
+   KUnit suite of the client memory lists guarded by mClientMemLock
+      Exercises FindClientMem, AddToReadMemList, PopFromReadMemList,
+      AddToNotifyList, NotifyAndPopNotifyList, AddToURBList and
+      PopFromURBList on a device without hardware, from one thread and
+      from many, and reports throughput and mClientMemLock wait and hold
+      times from the QMI_CLIENT_MEM_STATS counters
+
+   Built into GobiNet.ko by "make GOBI_KUNIT=y", which also turns on
+   QMI_CLIENT_MEM_STATS.  The suite runs when the module is loaded and
+   reports KTAP in the kernel log.  From 6.0 kunit_test_suite() runs it,
+   before that GobiUSBNetModInit calls GobiKUnitRun.  Under UML:
+
+      ./tools/testing/kunit/kunit.py config --build_dir=.uml \
+         --kunitconfig=<GobiNet>/test/gobi_clientmem.kunitconfig
+      make ARCH=um O=.uml -j$(nproc)
+      make -C <GobiNet> ARCH=um KDIR=<linux>/.uml GOBI_KUNIT=y
+      .uml/linux rootfstype=hostfs rw init=/bin/sh, then insmod of
+         usbnet.ko if modular and GobiNet.ko
+
+   Without a kernel tree, "make -C test kunit" runs the same suite as a
+   host program against the userspace stand-ins in test/kshim
+
+FUNCTIONS:
+   Fixture
+      GobiKUnitClientID
+      GobiKUnitInit
+      GobiKUnitExit
+      GobiKUnitNotify
+
+   Single threaded cases
+      GobiKUnitFindClient
+      GobiKUnitReadMemOrder
+      GobiKUnitNotifyMatch
+      GobiKUnitURBOrder
+
+   Concurrent case
+      GobiKUnitStressThread
+      GobiKUnitStress
+
+   Entry point before 6.0
+      GobiKUnitRun
+
+===========================================================================*/
+
+//---------------------------------------------------------------------------
+// Include Files
+//---------------------------------------------------------------------------
+#include <kunit/test.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include "../QMIDevice.h"
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION( 5,5,0 ))
+#error "KUnit needs Linux 5.5 or later"
+#endif
+
+// Added to KUnit in 6.0
+#ifndef KUNIT_EXPECT_NULL
+#define KUNIT_EXPECT_NULL( test, ptr ) KUNIT_EXPECT_PTR_EQ( test, ptr, NULL )
+#endif
+
+/*=========================================================================*/
+// Definitions
+/*=========================================================================*/
+
+// Clients on the test device
+#define GOBI_KUNIT_CLIENTS       16
+
+// Stress threads, at least GOBI_KUNIT_MIN_THREADS and two per CPU
+//    Each client sees at most one entry per thread, well under
+//    readQueueDepth
+#define GOBI_KUNIT_MIN_THREADS   4
+#define GOBI_KUNIT_MAX_THREADS   32
+
+// Rounds per stress thread, and the list operations in each
+#define GOBI_KUNIT_ROUNDS        20000
+#define GOBI_KUNIT_ROUND_OPS     7
+
+// Size of the data queued by the stress threads
+#define GOBI_KUNIT_DATA_SIZE     64
+
+/*=========================================================================*/
+// Struct sGobiKUnitStress
+//
+//    State of one stress thread
+/*=========================================================================*/
+typedef struct sGobiKUnitStress
+{
+   /* Test device */
+   sGobiUSBNet *              mpDev;
+
+   /* Thread number, its transaction ID is mIndex + 1 */
+   int                        mIndex;
+
+   /* Notifications run, shared by all threads */
+   atomic_t *                 mpNotified;
+
+   /* URBs popped, of any thread */
+   u32                        mURBs;
+
+   /* List operations that failed or returned the wrong entry */
+   u32                        mErrors;
+
+   /* Completed when the thread is done */
+   struct completion *        mpDone;
+
+} sGobiKUnitStress;
+
+/*=========================================================================*/
+// Fixture
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   GobiKUnitClientID (Private Method)
+
+DESCRIPTION:
+   Client ID of a test client, WDS with client number index + 1
+
+PARAMETERS:
+   index          [ I ] - Client number, 0 based
+
+RETURN VALUE:
+   u16 - Client ID
+===========================================================================*/
+static u16 GobiKUnitClientID( int index )
+{
+   return ((index + 1) << 8) | QMIWDS;
+}
+
+/*===========================================================================
+METHOD:
+   GobiKUnitInit (Private Method)
+
+DESCRIPTION:
+   Create a device without hardware and GOBI_KUNIT_CLIENTS clients on it
+
+PARAMETERS:
+   pTest          [ I ] - Test case, priv is set to the device
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for failure
+===========================================================================*/
+static int GobiKUnitInit( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev;
+   int client;
+   int result;
+
+   pDev = kzalloc( sizeof( sGobiUSBNet ), GFP_KERNEL );
+   if (pDev == NULL)
+   {
+      return -ENOMEM;
+   }
+
+   pDev->mbQMIValid = true;
+   spin_lock_init( &pDev->mQMIDev.mClientMemLock );
+   pTest->priv = pDev;
+
+   for (client = 0; client < GOBI_KUNIT_CLIENTS; client++)
+   {
+      result = CreateClientMem( pDev, GobiKUnitClientID( client ) );
+      if (result != GobiKUnitClientID( client ))
+      {
+         return result < 0 ? result : -EINVAL;
+      }
+   }
+
+   return 0;
+}
+
+/*===========================================================================
+METHOD:
+   GobiKUnitNotify (Private Method)
+
+DESCRIPTION:
+   Notification callback, counts its calls
+
+PARAMETERS:
+   pDev           [ I ] - Device specific memory
+   clientID       [ I ] - Client ID
+   pData          [ I ] - atomic_t counting the calls
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiKUnitNotify(
+   sGobiUSBNet *     pDev,
+   u16               clientID,
+   void *            pData )
+{
+   atomic_inc( (atomic_t *)pData );
+}
+
+/*===========================================================================
+METHOD:
+   GobiKUnitExit (Private Method)
+
+DESCRIPTION:
+   Free whatever a case left on the lists, then the clients and the device
+
+PARAMETERS:
+   pTest          [ I ] - Test case
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void GobiKUnitExit( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   sClientMemList * pClientMem;
+   sNotifyList * pNotify;
+   unsigned long flags;
+   void * pData;
+   u16 dataSize;
+
+   if (pDev == NULL)
+   {
+      return;
+   }
+
+   QMIClientMemLock( pDev, flags );
+   while (pDev->mQMIDev.mpClientMemList != NULL)
+   {
+      pClientMem = pDev->mQMIDev.mpClientMemList;
+
+      while (PopFromReadMemList( pDev,
+                                 pClientMem->mClientID,
+                                 0,
+                                 &pData,
+                                 &dataSize ) == true)
+      {
+         kfree( pData );
+      }
+      while (PopFromURBList( pDev, pClientMem->mClientID ) != NULL)
+      {
+         ;
+      }
+      while (pClientMem->mpReadNotifyList != NULL)
+      {
+         pNotify = pClientMem->mpReadNotifyList;
+         pClientMem->mpReadNotifyList = pNotify->mpNext;
+         kfree( pNotify );
+      }
+
+      pDev->mQMIDev.mpClientMemList = pClientMem->mpNext;
+      kfree( pClientMem );
+   }
+   QMIClientMemUnlock( pDev, flags );
+
+   kfree( pDev );
+}
+
+/*=========================================================================*/
+// Single threaded cases
+/*=========================================================================*/
+
+// Every client is found, unknown clients and invalid devices are not
+static void GobiKUnitFindClient( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   sClientMemList * pClientMem;
+   unsigned long flags;
+   int client;
+
+   QMIClientMemLock( pDev, flags );
+
+   for (client = 0; client < GOBI_KUNIT_CLIENTS; client++)
+   {
+      pClientMem = FindClientMem( pDev, GobiKUnitClientID( client ) );
+      KUNIT_EXPECT_NOT_ERR_OR_NULL( pTest, pClientMem );
+      if (pClientMem != NULL)
+      {
+         KUNIT_EXPECT_EQ( pTest,
+                          pClientMem->mClientID,
+                          GobiKUnitClientID( client ) );
+      }
+   }
+
+   KUNIT_EXPECT_NULL( pTest,
+                      FindClientMem( pDev,
+                                     GobiKUnitClientID( GOBI_KUNIT_CLIENTS ) ) );
+
+   pDev->mbQMIValid = false;
+   KUNIT_EXPECT_NULL( pTest, FindClientMem( pDev, GobiKUnitClientID( 0 ) ) );
+   pDev->mbQMIValid = true;
+
+   QMIClientMemUnlock( pDev, flags );
+
+   // Client IDs are unique
+   KUNIT_EXPECT_EQ( pTest,
+                    CreateClientMem( pDev, GobiKUnitClientID( 0 ) ),
+                    -ETOOMANYREFS );
+}
+
+// Pops match the transaction ID, or take the oldest entry for 0
+static void GobiKUnitReadMemOrder( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   u16 clientID = GobiKUnitClientID( 0 );
+   void * pData[3];
+   void * pPopped;
+   u16 poppedSize;
+   unsigned long flags;
+   int index;
+
+   for (index = 0; index < ARRAY_SIZE( pData ); index++)
+   {
+      pData[index] = kmalloc( 8, GFP_KERNEL );
+      KUNIT_ASSERT_NOT_ERR_OR_NULL( pTest, pData[index] );
+   }
+
+   QMIClientMemLock( pDev, flags );
+
+   KUNIT_EXPECT_TRUE( pTest,
+                      AddToReadMemList( pDev, clientID, 2, pData[0], 8 ) );
+   KUNIT_EXPECT_TRUE( pTest,
+                      AddToReadMemList( pDev, clientID, 3, pData[1], 8 ) );
+   KUNIT_EXPECT_TRUE( pTest,
+                      AddToReadMemList( pDev, clientID, 2, pData[2], 8 ) );
+   KUNIT_EXPECT_EQ( pTest, FindClientMem( pDev, clientID )->mReadCount, 3 );
+
+   KUNIT_EXPECT_TRUE( pTest,
+                      PopFromReadMemList( pDev,
+                                          clientID,
+                                          3,
+                                          &pPopped,
+                                          &poppedSize ) );
+   KUNIT_EXPECT_PTR_EQ( pTest, pPopped, pData[1] );
+   KUNIT_EXPECT_EQ( pTest, poppedSize, 8 );
+
+   KUNIT_EXPECT_TRUE( pTest,
+                      PopFromReadMemList( pDev,
+                                          clientID,
+                                          0,
+                                          &pPopped,
+                                          &poppedSize ) );
+   KUNIT_EXPECT_PTR_EQ( pTest, pPopped, pData[0] );
+
+   KUNIT_EXPECT_FALSE( pTest,
+                       PopFromReadMemList( pDev,
+                                           clientID,
+                                           3,
+                                           &pPopped,
+                                           &poppedSize ) );
+
+   KUNIT_EXPECT_TRUE( pTest,
+                      PopFromReadMemList( pDev,
+                                          clientID,
+                                          2,
+                                          &pPopped,
+                                          &poppedSize ) );
+   KUNIT_EXPECT_PTR_EQ( pTest, pPopped, pData[2] );
+
+   KUNIT_EXPECT_FALSE( pTest,
+                       PopFromReadMemList( pDev,
+                                           clientID,
+                                           0,
+                                           &pPopped,
+                                           &poppedSize ) );
+   KUNIT_EXPECT_EQ( pTest, FindClientMem( pDev, clientID )->mReadCount, 0 );
+   KUNIT_EXPECT_EQ( pTest, FindClientMem( pDev, clientID )->mReadBytes, 0 );
+
+   // Unknown clients take nothing
+   KUNIT_EXPECT_FALSE( pTest,
+                       AddToReadMemList(
+                          pDev,
+                          GobiKUnitClientID( GOBI_KUNIT_CLIENTS ),
+                          1,
+                          pData[0],
+                          8 ) );
+
+   QMIClientMemUnlock( pDev, flags );
+
+   for (index = 0; index < ARRAY_SIZE( pData ); index++)
+   {
+      kfree( pData[index] );
+   }
+}
+
+// Entries registered for transaction 0 match any transaction
+static void GobiKUnitNotifyMatch( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   u16 clientID = GobiKUnitClientID( 1 );
+   atomic_t specific = ATOMIC_INIT( 0 );
+   atomic_t any = ATOMIC_INIT( 0 );
+   unsigned long flags;
+
+   QMIClientMemLock( pDev, flags );
+
+   KUNIT_EXPECT_TRUE( pTest,
+                      AddToNotifyList( pDev,
+                                       clientID,
+                                       5,
+                                       GobiKUnitNotify,
+                                       &specific ) );
+   KUNIT_EXPECT_TRUE( pTest,
+                      AddToNotifyList( pDev,
+                                       clientID,
+                                       0,
+                                       GobiKUnitNotify,
+                                       &any ) );
+
+   // Skips transaction 5 for the wildcard behind it
+   KUNIT_EXPECT_TRUE( pTest, NotifyAndPopNotifyList( pDev, clientID, 7 ) );
+   KUNIT_EXPECT_EQ( pTest, atomic_read( &specific ), 0 );
+   KUNIT_EXPECT_EQ( pTest, atomic_read( &any ), 1 );
+
+   KUNIT_EXPECT_FALSE( pTest, NotifyAndPopNotifyList( pDev, clientID, 7 ) );
+
+   KUNIT_EXPECT_TRUE( pTest, NotifyAndPopNotifyList( pDev, clientID, 5 ) );
+   KUNIT_EXPECT_EQ( pTest, atomic_read( &specific ), 1 );
+
+   KUNIT_EXPECT_FALSE( pTest, NotifyAndPopNotifyList( pDev, clientID, 0 ) );
+
+   QMIClientMemUnlock( pDev, flags );
+}
+
+// URBs come back first in, first out, the list never dereferences them
+static void GobiKUnitURBOrder( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   u16 clientID = GobiKUnitClientID( 2 );
+   unsigned long flags;
+   unsigned long index;
+
+   QMIClientMemLock( pDev, flags );
+
+   for (index = 1; index <= 3; index++)
+   {
+      KUNIT_EXPECT_TRUE( pTest,
+                         AddToURBList( pDev,
+                                       clientID,
+                                       (struct urb *)index ) );
+   }
+
+   for (index = 1; index <= 3; index++)
+   {
+      KUNIT_EXPECT_PTR_EQ( pTest,
+                           PopFromURBList( pDev, clientID ),
+                           (struct urb *)index );
+   }
+
+   KUNIT_EXPECT_NULL( pTest, PopFromURBList( pDev, clientID ) );
+   KUNIT_EXPECT_NULL( pTest,
+                      PopFromURBList( pDev,
+                                      GobiKUnitClientID( GOBI_KUNIT_CLIENTS ) ) );
+
+   QMIClientMemUnlock( pDev, flags );
+}
+
+/*=========================================================================*/
+// Concurrent case
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   GobiKUnitStressThread (Private Method)
+
+DESCRIPTION:
+   Queue and take back a read entry, a notification and a URB per round,
+   moving to the next client every round so threads meet on each client
+
+PARAMETERS:
+   pContext       [ I ] - sGobiKUnitStress of this thread
+
+RETURN VALUE:
+   int - 0
+===========================================================================*/
+static int GobiKUnitStressThread( void * pContext )
+{
+   sGobiKUnitStress * pStress = pContext;
+   sGobiUSBNet * pDev = pStress->mpDev;
+   u16 transactionID = pStress->mIndex + 1;
+   unsigned long flags;
+   void * pData;
+   void * pPopped;
+   u16 poppedSize;
+   u16 clientID;
+   int round;
+
+   for (round = 0; round < GOBI_KUNIT_ROUNDS; round++)
+   {
+      clientID = GobiKUnitClientID(
+                    (pStress->mIndex + round) % GOBI_KUNIT_CLIENTS );
+
+      pData = kmalloc( GOBI_KUNIT_DATA_SIZE, GFP_KERNEL );
+      if (pData == NULL)
+      {
+         pStress->mErrors++;
+         break;
+      }
+
+      QMIClientMemLock( pDev, flags );
+
+      if (FindClientMem( pDev, clientID ) == NULL)
+      {
+         pStress->mErrors++;
+      }
+      if (AddToReadMemList( pDev,
+                            clientID,
+                            transactionID,
+                            pData,
+                            GOBI_KUNIT_DATA_SIZE ) == false)
+      {
+         pStress->mErrors++;
+         kfree( pData );
+         pData = NULL;
+      }
+      if (AddToNotifyList( pDev,
+                           clientID,
+                           transactionID,
+                           GobiKUnitNotify,
+                           pStress->mpNotified ) == false)
+      {
+         pStress->mErrors++;
+      }
+      if (AddToURBList( pDev, clientID, (struct urb *)pStress ) == false)
+      {
+         pStress->mErrors++;
+      }
+
+      QMIClientMemUnlock( pDev, flags );
+
+      QMIClientMemLock( pDev, flags );
+
+      if (NotifyAndPopNotifyList( pDev, clientID, transactionID ) == false)
+      {
+         pStress->mErrors++;
+      }
+      if (PopFromReadMemList( pDev,
+                              clientID,
+                              transactionID,
+                              &pPopped,
+                              &poppedSize ) == true)
+      {
+         if (pPopped != pData)
+         {
+            pStress->mErrors++;
+         }
+      }
+      else if (pData != NULL)
+      {
+         pStress->mErrors++;
+      }
+
+      // The head of the list, possibly another thread's
+      if (PopFromURBList( pDev, clientID ) != NULL)
+      {
+         pStress->mURBs++;
+      }
+
+      QMIClientMemUnlock( pDev, flags );
+
+      kfree( pData );
+   }
+
+   complete( pStress->mpDone );
+   return 0;
+}
+
+// Many threads on shared clients, all entries accounted for, throughput
+//    and mClientMemLock wait and hold times reported
+static void GobiKUnitStress( struct kunit * pTest )
+{
+   sGobiUSBNet * pDev = pTest->priv;
+   sGobiKUnitStress * pStress;
+   sClientMemList * pClientMem;
+   struct task_struct * pTask;
+   struct completion done;
+   atomic_t notified;
+   unsigned long flags;
+   ktime_t start;
+   u64 elapsedNs;
+   u64 ops;
+   u32 urbs = 0;
+   u32 errors = 0;
+   int threads;
+   int started;
+   int index;
+#ifdef QMI_CLIENT_MEM_STATS
+   sQMIClientMemStats stats;
+#endif
+
+   threads = clamp( 2 * (int)num_online_cpus(),
+                    GOBI_KUNIT_MIN_THREADS,
+                    GOBI_KUNIT_MAX_THREADS );
+
+   pStress = kunit_kzalloc( pTest, threads * sizeof( *pStress ), GFP_KERNEL );
+   KUNIT_ASSERT_NOT_ERR_OR_NULL( pTest, pStress );
+
+   init_completion( &done );
+   atomic_set( &notified, 0 );
+
+#ifdef QMI_CLIENT_MEM_STATS
+   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   memset( &pDev->mQMIDev.mClientMemStats,
+           0,
+           sizeof( pDev->mQMIDev.mClientMemStats ) );
+   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+#endif
+
+   start = ktime_get();
+   for (started = 0; started < threads; started++)
+   {
+      pStress[started].mpDev = pDev;
+      pStress[started].mIndex = started;
+      pStress[started].mpNotified = &notified;
+      pStress[started].mpDone = &done;
+
+      pTask = kthread_run( GobiKUnitStressThread,
+                           &pStress[started],
+                           "gobi_kunit/%d",
+                           started );
+      if (IS_ERR( pTask ))
+      {
+         KUNIT_FAIL( pTest,
+                     "thread %d not started: %ld",
+                     started,
+                     PTR_ERR( pTask ) );
+         break;
+      }
+   }
+
+   // The threads use done and notified, wait for all of them
+   for (index = 0; index < started; index++)
+   {
+      wait_for_completion( &done );
+   }
+   elapsedNs = ktime_to_ns( ktime_sub( ktime_get(), start ) );
+
+   for (index = 0; index < started; index++)
+   {
+      urbs += pStress[index].mURBs;
+      errors += pStress[index].mErrors;
+   }
+   ops = (u64)started * GOBI_KUNIT_ROUNDS * GOBI_KUNIT_ROUND_OPS;
+
+   KUNIT_EXPECT_EQ( pTest, errors, 0 );
+   KUNIT_EXPECT_EQ( pTest, atomic_read( &notified ),
+                    started * GOBI_KUNIT_ROUNDS );
+   KUNIT_EXPECT_EQ( pTest, urbs, started * GOBI_KUNIT_ROUNDS );
+
+   // Nothing left behind
+   QMIClientMemLock( pDev, flags );
+   for (pClientMem = pDev->mQMIDev.mpClientMemList;
+        pClientMem != NULL;
+        pClientMem = pClientMem->mpNext)
+   {
+      KUNIT_EXPECT_NULL( pTest, pClientMem->mpList );
+      KUNIT_EXPECT_NULL( pTest, pClientMem->mpReadNotifyList );
+      KUNIT_EXPECT_NULL( pTest, pClientMem->mpURBList );
+      KUNIT_EXPECT_EQ( pTest, pClientMem->mReadCount, 0 );
+      KUNIT_EXPECT_EQ( pTest, pClientMem->mReadDropped, 0 );
+   }
+   QMIClientMemUnlock( pDev, flags );
+
+   kunit_info( pTest,
+               "%d threads on %d clients: %llu list ops in %llu us, "
+               "%llu ops/s\n",
+               started,
+               GOBI_KUNIT_CLIENTS,
+               (unsigned long long)ops,
+               (unsigned long long)div_u64( elapsedNs, NSEC_PER_USEC ),
+               (unsigned long long)div64_u64( ops * NSEC_PER_SEC,
+                                              max_t( u64, elapsedNs, 1 ) ) );
+
+#ifdef QMI_CLIENT_MEM_STATS
+   spin_lock_irqsave( &pDev->mQMIDev.mClientMemLock, flags );
+   stats = pDev->mQMIDev.mClientMemStats;
+   spin_unlock_irqrestore( &pDev->mQMIDev.mClientMemLock, flags );
+
+   kunit_info( pTest,
+               "mClientMemLock: %llu acquisitions, wait avg %llu ns "
+               "max %llu ns, hold avg %llu ns max %llu ns\n",
+               (unsigned long long)stats.mAcquired,
+               (unsigned long long)div64_u64( stats.mTotalWaitNs,
+                                              max_t( u64, stats.mAcquired, 1 ) ),
+               (unsigned long long)stats.mMaxWaitNs,
+               (unsigned long long)div64_u64( stats.mTotalHoldNs,
+                                              max_t( u64, stats.mAcquired, 1 ) ),
+               (unsigned long long)stats.mMaxHoldNs );
+   kunit_info( pTest,
+               "ops: find %llu add_read %llu pop_read %llu add_notify %llu "
+               "notify_pop %llu add_urb %llu pop_urb %llu\n",
+               (unsigned long long)stats.mOps[QMI_MEM_OP_FIND_CLIENT],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_ADD_READ],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_POP_READ],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_ADD_NOTIFY],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_NOTIFY_POP],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_ADD_URB],
+               (unsigned long long)stats.mOps[QMI_MEM_OP_POP_URB] );
+
+   KUNIT_EXPECT_EQ( pTest,
+                    stats.mOps[QMI_MEM_OP_ADD_READ],
+                    (u64)started * GOBI_KUNIT_ROUNDS );
+   KUNIT_EXPECT_EQ( pTest,
+                    stats.mOps[QMI_MEM_OP_POP_URB],
+                    (u64)started * GOBI_KUNIT_ROUNDS );
+#endif
+}
+
+static struct kunit_case GobiKUnitCases[] =
+{
+   KUNIT_CASE( GobiKUnitFindClient ),
+   KUNIT_CASE( GobiKUnitReadMemOrder ),
+   KUNIT_CASE( GobiKUnitNotifyMatch ),
+   KUNIT_CASE( GobiKUnitURBOrder ),
+   KUNIT_CASE( GobiKUnitStress ),
+   {}
+};
+
+static struct kunit_suite GobiKUnitSuite =
+{
+   .name       = "gobinet_clientmem",
+   .init       = GobiKUnitInit,
+   .exit       = GobiKUnitExit,
+   .test_cases = GobiKUnitCases,
+};
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION( 6,0,0 ))
+
+kunit_test_suite( GobiKUnitSuite );
+
+#else
+
+/*===========================================================================
+METHOD:
+   GobiKUnitRun (Public Method)
+
+DESCRIPTION:
+   Run the suite from GobiUSBNetModInit
+      Before 6.0 kunit_test_suite() defines module_init and module_exit,
+      which GobiUSBNet.c already does
+
+RETURN VALUE:
+   int - 0 if the suite ran
+         Negative errno for error
+===========================================================================*/
+int GobiKUnitRun( void )
+{
+   return kunit_run_tests( &GobiKUnitSuite );
+}
+
+#endif
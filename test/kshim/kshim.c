@@ -0,0 +1,207 @@
+/*===========================================================================
+FILE:
+   kshim.c
+
+DESCRIPTION:
+   libc side of the kernel stand-in for the host run of the KUnit suite
+      Built with the system headers, unlike the driver sources, so only
+      plain C types cross between the two.  See kshim.h
+
+FUNCTIONS:
+   Memory
+      printk
+      kmalloc
+      kzalloc
+      kcalloc
+      kfree
+
+   Time
+      ktime_get
+      kshim_jiffies
+      msleep
+      usleep_range
+      udelay
+
+   Threads
+      kshim_yield
+      kshim_thread_run
+      num_online_cpus
+
+===========================================================================*/
+
+//---------------------------------------------------------------------------
+// Include Files
+//---------------------------------------------------------------------------
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*=========================================================================*/
+// Definitions
+/*=========================================================================*/
+
+// kshim.h HZ
+#define KSHIM_HZ 100
+
+// Thread of kshim_thread_run
+typedef struct sKShimThread
+{
+   int         (* mpThreadFn)( void * );
+   void *         mpData;
+} sKShimThread;
+
+/*=========================================================================*/
+// Memory
+/*=========================================================================*/
+
+int printk( const char * pFormat, ... )
+{
+   va_list args;
+   int result;
+
+   va_start( args, pFormat );
+   result = vprintf( pFormat, args );
+   va_end( args );
+
+   return result;
+}
+
+void * kmalloc( size_t size, unsigned int flags )
+{
+   return malloc( size );
+}
+
+void * kzalloc( size_t size, unsigned int flags )
+{
+   return calloc( 1, size );
+}
+
+void * kcalloc( size_t count, size_t size, unsigned int flags )
+{
+   return calloc( count, size );
+}
+
+void kfree( const void * pMem )
+{
+   free( (void *)pMem );
+}
+
+/*=========================================================================*/
+// Time
+/*=========================================================================*/
+
+long long ktime_get( void )
+{
+   struct timespec now;
+
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+unsigned long kshim_jiffies( void )
+{
+   return (unsigned long)(ktime_get() / (1000000000LL / KSHIM_HZ));
+}
+
+void msleep( unsigned int msecs )
+{
+   usleep( msecs * 1000 );
+}
+
+void usleep_range( unsigned long min, unsigned long max )
+{
+   usleep( min );
+}
+
+void udelay( unsigned long usecs )
+{
+   long long end = ktime_get() + usecs * 1000LL;
+
+   while (ktime_get() < end)
+   {
+      ;
+   }
+}
+
+/*=========================================================================*/
+// Threads
+/*=========================================================================*/
+
+void kshim_yield( void )
+{
+   sched_yield();
+}
+
+/*===========================================================================
+METHOD:
+   KShimThread (Private Method)
+
+DESCRIPTION:
+   pthread entry point running a kthread_run function
+
+PARAMETERS:
+   pContext       [ I ] - sKShimThread, freed here
+
+RETURN VALUE:
+   void * - NULL
+===========================================================================*/
+static void * KShimThread( void * pContext )
+{
+   sKShimThread thread = *(sKShimThread *)pContext;
+
+   free( pContext );
+   thread.mpThreadFn( thread.mpData );
+   return NULL;
+}
+
+/*===========================================================================
+METHOD:
+   kshim_thread_run (Public Method)
+
+DESCRIPTION:
+   Start a detached thread, as kthread_run does
+
+PARAMETERS:
+   pThreadFn      [ I ] - Thread function
+   pData          [ I ] - Its argument
+
+RETURN VALUE:
+   void * - Non NULL placeholder for the task_struct
+            ERR_PTR( -ENOMEM ) on failure
+===========================================================================*/
+void * kshim_thread_run(
+   int          (* pThreadFn)( void * ),
+   void *       pData )
+{
+   static char task;
+   sKShimThread * pThread;
+   pthread_t id;
+
+   pThread = malloc( sizeof( *pThread ) );
+   if (pThread == NULL)
+   {
+      return (void *)-12L;
+   }
+
+   pThread->mpThreadFn = pThreadFn;
+   pThread->mpData = pData;
+   if (pthread_create( &id, NULL, KShimThread, pThread ) != 0)
+   {
+      free( pThread );
+      return (void *)-12L;
+   }
+
+   pthread_detach( id );
+   return &task;
+}
+
+unsigned int num_online_cpus( void )
+{
+   long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+
+   return cpus > 0 ? (unsigned int)cpus : 1;
+}
@@ -0,0 +1,864 @@
+/*===========================================================================
+FILE:
+   kshim.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel headers QMIDevice.c, QMI.c and the
+   KUnit suite include, used by the host run of the suite, see Makefile
+      Every <linux/...> header of the driver resolves to this file.
+      Locks, atomics, bit operations and lists are real, on the compiler
+      atomics.  Memory, time and threads are in kshim.c on top of libc.
+      Everything else is only declared: the host link drops the code that
+      needs it, and fails if a test reaches it
+
+   Built with -nostdinc, nothing here may come from libc headers
+
+===========================================================================*/
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+/*=========================================================================*/
+// Build configuration
+/*=========================================================================*/
+
+#define __KERNEL__ 1
+#define KERNEL_VERSION( a, b, c ) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION( 6,1,0 )
+#define CONFIG_PM 1
+#define CONFIG_SMP 1
+
+/*=========================================================================*/
+// Types
+/*=========================================================================*/
+
+#define NULL ((void *)0)
+#define __user
+#define __iomem
+#define __rcu
+#define __init
+#define __exit
+#define __packed __attribute__((packed))
+#define __always_inline inline
+#define likely( x ) __builtin_expect( !!(x), 1 )
+#define unlikely( x ) __builtin_expect( !!(x), 0 )
+
+typedef unsigned long size_t;
+typedef long ssize_t;
+typedef long long loff_t;
+typedef _Bool bool;
+#define true 1
+#define false 0
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef signed char s8;
+typedef short s16;
+typedef int s32;
+typedef long long s64;
+typedef unsigned char __u8;
+typedef unsigned short __u16;
+typedef unsigned int __u32;
+typedef unsigned long long __u64;
+typedef unsigned short __be16;
+typedef unsigned short __le16;
+typedef unsigned int __le32;
+typedef unsigned long long __le64;
+
+typedef unsigned int gfp_t;
+typedef unsigned int dev_t;
+typedef int pid_t;
+typedef unsigned int fmode_t;
+typedef unsigned int __poll_t;
+typedef unsigned int umode_t;
+typedef void * fl_owner_t;
+typedef int netdev_tx_t;
+typedef int irqreturn_t;
+typedef unsigned long long dma_addr_t;
+typedef unsigned long long cycles_t;
+
+// Nanoseconds, as in the kernel
+typedef s64 ktime_t;
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+
+// Test and set lock, see kshim_spin_lock
+typedef struct { int mLocked; } spinlock_t;
+typedef spinlock_t raw_spinlock_t;
+
+struct list_head { struct list_head * next, * prev; };
+struct hlist_head { void * first; };
+
+typedef struct { spinlock_t lock; } wait_queue_head_t;
+typedef struct { int x; struct list_head entry; int flags; } wait_queue_entry_t;
+typedef struct { int event; } pm_message_t;
+
+// Counts complete() calls not yet waited for
+struct completion { atomic_t mDone; };
+
+struct semaphore { int x; };
+struct mutex { spinlock_t mLock; };
+struct kref { atomic_t refcount; };
+struct kobject { struct kref kref; };
+struct module { int x; };
+struct class { int x; };
+struct device { struct kobject kobj; void * platform_data; struct { struct { int event; } power_state; } power; };
+struct attribute { const char * name; umode_t mode; };
+struct device_attribute { struct attribute attr; ssize_t (* show)( struct device *, struct device_attribute *, char * ); ssize_t (* store)( struct device *, struct device_attribute *, const char *, size_t ); };
+struct attribute_group { const char * name; struct attribute ** attrs; };
+
+struct file;
+struct inode;
+struct poll_table_struct;
+struct vm_area_struct;
+struct eventfd_ctx;
+struct seq_file;
+struct file_operations { struct module * owner; ssize_t (* read)( struct file *, char __user *, size_t, loff_t * ); ssize_t (* write)( struct file *, const char __user *, size_t, loff_t * ); long (* unlocked_ioctl)( struct file *, unsigned int, unsigned long ); long (* compat_ioctl)( struct file *, unsigned int, unsigned long ); int (* ioctl)( struct inode *, struct file *, unsigned int, unsigned long ); int (* open)( struct inode *, struct file * ); int (* flush)( struct file *, fl_owner_t ); int (* release)( struct inode *, struct file * ); unsigned int (* poll)( struct file *, struct poll_table_struct * ); int (* mmap)( struct file *, struct vm_area_struct * ); loff_t (* llseek)( struct file *, loff_t, int ); };
+struct cdev { struct kobject kobj; struct module * owner; const struct file_operations * ops; struct list_head list; };
+struct dentry { struct inode * d_inode; };
+struct path { struct dentry * dentry; };
+struct inode { struct cdev * i_cdev; struct list_head i_devices; const struct file_operations * i_fop; void * i_private; };
+struct file { void * private_data; const struct file_operations * f_op; struct path f_path; atomic_long_t f_count; unsigned int f_flags; struct inode * f_inode; };
+#define f_dentry f_path.dentry
+struct poll_table_struct { int x; };
+typedef struct poll_table_struct poll_table;
+struct vm_operations_struct { void (* open)( struct vm_area_struct * ); void (* close)( struct vm_area_struct * ); };
+struct vm_area_struct { unsigned long vm_start, vm_end, vm_pgoff, vm_flags; void * vm_private_data; const struct vm_operations_struct * vm_ops; };
+struct fdtable { unsigned int max_fds; struct file ** fd; };
+struct files_struct { spinlock_t file_lock; };
+struct task_struct { struct files_struct * files; int pid; char comm[16]; };
+struct timer_list { unsigned long expires; void (* function)( struct timer_list * ); unsigned long data; };
+struct work_struct { int x; };
+struct delayed_work { struct work_struct work; struct timer_list timer; };
+struct workqueue_struct { int x; };
+struct tasklet_struct { int x; };
+struct seq_file { void * private; };
+struct static_key_false { int x; };
+struct static_key_true { int x; };
+struct kernel_param { void * arg; };
+struct kernel_param_ops { int (* set)( const char *, const struct kernel_param * ); int (* get)( char *, const struct kernel_param * ); };
+struct rcu_head { int x; };
+struct trace_event { int x; };
+
+struct sk_buff;
+struct net_device;
+struct ethtool_ops;
+struct net_device_stats { unsigned long rx_packets, tx_packets, rx_bytes, tx_bytes, rx_errors, tx_errors, rx_dropped, tx_dropped, rx_fifo_errors, tx_fifo_errors, rx_length_errors, rx_over_errors; };
+struct net_device_ops { int (* ndo_open)( struct net_device * ); int (* ndo_stop)( struct net_device * ); int (* ndo_start_xmit)( struct sk_buff *, struct net_device * ); void (* ndo_tx_timeout)( struct net_device * ); };
+struct net_device { char name[16]; unsigned char dev_addr[6]; unsigned int flags; struct net_device_stats stats; const struct net_device_ops * netdev_ops; const struct ethtool_ops * ethtool_ops; unsigned short hard_header_len; unsigned long trans_start; struct device dev; unsigned int mtu; };
+struct sk_buff { unsigned int len; unsigned char * data; void (* destructor)( struct sk_buff * ); char cb[48]; ktime_t tstamp; struct sk_buff * next; };
+struct sk_buff_head { struct sk_buff * next; unsigned int qlen; spinlock_t lock; };
+struct ethhdr { unsigned char h_dest[6]; unsigned char h_source[6]; __be16 h_proto; };
+struct ethtool_drvinfo { char driver[32]; char version[32]; };
+struct ethtool_stats { unsigned int n_stats; };
+struct ethtool_cmd { unsigned int speed; unsigned char duplex, port, autoneg; };
+struct ethtool_link_settings { unsigned int speed; unsigned char duplex, port, autoneg; };
+struct ethtool_link_ksettings { struct ethtool_link_settings base; };
+struct ethtool_ops { int (* get_settings)( struct net_device *, struct ethtool_cmd * ); int (* get_link_ksettings)( struct net_device *, struct ethtool_link_ksettings * ); void (* get_drvinfo)( struct net_device *, struct ethtool_drvinfo * ); unsigned int (* get_link)( struct net_device * ); unsigned int (* get_msglevel)( struct net_device * ); void (* set_msglevel)( struct net_device *, unsigned int ); int (* nway_reset)( struct net_device * ); void (* get_strings)( struct net_device *, unsigned int, unsigned char * ); int (* get_sset_count)( struct net_device *, int ); void (* get_ethtool_stats)( struct net_device *, struct ethtool_stats *, unsigned long long * ); };
+
+struct urb;
+typedef void (* usb_complete_t)( struct urb * );
+struct usb_device_descriptor { __le16 idVendor, idProduct; };
+struct usb_endpoint_descriptor { unsigned char bEndpointAddress, bmAttributes, bInterval; __le16 wMaxPacketSize; };
+struct usb_host_endpoint { struct usb_endpoint_descriptor desc; };
+struct usb_interface_descriptor { unsigned char bInterfaceNumber, bNumEndpoints; };
+struct usb_host_interface { struct usb_interface_descriptor desc; struct usb_host_endpoint * endpoint; };
+struct usb_interface { struct usb_host_interface * cur_altsetting; unsigned num_altsetting; struct device dev; int needs_remote_wakeup; };
+struct usb_device { struct usb_device_descriptor descriptor; int speed; int devnum; int auto_pm; int reset_resume; };
+struct usb_anchor { struct list_head urb_list; };
+struct urb { struct usb_device * dev; unsigned int pipe; void * transfer_buffer; unsigned int transfer_buffer_length; unsigned int actual_length; int status; usb_complete_t complete; void * context; struct usb_host_endpoint * ep; unsigned int transfer_flags; unsigned char * setup_packet; struct list_head anchor_list; };
+struct usb_device_id { int x; unsigned long driver_info; };
+struct usb_driver { const char * name; const struct usb_device_id * id_table; int (* probe)( struct usb_interface *, const struct usb_device_id * ); void (* disconnect)( struct usb_interface * ); int (* suspend)( struct usb_interface *, pm_message_t ); int (* resume)( struct usb_interface * ); int supports_autosuspend; };
+struct usbnet;
+struct driver_info { const char * description; int flags; int (* bind)( struct usbnet *, struct usb_interface * ); void (* unbind)( struct usbnet *, struct usb_interface * ); int (* rx_fixup)( struct usbnet *, struct sk_buff * ); struct sk_buff * (* tx_fixup)( struct usbnet *, struct sk_buff *, gfp_t ); unsigned long data; };
+struct usbnet { struct usb_device * udev; struct usb_interface * intf; const struct driver_info * driver_info; struct net_device * net; unsigned long data[5]; unsigned int in, out; size_t rx_urb_size; unsigned int maxpacket; struct net_device_stats stats; unsigned long hard_mtu; struct sk_buff_head txq; };
+struct usb_cdc_notification { unsigned char bmRequestType, bNotificationType; __le16 wValue, wIndex, wLength; };
+
+struct u64_stats_sync { unsigned int seq; };
+
+/*=========================================================================*/
+// Constants
+/*=========================================================================*/
+
+#define THIS_MODULE ((struct module *)0)
+#define KERN_INFO ""
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 1
+#define GFP_NOIO 2
+#define HZ 100
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define PAGE_ALIGN( x ) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define NSEC_PER_SEC 1000000000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_USEC 1000L
+#define USEC_PER_SEC 1000000L
+#define BITS_PER_LONG 64
+#define INT_MAX 0x7fffffff
+#define UINT_MAX 0xffffffffU
+#define U16_MAX 0xffff
+#define U32_MAX 0xffffffffU
+#define ULLONG_MAX (~0ULL)
+#define MAX_SCHEDULE_TIMEOUT 0x7fffffff
+
+#define EPERM 1
+#define ENOENT 2
+#define EINTR 4
+#define EIO 5
+#define ENXIO 6
+#define E2BIG 7
+#define EBADF 9
+#define EAGAIN 11
+#define ENOMEM 12
+#define EFAULT 14
+#define EBUSY 16
+#define EEXIST 17
+#define ENODEV 19
+#define EINVAL 22
+#define ENOSPC 28
+#define ERANGE 34
+#define ENOMSG 42
+#define EBADR 53
+#define EBADRQC 56
+#define ENODATA 61
+#define ETIME 62
+#define EOVERFLOW 75
+#define EMSGSIZE 90
+#define EOPNOTSUPP 95
+#define ECONNRESET 104
+#define ESHUTDOWN 108
+#define ETOOMANYREFS 109
+#define ETIMEDOUT 110
+#define EINPROGRESS 115
+#define ECANCELED 125
+#define ERESTARTSYS 512
+
+#define VM_DONTEXPAND 1
+#define VM_DONTDUMP 2
+#define O_NONBLOCK 04000
+#define POLLIN 1
+#define POLLPRI 2
+#define POLLOUT 4
+#define POLLERR 8
+#define POLLHUP 16
+#define POLLRDNORM 64
+#define POLLWRNORM 256
+#define S_IRUGO 0444
+#define S_IWUSR 0200
+#define S_IRUSR 0400
+#define S_IWGRP 020
+#define S_IRGRP 040
+#define S_IFCHR 0020000
+#define TASK_INTERRUPTIBLE 1
+#define WQ_UNBOUND 2
+#define WQ_HIGHPRI 0x10
+#define WQ_MEM_RECLAIM 8
+#define _IOC_NONE 0U
+#define _IO( a, b ) (((a) << 8) | (b))
+#define _IOR( a, b, c ) (((a) << 8) | (b) | (sizeof( c ) << 16))
+#define _IOW( a, b, c ) (((a) << 8) | (b) | (sizeof( c ) << 16))
+#define _IOWR( a, b, c ) (((a) << 8) | (b) | (sizeof( c ) << 16))
+
+#define USB_ENDPOINT_DIR_MASK 0x80
+#define USB_ENDPOINT_XFERTYPE_MASK 3
+#define USB_ENDPOINT_XFER_INT 3
+#define USB_ENDPOINT_XFER_BULK 2
+#define USB_ENDPOINT_NUMBER_MASK 0xf
+#define USB_DIR_IN 0x80
+#define USB_DIR_OUT 0
+#define USB_SPEED_HIGH 3
+#define URB_ZERO_PACKET 0x40
+#define URB_FREE_BUFFER 0x100
+#define URB_NO_TRANSFER_DMA_MAP 4
+#define PM_EVENT_SUSPEND 2
+#define PM_EVENT_AUTO 0x400
+#define PM_EVENT_ON 0
+#define PMSG_SUSPEND ((pm_message_t){ .event = PM_EVENT_SUSPEND })
+#define NETDEV_TX_OK 0
+#define NETDEV_TX_BUSY 16
+#define ETH_HLEN 14
+#define ETH_ALEN 6
+#define ETH_P_IP 0x800
+#define ETH_P_IPV6 0x86dd
+#define ETH_GSTRING_LEN 32
+#define ETH_SS_STATS 1
+#define DUPLEX_FULL 1
+#define PORT_OTHER 0xff
+#define AUTONEG_DISABLE 0
+#define SPEED_UNKNOWN -1
+#define IFF_NOARP 0x80
+#define FLAG_ETHER 0x20
+#define FLAG_POINTTOPOINT 0x1000
+
+/*=========================================================================*/
+// Helpers
+/*=========================================================================*/
+
+#define offsetof( t, m ) __builtin_offsetof( t, m )
+#define container_of( ptr, type, member ) \
+   ((type *)((char *)(ptr) - offsetof( type, member )))
+#define ARRAY_SIZE( a ) (sizeof( a ) / sizeof( (a)[0] ))
+#define ALIGN( x, a ) (((x) + (a) - 1) & ~((a) - 1))
+#define min( a, b ) ((a) < (b) ? (a) : (b))
+#define max( a, b ) ((a) > (b) ? (a) : (b))
+#define min_t( t, a, b ) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t( t, a, b ) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t( t, v, lo, hi ) min_t( t, max_t( t, v, lo ), hi )
+#define clamp( v, lo, hi ) min( max( v, lo ), hi )
+#define BUILD_BUG_ON( c ) ((void)sizeof( char[1 - 2 * !!(c)] ))
+#define WARN_ON( c ) (c)
+#define WARN_ON_ONCE( c ) (c)
+#define BUG() __builtin_trap()
+#define BUG_ON( c ) do { if (c) __builtin_trap(); } while (0)
+#define IS_ERR( p ) ((unsigned long)(p) > (unsigned long)-4096)
+#define PTR_ERR( p ) ((long)(p))
+#define ERR_PTR( e ) ((void *)(long)(e))
+#define IS_ERR_OR_NULL( p ) (!(p) || IS_ERR( p ))
+#define READ_ONCE( x ) (*(volatile __typeof__( x ) *)&(x))
+#define WRITE_ONCE( x, v ) (*(volatile __typeof__( x ) *)&(x) = (v))
+#define ACCESS_ONCE( x ) READ_ONCE( x )
+#define barrier() __asm__ __volatile__( "" : : : "memory" )
+#define smp_mb() __atomic_thread_fence( __ATOMIC_SEQ_CST )
+#define smp_rmb() __atomic_thread_fence( __ATOMIC_ACQUIRE )
+#define smp_wmb() __atomic_thread_fence( __ATOMIC_RELEASE )
+#define might_sleep() do { } while (0)
+
+// The hosts this runs on are little endian, like QMI on the wire
+#define le16_to_cpu( x ) ((u16)(x))
+#define cpu_to_le16( x ) ((u16)(x))
+#define le32_to_cpu( x ) ((u32)(x))
+#define cpu_to_le32( x ) ((u32)(x))
+#define le64_to_cpu( x ) ((u64)(x))
+#define cpu_to_le64( x ) ((u64)(x))
+#define htons( x ) __builtin_bswap16( x )
+#define get_unaligned( ptr ) ({ \
+   __typeof__( *(ptr) ) __val; \
+   __builtin_memcpy( &__val, (ptr), sizeof( __val ) ); \
+   __val; })
+#define put_unaligned( val, ptr ) do { \
+   __typeof__( *(ptr) ) __val = (val); \
+   __builtin_memcpy( (ptr), &__val, sizeof( __val ) ); \
+   } while (0)
+#define get_unaligned_le16( p ) get_unaligned( (u16 *)(p) )
+#define get_unaligned_le32( p ) get_unaligned( (u32 *)(p) )
+#define put_unaligned_le16( v, p ) put_unaligned( (u16)(v), (u16 *)(p) )
+#define put_unaligned_le32( v, p ) put_unaligned( (u32)(v), (u32 *)(p) )
+
+#define memcpy __builtin_memcpy
+#define memmove __builtin_memmove
+#define memset __builtin_memset
+#define memcmp __builtin_memcmp
+#define strlen __builtin_strlen
+#define strcmp __builtin_strcmp
+#define strncmp __builtin_strncmp
+#define strstr __builtin_strstr
+#define snprintf __builtin_snprintf
+#define scnprintf __builtin_snprintf
+#define sprintf __builtin_sprintf
+#define strscpy( d, s, n ) ((void)__builtin_strncpy( d, s, n ), 0)
+#define strlcpy( d, s, n ) ((void)__builtin_strncpy( d, s, n ), 0)
+#define va_list __builtin_va_list
+#define va_start __builtin_va_start
+#define va_end __builtin_va_end
+
+static inline u64 div_u64( u64 dividend, u32 divisor )
+{
+   return dividend / divisor;
+}
+
+static inline u64 div64_u64( u64 dividend, u64 divisor )
+{
+   return dividend / divisor;
+}
+
+static inline s64 div_s64( s64 dividend, s32 divisor )
+{
+   return dividend / divisor;
+}
+
+#define fls( x ) ((x) == 0 ? 0 : 32 - __builtin_clz( x ))
+#define fls64( x ) ((x) == 0 ? 0 : 64 - __builtin_clzll( x ))
+#define __fls( x ) (63 - __builtin_clzl( x ))
+#define ilog2( n ) (fls64( (u64)(n) ) - 1)
+#define is_power_of_2( n ) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+#define roundup_pow_of_two( n ) \
+   ((n) <= 1 ? 1UL : 1UL << fls64( (u64)(n) - 1 ))
+
+/*=========================================================================*/
+// Atomics and bit operations
+/*=========================================================================*/
+
+#define ATOMIC_INIT( v ) { (v) }
+#define atomic_read( a ) __atomic_load_n( &(a)->counter, __ATOMIC_RELAXED )
+#define atomic_set( a, v ) \
+   __atomic_store_n( &(a)->counter, (v), __ATOMIC_RELAXED )
+#define atomic_add_return( v, a ) \
+   __atomic_add_fetch( &(a)->counter, (v), __ATOMIC_SEQ_CST )
+#define atomic_sub_return( v, a ) \
+   __atomic_sub_fetch( &(a)->counter, (v), __ATOMIC_SEQ_CST )
+#define atomic_add( v, a ) ((void)atomic_add_return( v, a ))
+#define atomic_sub( v, a ) ((void)atomic_sub_return( v, a ))
+#define atomic_inc( a ) atomic_add( 1, a )
+#define atomic_dec( a ) atomic_sub( 1, a )
+#define atomic_inc_return( a ) atomic_add_return( 1, a )
+#define atomic_dec_return( a ) atomic_sub_return( 1, a )
+#define atomic_dec_and_test( a ) (atomic_dec_return( a ) == 0)
+#define atomic_xchg( a, v ) \
+   __atomic_exchange_n( &(a)->counter, (v), __ATOMIC_SEQ_CST )
+#define atomic_cmpxchg( a, o, n ) ({ \
+   int __old = (o); \
+   __atomic_compare_exchange_n( &(a)->counter, &__old, (n), false, \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ); \
+   __old; })
+#define atomic_long_read( a ) \
+   __atomic_load_n( &(a)->counter, __ATOMIC_RELAXED )
+
+#define BIT_WORD( n ) ((n) / BITS_PER_LONG)
+#define BIT_MASK( n ) (1UL << ((n) % BITS_PER_LONG))
+#define set_bit( n, p ) ((void)__atomic_fetch_or( \
+   (unsigned long *)(p) + BIT_WORD( n ), BIT_MASK( n ), __ATOMIC_SEQ_CST ))
+#define clear_bit( n, p ) ((void)__atomic_fetch_and( \
+   (unsigned long *)(p) + BIT_WORD( n ), ~BIT_MASK( n ), __ATOMIC_SEQ_CST ))
+#define test_bit( n, p ) ((__atomic_load_n( \
+   (unsigned long *)(p) + BIT_WORD( n ), __ATOMIC_RELAXED ) \
+   & BIT_MASK( n )) != 0)
+#define test_and_set_bit( n, p ) ((__atomic_fetch_or( \
+   (unsigned long *)(p) + BIT_WORD( n ), BIT_MASK( n ), __ATOMIC_SEQ_CST ) \
+   & BIT_MASK( n )) != 0)
+#define test_and_clear_bit( n, p ) ((__atomic_fetch_and( \
+   (unsigned long *)(p) + BIT_WORD( n ), ~BIT_MASK( n ), __ATOMIC_SEQ_CST ) \
+   & BIT_MASK( n )) != 0)
+
+/*=========================================================================*/
+// Locks
+//    Interrupts do not exist here, the _irqsave forms only take the lock
+/*=========================================================================*/
+
+// Give up the CPU, see kshim.c
+void kshim_yield( void );
+
+static inline void kshim_spin_lock( spinlock_t * pLock )
+{
+   // Yield rather than spin, the holder may be preempted on this CPU
+   while (__atomic_exchange_n( &pLock->mLocked, 1, __ATOMIC_ACQUIRE ) != 0)
+   {
+      kshim_yield();
+   }
+}
+
+static inline void kshim_spin_unlock( spinlock_t * pLock )
+{
+   __atomic_store_n( &pLock->mLocked, 0, __ATOMIC_RELEASE );
+}
+
+#define DEFINE_SPINLOCK( x ) spinlock_t x = { 0 }
+#define spin_lock_init( l ) ((l)->mLocked = 0)
+#define spin_lock( l ) kshim_spin_lock( l )
+#define spin_unlock( l ) kshim_spin_unlock( l )
+#define spin_lock_bh( l ) kshim_spin_lock( l )
+#define spin_unlock_bh( l ) kshim_spin_unlock( l )
+#define spin_lock_irq( l ) kshim_spin_lock( l )
+#define spin_unlock_irq( l ) kshim_spin_unlock( l )
+#define spin_lock_irqsave( l, f ) do { \
+   kshim_spin_lock( l ); (f) = 0; } while (0)
+#define spin_unlock_irqrestore( l, f ) do { \
+   (void)(f); kshim_spin_unlock( l ); } while (0)
+#define spin_is_locked( l ) (__atomic_load_n( &(l)->mLocked, \
+                                              __ATOMIC_RELAXED ) != 0)
+#define assert_spin_locked( l ) BUG_ON( !spin_is_locked( l ) )
+#define lockdep_assert_held( l ) do { } while (0)
+#define local_irq_save( f ) ((f) = 0)
+#define local_irq_restore( f ) ((void)(f))
+#define mutex_init( m ) spin_lock_init( &(m)->mLock )
+#define mutex_lock( m ) kshim_spin_lock( &(m)->mLock )
+#define mutex_unlock( m ) kshim_spin_unlock( &(m)->mLock )
+#define rcu_read_lock() do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+#define rcu_assign_pointer( p, v ) ((p) = (v))
+
+/*=========================================================================*/
+// Lists
+/*=========================================================================*/
+
+#define LIST_HEAD_INIT( n ) { &(n), &(n) }
+#define LIST_HEAD( n ) struct list_head n = LIST_HEAD_INIT( n )
+#define INIT_LIST_HEAD( l ) ((l)->next = (l)->prev = (l))
+#define list_empty( l ) ((l)->next == (l))
+#define list_entry( p, t, m ) container_of( p, t, m )
+#define list_first_entry( h, t, m ) container_of( (h)->next, t, m )
+#define list_for_each( pos, head ) \
+   for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_entry( pos, head, member ) \
+   for (pos = container_of( (head)->next, __typeof__( *pos ), member ); \
+        &pos->member != (head); \
+        pos = container_of( pos->member.next, __typeof__( *pos ), member ))
+#define list_for_each_entry_safe( pos, n, head, member ) \
+   for (pos = container_of( (head)->next, __typeof__( *pos ), member ), \
+        n = container_of( pos->member.next, __typeof__( *pos ), member ); \
+        &pos->member != (head); \
+        pos = n, \
+        n = container_of( n->member.next, __typeof__( *n ), member ))
+
+static inline void kshim_list_insert(
+   struct list_head * pNew,
+   struct list_head * pPrev,
+   struct list_head * pNext )
+{
+   pNext->prev = pNew;
+   pNew->next = pNext;
+   pNew->prev = pPrev;
+   pPrev->next = pNew;
+}
+
+static inline void list_add( struct list_head * pNew, struct list_head * pHead )
+{
+   kshim_list_insert( pNew, pHead, pHead->next );
+}
+
+static inline void list_add_tail(
+   struct list_head * pNew,
+   struct list_head * pHead )
+{
+   kshim_list_insert( pNew, pHead->prev, pHead );
+}
+
+static inline void list_del( struct list_head * pEntry )
+{
+   pEntry->next->prev = pEntry->prev;
+   pEntry->prev->next = pEntry->next;
+   pEntry->next = pEntry->prev = NULL;
+}
+
+static inline void list_splice_init(
+   struct list_head * pList,
+   struct list_head * pHead )
+{
+   if (list_empty( pList ) == false)
+   {
+      pList->next->prev = pHead;
+      pList->prev->next = pHead->next;
+      pHead->next->prev = pList->prev;
+      pHead->next = pList->next;
+      INIT_LIST_HEAD( pList );
+   }
+}
+
+/*=========================================================================*/
+// Memory, time and threads, see kshim.c
+/*=========================================================================*/
+
+int printk( const char * pFormat, ... )
+   __attribute__((format( printf, 1, 2 )));
+void * kmalloc( size_t size, gfp_t flags );
+void * kzalloc( size_t size, gfp_t flags );
+void * kcalloc( size_t count, size_t size, gfp_t flags );
+void kfree( const void * pMem );
+void * vmalloc_user( unsigned long size );
+void vfree( const void * pMem );
+
+// CLOCK_MONOTONIC in nanoseconds
+ktime_t ktime_get( void );
+#define ktime_sub( a, b ) ((a) - (b))
+#define ktime_add_ns( a, n ) ((a) + (n))
+#define ktime_to_ns( t ) ((s64)(t))
+#define ktime_to_us( t ) ((s64)(t) / NSEC_PER_USEC)
+#define ktime_to_ms( t ) ((s64)(t) / NSEC_PER_MSEC)
+#define ktime_us_delta( a, b ) ktime_to_us( ktime_sub( a, b ) )
+#define ktime_get_ns() ((u64)ktime_get())
+#define local_clock() ((u64)ktime_get())
+#define sched_clock() ((u64)ktime_get())
+
+// HZ ticks since the program started
+unsigned long kshim_jiffies( void );
+#define jiffies kshim_jiffies()
+#define msecs_to_jiffies( m ) \
+   (((unsigned long)(m) + (1000 / HZ) - 1) / (1000 / HZ))
+#define usecs_to_jiffies( u ) msecs_to_jiffies( ((u) + 999) / 1000 )
+#define jiffies_to_msecs( j ) ((unsigned int)(j) * (1000 / HZ))
+#define time_after( a, b ) ((long)((b) - (a)) < 0)
+#define time_before( a, b ) time_after( b, a )
+#define time_after_eq( a, b ) ((long)((a) - (b)) >= 0)
+#define time_before_eq( a, b ) time_after_eq( b, a )
+
+void msleep( unsigned int msecs );
+void usleep_range( unsigned long min, unsigned long max );
+void udelay( unsigned long usecs );
+#define cond_resched() kshim_yield()
+#define schedule() kshim_yield()
+
+unsigned int num_online_cpus( void );
+
+// Threads run detached, the task_struct is a placeholder
+struct task_struct * kshim_thread_run(
+   int          (* pThreadFn)( void * ),
+   void *       pData );
+#define kthread_run( fn, data, name, args... ) \
+   kshim_thread_run( (fn), (data) )
+
+// Completions count, and waiters yield until they can take one
+#define init_completion( c ) atomic_set( &(c)->mDone, 0 )
+#define reinit_completion( c ) atomic_set( &(c)->mDone, 0 )
+#define completion_done( c ) (atomic_read( &(c)->mDone ) > 0)
+
+// Not a macro, struct urb has a member of the same name
+static inline void complete( struct completion * pDone )
+{
+   atomic_inc( &pDone->mDone );
+}
+
+static inline void wait_for_completion( struct completion * pDone )
+{
+   int done;
+
+   for (;;)
+   {
+      done = atomic_read( &pDone->mDone );
+      if (done > 0 && atomic_cmpxchg( &pDone->mDone, done, done - 1 ) == done)
+      {
+         return;
+      }
+      kshim_yield();
+   }
+}
+
+// Nobody sleeps on a wait queue in the host build
+#define init_waitqueue_head( q ) spin_lock_init( &(q)->lock )
+#define waitqueue_active( q ) false
+#define wake_up( q ) ((void)(q))
+#define wake_up_all( q ) ((void)(q))
+#define wake_up_locked( q ) ((void)(q))
+#define wake_up_interruptible( q ) ((void)(q))
+#define wake_up_interruptible_sync( q ) ((void)(q))
+#define wake_up_interruptible_poll( q, m ) ((void)(q))
+#define wake_up_interruptible_sync_poll( q, m ) ((void)(q))
+
+#define u64_stats_init( s ) ((s)->seq = 0)
+#define u64_stats_update_begin( s ) ((void)(s))
+#define u64_stats_update_end( s ) ((void)(s))
+#define u64_stats_fetch_begin( s ) ((s)->seq)
+#define u64_stats_fetch_retry( s, start ) false
+
+#define DEFINE_STATIC_KEY_FALSE( n ) struct static_key_false n = { 0 }
+#define DECLARE_STATIC_KEY_FALSE( n ) extern struct static_key_false n
+#define static_branch_unlikely( k ) ((k)->x != 0)
+#define static_branch_likely( k ) ((k)->x != 0)
+#define static_branch_enable( k ) ((k)->x = 1)
+#define static_branch_disable( k ) ((k)->x = 0)
+
+/*=========================================================================*/
+// Declared only, the host link fails if a test reaches any of these
+/*=========================================================================*/
+
+#define for_each_process( p ) for ((p) = NULL; (p) != NULL; )
+#define task_lock( p ) ((void)(p))
+#define task_unlock( p ) ((void)(p))
+#define files_fdtable( f ) ((struct fdtable *)(f))
+#define poll_wait( f, q, p ) ((void)(f), (void)(q), (void)(p))
+#define DEFINE_WAIT( w ) wait_queue_entry_t w
+#define wait_event_interruptible( q, c ) kshim_unsupported()
+#define wait_event_interruptible_timeout( q, c, t ) kshim_unsupported()
+#define wait_event_timeout( q, c, t ) kshim_unsupported()
+#define wait_event_interruptible_exclusive( q, c ) kshim_unsupported()
+#define wait_event( q, c ) kshim_unsupported()
+#define INIT_WORK( w, f ) do { \
+   void (* __fn)( struct work_struct * ) = (f); (void)__fn; \
+   (void)(w); } while (0)
+#define INIT_DELAYED_WORK( w, f ) INIT_WORK( &(w)->work, f )
+#define to_delayed_work( w ) container_of( w, struct delayed_work, work )
+#define timer_setup( t, f, fl ) do { (t)->function = (f); } while (0)
+#define from_timer( var, t, field ) \
+   container_of( t, __typeof__( *var ), field )
+#define sema_init( s, v ) ((void)(s))
+#define module_param( n, t, p ) extern int kshim_param_##n
+#define module_param_cb( n, o, a, p ) extern int kshim_param_##n
+#define MODULE_PARM_DESC( n, d ) extern int kshim_param_desc_##n
+#define MODULE_VERSION( x ) extern int kshim_module_version
+#define MODULE_AUTHOR( x ) extern int kshim_module_author
+#define MODULE_DESCRIPTION( x ) extern int kshim_module_desc
+#define MODULE_LICENSE( x ) extern int kshim_module_license
+#define MODULE_DEVICE_TABLE( a, b ) extern int kshim_module_table
+#define module_init( f ) extern int kshim_module_init
+#define module_exit( f ) extern int kshim_module_exit
+#define EXPORT_SYMBOL( x ) extern int kshim_export
+#define EXPORT_SYMBOL_GPL( x ) extern int kshim_export
+#define USB_DEVICE( v, p ) .x = ((v) << 16 | (p))
+#define DEVICE_ATTR( n, m, s, st ) \
+   struct device_attribute dev_attr_##n = { { #n, m }, s, st }
+#define DEVICE_ATTR_RO( n ) \
+   struct device_attribute dev_attr_##n = { { #n, 0444 }, n##_show, NULL }
+#define DEVICE_ATTR_RW( n ) \
+   struct device_attribute dev_attr_##n = \
+      { { #n, 0644 }, n##_show, n##_store }
+#define DEVICE_ATTR_WO( n ) \
+   struct device_attribute dev_attr_##n = { { #n, 0200 }, NULL, n##_store }
+#define DEFINE_SHOW_ATTRIBUTE( n ) extern const struct file_operations n##_fops
+#define DEFINE_DEBUGFS_ATTRIBUTE( n, g, s, f ) \
+   extern const struct file_operations n
+#define usb_fill_control_urb( u, d, p, s, b, l, c, x ) do { \
+   (u)->complete = (c); (u)->context = (x); } while (0)
+#define usb_fill_int_urb( u, d, p, b, l, c, x, i ) do { \
+   (u)->complete = (c); (u)->context = (x); } while (0)
+#define usb_fill_bulk_urb( u, d, p, b, l, c, x ) do { \
+   (u)->complete = (c); (u)->context = (x); } while (0)
+#define usb_sndctrlpipe( d, e ) ((unsigned)(e))
+#define usb_rcvctrlpipe( d, e ) ((unsigned)(e))
+#define usb_rcvintpipe( d, e ) ((unsigned)(e))
+#define usb_rcvbulkpipe( d, e ) ((unsigned)(e))
+#define usb_sndbulkpipe( d, e ) ((unsigned)(e))
+#define to_usb_interface( d ) container_of( d, struct usb_interface, dev )
+#define interface_to_usbdev( i ) ((struct usb_device *)(i))
+#define netdev_priv( n ) ((void *)(n))
+#define eth_hdr( s ) ((struct ethhdr *)(s)->data)
+#define is_multicast_ether_addr( a ) ((a)[0] & 1)
+#define get_user( x, p ) ((x) = *(p), 0)
+#define put_user( x, p ) (*(p) = (x), 0)
+#define TRACE_EVENT( name, proto, args, tstruct, assign, print ) \
+   static inline void trace_##name( proto ) { }
+#define DECLARE_EVENT_CLASS( name, proto, args, tstruct, assign, print )
+#define DEFINE_EVENT( tmpl, name, proto, args ) \
+   static inline void trace_##name( proto ) { }
+#define TP_PROTO( args... ) args
+#define TP_ARGS( args... ) args
+#define TP_STRUCT__entry( args... ) args
+#define TP_fast_assign( args... ) args
+#define TP_printk( args... ) args
+
+extern struct task_struct * current;
+int kshim_unsupported( void );
+int signal_pending( struct task_struct * pTask );
+int remap_vmalloc_range( struct vm_area_struct *, void *, unsigned long );
+unsigned long copy_to_user( void __user *, const void *, unsigned long );
+unsigned long copy_from_user( void *, const void __user *, unsigned long );
+void * memdup_user( const void __user *, size_t );
+struct urb * usb_alloc_urb( int, gfp_t );
+void usb_free_urb( struct urb * );
+int usb_submit_urb( struct urb *, gfp_t );
+void usb_kill_urb( struct urb * );
+int usb_unlink_urb( struct urb * );
+void init_usb_anchor( struct usb_anchor * );
+void usb_anchor_urb( struct urb *, struct usb_anchor * );
+void usb_unanchor_urb( struct urb * );
+void usb_kill_anchored_urbs( struct usb_anchor * );
+int usb_wait_anchor_empty_timeout( struct usb_anchor *, unsigned int );
+void * usb_alloc_coherent( struct usb_device *, size_t, gfp_t, dma_addr_t * );
+void usb_free_coherent( struct usb_device *, size_t, void *, dma_addr_t );
+int usb_autopm_get_interface( struct usb_interface * );
+void usb_autopm_put_interface( struct usb_interface * );
+int usb_autopm_get_interface_async( struct usb_interface * );
+void usb_autopm_put_interface_async( struct usb_interface * );
+void usb_autopm_enable( struct usb_interface * );
+int usb_control_msg( struct usb_device *, unsigned int, unsigned char, unsigned char, unsigned short, unsigned short, void *, unsigned short, int );
+int usb_set_interface( struct usb_device *, int, int );
+int usb_clear_halt( struct usb_device *, int );
+int usb_register( struct usb_driver * );
+void usb_deregister( struct usb_driver * );
+void * usb_get_intfdata( struct usb_interface * );
+int usb_endpoint_type( const struct usb_endpoint_descriptor * );
+int usb_endpoint_dir_in( const struct usb_endpoint_descriptor * );
+int usb_endpoint_dir_out( const struct usb_endpoint_descriptor * );
+int usb_endpoint_xfer_int( const struct usb_endpoint_descriptor * );
+int usbnet_probe( struct usb_interface *, const struct usb_device_id * );
+void usbnet_disconnect( struct usb_interface * );
+int usbnet_suspend( struct usb_interface *, pm_message_t );
+int usbnet_resume( struct usb_interface * );
+int usbnet_start_xmit( struct sk_buff *, struct net_device * );
+void usbnet_tx_timeout( struct net_device * );
+void usbnet_get_drvinfo( struct net_device *, struct ethtool_drvinfo * );
+unsigned int usbnet_get_link( struct net_device * );
+unsigned int usbnet_get_msglevel( struct net_device * );
+void usbnet_set_msglevel( struct net_device *, unsigned int );
+int usbnet_nway_reset( struct net_device * );
+void netif_carrier_on( struct net_device * );
+void netif_carrier_off( struct net_device * );
+int netif_carrier_ok( const struct net_device * );
+void dev_kfree_skb_any( struct sk_buff * );
+unsigned char * skb_pull( struct sk_buff *, unsigned int );
+unsigned char * skb_push( struct sk_buff *, unsigned int );
+void skb_reset_mac_header( struct sk_buff * );
+int skb_headroom( const struct sk_buff * );
+int pskb_expand_head( struct sk_buff *, int, int, gfp_t );
+void dev_err( const struct device *, const char *, ... );
+void dump_stack( void );
+void up( struct semaphore * );
+void down( struct semaphore * );
+int down_interruptible( struct semaphore * );
+int down_trylock( struct semaphore * );
+int down_timeout( struct semaphore *, long );
+void complete_all( struct completion * );
+long wait_for_completion_timeout( struct completion *, unsigned long );
+long wait_for_completion_interruptible( struct completion * );
+long wait_for_completion_interruptible_timeout( struct completion *, unsigned long );
+void prepare_to_wait_exclusive( wait_queue_head_t *, wait_queue_entry_t *, int );
+void prepare_to_wait( wait_queue_head_t *, wait_queue_entry_t *, int );
+void finish_wait( wait_queue_head_t *, wait_queue_entry_t * );
+long schedule_timeout( long );
+unsigned long msleep_interruptible( unsigned int );
+void add_timer( struct timer_list * );
+int mod_timer( struct timer_list *, unsigned long );
+int del_timer( struct timer_list * );
+int del_timer_sync( struct timer_list * );
+int schedule_work( struct work_struct * );
+int queue_work( struct workqueue_struct *, struct work_struct * );
+int schedule_delayed_work( struct delayed_work *, unsigned long );
+int cancel_work_sync( struct work_struct * );
+int cancel_delayed_work_sync( struct delayed_work * );
+void flush_work( struct work_struct * );
+struct workqueue_struct * alloc_workqueue( const char *, unsigned int, int, ... );
+void destroy_workqueue( struct workqueue_struct * );
+struct workqueue_struct * create_singlethread_workqueue( const char * );
+struct workqueue_struct * alloc_ordered_workqueue( const char *, unsigned int, ... );
+void tasklet_init( struct tasklet_struct *, void (*)( unsigned long ), unsigned long );
+void tasklet_schedule( struct tasklet_struct * );
+void tasklet_kill( struct tasklet_struct * );
+int alloc_chrdev_region( dev_t *, unsigned, unsigned, const char * );
+void unregister_chrdev_region( dev_t, unsigned );
+void cdev_init( struct cdev *, const struct file_operations * );
+int cdev_add( struct cdev *, dev_t, unsigned );
+void cdev_del( struct cdev * );
+struct device * device_create( struct class *, struct device *, dev_t, void *, const char *, ... );
+void device_destroy( struct class *, dev_t );
+int device_create_file( struct device *, const struct device_attribute * );
+void device_remove_file( struct device *, const struct device_attribute * );
+int sysfs_create_group( struct kobject *, const struct attribute_group * );
+void sysfs_remove_group( struct kobject *, const struct attribute_group * );
+struct class * class_create( struct module *, const char * );
+void class_destroy( struct class * );
+unsigned long simple_strtoul( const char *, char **, unsigned int );
+int kstrtouint( const char *, unsigned int, unsigned int * );
+int kstrtoint( const char *, unsigned int, int * );
+int kstrtobool( const char *, bool * );
+int param_set_int( const char *, const struct kernel_param * );
+int param_get_int( char *, const struct kernel_param * );
+int filp_close( struct file *, struct files_struct * );
+void * dev_get_drvdata( const struct device * );
+void dev_set_drvdata( struct device *, void * );
+cycles_t get_cycles( void );
+struct dentry * debugfs_create_dir( const char *, struct dentry * );
+struct dentry * debugfs_create_file( const char *, umode_t, struct dentry *, void *, const struct file_operations * );
+void debugfs_remove_recursive( struct dentry * );
+void seq_printf( struct seq_file *, const char *, ... );
+void seq_puts( struct seq_file *, const char * );
+void seq_putc( struct seq_file *, char );
+int single_open( struct file *, int (*)( struct seq_file *, void * ), void * );
+int single_release( struct inode *, struct file * );
+ssize_t seq_read( struct file *, char __user *, size_t, loff_t * );
+loff_t seq_lseek( struct file *, loff_t, int );
+int simple_open( struct inode *, struct file * );
+loff_t noop_llseek( struct file *, loff_t, int );
+struct eventfd_ctx * eventfd_ctx_fdget( int );
+void eventfd_ctx_put( struct eventfd_ctx * );
+unsigned long long eventfd_signal( struct eventfd_ctx *, unsigned long long );
+void kref_init( struct kref * );
+void kref_get( struct kref * );
+int kref_put( struct kref *, void (*)( struct kref * ) );
+void ethtool_cmd_speed_set( struct ethtool_cmd *, unsigned int );
+int in_interrupt( void );
+int in_atomic( void );
+int irqs_disabled( void );
+
+#endif // KSHIM_H
@@ -0,0 +1,254 @@
+/*===========================================================================
+FILE:
+   kunit.c
+
+DESCRIPTION:
+   Host runner of the client memory KUnit suite
+      Runs every case of the suite kunit_test_suite() registered, between
+      its init and exit, and prints KTAP as the kernel would.  Also
+      defines the module parameters GobiUSBNet.c would, with the same
+      defaults
+
+FUNCTIONS:
+   KUnit API
+      KShimExpect
+      kunit_info
+      kunit_kzalloc
+
+   Runner
+      KShimFreeResources
+      main
+
+===========================================================================*/
+
+//---------------------------------------------------------------------------
+// Include Files
+//---------------------------------------------------------------------------
+#include <kunit/test.h>
+
+/*=========================================================================*/
+// Module parameters of GobiUSBNet.c
+/*=========================================================================*/
+
+int debug = 0;
+DEFINE_STATIC_KEY_FALSE( gDebugKey );
+int interruptible = 1;
+int clientPoolSize = 0;
+int writeQueueLength = 8;
+int readQueueDepth = 128;
+int readQueueBytes = 256 * 1024;
+int readQueueDropOldest = 1;
+int orphanResponseTTL = 30000;
+int responseCache = 1;
+int ctrlUrbsInFlight = 4;
+
+// Registered by kunit_test_suite() in the suite
+extern struct kunit_suite * gpKShimSuite;
+
+// Header of each kunit_kzalloc() allocation
+typedef struct sKShimResource
+{
+   struct sKShimResource *    mpNext;
+   u64                        mData[];
+} sKShimResource;
+
+/*=========================================================================*/
+// KUnit API
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   KShimExpect (Public Method)
+
+DESCRIPTION:
+   Record an expectation, failing the case and printing where if it
+   did not hold
+
+PARAMETERS:
+   pTest          [ I ] - Running case
+   bPassed        [ I ] - Whether the expectation held
+   pFile          [ I ] - Source file of the expectation
+   line           [ I ] - Source line of the expectation
+   pCondition     [ I ] - Text of the expectation
+
+RETURN VALUE:
+   bool - bPassed
+===========================================================================*/
+bool KShimExpect(
+   struct kunit *             pTest,
+   bool                       bPassed,
+   const char *               pFile,
+   int                        line,
+   const char *               pCondition )
+{
+   if (bPassed == false)
+   {
+      printk( "    # %s: EXPECTATION FAILED at %s:%d\n"
+              "    Expected %s\n",
+              pTest->mpName,
+              pFile,
+              line,
+              pCondition );
+      pTest->mbFailed = true;
+   }
+
+   return bPassed;
+}
+
+/*===========================================================================
+METHOD:
+   kunit_info (Public Method)
+
+DESCRIPTION:
+   Print a diagnostic line of the running case
+
+PARAMETERS:
+   pTest          [ I ] - Running case
+   pFormat        [ I ] - printk format
+   ...            [ I ] - Arguments of pFormat
+
+RETURN VALUE:
+   None
+===========================================================================*/
+void kunit_info( struct kunit * pTest, const char * pFormat, ... )
+{
+   char message[256];
+   va_list args;
+
+   va_start( args, pFormat );
+   __builtin_vsnprintf( message, sizeof( message ), pFormat, args );
+   va_end( args );
+
+   printk( "    # %s: %s", pTest->mpName, message );
+}
+
+/*===========================================================================
+METHOD:
+   kunit_kzalloc (Public Method)
+
+DESCRIPTION:
+   Allocate zeroed memory freed when the case ends
+
+PARAMETERS:
+   pTest          [ I ] - Running case
+   size           [ I ] - Bytes wanted
+   flags          [ I ] - GFP flags
+
+RETURN VALUE:
+   void * - Memory, NULL if out of memory
+===========================================================================*/
+void * kunit_kzalloc( struct kunit * pTest, size_t size, gfp_t flags )
+{
+   sKShimResource * pResource;
+
+   pResource = kzalloc( sizeof( *pResource ) + size, flags );
+   if (pResource == NULL)
+   {
+      return NULL;
+   }
+
+   pResource->mpNext = pTest->mpResources;
+   pTest->mpResources = pResource;
+   return pResource->mData;
+}
+
+/*=========================================================================*/
+// Runner
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   KShimFreeResources (Private Method)
+
+DESCRIPTION:
+   Free the kunit_kzalloc() memory of a case
+
+PARAMETERS:
+   pTest          [ I ] - Case that ended
+
+RETURN VALUE:
+   None
+===========================================================================*/
+static void KShimFreeResources( struct kunit * pTest )
+{
+   sKShimResource * pResource;
+
+   while (pTest->mpResources != NULL)
+   {
+      pResource = pTest->mpResources;
+      pTest->mpResources = pResource->mpNext;
+      kfree( pResource );
+   }
+}
+
+/*===========================================================================
+METHOD:
+   main (Public Method)
+
+DESCRIPTION:
+   Run every case of the suite and print KTAP
+
+RETURN VALUE:
+   int - 0 if every case passed
+         1 otherwise
+===========================================================================*/
+int main( void )
+{
+   struct kunit_suite * pSuite = gpKShimSuite;
+   struct kunit_case * pCase;
+   struct kunit test;
+   int cases = 0;
+   int failed = 0;
+   int result;
+
+   for (pCase = pSuite->test_cases; pCase->run_case != NULL; pCase++)
+   {
+      cases++;
+   }
+
+   printk( "KTAP version 1\n1..1\n" );
+   printk( "    # Subtest: %s\n    1..%d\n", pSuite->name, cases );
+
+   cases = 0;
+   for (pCase = pSuite->test_cases; pCase->run_case != NULL; pCase++)
+   {
+      memset( &test, 0, sizeof( test ) );
+      test.mpName = pCase->name;
+
+      result = 0;
+      if (pSuite->init != NULL)
+      {
+         result = pSuite->init( &test );
+      }
+
+      if (result != 0)
+      {
+         printk( "    # %s: initialization failed %d\n",
+                 pCase->name,
+                 result );
+         test.mbFailed = true;
+      }
+      else
+      {
+         pCase->run_case( &test );
+      }
+
+      if (pSuite->exit != NULL)
+      {
+         pSuite->exit( &test );
+      }
+      KShimFreeResources( &test );
+
+      printk( "    %s %d %s\n",
+              test.mbFailed == true ? "not ok" : "ok",
+              ++cases,
+              pCase->name );
+      if (test.mbFailed == true)
+      {
+         failed++;
+      }
+   }
+
+   printk( "%s 1 %s\n", failed != 0 ? "not ok" : "ok", pSuite->name );
+   return failed != 0 ? 1 : 0;
+}
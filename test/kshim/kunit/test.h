@@ -0,0 +1,105 @@
+/*===========================================================================
+FILE:
+   kunit/test.h
+
+DESCRIPTION:
+   Userspace stand-in for the KUnit API the client memory suite uses
+      Cases run one after the other from kunit.c, which prints KTAP in
+      the format the kernel does.  A failed assertion returns from the
+      case, which is enough for cases that assert only in their own body
+
+===========================================================================*/
+
+#ifndef KSHIM_KUNIT_TEST_H
+#define KSHIM_KUNIT_TEST_H
+
+#include "../kshim.h"
+
+/*=========================================================================*/
+// Struct kunit
+//
+//    One running case
+/*=========================================================================*/
+struct kunit
+{
+   /* Fixture data, owned by the suite */
+   void *                     priv;
+
+   /* Case name, for messages */
+   const char *               mpName;
+
+   /* Set by the first failed expectation */
+   bool                       mbFailed;
+
+   /* kunit_kzalloc() memory, freed when the case ends */
+   void *                     mpResources;
+};
+
+struct kunit_case
+{
+   void                    (* run_case)( struct kunit * );
+   const char *               name;
+};
+
+struct kunit_suite
+{
+   const char *               name;
+   int                     (* init)( struct kunit * );
+   void                    (* exit)( struct kunit * );
+   struct kunit_case *        test_cases;
+};
+
+#define KUNIT_CASE( fn ) { .run_case = fn, .name = #fn }
+
+// The runner in kunit.c picks the suite up through this pointer
+#define kunit_test_suite( suite ) \
+   struct kunit_suite * gpKShimSuite = &(suite)
+
+// Record an expectation, see kunit.c
+bool KShimExpect(
+   struct kunit *             pTest,
+   bool                       bPassed,
+   const char *               pFile,
+   int                        line,
+   const char *               pCondition );
+
+// Print a diagnostic line of the running case
+void kunit_info( struct kunit * pTest, const char * pFormat, ... )
+   __attribute__((format( printf, 2, 3 )));
+
+// Zeroed memory freed when the case ends
+void * kunit_kzalloc( struct kunit * pTest, size_t size, gfp_t flags );
+
+#define KSHIM_EXPECT( test, cond, text ) \
+   ((void)KShimExpect( (test), (cond), __FILE__, __LINE__, (text) ))
+
+#define KSHIM_ASSERT( test, cond, text ) do { \
+   if (KShimExpect( (test), (cond), __FILE__, __LINE__, (text) ) == false) \
+   { \
+      return; \
+   } } while (0)
+
+#define KUNIT_FAIL( test, fmt, args... ) do { \
+   KSHIM_EXPECT( test, false, "KUNIT_FAIL" ); \
+   kunit_info( test, fmt, ## args ); } while (0)
+
+#define KUNIT_EXPECT_TRUE( test, cond ) \
+   KSHIM_EXPECT( test, (cond) != 0, #cond " is true" )
+#define KUNIT_EXPECT_FALSE( test, cond ) \
+   KSHIM_EXPECT( test, (cond) == 0, #cond " is false" )
+#define KUNIT_EXPECT_EQ( test, left, right ) \
+   KSHIM_EXPECT( test, (left) == (right), #left " == " #right )
+#define KUNIT_EXPECT_PTR_EQ( test, left, right ) \
+   KSHIM_EXPECT( test, \
+                 (const void *)(left) == (const void *)(right), \
+                 #left " == " #right )
+#define KUNIT_EXPECT_NULL( test, ptr ) \
+   KSHIM_EXPECT( test, (const void *)(ptr) == NULL, #ptr " is NULL" )
+#define KUNIT_EXPECT_NOT_ERR_OR_NULL( test, ptr ) \
+   KSHIM_EXPECT( test, IS_ERR_OR_NULL( ptr ) == false, \
+                 #ptr " is not error or NULL" )
+#define KUNIT_ASSERT_NOT_ERR_OR_NULL( test, ptr ) \
+   KSHIM_ASSERT( test, IS_ERR_OR_NULL( ptr ) == false, \
+                 #ptr " is not error or NULL" )
+
+#endif // KSHIM_KUNIT_TEST_H
@@ -0,0 +1,482 @@
+/*===========================================================================
+FILE:
+   qmi_bench.c
+
+DESCRIPTION:
+   Userspace microbenchmarks of the QMI.c parsers and request builders
+      Built against the shim headers in shim/, see Makefile
+
+FUNCTIONS:
+   Message construction
+      BenchPutTLV
+      BenchBuildMessages
+
+   Benchmarked operations
+      BenchParseQMUX
+      BenchGetTLV
+      BenchGetTLVPastIndex
+      BenchWDSEventResp
+      BenchCTLGetClientIDReq
+      BenchWDSSetEventReportReq
+      BenchWDASetDataFormatReq
+      BenchDMSGetMEIDReq
+      BenchCTLReleaseClientIDReq
+      BenchCTLReadyReq
+      BenchCTLSetDataFormatReq
+      BenchCTLSyncReq
+      BenchWDSGetPKGSRVCStatusReq
+      BenchWDSBindMuxDataPortReq
+      BenchWDSBindMuxDataPortPreReq
+      BenchServiceResetReq
+
+   Driver
+      BenchNowNs
+      BenchNowCycles
+      main
+
+===========================================================================*/
+
+//---------------------------------------------------------------------------
+// Include Files
+//---------------------------------------------------------------------------
+#include <stdlib.h>
+#include <time.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+#include <asm/unaligned.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include "QMI.h"
+
+/*=========================================================================*/
+// Definitions
+/*=========================================================================*/
+
+// DBG in QMI.c tests this, keep it quiet while timing
+int debug = 0;
+
+// Iterations of each benchmark unless given on the command line
+#define BENCH_DEFAULT_ITERATIONS 1000000
+
+// TLVs in the message used to time lookups past the TLV index
+#define BENCH_WIDE_TLVS (QMI_TLV_INDEX_MAX + 16)
+
+// WDS client used by the messages
+#define BENCH_CLIENT_ID ((0x01 << 8) | QMIWDS)
+
+// QMUX + WDS Event Report indication carrying every counter
+static u8 gEventReport[256];
+static u16 gEventReportSize;
+
+// QMI message, without QMUX and SDU, of BENCH_WIDE_TLVS one byte TLVs
+static u8 gWideMessage[4 + BENCH_WIDE_TLVS * 4];
+static u16 gWideMessageSize;
+
+// Output buffer of the request builders
+static u8 gRequest[256];
+
+// Results are folded in here so no call can be optimized away
+static volatile int gSink;
+
+/*=========================================================================*/
+// Message construction
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   BenchPutTLV (Private Method)
+
+DESCRIPTION:
+   Append a TLV to a message being built
+
+PARAMETERS
+   pBuffer         [ I ] - Message buffer
+   pos             [ I ] - Offset of the new TLV
+   type            [ I ] - TLV type
+   pValue          [ I ] - TLV value
+   length          [ I ] - Size of pValue
+
+RETURN VALUE:
+   u16 - Offset past the new TLV
+===========================================================================*/
+static u16 BenchPutTLV(
+   u8 *           pBuffer,
+   u16            pos,
+   u8             type,
+   const void *   pValue,
+   u16            length )
+{
+   pBuffer[pos] = type;
+   put_unaligned( cpu_to_le16( length ), (u16 *)(pBuffer + pos + 1) );
+   memcpy( pBuffer + pos + 3, pValue, length );
+
+   return pos + 3 + length;
+}
+
+/*===========================================================================
+METHOD:
+   BenchBuildMessages (Private Method)
+
+DESCRIPTION:
+   Build the messages the parsers are timed on, and check that the 
+   parsers accept them
+
+RETURN VALUE:
+   int - 0 for success
+         Negative errno for error
+===========================================================================*/
+static int BenchBuildMessages( void )
+{
+   // Service SDU: flags, transaction ID
+   const u16 sduSize = 3;
+   u8 * pMessage;
+   u32 counter;
+   u64 bytes;
+   u16 pos;
+   u16 clientID;
+   u8 type;
+   u8 value;
+   u32 txOk, rxOk, txErr, rxErr, txOfl, rxOfl;
+   u64 txBytesOk, rxBytesOk;
+   bool bLinkState, bReconfigure;
+   int result;
+
+   // WDS Event Report indication, message ID 0x0001
+   pMessage = gEventReport + sizeof( sQMUX ) + sduSize;
+   pos = 4;
+   for (type = 0x10; type <= 0x15; type++)
+   {
+      counter = cpu_to_le32( 1000 + type );
+      pos = BenchPutTLV( pMessage, pos, type, &counter, sizeof( counter ) );
+   }
+   bytes = cpu_to_le64( 1ULL << 32 );
+   pos = BenchPutTLV( pMessage, pos, 0x19, &bytes, sizeof( bytes ) );
+   pos = BenchPutTLV( pMessage, pos, 0x1A, &bytes, sizeof( bytes ) );
+   put_unaligned( cpu_to_le16( 0x0001 ), (u16 *)pMessage );
+   put_unaligned( cpu_to_le16( pos - 4 ), (u16 *)(pMessage + 2) );
+
+   gEventReportSize = sizeof( sQMUX ) + sduSize + pos;
+   FillQMUX( BENCH_CLIENT_ID, gEventReport, gEventReportSize );
+   ((sQMUX *)gEventReport)->mCtrlFlag = 0x80;
+   gEventReport[sizeof( sQMUX )] = 0x04;
+
+   // Message with more TLVs than the index records
+   pos = 4;
+   for (type = 0x10; type < 0x10 + BENCH_WIDE_TLVS; type++)
+   {
+      value = type;
+      pos = BenchPutTLV( gWideMessage, pos, type, &value, 1 );
+   }
+   put_unaligned( cpu_to_le16( 0x0001 ), (u16 *)gWideMessage );
+   put_unaligned( cpu_to_le16( pos - 4 ), (u16 *)(gWideMessage + 2) );
+   gWideMessageSize = pos;
+
+   result = ParseQMUX( &clientID, gEventReport, gEventReportSize );
+   if (result != sizeof( sQMUX ) || clientID != BENCH_CLIENT_ID)
+   {
+      fprintf( stderr, "ParseQMUX rejected the event report: %d\n", result );
+      return -EINVAL;
+   }
+
+   result = GetTLV( gWideMessage, 
+                    gWideMessageSize, 
+                    0x10 + BENCH_WIDE_TLVS - 1, 
+                    &value, 
+                    1 );
+   if (result != 1 || value != 0x10 + BENCH_WIDE_TLVS - 1)
+   {
+      fprintf( stderr, "GetTLV missed the last TLV: %d\n", result );
+      return -EINVAL;
+   }
+
+   txBytesOk = rxBytesOk = 0;
+   result = QMIWDSEventResp( gEventReport, 
+                             gEventReportSize, 
+                             &txOk, &rxOk, &txErr, &rxErr, &txOfl, &rxOfl, 
+                             &txBytesOk, &rxBytesOk, 
+                             &bLinkState, &bReconfigure );
+   if (result != 0 || txOk != 1000 + 0x10 || rxBytesOk != 1ULL << 32)
+   {
+      fprintf( stderr, "QMIWDSEventResp misparsed: %d\n", result );
+      return -EINVAL;
+   }
+
+   return 0;
+}
+
+/*=========================================================================*/
+// Benchmarked operations, one call each
+/*=========================================================================*/
+
+static int BenchParseQMUX( void )
+{
+   u16 clientID;
+
+   return ParseQMUX( &clientID, gEventReport, gEventReportSize );
+}
+
+static int BenchGetTLV( void )
+{
+   u64 bytes;
+   u16 offset = sizeof( sQMUX ) + 3;
+
+   return GetTLV( gEventReport + offset, 
+                  gEventReportSize - offset, 
+                  0x1A, 
+                  &bytes, 
+                  sizeof( bytes ) );
+}
+
+static int BenchGetTLVPastIndex( void )
+{
+   u8 value;
+
+   return GetTLV( gWideMessage, 
+                  gWideMessageSize, 
+                  0x10 + BENCH_WIDE_TLVS - 1, 
+                  &value, 
+                  1 );
+}
+
+static int BenchWDSEventResp( void )
+{
+   u32 txOk, rxOk, txErr, rxErr, txOfl, rxOfl;
+   u64 txBytesOk, rxBytesOk;
+   bool bLinkState, bReconfigure;
+
+   return QMIWDSEventResp( gEventReport, 
+                           gEventReportSize, 
+                           &txOk, &rxOk, &txErr, &rxErr, &txOfl, &rxOfl, 
+                           &txBytesOk, &rxBytesOk, 
+                           &bLinkState, &bReconfigure );
+}
+
+static int BenchCTLGetClientIDReq( void )
+{
+   return QMICTLGetClientIDReq( gRequest, 
+                                QMICTLGetClientIDReqSize(), 
+                                1, 
+                                QMIWDS );
+}
+
+static int BenchWDSSetEventReportReq( void )
+{
+   return QMIWDSSetEventReportReq( gRequest, 
+                                   QMIWDSSetEventReportReqSize(), 
+                                   1 );
+}
+
+static int BenchWDASetDataFormatReq( void )
+{
+   return QMIWDASetDataFormatReq( gRequest, 
+                                  QMIWDASetDataFormatReqSize(), 
+                                  1 );
+}
+
+static int BenchDMSGetMEIDReq( void )
+{
+   return QMIDMSGetMEIDReq( gRequest, QMIDMSGetMEIDReqSize(), 1 );
+}
+
+static int BenchCTLReleaseClientIDReq( void )
+{
+   return QMICTLReleaseClientIDReq( gRequest, 
+                                    QMICTLReleaseClientIDReqSize(), 
+                                    1, 
+                                    BENCH_CLIENT_ID );
+}
+
+static int BenchCTLReadyReq( void )
+{
+   return QMICTLReadyReq( gRequest, QMICTLReadyReqSize(), 1 );
+}
+
+static int BenchCTLSetDataFormatReq( void )
+{
+   return QMICTLSetDataFormatReq( gRequest, 
+                                  QMICTLSetDataFormatReqSize(), 
+                                  1 );
+}
+
+static int BenchCTLSyncReq( void )
+{
+   return QMICTLSyncReq( gRequest, QMICTLSyncReqSize(), 1 );
+}
+
+static int BenchWDSGetPKGSRVCStatusReq( void )
+{
+   return QMIWDSGetPKGSRVCStatusReq( gRequest, 
+                                     QMIWDSGetPKGSRVCStatusReqSize(), 
+                                     1 );
+}
+
+static int BenchWDSBindMuxDataPortReq( void )
+{
+   return QMIWDSBindMuxDataPortReq( gRequest, 
+                                    QMIWDSBindMuxDataPortReqSize(), 
+                                    1 );
+}
+
+static int BenchWDSBindMuxDataPortPreReq( void )
+{
+   return QMIWDSBindMuxDataPortPreReq( gRequest, 
+                                       QMIWDSBindMuxDataPortPreReqSize(), 
+                                       1,
+                                       0 );
+}
+
+static int BenchServiceResetReq( void )
+{
+   return QMIServiceResetReq( gRequest, QMIServiceResetReqSize(), 1 );
+}
+
+static const struct
+{
+   const char *   mpName;
+   int         (* mpBench)( void );
+} gBenches[] =
+{
+   { "ParseQMUX",                     BenchParseQMUX },
+   { "GetTLV",                        BenchGetTLV },
+   { "GetTLV past index",             BenchGetTLVPastIndex },
+   { "QMIWDSEventResp",               BenchWDSEventResp },
+   { "QMICTLGetClientIDReq",          BenchCTLGetClientIDReq },
+   { "QMIWDSSetEventReportReq",       BenchWDSSetEventReportReq },
+   { "QMIWDASetDataFormatReq",        BenchWDASetDataFormatReq },
+   { "QMIDMSGetMEIDReq",              BenchDMSGetMEIDReq },
+   { "QMICTLReleaseClientIDReq",      BenchCTLReleaseClientIDReq },
+   { "QMICTLReadyReq",                BenchCTLReadyReq },
+   { "QMICTLSetDataFormatReq",        BenchCTLSetDataFormatReq },
+   { "QMICTLSyncReq",                 BenchCTLSyncReq },
+   { "QMIWDSGetPKGSRVCStatusReq",     BenchWDSGetPKGSRVCStatusReq },
+   { "QMIWDSBindMuxDataPortReq",      BenchWDSBindMuxDataPortReq },
+   { "QMIWDSBindMuxDataPortPreReq",   BenchWDSBindMuxDataPortPreReq },
+   { "QMIServiceResetReq",            BenchServiceResetReq },
+};
+
+/*=========================================================================*/
+// Driver
+/*=========================================================================*/
+
+/*===========================================================================
+METHOD:
+   BenchNowNs (Private Method)
+
+DESCRIPTION:
+   Monotonic time
+
+RETURN VALUE:
+   u64 - Nanoseconds
+===========================================================================*/
+static u64 BenchNowNs( void )
+{
+   struct timespec now;
+
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*===========================================================================
+METHOD:
+   BenchNowCycles (Private Method)
+
+DESCRIPTION:
+   Time stamp counter, which ticks at the nominal clock rather than the
+   clock the core is running at
+
+RETURN VALUE:
+   u64 - Cycles, 0 where there is no counter to read
+===========================================================================*/
+static u64 BenchNowCycles( void )
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+   return __rdtsc();
+#else
+   return 0;
+#endif
+}
+
+/*===========================================================================
+METHOD:
+   main (Public Method)
+
+DESCRIPTION:
+   Time every benchmark and print nanoseconds per call, messages parsed
+   or built per second and time stamp counter cycles per message
+      Each call goes through a function pointer, which is included in 
+      the figures
+
+PARAMETERS
+   argc            [ I ] - Argument count
+   argv            [ I ] - Optional iteration count
+
+RETURN VALUE:
+   int - 0 for success
+         1 if a message was not parsed as expected
+===========================================================================*/
+int main(
+   int      argc,
+   char **  argv )
+{
+   long iterations = BENCH_DEFAULT_ITERATIONS;
+   long iteration;
+   u64 start;
+   u64 elapsed;
+   u64 startCycles;
+   u64 cycles;
+   int index;
+   int sink = 0;
+
+   if (argc > 1)
+   {
+      iterations = strtol( argv[1], NULL, 0 );
+      if (iterations <= 0)
+      {
+         fprintf( stderr, "usage: %s [iterations]\n", argv[0] );
+         return 1;
+      }
+   }
+
+   if (BenchBuildMessages() != 0)
+   {
+      return 1;
+   }
+
+   printf( "%-28s %10s %12s %12s\n", 
+           "# operation", 
+           "ns/call", 
+           "msgs/s", 
+           "cycles/msg" );
+   for (index = 0; index < ARRAY_SIZE( gBenches ); index++)
+   {
+      // Warm up caches and branch predictors
+      for (iteration = 0; iteration < iterations / 10; iteration++)
+      {
+         sink += gBenches[index].mpBench();
+      }
+
+      start = BenchNowNs();
+      startCycles = BenchNowCycles();
+      for (iteration = 0; iteration < iterations; iteration++)
+      {
+         sink += gBenches[index].mpBench();
+      }
+      cycles = BenchNowCycles() - startCycles;
+      elapsed = BenchNowNs() - start;
+
+      if (elapsed == 0)
+      {
+         elapsed = 1;
+      }
+
+      printf( "%-28s %10.1f %12.0f %12.1f\n", 
+              gBenches[index].mpName, 
+              (double)elapsed / iterations,
+              (double)iterations * 1000000000.0 / elapsed,
+              (double)cycles / iterations );
+   }
+
+   gSink = sink;
+   return 0;
+}
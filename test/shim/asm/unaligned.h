@@ -0,0 +1,24 @@
+/*===========================================================================
+FILE:
+   asm/unaligned.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel header, used by the QMI.c host build
+   
+===========================================================================*/
+
+#pragma once
+
+#include <string.h>
+
+// Read a possibly unaligned value through memcpy, which the compiler 
+//    turns into a plain load where the CPU allows it
+#define get_unaligned( ptr ) ({ \
+   __typeof__( *(ptr) ) __val; \
+   memcpy( &__val, (ptr), sizeof( __val ) ); \
+   __val; })
+
+#define put_unaligned( val, ptr ) do { \
+   __typeof__( *(ptr) ) __val = (val); \
+   memcpy( (ptr), &__val, sizeof( __val ) ); \
+   } while (0)
@@ -0,0 +1,11 @@
+/*===========================================================================
+FILE:
+   linux/jump_label.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel header, used by the QMI.c host build
+      Empty, without __KERNEL__ DBG tests debug instead of a static key
+
+===========================================================================*/
+
+#pragma once
@@ -0,0 +1,29 @@
+/*===========================================================================
+FILE:
+   linux/kernel.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel header, used by the QMI.c host build
+   
+===========================================================================*/
+
+#pragma once
+
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef int8_t s8;
+
+#define ARRAY_SIZE( arr ) (sizeof( arr ) / sizeof( (arr)[0] ))
+
+// QMI is little endian on the wire
+#define cpu_to_le16( x ) htole16( x )
+#define cpu_to_le32( x ) htole32( x )
+#define cpu_to_le64( x ) htole64( x )
+#define le16_to_cpu( x ) le16toh( x )
+#define le32_to_cpu( x ) le32toh( x )
+#define le64_to_cpu( x ) le64toh( x )
+
+#define KERN_INFO ""
+#define printk printf
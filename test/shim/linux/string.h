@@ -0,0 +1,12 @@
+/*===========================================================================
+FILE:
+   linux/string.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel header, used by the QMI.c host build
+   
+===========================================================================*/
+
+#pragma once
+
+#include <string.h>
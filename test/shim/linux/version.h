@@ -0,0 +1,14 @@
+/*===========================================================================
+FILE:
+   linux/version.h
+
+DESCRIPTION:
+   Userspace stand-in for the kernel header, used by the QMI.c host build
+      QMI.h only checks the version for the debug static key, which the
+      host build never uses as __KERNEL__ is not defined
+
+===========================================================================*/
+
+#pragma once
+
+#define KERNEL_VERSION( a, b, c ) (((a) << 16) + ((b) << 8) + (c))